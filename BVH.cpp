@@ -0,0 +1,1197 @@
+#include "BVH.h"
+#include <algorithm>
+#include <thread>
+
+struct SBVHBin
+{
+    float3 m_min = { FLT_MAX, FLT_MAX, FLT_MAX };
+    float3 m_max = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+    size_t m_count = 0;
+};
+
+static void BuildBVHSAHRecursive (const std::vector<SBVHPrimitive>& primitives, SBVH& bvh, size_t begin, size_t end, size_t depth)
+{
+    size_t nodeIndex = bvh.m_nodes.size();
+    bvh.m_nodes.emplace_back();
+
+    // calculate the bounds of the primitives, and the bounds of their centroids
+    float3 boundsMin = { FLT_MAX, FLT_MAX, FLT_MAX };
+    float3 boundsMax = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+    float3 centroidMin = boundsMin;
+    float3 centroidMax = boundsMax;
+    for (size_t i = begin; i < end; ++i)
+    {
+        const SBVHPrimitive& primitive = primitives[bvh.m_primOrder[i]];
+        GrowBounds(boundsMin, boundsMax, primitive.m_min, primitive.m_max);
+        GrowBounds(centroidMin, centroidMax, primitive.m_centroid, primitive.m_centroid);
+    }
+    bvh.m_nodes[nodeIndex].m_min = boundsMin;
+    bvh.m_nodes[nodeIndex].m_max = boundsMax;
+
+    auto MakeLeaf = [&] ()
+    {
+        bvh.m_nodes[nodeIndex].m_rightChild = 0;
+        bvh.m_nodes[nodeIndex].m_firstPrim = (uint32_t)begin;
+        bvh.m_nodes[nodeIndex].m_numPrims = (uint32_t)(end - begin);
+        bvh.m_nodes[nodeIndex].m_splitAxis = 0;
+    };
+
+    size_t count = end - begin;
+    if (count == 1 || depth + 1 >= c_bvhMaxDepth)
+    {
+        MakeLeaf();
+        return;
+    }
+
+    // evaluate the binned SAH on each axis and remember the best split found
+    float parentArea = SurfaceArea(boundsMin, boundsMax);
+    float bestCost = FLT_MAX;
+    size_t bestAxis = 0;
+    size_t bestBin = 0;
+    for (size_t axis = 0; axis < 3; ++axis)
+    {
+        float extent = centroidMax[axis] - centroidMin[axis];
+        if (extent <= 0.0f)
+            continue;
+
+        std::array<SBVHBin, c_bvhNumBins> bins;
+        float binScale = float(c_bvhNumBins) / extent;
+        for (size_t i = begin; i < end; ++i)
+        {
+            const SBVHPrimitive& primitive = primitives[bvh.m_primOrder[i]];
+            size_t bin = (std::min)(size_t((primitive.m_centroid[axis] - centroidMin[axis]) * binScale), c_bvhNumBins - 1);
+            GrowBounds(bins[bin].m_min, bins[bin].m_max, primitive.m_min, primitive.m_max);
+            bins[bin].m_count++;
+        }
+
+        // sweep from the right to get the area and count on the right of each split plane
+        std::array<float, c_bvhNumBins> rightArea;
+        std::array<size_t, c_bvhNumBins> rightCount;
+        SBVHBin right;
+        for (size_t bin = c_bvhNumBins - 1; bin > 0; --bin)
+        {
+            GrowBounds(right.m_min, right.m_max, bins[bin].m_min, bins[bin].m_max);
+            right.m_count += bins[bin].m_count;
+            rightArea[bin] = SurfaceArea(right.m_min, right.m_max);
+            rightCount[bin] = right.m_count;
+        }
+
+        // sweep from the left, evaluating the cost of splitting between bin-1 and bin
+        SBVHBin left;
+        for (size_t bin = 1; bin < c_bvhNumBins; ++bin)
+        {
+            GrowBounds(left.m_min, left.m_max, bins[bin - 1].m_min, bins[bin - 1].m_max);
+            left.m_count += bins[bin - 1].m_count;
+            if (left.m_count == 0 || rightCount[bin] == 0)
+                continue;
+
+            float cost = c_bvhTraversalCost + c_bvhIntersectCost * (SurfaceArea(left.m_min, left.m_max) * float(left.m_count) + rightArea[bin] * float(rightCount[bin])) / parentArea;
+            if (cost < bestCost)
+            {
+                bestCost = cost;
+                bestAxis = axis;
+                bestBin = bin;
+            }
+        }
+    }
+
+    // make a leaf if it's small enough and splitting doesn't pay off
+    float leafCost = c_bvhIntersectCost * float(count);
+    if (count <= c_bvhMaxLeafPrims && leafCost <= bestCost)
+    {
+        MakeLeaf();
+        return;
+    }
+
+    // partition the primitives. If all the centroids were in the same spot, just split them down the middle.
+    size_t middle;
+    if (bestCost < FLT_MAX)
+    {
+        float binScale = float(c_bvhNumBins) / (centroidMax[bestAxis] - centroidMin[bestAxis]);
+        uint32_t* split = std::partition(&bvh.m_primOrder[begin], &bvh.m_primOrder[0] + end,
+            [&] (uint32_t index)
+            {
+                size_t bin = (std::min)(size_t((primitives[index].m_centroid[bestAxis] - centroidMin[bestAxis]) * binScale), c_bvhNumBins - 1);
+                return bin < bestBin;
+            }
+        );
+        middle = split - &bvh.m_primOrder[0];
+    }
+    else
+    {
+        float3 extents = boundsMax - boundsMin;
+        bestAxis = (extents[0] > extents[1] && extents[0] > extents[2]) ? 0 : (extents[1] > extents[2] ? 1 : 2);
+        middle = begin + count / 2;
+    }
+
+    // the left child comes right after this node. The right child comes after the whole left sub tree.
+    BuildBVHSAHRecursive(primitives, bvh, begin, middle, depth + 1);
+    bvh.m_nodes[nodeIndex].m_rightChild = (uint32_t)bvh.m_nodes.size();
+    bvh.m_nodes[nodeIndex].m_firstPrim = 0;
+    bvh.m_nodes[nodeIndex].m_numPrims = 0;
+    bvh.m_nodes[nodeIndex].m_splitAxis = (uint32_t)bestAxis;
+    BuildBVHSAHRecursive(primitives, bvh, middle, end, depth + 1);
+}
+
+void BuildBVHSAH (const std::vector<SBVHPrimitive>& primitives, SBVH& bvh)
+{
+    bvh.m_nodes.clear();
+    bvh.m_primOrder.resize(primitives.size());
+    for (size_t i = 0; i < primitives.size(); ++i)
+        bvh.m_primOrder[i] = (uint32_t)i;
+
+    if (primitives.size() == 0)
+        return;
+
+    bvh.m_nodes.reserve(primitives.size() * 2);
+    BuildBVHSAHRecursive(primitives, bvh, 0, primitives.size(), 0);
+}
+
+float BVHSAHCost (const SBVH& bvh)
+{
+    if (bvh.m_nodes.size() == 0)
+        return 0.0f;
+
+    float cost = 0.0f;
+    for (const SBVHNode& node : bvh.m_nodes)
+    {
+        float area = SurfaceArea(node.m_min, node.m_max);
+        if (node.m_numPrims > 0)
+            cost += area * c_bvhIntersectCost * float(node.m_numPrims);
+        else
+            cost += area * c_bvhTraversalCost;
+    }
+    return cost / SurfaceArea(bvh.m_nodes[0].m_min, bvh.m_nodes[0].m_max);
+}
+
+// a reference to a primitive while building an SBVH. Spatial splits can give a primitive several references, each
+// with the bounds of the part of the primitive on its side of the split.
+struct SSBVHReference
+{
+    float3 m_min;
+    float3 m_max;
+    uint32_t m_prim;
+};
+
+typedef std::vector<SSBVHReference> TSBVHReferences;
+
+struct SSBVHBuild
+{
+    const std::vector<SBVHPrimitive>& m_primitives;
+    const std::vector<SBVHTriangle>& m_triangles;
+    SBVH& m_bvh;
+    float m_rootArea;
+    size_t m_numReferences;
+    size_t m_maxReferences;
+};
+
+// spatial split bins count the references that start and end in them, rather than the ones whose centroid is in them
+struct SSBVHSpatialBin
+{
+    float3 m_min = { FLT_MAX, FLT_MAX, FLT_MAX };
+    float3 m_max = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+    size_t m_entries = 0;
+    size_t m_exits = 0;
+};
+
+// the bounds of the part of the reference between the planes lo and hi on the axis. min > max if there is none.
+static void ClipReference (const SSBVHBuild& build, const SSBVHReference& reference, size_t axis, float lo, float hi, float3& clipMin, float3& clipMax)
+{
+    if (build.m_triangles.empty())
+    {
+        clipMin = reference.m_min;
+        clipMax = reference.m_max;
+    }
+    else
+    {
+        // the box around the triangle's vertices in the slab and the points where its edges cross the planes
+        clipMin = { FLT_MAX, FLT_MAX, FLT_MAX };
+        clipMax = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+        const SBVHTriangle& triangle = build.m_triangles[reference.m_prim];
+        const float3* vertices[3] = { &triangle.m_a, &triangle.m_b, &triangle.m_c };
+        for (size_t i = 0; i < 3; ++i)
+        {
+            const float3& v0 = *vertices[i];
+            const float3& v1 = *vertices[(i + 1) % 3];
+            if (v0[axis] >= lo && v0[axis] <= hi)
+                GrowBounds(clipMin, clipMax, v0, v0);
+
+            for (float plane : { lo, hi })
+            {
+                if ((v0[axis] < plane && v1[axis] > plane) || (v0[axis] > plane && v1[axis] < plane))
+                {
+                    float3 p = v0 + (v1 - v0) * ((plane - v0[axis]) / (v1[axis] - v0[axis]));
+                    p[axis] = plane;
+                    GrowBounds(clipMin, clipMax, p, p);
+                }
+            }
+        }
+    }
+
+    // stay inside the reference's box, which earlier splits may already have clipped
+    for (size_t i = 0; i < 3; ++i)
+    {
+        clipMin[i] = (std::max)(clipMin[i], reference.m_min[i]);
+        clipMax[i] = (std::min)(clipMax[i], reference.m_max[i]);
+    }
+    clipMin[axis] = (std::max)(clipMin[axis], lo);
+    clipMax[axis] = (std::min)(clipMax[axis], hi);
+}
+
+static bool ValidBounds (const float3& boundsMin, const float3& boundsMax)
+{
+    return boundsMin[0] <= boundsMax[0] && boundsMin[1] <= boundsMax[1] && boundsMin[2] <= boundsMax[2];
+}
+
+static size_t SpatialBin (float value, float boundsMin, float binScale)
+{
+    float bin = (value - boundsMin) * binScale;
+    return (size_t)(std::min)((std::max)(bin, 0.0f), float(c_bvhNumBins - 1));
+}
+
+static void BuildBVHSBVHRecursive (SSBVHBuild& build, TSBVHReferences& references, size_t depth)
+{
+    SBVH& bvh = build.m_bvh;
+    size_t nodeIndex = bvh.m_nodes.size();
+    bvh.m_nodes.emplace_back();
+
+    float3 boundsMin = { FLT_MAX, FLT_MAX, FLT_MAX };
+    float3 boundsMax = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+    float3 centroidMin = boundsMin;
+    float3 centroidMax = boundsMax;
+    for (const SSBVHReference& reference : references)
+    {
+        float3 centroid = (reference.m_min + reference.m_max) * 0.5f;
+        GrowBounds(boundsMin, boundsMax, reference.m_min, reference.m_max);
+        GrowBounds(centroidMin, centroidMax, centroid, centroid);
+    }
+    bvh.m_nodes[nodeIndex].m_min = boundsMin;
+    bvh.m_nodes[nodeIndex].m_max = boundsMax;
+
+    auto MakeLeaf = [&] ()
+    {
+        bvh.m_nodes[nodeIndex].m_rightChild = 0;
+        bvh.m_nodes[nodeIndex].m_firstPrim = (uint32_t)bvh.m_primOrder.size();
+        bvh.m_nodes[nodeIndex].m_numPrims = (uint32_t)references.size();
+        bvh.m_nodes[nodeIndex].m_splitAxis = 0;
+        for (const SSBVHReference& reference : references)
+            bvh.m_primOrder.push_back(reference.m_prim);
+    };
+
+    size_t count = references.size();
+    if (count == 1 || depth + 1 >= c_bvhMaxDepth)
+    {
+        MakeLeaf();
+        return;
+    }
+
+    // binned SAH object split, same as BuildBVHSAH(), but also remembering the child boxes of the best split
+    float parentArea = SurfaceArea(boundsMin, boundsMax);
+    float bestObjectCost = FLT_MAX;
+    size_t bestObjectAxis = 0;
+    size_t bestObjectBin = 0;
+    float3 objectLeftMin, objectLeftMax, objectRightMin, objectRightMax;
+    for (size_t axis = 0; axis < 3; ++axis)
+    {
+        float extent = centroidMax[axis] - centroidMin[axis];
+        if (extent <= 0.0f)
+            continue;
+
+        std::array<SBVHBin, c_bvhNumBins> bins;
+        float binScale = float(c_bvhNumBins) / extent;
+        for (const SSBVHReference& reference : references)
+        {
+            float centroid = (reference.m_min[axis] + reference.m_max[axis]) * 0.5f;
+            size_t bin = (std::min)(size_t((centroid - centroidMin[axis]) * binScale), c_bvhNumBins - 1);
+            GrowBounds(bins[bin].m_min, bins[bin].m_max, reference.m_min, reference.m_max);
+            bins[bin].m_count++;
+        }
+
+        std::array<SBVHBin, c_bvhNumBins> rights;
+        SBVHBin right;
+        for (size_t bin = c_bvhNumBins - 1; bin > 0; --bin)
+        {
+            GrowBounds(right.m_min, right.m_max, bins[bin].m_min, bins[bin].m_max);
+            right.m_count += bins[bin].m_count;
+            rights[bin] = right;
+        }
+
+        SBVHBin left;
+        for (size_t bin = 1; bin < c_bvhNumBins; ++bin)
+        {
+            GrowBounds(left.m_min, left.m_max, bins[bin - 1].m_min, bins[bin - 1].m_max);
+            left.m_count += bins[bin - 1].m_count;
+            if (left.m_count == 0 || rights[bin].m_count == 0)
+                continue;
+
+            float cost = c_bvhTraversalCost + c_bvhIntersectCost * (SurfaceArea(left.m_min, left.m_max) * float(left.m_count) + SurfaceArea(rights[bin].m_min, rights[bin].m_max) * float(rights[bin].m_count)) / parentArea;
+            if (cost < bestObjectCost)
+            {
+                bestObjectCost = cost;
+                bestObjectAxis = axis;
+                bestObjectBin = bin;
+                objectLeftMin = left.m_min;
+                objectLeftMax = left.m_max;
+                objectRightMin = rights[bin].m_min;
+                objectRightMax = rights[bin].m_max;
+            }
+        }
+    }
+
+    // only try spatial splits where the object split's children overlap enough to matter, and there is budget left
+    float bestSpatialCost = FLT_MAX;
+    size_t bestSpatialAxis = 0;
+    size_t bestSpatialBin = 0;
+    float3 spatialLeftMin, spatialLeftMax, spatialRightMin, spatialRightMax;
+    size_t spatialLeftCount = 0;
+    size_t spatialRightCount = 0;
+    float overlapArea = 0.0f;
+    if (bestObjectCost < FLT_MAX)
+    {
+        float3 overlapMin, overlapMax;
+        for (size_t i = 0; i < 3; ++i)
+        {
+            overlapMin[i] = (std::max)(objectLeftMin[i], objectRightMin[i]);
+            overlapMax[i] = (std::min)(objectLeftMax[i], objectRightMax[i]);
+        }
+        if (ValidBounds(overlapMin, overlapMax))
+            overlapArea = SurfaceArea(overlapMin, overlapMax);
+    }
+    if ((bestObjectCost == FLT_MAX || overlapArea > c_sbvhOverlapThreshold * build.m_rootArea) && build.m_numReferences < build.m_maxReferences)
+    {
+        for (size_t axis = 0; axis < 3; ++axis)
+        {
+            float extent = boundsMax[axis] - boundsMin[axis];
+            if (extent <= 0.0f)
+                continue;
+
+            // chop each reference into the bins it covers
+            std::array<SSBVHSpatialBin, c_bvhNumBins> bins;
+            float binScale = float(c_bvhNumBins) / extent;
+            float binWidth = extent / float(c_bvhNumBins);
+            for (const SSBVHReference& reference : references)
+            {
+                size_t entryBin = SpatialBin(reference.m_min[axis], boundsMin[axis], binScale);
+                size_t exitBin = SpatialBin(reference.m_max[axis], boundsMin[axis], binScale);
+                bins[entryBin].m_entries++;
+                bins[exitBin].m_exits++;
+                if (entryBin == exitBin)
+                {
+                    GrowBounds(bins[entryBin].m_min, bins[entryBin].m_max, reference.m_min, reference.m_max);
+                    continue;
+                }
+                for (size_t bin = entryBin; bin <= exitBin; ++bin)
+                {
+                    float lo = bin == entryBin ? -FLT_MAX : boundsMin[axis] + binWidth * float(bin);
+                    float hi = bin == exitBin ? FLT_MAX : boundsMin[axis] + binWidth * float(bin + 1);
+                    float3 clipMin, clipMax;
+                    ClipReference(build, reference, axis, lo, hi, clipMin, clipMax);
+                    if (ValidBounds(clipMin, clipMax))
+                        GrowBounds(bins[bin].m_min, bins[bin].m_max, clipMin, clipMax);
+                }
+            }
+
+            std::array<SSBVHSpatialBin, c_bvhNumBins> rights;
+            SSBVHSpatialBin right;
+            for (size_t bin = c_bvhNumBins - 1; bin > 0; --bin)
+            {
+                GrowBounds(right.m_min, right.m_max, bins[bin].m_min, bins[bin].m_max);
+                right.m_exits += bins[bin].m_exits;
+                rights[bin] = right;
+            }
+
+            SSBVHSpatialBin left;
+            for (size_t bin = 1; bin < c_bvhNumBins; ++bin)
+            {
+                GrowBounds(left.m_min, left.m_max, bins[bin - 1].m_min, bins[bin - 1].m_max);
+                left.m_entries += bins[bin - 1].m_entries;
+                size_t rightCount = rights[bin].m_exits;
+                if (left.m_entries == 0 || rightCount == 0)
+                    continue;
+
+                size_t duplicates = left.m_entries + rightCount - count;
+                if (build.m_numReferences + duplicates > build.m_maxReferences)
+                    continue;
+
+                float cost = c_bvhTraversalCost + c_bvhIntersectCost * (SurfaceArea(left.m_min, left.m_max) * float(left.m_entries) + SurfaceArea(rights[bin].m_min, rights[bin].m_max) * float(rightCount)) / parentArea;
+                if (cost < bestSpatialCost)
+                {
+                    bestSpatialCost = cost;
+                    bestSpatialAxis = axis;
+                    bestSpatialBin = bin;
+                    spatialLeftMin = left.m_min;
+                    spatialLeftMax = left.m_max;
+                    spatialRightMin = rights[bin].m_min;
+                    spatialRightMax = rights[bin].m_max;
+                    spatialLeftCount = left.m_entries;
+                    spatialRightCount = rightCount;
+                }
+            }
+        }
+    }
+
+    float bestCost = (std::min)(bestObjectCost, bestSpatialCost);
+    float leafCost = c_bvhIntersectCost * float(count);
+    if (count <= c_bvhMaxLeafPrims && leafCost <= bestCost)
+    {
+        MakeLeaf();
+        return;
+    }
+
+    TSBVHReferences leftReferences, rightReferences;
+    size_t splitAxis = bestObjectAxis;
+    if (bestSpatialCost < bestObjectCost)
+    {
+        splitAxis = bestSpatialAxis;
+        float binScale = float(c_bvhNumBins) / (boundsMax[splitAxis] - boundsMin[splitAxis]);
+        float plane = boundsMin[splitAxis] + (boundsMax[splitAxis] - boundsMin[splitAxis]) * float(bestSpatialBin) / float(c_bvhNumBins);
+        for (const SSBVHReference& reference : references)
+        {
+            size_t entryBin = SpatialBin(reference.m_min[splitAxis], boundsMin[splitAxis], binScale);
+            size_t exitBin = SpatialBin(reference.m_max[splitAxis], boundsMin[splitAxis], binScale);
+            if (exitBin < bestSpatialBin)
+            {
+                leftReferences.push_back(reference);
+                continue;
+            }
+            if (entryBin >= bestSpatialBin)
+            {
+                rightReferences.push_back(reference);
+                continue;
+            }
+
+            // the reference straddles the plane. Splitting it isn't always cheapest: moving all of it to one side
+            // grows that side's box, but takes a primitive away from the other side.
+            SSBVHReference leftPart = reference;
+            SSBVHReference rightPart = reference;
+            ClipReference(build, reference, splitAxis, -FLT_MAX, plane, leftPart.m_min, leftPart.m_max);
+            ClipReference(build, reference, splitAxis, plane, FLT_MAX, rightPart.m_min, rightPart.m_max);
+            bool leftValid = ValidBounds(leftPart.m_min, leftPart.m_max);
+            bool rightValid = ValidBounds(rightPart.m_min, rightPart.m_max);
+
+            float3 wholeLeftMin = spatialLeftMin, wholeLeftMax = spatialLeftMax;
+            float3 wholeRightMin = spatialRightMin, wholeRightMax = spatialRightMax;
+            GrowBounds(wholeLeftMin, wholeLeftMax, reference.m_min, reference.m_max);
+            GrowBounds(wholeRightMin, wholeRightMax, reference.m_min, reference.m_max);
+            float splitCost = SurfaceArea(spatialLeftMin, spatialLeftMax) * float(spatialLeftCount) + SurfaceArea(spatialRightMin, spatialRightMax) * float(spatialRightCount);
+            float leftCost = SurfaceArea(wholeLeftMin, wholeLeftMax) * float(spatialLeftCount) + SurfaceArea(spatialRightMin, spatialRightMax) * float(spatialRightCount - 1);
+            float rightCost = SurfaceArea(spatialLeftMin, spatialLeftMax) * float(spatialLeftCount - 1) + SurfaceArea(wholeRightMin, wholeRightMax) * float(spatialRightCount);
+
+            if (!rightValid || (leftValid && leftCost < splitCost && leftCost <= rightCost))
+            {
+                leftReferences.push_back(reference);
+                spatialLeftMin = wholeLeftMin;
+                spatialLeftMax = wholeLeftMax;
+                --spatialRightCount;
+            }
+            else if (!leftValid || rightCost < splitCost)
+            {
+                rightReferences.push_back(reference);
+                spatialRightMin = wholeRightMin;
+                spatialRightMax = wholeRightMax;
+                --spatialLeftCount;
+            }
+            else
+            {
+                leftReferences.push_back(leftPart);
+                rightReferences.push_back(rightPart);
+            }
+        }
+
+        // unsplitting can empty a side, in which case the object split is used instead
+        if (leftReferences.empty() || rightReferences.empty())
+        {
+            leftReferences.clear();
+            rightReferences.clear();
+            splitAxis = bestObjectAxis;
+        }
+    }
+
+    if (leftReferences.empty())
+    {
+        // object split. If all the centroids were in the same spot, just split them down the middle.
+        if (bestObjectCost < FLT_MAX)
+        {
+            float binScale = float(c_bvhNumBins) / (centroidMax[splitAxis] - centroidMin[splitAxis]);
+            for (const SSBVHReference& reference : references)
+            {
+                float centroid = (reference.m_min[splitAxis] + reference.m_max[splitAxis]) * 0.5f;
+                size_t bin = (std::min)(size_t((centroid - centroidMin[splitAxis]) * binScale), c_bvhNumBins - 1);
+                (bin < bestObjectBin ? leftReferences : rightReferences).push_back(reference);
+            }
+        }
+        else
+        {
+            float3 extents = boundsMax - boundsMin;
+            splitAxis = (extents[0] > extents[1] && extents[0] > extents[2]) ? 0 : (extents[1] > extents[2] ? 1 : 2);
+            leftReferences.assign(references.begin(), references.begin() + count / 2);
+            rightReferences.assign(references.begin() + count / 2, references.end());
+        }
+    }
+
+    // the references are in the children now, so free them before going deeper
+    build.m_numReferences += leftReferences.size() + rightReferences.size() - count;
+    TSBVHReferences().swap(references);
+
+    BuildBVHSBVHRecursive(build, leftReferences, depth + 1);
+    bvh.m_nodes[nodeIndex].m_rightChild = (uint32_t)bvh.m_nodes.size();
+    bvh.m_nodes[nodeIndex].m_firstPrim = 0;
+    bvh.m_nodes[nodeIndex].m_numPrims = 0;
+    bvh.m_nodes[nodeIndex].m_splitAxis = (uint32_t)splitAxis;
+    BuildBVHSBVHRecursive(build, rightReferences, depth + 1);
+}
+
+void BuildBVHSBVH (const std::vector<SBVHPrimitive>& primitives, const std::vector<SBVHTriangle>& triangles, SBVH& bvh, float referenceBudget)
+{
+    bvh.m_nodes.clear();
+    bvh.m_primOrder.clear();
+    if (primitives.size() == 0)
+        return;
+
+    TSBVHReferences references(primitives.size());
+    float3 boundsMin = { FLT_MAX, FLT_MAX, FLT_MAX };
+    float3 boundsMax = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+    for (size_t i = 0; i < primitives.size(); ++i)
+    {
+        references[i].m_min = primitives[i].m_min;
+        references[i].m_max = primitives[i].m_max;
+        references[i].m_prim = (uint32_t)i;
+        GrowBounds(boundsMin, boundsMax, primitives[i].m_min, primitives[i].m_max);
+    }
+
+    size_t maxReferences = primitives.size() + (size_t)(float(primitives.size()) * (std::max)(referenceBudget, 0.0f));
+    SSBVHBuild build = { primitives, triangles, bvh, SurfaceArea(boundsMin, boundsMax), primitives.size(), maxReferences };
+
+    bvh.m_nodes.reserve(build.m_maxReferences * 2);
+    bvh.m_primOrder.reserve(build.m_maxReferences);
+    BuildBVHSBVHRecursive(build, references, 0);
+}
+
+void BuildBVH (const std::vector<SBVHPrimitive>& primitives, SBVH& bvh, EBVHBuilder builder)
+{
+    switch (builder)
+    {
+        case EBVHBuilder::SAH: BuildBVHSAH(primitives, bvh); break;
+        case EBVHBuilder::LBVH30: BuildBVHLBVH(primitives, bvh, 30, false); break;
+        case EBVHBuilder::LBVH63: BuildBVHLBVH(primitives, bvh, 63, false); break;
+        case EBVHBuilder::LBVH30Treelets: BuildBVHLBVH(primitives, bvh, 30, true); break;
+        case EBVHBuilder::LBVH63Treelets: BuildBVHLBVH(primitives, bvh, 63, true); break;
+        default: BuildBVHSAH(primitives, bvh); break;
+    }
+}
+
+const char* BVHBuilderName (EBVHBuilder builder)
+{
+    switch (builder)
+    {
+        case EBVHBuilder::SAH: return "SAH";
+        case EBVHBuilder::LBVH30: return "LBVH30";
+        case EBVHBuilder::LBVH63: return "LBVH63";
+        case EBVHBuilder::LBVH30Treelets: return "LBVH30+treelets";
+        case EBVHBuilder::LBVH63Treelets: return "LBVH63+treelets";
+        default: return "unknown";
+    }
+}
+
+// LBVH build nodes have explicit children so that treelet restructuring can re-arrange them. Leaves hold one primitive.
+static const uint32_t c_lbvhNoChild = 0xFFFFFFFF;
+
+struct SLBVHNode
+{
+    float3 m_min;
+    float3 m_max;
+    uint32_t m_left;
+    uint32_t m_right;
+    uint32_t m_firstPrim;   // leaves only, index into the sorted primitive order
+    uint32_t m_numPrims;    // how many primitives are under this node
+    float m_cost;           // SAH cost of this sub tree, not divided by the area of the root
+};
+
+struct SLBVHBuild
+{
+    const std::vector<SBVHPrimitive>& m_primitives;
+    std::vector<uint64_t> m_mortonCodes;
+    std::vector<uint32_t> m_sortedPrims;
+    std::vector<SLBVHNode> m_nodes;
+    size_t m_parallelDepth;
+};
+
+// runs lambda(chunkIndex) for each chunk, on its own thread
+template <typename LAMBDA>
+static void RunChunksInParallel (size_t numChunks, LAMBDA&& lambda)
+{
+    std::vector<std::thread> threads;
+    for (size_t chunk = 1; chunk < numChunks; ++chunk)
+        threads.emplace_back([&lambda, chunk] () { lambda(chunk); });
+    lambda(0);
+    for (std::thread& thread : threads)
+        thread.join();
+}
+
+// spreads the low bits of v out so there are two zero bits between each one
+static uint64_t SpreadBits3 (uint64_t v, size_t bitsPerAxis)
+{
+    if (bitsPerAxis <= 10)
+    {
+        v &= 0x3FF;
+        v = (v | (v << 16)) & 0x030000FF;
+        v = (v | (v << 8)) & 0x0300F00F;
+        v = (v | (v << 4)) & 0x030C30C3;
+        v = (v | (v << 2)) & 0x09249249;
+        return v;
+    }
+
+    v &= 0x1FFFFF;
+    v = (v | (v << 32)) & 0x001F00000000FFFFull;
+    v = (v | (v << 16)) & 0x001F0000FF0000FFull;
+    v = (v | (v << 8)) & 0x100F00F00F00F00Full;
+    v = (v | (v << 4)) & 0x10C30C30C30C30C3ull;
+    v = (v | (v << 2)) & 0x1249249249249249ull;
+    return v;
+}
+
+// least significant digit radix sort of the morton codes, carrying the primitive indices along.
+// Each pass histograms and scatters a chunk of the codes per thread.
+static void RadixSortMortonCodes (std::vector<uint64_t>& codes, std::vector<uint32_t>& indices, size_t numBits, size_t numThreads)
+{
+    static const size_t c_digitBits = 8;
+    static const size_t c_numDigits = 1 << c_digitBits;
+
+    size_t count = codes.size();
+    size_t numChunks = (std::min)(numThreads, count / c_lbvhParallelMinPrims + 1);
+    size_t chunkSize = (count + numChunks - 1) / numChunks;
+
+    std::vector<uint64_t> tempCodes(count);
+    std::vector<uint32_t> tempIndices(count);
+    std::vector<std::array<size_t, c_numDigits>> offsets(numChunks);
+
+    for (size_t shift = 0; shift < numBits; shift += c_digitBits)
+    {
+        // count how many of each digit are in each chunk
+        RunChunksInParallel(numChunks,
+            [&] (size_t chunk)
+            {
+                std::array<size_t, c_numDigits>& histogram = offsets[chunk];
+                histogram.fill(0);
+                size_t end = (std::min)((chunk + 1) * chunkSize, count);
+                for (size_t i = chunk * chunkSize; i < end; ++i)
+                    histogram[(codes[i] >> shift) & (c_numDigits - 1)]++;
+            }
+        );
+
+        // turn the counts into where each chunk writes each digit. Earlier chunks go first to keep the sort stable.
+        size_t offset = 0;
+        for (size_t digit = 0; digit < c_numDigits; ++digit)
+        {
+            for (size_t chunk = 0; chunk < numChunks; ++chunk)
+            {
+                size_t digitCount = offsets[chunk][digit];
+                offsets[chunk][digit] = offset;
+                offset += digitCount;
+            }
+        }
+
+        RunChunksInParallel(numChunks,
+            [&] (size_t chunk)
+            {
+                std::array<size_t, c_numDigits>& chunkOffsets = offsets[chunk];
+                size_t end = (std::min)((chunk + 1) * chunkSize, count);
+                for (size_t i = chunk * chunkSize; i < end; ++i)
+                {
+                    size_t dest = chunkOffsets[(codes[i] >> shift) & (c_numDigits - 1)]++;
+                    tempCodes[dest] = codes[i];
+                    tempIndices[dest] = indices[i];
+                }
+            }
+        );
+
+        codes.swap(tempCodes);
+        indices.swap(tempIndices);
+    }
+}
+
+// Makes the node for sorted primitives [begin, end) and everything under it. Leaves have one primitive, so a sub tree
+// over N primitives always has 2N-1 nodes, which means the right child's index is known before the left child is made
+// and both sides can be built at the same time.
+static void EmitLBVHNode (SLBVHBuild& build, size_t nodeIndex, size_t begin, size_t end, size_t depth)
+{
+    SLBVHNode& node = build.m_nodes[nodeIndex];
+    node.m_numPrims = (uint32_t)(end - begin);
+
+    if (end - begin == 1)
+    {
+        const SBVHPrimitive& primitive = build.m_primitives[build.m_sortedPrims[begin]];
+        node.m_min = primitive.m_min;
+        node.m_max = primitive.m_max;
+        node.m_left = c_lbvhNoChild;
+        node.m_right = c_lbvhNoChild;
+        node.m_firstPrim = (uint32_t)begin;
+        node.m_cost = c_bvhIntersectCost * SurfaceArea(node.m_min, node.m_max);
+        return;
+    }
+
+    // split where the highest bit that differs in the range changes from 0 to 1. The codes are sorted so the first
+    // and last codes tell us which bit that is, and a binary search finds where it changes.
+    size_t split;
+    uint64_t firstCode = build.m_mortonCodes[begin];
+    uint64_t lastCode = build.m_mortonCodes[end - 1];
+    if (firstCode == lastCode)
+    {
+        split = begin + (end - begin) / 2;
+    }
+    else
+    {
+        uint64_t differentBits = firstCode ^ lastCode;
+        uint64_t highestBit = 1ull << 63;
+        while ((differentBits & highestBit) == 0)
+            highestBit >>= 1;
+        split = std::partition_point(&build.m_mortonCodes[begin], &build.m_mortonCodes[0] + end,
+            [highestBit] (uint64_t code)
+            {
+                return (code & highestBit) == 0;
+            }
+        ) - &build.m_mortonCodes[0];
+    }
+
+    node.m_firstPrim = 0;
+    node.m_left = (uint32_t)(nodeIndex + 1);
+    node.m_right = (uint32_t)(nodeIndex + 2 * (split - begin));
+
+    if (depth < build.m_parallelDepth && end - begin >= c_lbvhParallelMinPrims)
+    {
+        std::thread leftThread([&] () { EmitLBVHNode(build, node.m_left, begin, split, depth + 1); });
+        EmitLBVHNode(build, node.m_right, split, end, depth + 1);
+        leftThread.join();
+    }
+    else
+    {
+        EmitLBVHNode(build, node.m_left, begin, split, depth + 1);
+        EmitLBVHNode(build, node.m_right, split, end, depth + 1);
+    }
+
+    const SLBVHNode& left = build.m_nodes[node.m_left];
+    const SLBVHNode& right = build.m_nodes[node.m_right];
+    node.m_min = left.m_min;
+    node.m_max = left.m_max;
+    GrowBounds(node.m_min, node.m_max, right.m_min, right.m_max);
+    node.m_cost = c_bvhTraversalCost * SurfaceArea(node.m_min, node.m_max) + left.m_cost + right.m_cost;
+}
+
+static size_t CountBits (size_t v)
+{
+    size_t count = 0;
+    for (; v; v &= v - 1)
+        ++count;
+    return count;
+}
+
+// Finds the treelet of up to c_lbvhTreeletSize leaves under the node, finds the lowest SAH cost arrangement of those
+// leaves by trying every way of splitting every subset of them, and re-links the treelet's interior nodes to match
+// if it's better. From "Fast Parallel Construction of High-Quality Bounding Volume Hierarchies" by Karras and Aila.
+static void RestructureTreelet (SLBVHBuild& build, uint32_t rootIndex)
+{
+    static const size_t c_numSubsets = 1 << c_lbvhTreeletSize;
+
+    // grow the treelet by opening up the leaf with the largest surface area until there are enough leaves
+    std::array<uint32_t, c_lbvhTreeletSize> leaves;
+    std::array<uint32_t, c_lbvhTreeletSize - 1> interiors;
+    size_t numLeaves = 2;
+    size_t numInteriors = 1;
+    leaves[0] = build.m_nodes[rootIndex].m_left;
+    leaves[1] = build.m_nodes[rootIndex].m_right;
+    interiors[0] = rootIndex;
+    while (numLeaves < c_lbvhTreeletSize)
+    {
+        size_t bestLeaf = numLeaves;
+        float bestArea = -1.0f;
+        for (size_t i = 0; i < numLeaves; ++i)
+        {
+            const SLBVHNode& leaf = build.m_nodes[leaves[i]];
+            float area = SurfaceArea(leaf.m_min, leaf.m_max);
+            if (leaf.m_left != c_lbvhNoChild && area > bestArea)
+            {
+                bestArea = area;
+                bestLeaf = i;
+            }
+        }
+        if (bestLeaf == numLeaves)
+            break;
+
+        uint32_t opened = leaves[bestLeaf];
+        interiors[numInteriors++] = opened;
+        leaves[bestLeaf] = build.m_nodes[opened].m_left;
+        leaves[numLeaves++] = build.m_nodes[opened].m_right;
+    }
+
+    if (numLeaves < 3)
+        return;
+
+    // bounds and lowest cost for every subset of the leaves, and which split of the subset gave that cost
+    std::array<float3, c_numSubsets> subsetMin;
+    std::array<float3, c_numSubsets> subsetMax;
+    std::array<float, c_numSubsets> subsetCost;
+    std::array<uint8_t, c_numSubsets> subsetSplit;
+    size_t numSubsets = size_t(1) << numLeaves;
+    for (size_t subset = 1; subset < numSubsets; ++subset)
+    {
+        size_t lowestBit = subset & (~subset + 1);
+        size_t leafIndex = CountBits(lowestBit - 1);
+        const SLBVHNode& leaf = build.m_nodes[leaves[leafIndex]];
+        if (subset == lowestBit)
+        {
+            subsetMin[subset] = leaf.m_min;
+            subsetMax[subset] = leaf.m_max;
+            subsetCost[subset] = leaf.m_cost;
+            continue;
+        }
+
+        subsetMin[subset] = subsetMin[subset ^ lowestBit];
+        subsetMax[subset] = subsetMax[subset ^ lowestBit];
+        GrowBounds(subsetMin[subset], subsetMax[subset], leaf.m_min, leaf.m_max);
+
+        // only look at splits where the lowest leaf is on the left, since the mirror image costs the same
+        float bestCost = FLT_MAX;
+        size_t bestSplit = 0;
+        for (size_t left = (subset - 1) & subset; left != 0; left = (left - 1) & subset)
+        {
+            if ((left & lowestBit) == 0)
+                continue;
+            float cost = subsetCost[left] + subsetCost[subset ^ left];
+            if (cost < bestCost)
+            {
+                bestCost = cost;
+                bestSplit = left;
+            }
+        }
+        subsetCost[subset] = c_bvhTraversalCost * SurfaceArea(subsetMin[subset], subsetMax[subset]) + bestCost;
+        subsetSplit[subset] = (uint8_t)bestSplit;
+    }
+
+    size_t allLeaves = numSubsets - 1;
+    if (subsetCost[allLeaves] >= build.m_nodes[rootIndex].m_cost)
+        return;
+
+    // re-link the interior nodes into the better arrangement. The root stays where it is.
+    size_t nextInterior = 1;
+    auto Relink = [&] (size_t subset, uint32_t nodeIndex, auto& relink) -> void
+    {
+        SLBVHNode& node = build.m_nodes[nodeIndex];
+        node.m_min = subsetMin[subset];
+        node.m_max = subsetMax[subset];
+        node.m_cost = subsetCost[subset];
+        node.m_numPrims = 0;
+
+        size_t childSubsets[2] = { subsetSplit[subset], subset ^ subsetSplit[subset] };
+        uint32_t children[2];
+        for (size_t i = 0; i < 2; ++i)
+        {
+            if (CountBits(childSubsets[i]) == 1)
+            {
+                children[i] = leaves[CountBits(childSubsets[i] - 1)];
+            }
+            else
+            {
+                children[i] = interiors[nextInterior++];
+                relink(childSubsets[i], children[i], relink);
+            }
+            node.m_numPrims += build.m_nodes[children[i]].m_numPrims;
+        }
+        node.m_left = children[0];
+        node.m_right = children[1];
+    };
+    Relink(allLeaves, rootIndex, Relink);
+}
+
+// restructures the treelets bottom up, so each treelet is made from sub trees that are already optimized
+static void RestructureLBVHNode (SLBVHBuild& build, uint32_t nodeIndex, size_t depth)
+{
+    SLBVHNode& node = build.m_nodes[nodeIndex];
+    if (node.m_left == c_lbvhNoChild)
+        return;
+
+    if (depth < build.m_parallelDepth && node.m_numPrims >= c_lbvhParallelMinPrims)
+    {
+        std::thread leftThread([&] () { RestructureLBVHNode(build, node.m_left, depth + 1); });
+        RestructureLBVHNode(build, node.m_right, depth + 1);
+        leftThread.join();
+    }
+    else
+    {
+        RestructureLBVHNode(build, node.m_left, depth + 1);
+        RestructureLBVHNode(build, node.m_right, depth + 1);
+    }
+
+    // the children may have gotten cheaper
+    node.m_cost = c_bvhTraversalCost * SurfaceArea(node.m_min, node.m_max) + build.m_nodes[node.m_left].m_cost + build.m_nodes[node.m_right].m_cost;
+
+    if (node.m_numPrims >= c_lbvhTreeletSize)
+        RestructureTreelet(build, nodeIndex);
+}
+
+static void GatherLBVHPrims (const SLBVHBuild& build, uint32_t nodeIndex, std::vector<uint32_t>& primOrder)
+{
+    const SLBVHNode& node = build.m_nodes[nodeIndex];
+    if (node.m_left == c_lbvhNoChild)
+    {
+        primOrder.push_back(build.m_sortedPrims[node.m_firstPrim]);
+        return;
+    }
+    GatherLBVHPrims(build, node.m_left, primOrder);
+    GatherLBVHPrims(build, node.m_right, primOrder);
+}
+
+// how many levels a balanced tree over this many primitives needs below its root
+static size_t BalancedBVHDepth (size_t count)
+{
+    size_t depth = 0;
+    while (count > c_bvhMaxLeafPrims)
+    {
+        count = (count + 1) / 2;
+        ++depth;
+    }
+    return depth;
+}
+
+// picks the axis the children are furthest apart on, and whether the right child is the nearer one along it
+static void ChildSplitAxis (const float3& leftMin, const float3& leftMax, const float3& rightMin, const float3& rightMax, uint32_t& axis, bool& swapChildren)
+{
+    float3 offset = (rightMin + rightMax) - (leftMin + leftMax);
+    axis = 0;
+    for (uint32_t i = 1; i < 3; ++i)
+    {
+        if (std::abs(offset[i]) > std::abs(offset[axis]))
+            axis = i;
+    }
+    swapChildren = offset[axis] < 0.0f;
+}
+
+// Makes a balanced sub tree over m_primOrder[begin, end) by splitting it in the middle. The LBVH uses this for sub trees
+// that would otherwise go deeper than c_bvhMaxDepth.
+static void FlattenBalanced (const std::vector<SBVHPrimitive>& primitives, SBVH& bvh, size_t begin, size_t end)
+{
+    auto RangeBounds = [&] (size_t rangeBegin, size_t rangeEnd, float3& boundsMin, float3& boundsMax)
+    {
+        boundsMin = { FLT_MAX, FLT_MAX, FLT_MAX };
+        boundsMax = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+        for (size_t i = rangeBegin; i < rangeEnd; ++i)
+            GrowBounds(boundsMin, boundsMax, primitives[bvh.m_primOrder[i]].m_min, primitives[bvh.m_primOrder[i]].m_max);
+    };
+
+    size_t nodeIndex = bvh.m_nodes.size();
+    bvh.m_nodes.emplace_back();
+    RangeBounds(begin, end, bvh.m_nodes[nodeIndex].m_min, bvh.m_nodes[nodeIndex].m_max);
+
+    if (end - begin <= c_bvhMaxLeafPrims)
+    {
+        bvh.m_nodes[nodeIndex].m_rightChild = 0;
+        bvh.m_nodes[nodeIndex].m_firstPrim = (uint32_t)begin;
+        bvh.m_nodes[nodeIndex].m_numPrims = (uint32_t)(end - begin);
+        bvh.m_nodes[nodeIndex].m_splitAxis = 0;
+        return;
+    }
+
+    // put the nearer half first along the axis the halves are furthest apart on
+    size_t middle = begin + (end - begin) / 2;
+    float3 leftMin, leftMax, rightMin, rightMax;
+    RangeBounds(begin, middle, leftMin, leftMax);
+    RangeBounds(middle, end, rightMin, rightMax);
+    uint32_t axis;
+    bool swapChildren;
+    ChildSplitAxis(leftMin, leftMax, rightMin, rightMax, axis, swapChildren);
+    if (swapChildren)
+    {
+        std::rotate(&bvh.m_primOrder[begin], &bvh.m_primOrder[middle], &bvh.m_primOrder[0] + end);
+        middle = end - (middle - begin);
+    }
+
+    FlattenBalanced(primitives, bvh, begin, middle);
+    bvh.m_nodes[nodeIndex].m_rightChild = (uint32_t)bvh.m_nodes.size();
+    bvh.m_nodes[nodeIndex].m_firstPrim = 0;
+    bvh.m_nodes[nodeIndex].m_numPrims = 0;
+    bvh.m_nodes[nodeIndex].m_splitAxis = axis;
+    FlattenBalanced(primitives, bvh, middle, end);
+}
+
+// Converts the LBVH build nodes into depth first SBVHNodes. Small sub trees become leaves when the SAH says a leaf
+// is cheaper, and sub trees that would go too deep are rebuilt balanced.
+static void FlattenLBVHNode (const SLBVHBuild& build, SBVH& bvh, uint32_t buildNodeIndex, size_t depth)
+{
+    const SLBVHNode& buildNode = build.m_nodes[buildNodeIndex];
+    size_t count = buildNode.m_numPrims;
+    size_t firstPrim = bvh.m_primOrder.size();
+
+    if (buildNode.m_left != c_lbvhNoChild && depth + BalancedBVHDepth(count) + 2 >= c_bvhMaxDepth)
+    {
+        GatherLBVHPrims(build, buildNodeIndex, bvh.m_primOrder);
+        FlattenBalanced(build.m_primitives, bvh, firstPrim, firstPrim + count);
+        return;
+    }
+
+    size_t nodeIndex = bvh.m_nodes.size();
+    bvh.m_nodes.emplace_back();
+    bvh.m_nodes[nodeIndex].m_min = buildNode.m_min;
+    bvh.m_nodes[nodeIndex].m_max = buildNode.m_max;
+
+    float leafCost = c_bvhIntersectCost * SurfaceArea(buildNode.m_min, buildNode.m_max) * float(count);
+    if (buildNode.m_left == c_lbvhNoChild || (count <= c_bvhMaxLeafPrims && leafCost <= buildNode.m_cost))
+    {
+        GatherLBVHPrims(build, buildNodeIndex, bvh.m_primOrder);
+        bvh.m_nodes[nodeIndex].m_rightChild = 0;
+        bvh.m_nodes[nodeIndex].m_firstPrim = (uint32_t)firstPrim;
+        bvh.m_nodes[nodeIndex].m_numPrims = (uint32_t)count;
+        bvh.m_nodes[nodeIndex].m_splitAxis = 0;
+        return;
+    }
+
+    const SLBVHNode& left = build.m_nodes[buildNode.m_left];
+    const SLBVHNode& right = build.m_nodes[buildNode.m_right];
+    uint32_t axis;
+    bool swapChildren;
+    ChildSplitAxis(left.m_min, left.m_max, right.m_min, right.m_max, axis, swapChildren);
+    uint32_t nearChild = swapChildren ? buildNode.m_right : buildNode.m_left;
+    uint32_t farChild = swapChildren ? buildNode.m_left : buildNode.m_right;
+
+    FlattenLBVHNode(build, bvh, nearChild, depth + 1);
+    bvh.m_nodes[nodeIndex].m_rightChild = (uint32_t)bvh.m_nodes.size();
+    bvh.m_nodes[nodeIndex].m_firstPrim = 0;
+    bvh.m_nodes[nodeIndex].m_numPrims = 0;
+    bvh.m_nodes[nodeIndex].m_splitAxis = axis;
+    FlattenLBVHNode(build, bvh, farChild, depth + 1);
+}
+
+void BuildBVHLBVH (const std::vector<SBVHPrimitive>& primitives, SBVH& bvh, size_t mortonCodeBits, bool restructureTreelets)
+{
+    bvh.m_nodes.clear();
+    bvh.m_primOrder.clear();
+    if (primitives.size() == 0)
+        return;
+
+    size_t numThreads = (std::max)(size_t(std::thread::hardware_concurrency()), size_t(1));
+    size_t count = primitives.size();
+
+    size_t parallelDepth = 0;
+    while ((size_t(1) << parallelDepth) < numThreads)
+        ++parallelDepth;
+    SLBVHBuild build = { primitives, {}, {}, {}, parallelDepth };
+
+    // quantize the centroids within the centroid bounds and make morton codes from them
+    float3 centroidMin = { FLT_MAX, FLT_MAX, FLT_MAX };
+    float3 centroidMax = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+    for (const SBVHPrimitive& primitive : primitives)
+        GrowBounds(centroidMin, centroidMax, primitive.m_centroid, primitive.m_centroid);
+
+    size_t bitsPerAxis = mortonCodeBits / 3;
+    float cellsPerAxis = float(uint64_t(1) << bitsPerAxis);
+    float3 scale;
+    for (size_t i = 0; i < 3; ++i)
+        scale[i] = centroidMax[i] > centroidMin[i] ? cellsPerAxis / (centroidMax[i] - centroidMin[i]) : 0.0f;
+
+    build.m_mortonCodes.resize(count);
+    build.m_sortedPrims.resize(count);
+    size_t numChunks = (std::min)(numThreads, count / c_lbvhParallelMinPrims + 1);
+    size_t chunkSize = (count + numChunks - 1) / numChunks;
+    RunChunksInParallel(numChunks,
+        [&] (size_t chunk)
+        {
+            size_t end = (std::min)((chunk + 1) * chunkSize, count);
+            for (size_t i = chunk * chunkSize; i < end; ++i)
+            {
+                uint64_t code = 0;
+                for (size_t axis = 0; axis < 3; ++axis)
+                {
+                    float cell = (primitives[i].m_centroid[axis] - centroidMin[axis]) * scale[axis];
+                    uint64_t quantized = (uint64_t)(std::min)((std::max)(cell, 0.0f), cellsPerAxis - 1.0f);
+                    code |= SpreadBits3(quantized, bitsPerAxis) << axis;
+                }
+                build.m_mortonCodes[i] = code;
+                build.m_sortedPrims[i] = (uint32_t)i;
+            }
+        }
+    );
+
+    RadixSortMortonCodes(build.m_mortonCodes, build.m_sortedPrims, bitsPerAxis * 3, numThreads);
+
+    build.m_nodes.resize(count * 2 - 1);
+    EmitLBVHNode(build, 0, 0, count, 0);
+
+    if (restructureTreelets)
+        RestructureLBVHNode(build, 0, 0);
+
+    bvh.m_nodes.reserve(count * 2);
+    bvh.m_primOrder.reserve(count);
+    FlattenLBVHNode(build, bvh, 0, 0);
+}
+
+// refits the sub tree under nodeIndex. Interior nodes at stopDepth are skipped, because another thread has them.
+static void RefitBVHNode (const std::vector<SBVHPrimitive>& primitives, SBVH& bvh, uint32_t nodeIndex, size_t depth, size_t stopDepth)
+{
+    SBVHNode& node = bvh.m_nodes[nodeIndex];
+    if (node.m_numPrims > 0)
+    {
+        node.m_min = { FLT_MAX, FLT_MAX, FLT_MAX };
+        node.m_max = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+        for (uint32_t i = node.m_firstPrim; i < node.m_firstPrim + node.m_numPrims; ++i)
+        {
+            const SBVHPrimitive& primitive = primitives[bvh.m_primOrder[i]];
+            GrowBounds(node.m_min, node.m_max, primitive.m_min, primitive.m_max);
+        }
+        return;
+    }
+
+    if (depth == stopDepth)
+        return;
+
+    RefitBVHNode(primitives, bvh, nodeIndex + 1, depth + 1, stopDepth);
+    RefitBVHNode(primitives, bvh, node.m_rightChild, depth + 1, stopDepth);
+    const SBVHNode& left = bvh.m_nodes[nodeIndex + 1];
+    const SBVHNode& right = bvh.m_nodes[node.m_rightChild];
+    node.m_min = left.m_min;
+    node.m_max = left.m_max;
+    GrowBounds(node.m_min, node.m_max, right.m_min, right.m_max);
+}
+
+static void GatherRefitSubTrees (const SBVH& bvh, uint32_t nodeIndex, size_t depth, size_t stopDepth, std::vector<uint32_t>& subTrees)
+{
+    const SBVHNode& node = bvh.m_nodes[nodeIndex];
+    if (node.m_numPrims > 0)
+        return;
+    if (depth == stopDepth)
+    {
+        subTrees.push_back(nodeIndex);
+        return;
+    }
+    GatherRefitSubTrees(bvh, nodeIndex + 1, depth + 1, stopDepth, subTrees);
+    GatherRefitSubTrees(bvh, node.m_rightChild, depth + 1, stopDepth, subTrees);
+}
+
+void RefitBVH (const std::vector<SBVHPrimitive>& primitives, SBVH& bvh)
+{
+    if (bvh.m_nodes.size() == 0)
+        return;
+
+    size_t numThreads = (std::max)(size_t(std::thread::hardware_concurrency()), size_t(1));
+    if (numThreads == 1 || bvh.m_nodes.size() < c_bvhRefitParallelMinNodes)
+    {
+        RefitBVHNode(primitives, bvh, 0, 0, c_bvhMaxDepth);
+        return;
+    }
+
+    // refit the sub trees a few levels down on their own threads, a few sub trees per thread so they even out.
+    // Nodes are depth first so each sub tree is its own range of nodes. Then refit the nodes above them.
+    size_t parallelDepth = 0;
+    while ((size_t(1) << parallelDepth) < numThreads * 4 && parallelDepth + 1 < c_bvhMaxDepth)
+        ++parallelDepth;
+
+    std::vector<uint32_t> subTrees;
+    GatherRefitSubTrees(bvh, 0, 0, parallelDepth, subTrees);
+    size_t numChunks = (std::max)((std::min)(numThreads, subTrees.size()), size_t(1));
+    RunChunksInParallel(numChunks,
+        [&] (size_t chunk)
+        {
+            for (size_t i = chunk; i < subTrees.size(); i += numChunks)
+                RefitBVHNode(primitives, bvh, subTrees[i], 0, c_bvhMaxDepth);
+        }
+    );
+
+    RefitBVHNode(primitives, bvh, 0, 0, parallelDepth);
+}
\ No newline at end of file
@@ -0,0 +1,221 @@
+#pragma once
+
+#include <algorithm>
+#include <vector>
+#include <float.h>
+#include <stdint.h>
+#include "ShaderTypes.h"
+
+// BVH build settings
+static const size_t c_bvhNumBins = 16;          // how many buckets the binned SAH evaluates per axis
+static const size_t c_bvhMaxLeafPrims = 4;      // leaves with at most this many primitives are allowed
+static const size_t c_bvhMaxDepth = 32;         // must match c_bvhStackSize in Shaders/PathTrace.h
+static const float c_bvhTraversalCost = 1.0f;   // SAH cost of visiting a node
+static const float c_bvhIntersectCost = 1.0f;   // SAH cost of testing a primitive
+static const size_t c_lbvhTreeletSize = 7;      // how many leaves each treelet has when restructuring an LBVH. At most 8.
+static const size_t c_lbvhParallelMinPrims = 4096;  // LBVH sub trees smaller than this are built on a single thread
+static const float c_sbvhOverlapThreshold = 1e-5f;  // SBVH only tries spatial splits where the object split's children overlap by more than this fraction of the root's area
+static const float c_sbvhDefaultReferenceBudget = 0.3f; // SBVH may add up to this fraction of the primitive count as duplicate references
+static const float c_bvhRefitRebuildRatio = 1.5f;      // a refit BVH is rebuilt once its SAH cost grows past this multiple of its cost when built
+static const size_t c_bvhRefitParallelMinNodes = 1024; // BVHs with fewer nodes than this are refit on a single thread
+
+// which BVH builder to use. The SAH builder makes the best trees, the LBVH builders are much faster to build.
+enum class EBVHBuilder
+{
+    SAH,
+    LBVH30,             // 30 bit morton codes
+    LBVH63,             // 63 bit morton codes
+    LBVH30Treelets,     // 30 bit morton codes, then treelet restructuring to improve the SAH cost
+    LBVH63Treelets,     // 63 bit morton codes, then treelet restructuring to improve the SAH cost
+    COUNT
+};
+
+// the types of primitives that the scene BVH holds. Must match c_scenePrimitive* in Shaders/PathTrace.h
+enum class EScenePrimitive : unsigned int
+{
+    Sphere,
+    Triangle,
+    Quad,
+    OBB,
+    Model
+};
+
+// what the builder needs to know about each primitive
+struct SBVHPrimitive
+{
+    float3 m_min;
+    float3 m_max;
+    float3 m_centroid;
+};
+
+// the geometry the SBVH builder clips against when a spatial split cuts a primitive
+struct SBVHTriangle
+{
+    float3 m_a;
+    float3 m_b;
+    float3 m_c;
+};
+
+// Nodes are stored depth first, so the left child of an interior node is always the node right after it.
+// Leaves have m_numPrims > 0 and index m_primOrder[m_firstPrim] to m_primOrder[m_firstPrim + m_numPrims - 1].
+struct SBVHNode
+{
+    float3 m_min;
+    float3 m_max;
+    uint32_t m_rightChild;
+    uint32_t m_firstPrim;
+    uint32_t m_numPrims;
+    uint32_t m_splitAxis;
+};
+
+struct SBVH
+{
+    std::vector<SBVHNode> m_nodes;
+    std::vector<uint32_t> m_primOrder;
+};
+
+inline void GrowBounds (float3& boundsMin, float3& boundsMax, const float3& min, const float3& max)
+{
+    for (size_t i = 0; i < 3; ++i)
+    {
+        boundsMin[i] = (std::min)(boundsMin[i], min[i]);
+        boundsMax[i] = (std::max)(boundsMax[i], max[i]);
+    }
+}
+
+inline float SurfaceArea (const float3& boundsMin, const float3& boundsMax)
+{
+    float3 extents = boundsMax - boundsMin;
+    if (extents[0] < 0.0f)
+        return 0.0f;
+    return 2.0f * (extents[0] * extents[1] + extents[1] * extents[2] + extents[2] * extents[0]);
+}
+
+void BuildBVHSAH (const std::vector<SBVHPrimitive>& primitives, SBVH& bvh);
+
+// Linear BVH: sorts the primitives by the morton code of their centroids with a parallel radix sort and makes the
+// hierarchy from the sorted codes in one pass. Treelet restructuring optionally re-arranges small groups of nodes to
+// lower the SAH cost afterwards.
+void BuildBVHLBVH (const std::vector<SBVHPrimitive>& primitives, SBVH& bvh, size_t mortonCodeBits, bool restructureTreelets);
+
+// Spatial split BVH (Stich et al. 2009): the binned SAH, plus splits that cut primitives at a plane and put a
+// reference to them in both children. This helps meshes with long thin triangles whose boxes overlap a lot.
+// m_primOrder can hold a primitive more than once, so it can be longer than primitives. referenceBudget limits how
+// many duplicates are made, as a fraction of the primitive count. If triangles is empty, the primitive boxes are
+// clipped instead of the triangles, which makes looser boxes.
+void BuildBVHSBVH (const std::vector<SBVHPrimitive>& primitives, const std::vector<SBVHTriangle>& triangles, SBVH& bvh, float referenceBudget);
+
+void BuildBVH (const std::vector<SBVHPrimitive>& primitives, SBVH& bvh, EBVHBuilder builder);
+
+const char* BVHBuilderName (EBVHBuilder builder);
+
+// Recomputes the node boxes bottom up from the primitives' current bounds, keeping the tree as it is. For animation,
+// where rebuilding every frame costs too much. The tree gets worse as things move, so compare BVHSAHCost() against
+// the cost when it was built, and rebuild once it passes c_bvhRefitRebuildRatio.
+void RefitBVH (const std::vector<SBVHPrimitive>& primitives, SBVH& bvh);
+
+float BVHSAHCost (const SBVH& bvh);
+
+inline void MakeBVHPrimitive (SBVHPrimitive& primitive, const float3& min, const float3& max)
+{
+    primitive.m_min = min;
+    primitive.m_max = max;
+    for (size_t i = 0; i < 3; ++i)
+        primitive.m_centroid[i] = (min[i] + max[i]) * 0.5f;
+}
+
+template <typename T>
+void MakeBVHPrimitive (SBVHPrimitive& primitive, const T& triangle)
+{
+    for (size_t i = 0; i < 3; ++i)
+    {
+        primitive.m_min[i] = (std::min)((std::min)(triangle.positionA_w[i], triangle.positionB_w[i]), triangle.positionC_w[i]);
+        primitive.m_max[i] = (std::max)((std::max)(triangle.positionA_w[i], triangle.positionB_w[i]), triangle.positionC_w[i]);
+        primitive.m_centroid[i] = (primitive.m_min[i] + primitive.m_max[i]) * 0.5f;
+    }
+}
+
+template <typename T>
+void MakeBVHTriangle (SBVHTriangle& bvhTriangle, const T& triangle)
+{
+    bvhTriangle.m_a = XYZ(triangle.positionA_w);
+    bvhTriangle.m_b = XYZ(triangle.positionB_w);
+    bvhTriangle.m_c = XYZ(triangle.positionC_w);
+}
+
+// Writes the nodes into the BVHNodes structured buffer storage starting at nodeIndex, making the node and primitive indices absolute
+// so the shader can use them directly. The caller needs to make sure there is room.
+template <typename NODES>
+void WriteBVHNodes (const SBVH& bvh, NODES& nodes, size_t& nodeIndex, size_t firstPrim)
+{
+    size_t firstNode = nodeIndex;
+    for (const SBVHNode& src : bvh.m_nodes)
+    {
+        auto& dest = nodes[nodeIndex];
+        dest.boundsMin_w = { src.m_min[0], src.m_min[1], src.m_min[2], 0.0f };
+        dest.boundsMax_w = { src.m_max[0], src.m_max[1], src.m_max[2], 0.0f };
+        dest.rightChild_firstPrim_numPrims_splitAxis =
+        {
+            src.m_numPrims > 0 ? 0 : (unsigned int)(firstNode + src.m_rightChild),
+            src.m_numPrims > 0 ? (unsigned int)(firstPrim + src.m_firstPrim) : 0,
+            src.m_numPrims,
+            src.m_splitAxis
+        };
+        ++nodeIndex;
+    }
+}
+
+// Builds a BVH over triangles [firstTriangle, lastTriangle), re-orders those triangles to match the leaves, and writes
+// the nodes with WriteBVHNodes(). Returns false if it ran out of nodes.
+template <typename TRIANGLES, typename NODES>
+bool BuildModelBVH (TRIANGLES& triangles, size_t firstTriangle, size_t lastTriangle, NODES& nodes, size_t& nodeIndex, EBVHBuilder builder)
+{
+    std::vector<SBVHPrimitive> primitives(lastTriangle - firstTriangle);
+    for (size_t i = 0; i < primitives.size(); ++i)
+        MakeBVHPrimitive(primitives[i], triangles[firstTriangle + i]);
+
+    SBVH bvh;
+    BuildBVH(primitives, bvh, builder);
+
+    if (nodeIndex + bvh.m_nodes.size() > nodes.size())
+        return false;
+
+    // re-order the triangles so each leaf references a contiguous range
+    std::vector<typename TRIANGLES::value_type> sortedTriangles(primitives.size());
+    for (size_t i = 0; i < primitives.size(); ++i)
+        sortedTriangles[i] = triangles[firstTriangle + bvh.m_primOrder[i]];
+    for (size_t i = 0; i < primitives.size(); ++i)
+        triangles[firstTriangle + i] = sortedTriangles[i];
+
+    WriteBVHNodes(bvh, nodes, nodeIndex, firstTriangle);
+    return true;
+}
+
+// Builds an SBVH over all of the triangles and replaces them with one triangle per leaf reference, in leaf order,
+// so the list grows by however many duplicates the spatial splits made. The nodes are written with WriteBVHNodes().
+// Returns false if it ran out of nodes.
+template <typename T, typename NODES>
+bool BuildModelSBVH (std::vector<T>& triangles, NODES& nodes, size_t& nodeIndex, float referenceBudget)
+{
+    std::vector<SBVHPrimitive> primitives(triangles.size());
+    std::vector<SBVHTriangle> bvhTriangles(triangles.size());
+    for (size_t i = 0; i < triangles.size(); ++i)
+    {
+        MakeBVHPrimitive(primitives[i], triangles[i]);
+        MakeBVHTriangle(bvhTriangles[i], triangles[i]);
+    }
+
+    SBVH bvh;
+    BuildBVHSBVH(primitives, bvhTriangles, bvh, referenceBudget);
+
+    if (nodeIndex + bvh.m_nodes.size() > nodes.size())
+        return false;
+
+    std::vector<T> sortedTriangles(bvh.m_primOrder.size());
+    for (size_t i = 0; i < bvh.m_primOrder.size(); ++i)
+        sortedTriangles[i] = triangles[bvh.m_primOrder[i]];
+    triangles.swap(sortedTriangles);
+
+    WriteBVHNodes(bvh, nodes, nodeIndex, 0);
+    return true;
+}
\ No newline at end of file
@@ -0,0 +1,199 @@
+#include "BVH8.h"
+#include <cmath>
+
+// a child of a BVH8 node while converting. Either a node of the binary BVH, or a range of the binary BVH's m_primOrder.
+struct SBVH8Child
+{
+    float3 m_min;
+    float3 m_max;
+    uint32_t m_binaryNode;  // c_bvh8NoNode for a primitive range
+    uint32_t m_firstPrim;
+    uint32_t m_numPrims;
+};
+
+static const uint32_t c_bvh8NoNode = 0xFFFFFFFF;
+
+typedef std::vector<SBVH8Child> TBVH8Children;
+
+struct SBVH8Convert
+{
+    const SBVH& m_bvh;
+    const std::vector<SBVHPrimitive>& m_primitives;
+    SBVH8& m_bvh8;
+};
+
+static bool IsBVH8Interior (const SBVH8Child& child)
+{
+    return child.m_binaryNode != c_bvh8NoNode || child.m_numPrims > c_bvhMaxLeafPrims;
+}
+
+static SBVH8Child BinaryNodeChild (const SBVH& bvh, uint32_t nodeIndex)
+{
+    const SBVHNode& node = bvh.m_nodes[nodeIndex];
+    SBVH8Child child;
+    child.m_min = node.m_min;
+    child.m_max = node.m_max;
+    child.m_binaryNode = node.m_numPrims > 0 ? c_bvh8NoNode : nodeIndex;
+    child.m_firstPrim = node.m_firstPrim;
+    child.m_numPrims = node.m_numPrims;
+    return child;
+}
+
+// opens up binary nodes, largest surface area first, until there are 8 children or only leaves are left
+static void OpenBinaryNode (const SBVH& bvh, uint32_t nodeIndex, TBVH8Children& children)
+{
+    const SBVHNode& node = bvh.m_nodes[nodeIndex];
+    children.clear();
+    children.push_back(BinaryNodeChild(bvh, nodeIndex + 1));
+    children.push_back(BinaryNodeChild(bvh, node.m_rightChild));
+    while (children.size() < c_bvh8Width)
+    {
+        size_t bestChild = children.size();
+        float bestArea = -1.0f;
+        for (size_t i = 0; i < children.size(); ++i)
+        {
+            float area = SurfaceArea(children[i].m_min, children[i].m_max);
+            if (children[i].m_binaryNode != c_bvh8NoNode && area > bestArea)
+            {
+                bestArea = area;
+                bestChild = i;
+            }
+        }
+        if (bestChild == children.size())
+            break;
+
+        uint32_t opened = children[bestChild].m_binaryNode;
+        children[bestChild] = BinaryNodeChild(bvh, opened + 1);
+        children.push_back(BinaryNodeChild(bvh, bvh.m_nodes[opened].m_rightChild));
+    }
+}
+
+// splits a range of primitives that is too big for a leaf into up to 8 pieces
+static void SplitPrimRange (const SBVH8Convert& convert, uint32_t firstPrim, uint32_t numPrims, TBVH8Children& children)
+{
+    uint32_t piecePrims = (std::max)(uint32_t(c_bvhMaxLeafPrims), (numPrims + uint32_t(c_bvh8Width) - 1) / uint32_t(c_bvh8Width));
+    children.clear();
+    for (uint32_t begin = firstPrim; begin < firstPrim + numPrims; begin += piecePrims)
+    {
+        SBVH8Child child;
+        child.m_min = { FLT_MAX, FLT_MAX, FLT_MAX };
+        child.m_max = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+        child.m_binaryNode = c_bvh8NoNode;
+        child.m_firstPrim = begin;
+        child.m_numPrims = (std::min)(piecePrims, firstPrim + numPrims - begin);
+        for (uint32_t i = begin; i < begin + child.m_numPrims; ++i)
+        {
+            const SBVHPrimitive& primitive = convert.m_primitives[convert.m_bvh.m_primOrder[i]];
+            GrowBounds(child.m_min, child.m_max, primitive.m_min, primitive.m_max);
+        }
+        children.push_back(child);
+    }
+}
+
+static void WriteBVH8Node (const SBVH8Convert& convert, uint32_t nodeIndex, const float3& boundsMin, const float3& boundsMax, const TBVH8Children& children)
+{
+    SBVH8& bvh8 = convert.m_bvh8;
+
+    // pick the smallest power of two scale per axis that fits the node's box into 255 steps
+    SBVH8Node node;
+    node.m_origin = boundsMin;
+    float3 scale;
+    for (size_t axis = 0; axis < 3; ++axis)
+    {
+        float extent = boundsMax[axis] - boundsMin[axis];
+        int exponent = extent > 0.0f ? (int)std::ceil(std::log2(extent / 255.0f)) : -126;
+        exponent = (std::max)((std::min)(exponent, 127), -126);
+        if (std::ldexp(255.0f, exponent) < extent)
+            ++exponent;
+        node.m_exponent[axis] = (int8_t)exponent;
+        scale[axis] = std::ldexp(1.0f, exponent);
+    }
+
+    node.m_interiorMask = 0;
+    node.m_firstChild = (uint32_t)bvh8.m_nodes.size();
+    node.m_firstPrim = (uint32_t)bvh8.m_primOrder.size();
+    size_t numInteriors = 0;
+    for (size_t i = 0; i < c_bvh8Width; ++i)
+    {
+        // empty slots get an inside out box, which rays never hit
+        if (i >= children.size())
+        {
+            node.m_childMeta[i] = 0;
+            for (size_t axis = 0; axis < 3; ++axis)
+            {
+                node.m_min[axis][i] = 255;
+                node.m_max[axis][i] = 0;
+            }
+            continue;
+        }
+
+        const SBVH8Child& child = children[i];
+        for (size_t axis = 0; axis < 3; ++axis)
+        {
+            // step outwards if rounding in the subtraction made the box smaller
+            float quantizedMin = std::floor((child.m_min[axis] - node.m_origin[axis]) / scale[axis]);
+            float quantizedMax = std::ceil((child.m_max[axis] - node.m_origin[axis]) / scale[axis]);
+            if (node.m_origin[axis] + quantizedMin * scale[axis] > child.m_min[axis])
+                quantizedMin -= 1.0f;
+            if (node.m_origin[axis] + quantizedMax * scale[axis] < child.m_max[axis])
+                quantizedMax += 1.0f;
+            node.m_min[axis][i] = (uint8_t)(std::max)((std::min)(quantizedMin, 255.0f), 0.0f);
+            node.m_max[axis][i] = (uint8_t)(std::max)((std::min)(quantizedMax, 255.0f), 0.0f);
+        }
+
+        if (IsBVH8Interior(child))
+        {
+            node.m_interiorMask |= 1 << i;
+            node.m_childMeta[i] = (uint8_t)numInteriors;
+            ++numInteriors;
+        }
+        else
+        {
+            node.m_childMeta[i] = (uint8_t)((child.m_numPrims << 5) | (bvh8.m_primOrder.size() - node.m_firstPrim));
+            for (uint32_t prim = child.m_firstPrim; prim < child.m_firstPrim + child.m_numPrims; ++prim)
+                bvh8.m_primOrder.push_back(convert.m_bvh.m_primOrder[prim]);
+        }
+    }
+
+    // make room for the child nodes next to each other, then fill them in
+    bvh8.m_nodes[nodeIndex] = node;
+    bvh8.m_nodes.resize(bvh8.m_nodes.size() + numInteriors);
+
+    TBVH8Children grandChildren;
+    uint32_t childNodeIndex = node.m_firstChild;
+    for (const SBVH8Child& child : children)
+    {
+        if (!IsBVH8Interior(child))
+            continue;
+
+        if (child.m_binaryNode != c_bvh8NoNode)
+            OpenBinaryNode(convert.m_bvh, child.m_binaryNode, grandChildren);
+        else
+            SplitPrimRange(convert, child.m_firstPrim, child.m_numPrims, grandChildren);
+        WriteBVH8Node(convert, childNodeIndex, child.m_min, child.m_max, grandChildren);
+        ++childNodeIndex;
+    }
+}
+
+void ConvertBVHToBVH8 (const SBVH& bvh, const std::vector<SBVHPrimitive>& primitives, SBVH8& bvh8)
+{
+    bvh8.m_nodes.clear();
+    bvh8.m_primOrder.clear();
+    if (bvh.m_nodes.size() == 0)
+        return;
+
+    SBVH8Convert convert = { bvh, primitives, bvh8 };
+    const SBVHNode& root = bvh.m_nodes[0];
+
+    // the root is always a node, even if the binary BVH is a single leaf
+    TBVH8Children children;
+    if (root.m_numPrims > 0)
+        SplitPrimRange(convert, root.m_firstPrim, root.m_numPrims, children);
+    else
+        OpenBinaryNode(bvh, 0, children);
+
+    bvh8.m_nodes.reserve(bvh.m_nodes.size() / 4 + 1);
+    bvh8.m_primOrder.reserve(bvh.m_primOrder.size());
+    bvh8.m_nodes.resize(1);
+    WriteBVH8Node(convert, 0, root.m_min, root.m_max, children);
+}
\ No newline at end of file
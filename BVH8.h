@@ -0,0 +1,37 @@
+#pragma once
+
+#include <vector>
+#include <stdint.h>
+#include "BVH.h"
+
+// 8 wide BVH for CPU traversal, converted from the binary BVH. Child boxes are stored quantized to 8 bits within the
+// parent's box, so a whole node is 80 bytes instead of the 8 * 48 bytes the same boxes take as BVHNodes.
+// Quantization rounds outwards, so the child boxes only ever get bigger.
+
+static const size_t c_bvh8Width = 8;
+static const size_t c_bvh8StackSize = c_bvh8Width * (c_bvhMaxDepth + 8);  // ordered traversal pushes up to 8 entries per level
+
+struct SBVH8Node
+{
+    float3 m_origin;                    // min corner of the node's box
+    int8_t m_exponent[3];               // child box coordinates are m_origin + quantized * 2^m_exponent
+    uint8_t m_interiorMask;             // bit i is set if child i is a node rather than a leaf
+    uint32_t m_firstChild;              // index of the first child node. Child nodes are stored next to each other.
+    uint32_t m_firstPrim;               // index into m_primOrder of the first primitive of the leaf children
+    uint8_t m_childMeta[c_bvh8Width];   // node: offset from m_firstChild. leaf: prim count << 5 | offset from m_firstPrim.
+    uint8_t m_min[3][c_bvh8Width];      // quantized child box mins, per axis. Empty child slots have min > max.
+    uint8_t m_max[3][c_bvh8Width];      // quantized child box maxs, per axis
+};
+
+static_assert(sizeof(SBVH8Node) == 80, "SBVH8Node should be 80 bytes");
+static_assert(c_bvhMaxLeafPrims <= 7 && c_bvh8Width * c_bvhMaxLeafPrims <= 32, "leaf m_childMeta has 3 bits for the prim count and 5 for the offset");
+
+struct SBVH8
+{
+    std::vector<SBVH8Node> m_nodes;
+    std::vector<uint32_t> m_primOrder;
+};
+
+// Collapses the binary BVH into an 8 wide one by repeatedly opening the child with the largest surface area.
+// The primitives are needed to split up leaves that have more primitives than a leaf child can hold.
+void ConvertBVHToBVH8 (const SBVH& bvh, const std::vector<SBVHPrimitive>& primitives, SBVH8& bvh8);
\ No newline at end of file
@@ -0,0 +1,2586 @@
+#define _CRT_SECURE_NO_WARNINGS
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+#include <array>
+#include <random>
+#include <chrono>
+#include <thread>
+#ifdef _WIN32
+#include <direct.h>
+#define chdir _chdir
+#else
+#include <unistd.h>
+#endif
+#include "../MeshLoader.h"
+#include "../BVH.h"
+#include "../BVH8.h"
+#include "../LightTree.h"
+#include "../Environment.h"
+#include "../PathTraceCPU.h"
+#include "../PathTraceFirstHitCPU.h"
+#include "../PathTraceKernelsCPU.h"
+#include "../Scenes.h"
+
+// CPU benchmarks of the ray tracing code. Builds with CPU_ONLY defined, so runs anywhere, not just windows.
+
+static const size_t c_numRays = 1 << 16;
+static const size_t c_numBuildRepeats = 10;
+static const size_t c_sceneRayWidth = 256;
+static const size_t c_sceneRayHeight = 192;
+static const size_t c_syntheticMeshRings = 500;     // the synthetic mesh is a bumpy torus with 2 * rings * segments triangles
+static const size_t c_syntheticMeshSegments = 1000;
+static const size_t c_triangleBlockRays = 1 << 12;     // every ray tests every triangle, so fewer rays
+static const size_t c_animationFrames = 300;           // frames of animation at 60 fps
+static const size_t c_refitSyntheticSteps = 8;          // how many times the synthetic mesh is deformed further
+static const float c_firstHitTimeTolerance = 0.001f;    // packet and single ray first hits can be this fraction apart, see FirstHitsMatch()
+static const size_t c_dispatchFrames = 2;               // path trace frames per worker count in the dispatch benchmark
+static const unsigned int c_dispatchTileSizes[] = { 8, 16, 32, 64 };    // tile sizes tried with a worker per core
+static const size_t c_adaptiveWidth = 128;              // the adaptive sampling benchmark renders its reference at this size,
+static const size_t c_adaptiveHeight = 96;
+static const size_t c_adaptiveReferenceSamples = 2048;  // with this many samples
+static const size_t c_adaptiveTargetSamples = 64;       // uniform sampling's error at this many samples is the target error
+static const size_t c_adaptiveMaxFrames = 2048;
+static const unsigned int c_adaptiveTileSize = 8;
+static const float c_adaptiveError = 0.1f;
+static const size_t c_adaptiveMinSamples = 32;
+static const size_t c_rouletteFrames = 32;              // frames per setting in the russian roulette benchmark, at c_sceneRayWidth x c_sceneRayHeight
+static const size_t c_lightSamplingFrames = 32;         // frames per setting in the light sampling benchmark, at c_sceneRayWidth x c_sceneRayHeight
+static const size_t c_syntheticEmitterCounts[] = { 1000, 10000, 100000 };   // emitters in the light tree build benchmark
+static const size_t c_lightTreeCheckPoints = 16;        // shading points the light tree probabilities are checked to sum to 1 at
+static const size_t c_environmentSamples = 1 << 20;     // directions per estimate in the environment sampling benchmark
+static const size_t c_samplerReferenceSamples = 4096;   // the sampler convergence benchmark's reference, at c_adaptiveWidth x c_adaptiveHeight
+static const size_t c_samplerMaxSamples = 256;          // the sampler convergence benchmark gives the RMSE at each power of 2 up to this
+static const size_t c_sobolNetKeys = 1024;              // pixel, bounce and dimension keys whose Sobol points are checked to be stratified
+static const size_t c_sobolNetLog2Samples = 10;         // up to this many points, as a power of 2
+static const size_t c_restirFrames = 32;                // frames per setting in the reservoir resampling benchmark, at c_sceneRayWidth x c_sceneRayHeight
+static const size_t c_restirWarmupFrames = 8;           // the first frames aren't measured, while temporal reuse builds up
+static const size_t c_restirReferenceFrames = 512;
+static const size_t c_radianceCacheFrames = 32;         // frames per setting in the radiance cache benchmark, at c_sceneRayWidth x c_sceneRayHeight
+static const size_t c_radianceCacheReferenceFrames = 512;
+static const size_t c_lightmapWarmupFrames = c_lightmapMaxSamples;  // frames the lightmap benchmark accumulates before the camera moves, at c_sceneRayWidth x c_sceneRayHeight
+static const size_t c_lightmapMovedFrames[] = { 1, 4, 16, 64 };     // frames after the move that the RMSE is given at
+static const size_t c_lightmapReferenceFrames = 512;
+
+typedef std::vector<ShaderTypes::StructuredBuffers::ModelTrianglePrim> TTriangleList;
+typedef std::vector<ShaderTypes::StructuredBuffers::BVHNode> TBVHNodeList;
+
+//======================================================================================
+void WaitForEnter()
+{
+    printf("Press Enter to quit");
+    fflush(stdin);
+    getchar();
+}
+
+//======================================================================================
+//                                     STimer
+//======================================================================================
+// measures time since construction
+struct STimer
+{
+    STimer()
+    {
+        m_start = std::chrono::high_resolution_clock::now();
+    }
+
+    float Seconds() const
+    {
+        std::chrono::duration<float> seconds = std::chrono::high_resolution_clock::now() - m_start;
+        return seconds.count();
+    }
+
+    std::chrono::high_resolution_clock::time_point m_start;
+};
+
+//======================================================================================
+struct SRay
+{
+    float3 m_pos;
+    float3 m_dir;
+};
+
+//======================================================================================
+// rays start on a sphere around the normalized mesh and aim at random points in the mesh's bounding cube
+void MakeRays (std::vector<SRay>& rays)
+{
+    std::mt19937 rng(1337);
+    std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+
+    rays.resize(c_numRays);
+    for (SRay& ray : rays)
+    {
+        float3 pos;
+        do
+        {
+            pos = { dist(rng), dist(rng), dist(rng) };
+        }
+        while (LengthSq(pos) > 1.0f || LengthSq(pos) < 0.01f);
+        Normalize(pos);
+        ray.m_pos = pos * 2.0f;
+
+        float3 target = { dist(rng) * 0.5f, dist(rng) * 0.5f, dist(rng) * 0.5f };
+        ray.m_dir = target - ray.m_pos;
+        Normalize(ray.m_dir);
+    }
+}
+
+//======================================================================================
+template <typename LAMBDA>
+float TraceRays (const std::vector<SRay>& rays, std::vector<SRayHitInfo>& hits, LAMBDA&& lambda)
+{
+    hits.resize(rays.size());
+    STimer timer;
+    for (size_t i = 0; i < rays.size(); ++i)
+    {
+        hits[i] = SRayHitInfo();
+        lambda(rays[i], hits[i]);
+    }
+    return timer.Seconds();
+}
+
+//======================================================================================
+void BenchmarkModel (const char* fileName, const std::vector<SRay>& rays)
+{
+    // load the mesh, normalized to fit in a unit cube at the origin
+    TTriangleList triangles(100000);
+    size_t triangleCount = 0;
+    AddMeshToTriangleSoup(fileName, "../Art/Models/", triangles, triangleCount);
+    if (triangleCount == 0)
+        return;
+    triangles.resize(triangleCount);
+    NormalizeMesh(triangles, 0, triangleCount);
+
+    // build the BVH a few times to get a stable timing. Each build re-orders the triangles, which is harmless.
+    TBVHNodeList nodes(triangleCount * 2);
+    size_t nodeCount = 0;
+    STimer buildTimer;
+    for (size_t i = 0; i < c_numBuildRepeats; ++i)
+    {
+        nodeCount = 0;
+        BuildModelBVH(triangles, 0, triangleCount, nodes, nodeCount, EBVHBuilder::SAH);
+    }
+    float buildSeconds = buildTimer.Seconds() / float(c_numBuildRepeats);
+
+    // calculate the SAH cost of the tree
+    std::vector<SBVHPrimitive> primitives(triangleCount);
+    for (size_t i = 0; i < triangleCount; ++i)
+        MakeBVHPrimitive(primitives[i], triangles[i]);
+    SBVH bvh;
+    BuildBVHSAH(primitives, bvh);
+
+    // identity transform
+    ShaderTypes::StructuredBuffers::ModelPrim model;
+    model.worldToObjectX = { 1.0f, 0.0f, 0.0f, 0.0f };
+    model.worldToObjectY = { 0.0f, 1.0f, 0.0f, 0.0f };
+    model.worldToObjectZ = { 0.0f, 0.0f, 1.0f, 0.0f };
+    model.firstTriangle_lastTriangle_rootNode_firstLight = { 0, (unsigned int)triangleCount, 0, 0 };
+
+    // trace the rays both ways
+    std::vector<SRayHitInfo> linearHits, bvhHits;
+    float linearSeconds = TraceRays(rays, linearHits,
+        [&] (const SRay& ray, SRayHitInfo& hitInfo)
+        {
+            RayIntersectsModelLinear(ray.m_pos, ray.m_dir, model, triangles, hitInfo);
+        }
+    );
+    float bvhSeconds = TraceRays(rays, bvhHits,
+        [&] (const SRay& ray, SRayHitInfo& hitInfo)
+        {
+            RayIntersectsModel(ray.m_pos, ray.m_dir, model, triangles, nodes, hitInfo);
+        }
+    );
+
+    // make sure they agree
+    size_t hitCount = 0;
+    size_t mismatchCount = 0;
+    for (size_t i = 0; i < rays.size(); ++i)
+    {
+        if (linearHits[i].m_intersectTime >= 0.0f)
+            ++hitCount;
+        if (std::abs(linearHits[i].m_intersectTime - bvhHits[i].m_intersectTime) > 0.0001f)
+            ++mismatchCount;
+    }
+
+    float linearRaysPerSecond = float(rays.size()) / linearSeconds;
+    float bvhRaysPerSecond = float(rays.size()) / bvhSeconds;
+    printf("%-16s %6zu tris %6zu nodes  SAH %6.2f  build %7.3f ms  linear %7.2f Mrays/s  BVH %7.2f Mrays/s  (%5.1fx)  %5.1f%% hit  %zu mismatches\n",
+        fileName + strlen("../Art/Models/"), triangleCount, nodeCount, BVHSAHCost(bvh), buildSeconds * 1000.0f,
+        linearRaysPerSecond / 1000000.0f, bvhRaysPerSecond / 1000000.0f, bvhRaysPerSecond / linearRaysPerSecond,
+        100.0f * float(hitCount) / float(rays.size()), mismatchCount);
+}
+
+//======================================================================================
+// traces the rays against the binary SAH BVH in the shader's node format and against the BVH8 made from it
+void BenchmarkBVH8 (const char* name, const TTriangleList& triangles, const std::vector<SRay>& rays)
+{
+    std::vector<SBVHPrimitive> primitives(triangles.size());
+    for (size_t i = 0; i < triangles.size(); ++i)
+        MakeBVHPrimitive(primitives[i], triangles[i]);
+
+    SBVH bvh;
+    BuildBVHSAH(primitives, bvh);
+
+    SBVH8 bvh8;
+    STimer convertTimer;
+    ConvertBVHToBVH8(bvh, primitives, bvh8);
+    float convertSeconds = convertTimer.Seconds();
+
+    // each BVH wants the triangles in its own leaf order
+    TTriangleList binaryTriangles(triangles.size());
+    for (size_t i = 0; i < triangles.size(); ++i)
+        binaryTriangles[i] = triangles[bvh.m_primOrder[i]];
+    TBVHNodeList nodes(bvh.m_nodes.size());
+    size_t nodeCount = 0;
+    WriteBVHNodes(bvh, nodes, nodeCount, 0);
+
+    TTriangleList bvh8Triangles(triangles.size());
+    for (size_t i = 0; i < triangles.size(); ++i)
+        bvh8Triangles[i] = triangles[bvh8.m_primOrder[i]];
+
+    ShaderTypes::StructuredBuffers::ModelPrim model;
+    model.worldToObjectX = { 1.0f, 0.0f, 0.0f, 0.0f };
+    model.worldToObjectY = { 0.0f, 1.0f, 0.0f, 0.0f };
+    model.worldToObjectZ = { 0.0f, 0.0f, 1.0f, 0.0f };
+    model.firstTriangle_lastTriangle_rootNode_firstLight = { 0, (unsigned int)triangles.size(), 0, 0 };
+
+    std::vector<SRayHitInfo> binaryHits, bvh8Hits;
+    float binarySeconds = TraceRays(rays, binaryHits,
+        [&] (const SRay& ray, SRayHitInfo& hitInfo)
+        {
+            RayIntersectsModel(ray.m_pos, ray.m_dir, model, binaryTriangles, nodes, hitInfo);
+        }
+    );
+    float bvh8Seconds = TraceRays(rays, bvh8Hits,
+        [&] (const SRay& ray, SRayHitInfo& hitInfo)
+        {
+            RayIntersectsModelBVH8(ray.m_pos, ray.m_dir, model, bvh8Triangles, bvh8, hitInfo);
+        }
+    );
+
+    size_t mismatchCount = 0;
+    for (size_t i = 0; i < rays.size(); ++i)
+    {
+        if (std::abs(binaryHits[i].m_intersectTime - bvh8Hits[i].m_intersectTime) > 0.0001f)
+            ++mismatchCount;
+    }
+
+    size_t binaryBytes = nodes.size() * sizeof(ShaderTypes::StructuredBuffers::BVHNode);
+    size_t bvh8Bytes = bvh8.m_nodes.size() * sizeof(SBVH8Node);
+    float binaryRaysPerSecond = float(rays.size()) / binarySeconds;
+    float bvh8RaysPerSecond = float(rays.size()) / bvh8Seconds;
+    printf("%-16s binary %7zu nodes x %2zu B = %9zu B  %7.2f Mrays/s   BVH8 %6zu nodes x %2zu B = %9zu B  %7.2f Mrays/s  (%4.2fx)  convert %7.2f ms  %zu mismatches\n",
+        name, nodes.size(), sizeof(ShaderTypes::StructuredBuffers::BVHNode), binaryBytes, binaryRaysPerSecond / 1000000.0f,
+        bvh8.m_nodes.size(), sizeof(SBVH8Node), bvh8Bytes, bvh8RaysPerSecond / 1000000.0f, bvh8RaysPerSecond / binaryRaysPerSecond,
+        convertSeconds * 1000.0f, mismatchCount);
+}
+
+//======================================================================================
+void BenchmarkModelBVH8 (const char* fileName, const std::vector<SRay>& rays)
+{
+    TTriangleList triangles(100000);
+    size_t triangleCount = 0;
+    AddMeshToTriangleSoup(fileName, "../Art/Models/", triangles, triangleCount);
+    if (triangleCount == 0)
+        return;
+    triangles.resize(triangleCount);
+    NormalizeMesh(triangles, 0, triangleCount);
+    BenchmarkBVH8(fileName + strlen("../Art/Models/"), triangles, rays);
+}
+
+//======================================================================================
+// every ray against every triangle, one triangle at a time with the scalar GraphicsCodex routine vs 8 at a time with triangle blocks
+void BenchmarkTriangleBlocks (const char* fileName, const std::vector<SRay>& allRays)
+{
+    TTriangleList triangles(100000);
+    size_t triangleCount = 0;
+    AddMeshToTriangleSoup(fileName, "../Art/Models/", triangles, triangleCount);
+    if (triangleCount == 0)
+        return;
+    triangles.resize(triangleCount);
+    NormalizeMesh(triangles, 0, triangleCount);
+
+    std::vector<SRay> rays(allRays.begin(), allRays.begin() + (std::min)(allRays.size(), c_triangleBlockRays));
+
+    TTriangleBlocks blocks;
+    MakeTriangleBlocks(triangles, 0, triangleCount, blocks);
+
+    std::vector<SRayHitInfo> scalarHits, blockHits;
+    float scalarSeconds = TraceRays(rays, scalarHits,
+        [&] (const SRay& ray, SRayHitInfo& hitInfo)
+        {
+            for (size_t i = 0; i < triangleCount; ++i)
+                RayIntersectsTriangle(ray.m_pos, ray.m_dir, triangles[i], hitInfo);
+        }
+    );
+    float blockSeconds = TraceRays(rays, blockHits,
+        [&] (const SRay& ray, SRayHitInfo& hitInfo)
+        {
+            RayIntersectsTriangleBlocks(ray.m_pos, ray.m_dir, blocks, triangles, 0, hitInfo);
+        }
+    );
+
+    size_t mismatchCount = 0;
+    for (size_t i = 0; i < rays.size(); ++i)
+    {
+        if (std::abs(scalarHits[i].m_intersectTime - blockHits[i].m_intersectTime) > 0.0001f)
+            ++mismatchCount;
+    }
+
+    float numTests = float(rays.size()) * float(triangleCount);
+    printf("%-16s %6zu tris  %9zu B AoS  %9zu B blocks  scalar %6.2f ns/test  blocks %6.2f ns/test  (%4.2fx)  %zu mismatches\n",
+        fileName + strlen("../Art/Models/"), triangleCount, triangleCount * sizeof(ShaderTypes::StructuredBuffers::ModelTrianglePrim), blocks.size() * sizeof(STriangleBlock8),
+        scalarSeconds * 1000000000.0f / numTests, blockSeconds * 1000000000.0f / numTests, scalarSeconds / blockSeconds, mismatchCount);
+}
+
+//======================================================================================
+// the GraphicsCodex triangle test vs the precomputed Woop transform that MakeTriangle emits for SModelTriangleWoop.
+// Every ray against every triangle for the per test cost, then the SAH BVH for the total trace time.
+void BenchmarkWoopTriangles (const char* fileName, const std::vector<SRay>& rays)
+{
+    TTriangleList triangles(100000);
+    size_t triangleCount = 0;
+    AddMeshToTriangleSoup(fileName, "../Art/Models/", triangles, triangleCount);
+    if (triangleCount == 0)
+        return;
+    triangles.resize(triangleCount);
+    NormalizeMesh(triangles, 0, triangleCount);
+
+    std::vector<SModelTriangleWoop> woopTriangles(100000);
+    size_t woopTriangleCount = 0;
+    AddMeshToTriangleSoup(fileName, "../Art/Models/", woopTriangles, woopTriangleCount);
+    woopTriangles.resize(woopTriangleCount);
+    NormalizeMesh(woopTriangles, 0, woopTriangleCount);
+
+    std::vector<SRay> testRays(rays.begin(), rays.begin() + (std::min)(rays.size(), c_triangleBlockRays));
+    std::vector<SRayHitInfo> linearHits, woopLinearHits;
+    float linearSeconds = TraceRays(testRays, linearHits,
+        [&] (const SRay& ray, SRayHitInfo& hitInfo)
+        {
+            for (size_t i = 0; i < triangleCount; ++i)
+                RayIntersectsTriangle(ray.m_pos, ray.m_dir, triangles[i], hitInfo);
+        }
+    );
+    float woopLinearSeconds = TraceRays(testRays, woopLinearHits,
+        [&] (const SRay& ray, SRayHitInfo& hitInfo)
+        {
+            for (size_t i = 0; i < triangleCount; ++i)
+                RayIntersectsTriangle(ray.m_pos, ray.m_dir, woopTriangles[i], hitInfo);
+        }
+    );
+
+    // both lists build the same tree, since the builder only looks at positions
+    TBVHNodeList nodes(triangleCount * 2);
+    size_t nodeCount = 0;
+    BuildModelBVH(triangles, 0, triangleCount, nodes, nodeCount, EBVHBuilder::SAH);
+    TBVHNodeList woopNodes(triangleCount * 2);
+    size_t woopNodeCount = 0;
+    BuildModelBVH(woopTriangles, 0, triangleCount, woopNodes, woopNodeCount, EBVHBuilder::SAH);
+
+    ShaderTypes::StructuredBuffers::ModelPrim model;
+    model.worldToObjectX = { 1.0f, 0.0f, 0.0f, 0.0f };
+    model.worldToObjectY = { 0.0f, 1.0f, 0.0f, 0.0f };
+    model.worldToObjectZ = { 0.0f, 0.0f, 1.0f, 0.0f };
+    model.firstTriangle_lastTriangle_rootNode_firstLight = { 0, (unsigned int)triangleCount, 0, 0 };
+
+    std::vector<SRayHitInfo> bvhHits, woopBVHHits;
+    float bvhSeconds = TraceRays(rays, bvhHits,
+        [&] (const SRay& ray, SRayHitInfo& hitInfo)
+        {
+            RayIntersectsModel(ray.m_pos, ray.m_dir, model, triangles, nodes, hitInfo);
+        }
+    );
+    float woopBVHSeconds = TraceRays(rays, woopBVHHits,
+        [&] (const SRay& ray, SRayHitInfo& hitInfo)
+        {
+            RayIntersectsModel(ray.m_pos, ray.m_dir, model, woopTriangles, woopNodes, hitInfo);
+        }
+    );
+
+    size_t mismatchCount = 0;
+    for (size_t i = 0; i < testRays.size(); ++i)
+    {
+        if (std::abs(linearHits[i].m_intersectTime - woopLinearHits[i].m_intersectTime) > 0.0001f)
+            ++mismatchCount;
+    }
+    for (size_t i = 0; i < rays.size(); ++i)
+    {
+        if (std::abs(bvhHits[i].m_intersectTime - woopBVHHits[i].m_intersectTime) > 0.0001f)
+            ++mismatchCount;
+    }
+
+    float numTests = float(testRays.size()) * float(triangleCount);
+    printf("%-16s %6zu tris  %3zu vs %3zu B/tri  per test %5.2f vs %5.2f ns (%4.2fx)  BVH trace %7.2f vs %7.2f ms (%4.2fx)  %zu mismatches\n",
+        fileName + strlen("../Art/Models/"), triangleCount, sizeof(ShaderTypes::StructuredBuffers::ModelTrianglePrim), sizeof(SModelTriangleWoop),
+        linearSeconds * 1000000000.0f / numTests, woopLinearSeconds * 1000000000.0f / numTests, linearSeconds / woopLinearSeconds,
+        bvhSeconds * 1000.0f, woopBVHSeconds * 1000.0f, bvhSeconds / woopBVHSeconds, mismatchCount);
+}
+
+//======================================================================================
+// plain SAH BVH vs SBVH at a few reference budgets: SAH cost, how many triangle references the leaves hold, and trace speed
+void BenchmarkSBVH (const char* fileName, const std::vector<SRay>& rays)
+{
+    TTriangleList triangles(100000);
+    size_t triangleCount = 0;
+    AddMeshToTriangleSoup(fileName, "../Art/Models/", triangles, triangleCount);
+    if (triangleCount == 0)
+        return;
+    triangles.resize(triangleCount);
+    NormalizeMesh(triangles, 0, triangleCount);
+
+    std::vector<SBVHPrimitive> primitives(triangleCount);
+    std::vector<SBVHTriangle> bvhTriangles(triangleCount);
+    for (size_t i = 0; i < triangleCount; ++i)
+    {
+        MakeBVHPrimitive(primitives[i], triangles[i]);
+        MakeBVHTriangle(bvhTriangles[i], triangles[i]);
+    }
+
+    ShaderTypes::StructuredBuffers::ModelPrim model;
+    model.worldToObjectX = { 1.0f, 0.0f, 0.0f, 0.0f };
+    model.worldToObjectY = { 0.0f, 1.0f, 0.0f, 0.0f };
+    model.worldToObjectZ = { 0.0f, 0.0f, 1.0f, 0.0f };
+
+    SBVH bvh;
+    BuildBVHSAH(primitives, bvh);
+    float sahCost = BVHSAHCost(bvh);
+
+    TTriangleList sahTriangles(triangles);
+    TBVHNodeList sahNodes(triangleCount * 2);
+    size_t sahNodeCount = 0;
+    BuildModelBVH(sahTriangles, 0, triangleCount, sahNodes, sahNodeCount, EBVHBuilder::SAH);
+    model.firstTriangle_lastTriangle_rootNode_firstLight = { 0, (unsigned int)triangleCount, 0, 0 };
+    std::vector<SRayHitInfo> sahHits;
+    float sahSeconds = TraceRays(rays, sahHits,
+        [&] (const SRay& ray, SRayHitInfo& hitInfo)
+        {
+            RayIntersectsModel(ray.m_pos, ray.m_dir, model, sahTriangles, sahNodes, hitInfo);
+        }
+    );
+    printf("%-16s %6zu tris  SAH   %6zu nodes  SAH cost %6.2f  trace %7.2f Mrays/s\n",
+        fileName + strlen("../Art/Models/"), triangleCount, sahNodeCount, sahCost, float(rays.size()) / sahSeconds / 1000000.0f);
+
+    for (float budget : { 0.1f, c_sbvhDefaultReferenceBudget, 1.0f })
+    {
+        SBVH sbvh;
+        STimer buildTimer;
+        BuildBVHSBVH(primitives, bvhTriangles, sbvh, budget);
+        float buildSeconds = buildTimer.Seconds();
+        float sbvhCost = BVHSAHCost(sbvh);
+
+        TTriangleList sbvhTriangles(triangles);
+        TBVHNodeList sbvhNodes(triangleCount * 4);
+        size_t sbvhNodeCount = 0;
+        BuildModelSBVH(sbvhTriangles, sbvhNodes, sbvhNodeCount, budget);
+        model.firstTriangle_lastTriangle_rootNode_firstLight = { 0, (unsigned int)sbvhTriangles.size(), 0, 0 };
+        std::vector<SRayHitInfo> sbvhHits;
+        float sbvhSeconds = TraceRays(rays, sbvhHits,
+            [&] (const SRay& ray, SRayHitInfo& hitInfo)
+            {
+                RayIntersectsModel(ray.m_pos, ray.m_dir, model, sbvhTriangles, sbvhNodes, hitInfo);
+            }
+        );
+
+        size_t mismatchCount = 0;
+        for (size_t i = 0; i < rays.size(); ++i)
+        {
+            if (std::abs(sahHits[i].m_intersectTime - sbvhHits[i].m_intersectTime) > 0.0001f)
+                ++mismatchCount;
+        }
+
+        printf("    budget %3.0f%%  %6zu refs (+%5.1f%%)  %6zu nodes  SAH cost %6.2f (%5.1f%% lower)  build %7.3f ms  trace %7.2f Mrays/s (%4.2fx)  %zu mismatches\n",
+            budget * 100.0f, sbvh.m_primOrder.size(), 100.0f * float(sbvh.m_primOrder.size() - triangleCount) / float(triangleCount),
+            sbvhNodeCount, sbvhCost, 100.0f * (sahCost - sbvhCost) / sahCost, buildSeconds * 1000.0f,
+            float(rays.size()) / sbvhSeconds / 1000000.0f, sahSeconds / sbvhSeconds, mismatchCount);
+    }
+}
+
+//======================================================================================
+void BenchmarkScene (EScene scene, const char* sceneName)
+{
+    if (!FillSceneData(scene, nullptr))
+    {
+        printf("%-26s failed to fill scene data\n", sceneName);
+        return;
+    }
+
+    // camera rays for a low res image of the scene
+    std::vector<SRay> rays(c_sceneRayWidth * c_sceneRayHeight);
+    for (size_t y = 0; y < c_sceneRayHeight; ++y)
+    {
+        for (size_t x = 0; x < c_sceneRayWidth; ++x)
+        {
+            SRay& ray = rays[y * c_sceneRayWidth + x];
+            CalculateRay((float(x) + 0.5f) / float(c_sceneRayWidth), 1.0f - (float(y) + 0.5f) / float(c_sceneRayHeight), ray.m_pos, ray.m_dir);
+        }
+    }
+
+    // trace the rays both ways
+    std::vector<SRayHitInfo> linearHits, bvhHits;
+    float linearSeconds = TraceRays(rays, linearHits,
+        [&] (const SRay& ray, SRayHitInfo& hitInfo)
+        {
+            hitInfo = ClosestIntersectionLinear(ray.m_pos, ray.m_dir);
+        }
+    );
+    float bvhSeconds = TraceRays(rays, bvhHits,
+        [&] (const SRay& ray, SRayHitInfo& hitInfo)
+        {
+            hitInfo = ClosestIntersection(ray.m_pos, ray.m_dir);
+        }
+    );
+
+    // make sure they agree
+    size_t mismatchCount = 0;
+    for (size_t i = 0; i < rays.size(); ++i)
+    {
+        if (std::abs(linearHits[i].m_intersectTime - bvhHits[i].m_intersectTime) > 0.0001f)
+            ++mismatchCount;
+    }
+
+    // models share their mesh data, so count the triangles in the buffer separately from the triangles traced
+    const ShaderTypes::ConstantBuffers::ConstantsOnce& constants = ShaderData::ConstantBuffers::ConstantsOnce.Read();
+    unsigned int numModels = constants.numModels_sceneRootNode_numScenePrims_numLights[0];
+    unsigned int modelTriangles = 0;
+    unsigned int instancedTriangles = 0;
+    for (unsigned int i = 0; i < numModels; ++i)
+    {
+        const uint4& info = ShaderData::StructuredBuffers::Models.Read()[i].firstTriangle_lastTriangle_rootNode_firstLight;
+        modelTriangles = (std::max)(modelTriangles, info[1]);
+        instancedTriangles += info[1] - info[0];
+    }
+
+    float linearRaysPerSecond = float(rays.size()) / linearSeconds;
+    float bvhRaysPerSecond = float(rays.size()) / bvhSeconds;
+    printf("%-26s %4u scene prims  %2u models  %5u model tris stored (%5u instanced)  linear %7.2f Mrays/s  BVH %7.2f Mrays/s  (%5.1fx)  %zu mismatches\n",
+        sceneName, constants.numModels_sceneRootNode_numScenePrims_numLights[2], numModels, modelTriangles, instancedTriangles,
+        linearRaysPerSecond / 1000000.0f, bvhRaysPerSecond / 1000000.0f, bvhRaysPerSecond / linearRaysPerSecond, mismatchCount);
+
+    // rebuild the mesh and scene BVHs with each builder
+    for (size_t builderIndex = 0; builderIndex < (size_t)EBVHBuilder::COUNT; ++builderIndex)
+    {
+        EBVHBuilder builder = (EBVHBuilder)builderIndex;
+        STimer buildTimer;
+        bool built = true;
+        for (size_t i = 0; i < c_numBuildRepeats; ++i)
+            built &= BuildSceneBVHs(nullptr, builder);
+        float buildSeconds = buildTimer.Seconds() / float(c_numBuildRepeats);
+        if (!built)
+        {
+            printf("    %-16s failed to build the BVHs\n", BVHBuilderName(builder));
+            continue;
+        }
+
+        std::vector<SRayHitInfo> builderHits;
+        float builderSeconds = TraceRays(rays, builderHits,
+            [&] (const SRay& ray, SRayHitInfo& hitInfo)
+            {
+                hitInfo = ClosestIntersection(ray.m_pos, ray.m_dir);
+            }
+        );
+
+        size_t builderMismatchCount = 0;
+        for (size_t i = 0; i < rays.size(); ++i)
+        {
+            if (std::abs(linearHits[i].m_intersectTime - builderHits[i].m_intersectTime) > 0.0001f)
+                ++builderMismatchCount;
+        }
+
+        printf("    %-16s build %7.3f ms  trace %7.2f Mrays/s  %zu mismatches\n",
+            BVHBuilderName(builder), buildSeconds * 1000.0f, float(rays.size()) / builderSeconds / 1000000.0f, builderMismatchCount);
+    }
+}
+
+//======================================================================================
+// shadow ray style queries from the camera ray hits to random points in the scene, answered by OccludedBetween and
+// by a full ClosestIntersection. Both have to give the same answer.
+void BenchmarkOcclusion (EScene scene, const char* sceneName)
+{
+    if (!FillSceneData(scene, nullptr))
+    {
+        printf("%-26s failed to fill scene data\n", sceneName);
+        return;
+    }
+
+    const ShaderTypes::ConstantBuffers::ConstantsOnce& constants = ShaderData::ConstantBuffers::ConstantsOnce.Read();
+    const ShaderTypes::StructuredBuffers::BVHNode& root = ShaderData::StructuredBuffers::BVHNodes.Read()[constants.numModels_sceneRootNode_numScenePrims_numLights[1]];
+
+    std::mt19937 rng(1337);
+    std::uniform_real_distribution<float> dist(0.0f, 1.0f);
+    std::vector<SRay> segments;
+    for (size_t y = 0; y < c_sceneRayHeight; ++y)
+    {
+        for (size_t x = 0; x < c_sceneRayWidth; ++x)
+        {
+            float3 rayPos, rayDir;
+            CalculateRay((float(x) + 0.5f) / float(c_sceneRayWidth), 1.0f - (float(y) + 0.5f) / float(c_sceneRayHeight), rayPos, rayDir);
+            SRayHitInfo hitInfo = ClosestIntersection(rayPos, rayDir);
+            if (hitInfo.m_intersectTime < 0.0f)
+                continue;
+
+            // m_pos is the start of the segment and m_dir is the end
+            SRay segment;
+            segment.m_pos = rayPos + rayDir * (hitInfo.m_intersectTime + c_rayEpsilon) + hitInfo.m_surfaceNormal * c_rayEpsilon;
+            for (size_t axis = 0; axis < 3; ++axis)
+                segment.m_dir[axis] = root.boundsMin_w[axis] + (root.boundsMax_w[axis] - root.boundsMin_w[axis]) * dist(rng);
+            segments.push_back(segment);
+        }
+    }
+    if (segments.size() == 0)
+        return;
+
+    std::vector<bool> occluded(segments.size());
+    STimer occludedTimer;
+    for (size_t i = 0; i < segments.size(); ++i)
+        occluded[i] = OccludedBetween(segments[i].m_pos, segments[i].m_dir);
+    float occludedSeconds = occludedTimer.Seconds();
+
+    std::vector<bool> closestOccluded(segments.size());
+    STimer closestTimer;
+    for (size_t i = 0; i < segments.size(); ++i)
+    {
+        float3 rayDir = segments[i].m_dir - segments[i].m_pos;
+        float length = Length(rayDir);
+        rayDir = rayDir * (1.0f / length);
+        SRayHitInfo hitInfo = ClosestIntersection(segments[i].m_pos, rayDir);
+        closestOccluded[i] = hitInfo.m_intersectTime >= 0.0f && hitInfo.m_intersectTime <= length - 2.0f * c_rayEpsilon;
+    }
+    float closestSeconds = closestTimer.Seconds();
+
+    size_t occludedCount = 0;
+    size_t mismatchCount = 0;
+    for (size_t i = 0; i < segments.size(); ++i)
+    {
+        if (occluded[i])
+            ++occludedCount;
+        if (occluded[i] != closestOccluded[i])
+            ++mismatchCount;
+    }
+
+    float numSegments = float(segments.size());
+    printf("%-26s %6zu segments %5.1f%% occluded  closest hit %7.2f Mrays/s  any hit %7.2f Mrays/s  (%4.2fx)  %zu mismatches\n",
+        sceneName, segments.size(), 100.0f * float(occludedCount) / numSegments, numSegments / closestSeconds / 1000000.0f,
+        numSegments / occludedSeconds / 1000000.0f, closestSeconds / occludedSeconds, mismatchCount);
+}
+
+//======================================================================================
+// The packets do the same math as the single rays, but the compiler can fuse multiplies and adds (-mfma, /arch:AVX2
+// with /fp:fast) in one and not the other, which moves hits on grazing surfaces and sphere edges a little. Both have
+// to hit or both miss, and hit times have to be within c_firstHitTimeTolerance of each other.
+static bool FirstHitsMatch (const TFirstRayHit& a, const TFirstRayHit& b)
+{
+    float timeA = a.surfaceNormal_intersectTime[3];
+    float timeB = b.surfaceNormal_intersectTime[3];
+    if ((timeA >= 0.0f) != (timeB >= 0.0f))
+        return false;
+    return timeA < 0.0f || std::abs(timeA - timeB) <= c_firstHitTimeTolerance * (std::max)(timeA, timeB);
+}
+
+//======================================================================================
+// the first hit pass at full resolution, one ray per pixel like the shader vs 8x8 ray packets
+void BenchmarkFirstHit (EScene scene, const char* sceneName)
+{
+    if (!FillSceneData(scene, nullptr))
+    {
+        printf("%-26s failed to fill scene data\n", sceneName);
+        return;
+    }
+
+    std::vector<TFirstRayHit> singleHits(c_width * c_height);
+    STimer singleTimer;
+    TraceFirstHits(c_width, c_height, singleHits.data(), false);
+    float singleSeconds = singleTimer.Seconds();
+
+    float packetSeconds = 0.0f;
+    size_t mismatchCount = 0;
+    ShaderData::StructuredBuffers::FirstRayHits.WriteNoFlush(
+        [&] (std::array<TFirstRayHit, c_width * c_height>& packetHits)
+        {
+            STimer packetTimer;
+            TraceFirstHits(c_width, c_height, packetHits.data(), true);
+            packetSeconds = packetTimer.Seconds();
+
+            for (size_t i = 0; i < packetHits.size(); ++i)
+            {
+                if (!FirstHitsMatch(singleHits[i], packetHits[i]))
+                    ++mismatchCount;
+            }
+        }
+    );
+
+    float numRays = float(c_width * c_height);
+    printf("%-26s single rays %7.1f ms %6.2f Mrays/s  packets %7.1f ms %6.2f Mrays/s  (%4.2fx)  %zu mismatches\n",
+        sceneName, singleSeconds * 1000.0f, numRays / singleSeconds / 1000000.0f, packetSeconds * 1000.0f, numRays / packetSeconds / 1000000.0f,
+        singleSeconds / packetSeconds, mismatchCount);
+}
+
+//======================================================================================
+// runs the first hit and path trace kernels with CComputeDispatcherCPU at full resolution, with one worker and then
+// doubling up to one per core, then with a worker per core and different tile sizes. Every run has to make the same
+// image as one worker, and the first hits have to match the ray packets. Utilization and steals are from the work
+// stealing, and show whether time lost at higher worker counts is workers running out of tiles.
+void BenchmarkComputeDispatch (EScene scene, const char* sceneName)
+{
+    if (!FillSceneData(scene, nullptr))
+    {
+        printf("%-26s failed to fill scene data\n", sceneName);
+        return;
+    }
+
+    std::vector<TFirstRayHit> packetHits(c_width * c_height);
+    TraceFirstHits(c_width, c_height, packetHits.data(), true);
+
+    std::vector<size_t> workerCounts;
+    size_t numCores = (std::max)(std::thread::hardware_concurrency(), 1u);
+    for (size_t workers = 1; workers < numCores; workers *= 2)
+        workerCounts.push_back(workers);
+    workerCounts.push_back(numCores);
+
+    // path traces c_dispatchFrames frames with workers threads and tileSize tiles, returning the image and the time it took
+    auto PathTrace = [&] (size_t workers, unsigned int tileSize, std::vector<float4>& image, size_t& firstHitMismatches, size_t& steals, double& utilization)
+    {
+        CComputeDispatcherCPU dispatcher(workers);
+        ShaderData::Textures::pathTraceOutput.Create(c_width, c_height, 1);
+        SCamera camera = MakeCamera();
+        uint3 numThreads = { tileSize, tileSize, 1 };
+        size_t dispatchX, dispatchY;
+        PathTraceDispatchSize(tileSize, dispatchX, dispatchY);
+
+        dispatcher.Dispatch(numThreads, dispatchX, dispatchY, 1,
+            [&] (const SComputeThreadIDs& ids)
+            {
+                PathTraceFirstHitKernel(ids, camera);
+            }
+        );
+        firstHitMismatches = 0;
+        for (size_t i = 0; i < packetHits.size(); ++i)
+        {
+            if (std::abs(packetHits[i].surfaceNormal_intersectTime[3] - ShaderData::StructuredBuffers::FirstRayHits.Read()[i].surfaceNormal_intersectTime[3]) > 0.0001f)
+                ++firstHitMismatches;
+        }
+
+        SPathTraceSettings pathTraceSettings;
+        pathTraceSettings.m_sampler = ESampler::BlueNoise;
+        pathTraceSettings.m_lightPicker = ELightPicker::None;
+        dispatcher.ResetStats();
+        STimer timer;
+        for (size_t frame = 0; frame < c_dispatchFrames; ++frame)
+        {
+            ShaderData::ConstantBuffers::ConstantsPerFrame.Write(
+                nullptr,
+                [frame] (ShaderTypes::ConstantBuffers::ConstantsPerFrame& data)
+                {
+                    data.rngSeed_yzw = { 0, 0, 0, 0 };
+                    data.sampleCount_samplesPerFrame_zw = { (unsigned int)frame + 1, 1, 0, 0 };
+                }
+            );
+            dispatcher.Dispatch(numThreads, dispatchX, dispatchY, 1,
+                [&] (const SComputeThreadIDs& ids)
+                {
+                    PathTraceKernel(ids, camera, pathTraceSettings);
+                }
+            );
+        }
+        float seconds = timer.Seconds();
+
+        // average utilization over the workers, and the total steals
+        steals = 0;
+        utilization = 0.0;
+        for (const SComputeWorkerStats& stats : dispatcher.WorkerStats())
+        {
+            steals += stats.m_steals;
+            utilization += stats.m_busySeconds / dispatcher.DispatchSeconds();
+        }
+        utilization /= double(dispatcher.NumWorkers());
+
+        image.resize(c_width * c_height);
+        for (size_t y = 0; y < c_height; ++y)
+        {
+            for (size_t x = 0; x < c_width; ++x)
+                image[y * c_width + x] = ShaderData::Textures::pathTraceOutput.Texel(x, y);
+        }
+        return seconds;
+    };
+
+    // the image has to come out the same however the tiles get split up between workers
+    std::vector<float4> referenceImage;
+    auto ImageMismatches = [&referenceImage] (const std::vector<float4>& image)
+    {
+        size_t mismatches = 0;
+        for (size_t i = 0; i < image.size(); ++i)
+        {
+            if (image[i] != referenceImage[i])
+                ++mismatches;
+        }
+        return mismatches;
+    };
+
+    float numPaths = float(c_width * c_height * c_dispatchFrames);
+    float referenceSeconds = 0.0f;
+    for (size_t workers : workerCounts)
+    {
+        std::vector<float4> image;
+        size_t firstHitMismatches, steals;
+        double utilization;
+        float seconds = PathTrace(workers, c_pathTraceNumThreadsX, image, firstHitMismatches, steals, utilization);
+        if (workers == 1)
+        {
+            referenceImage = image;
+            referenceSeconds = seconds;
+        }
+
+        printf("%-26s %2zu workers %8.1f ms %6.2f Mpaths/s  (%5.2fx, %3.0f%% efficiency, %3.0f%% utilization, %4zu steals)  %zu first hit mismatches  %zu pixel mismatches\n",
+            sceneName, workers, seconds * 1000.0f, numPaths / seconds / 1000000.0f, referenceSeconds / seconds,
+            100.0f * referenceSeconds / seconds / float(workers), 100.0 * utilization, steals, firstHitMismatches, ImageMismatches(image));
+    }
+
+    // small tiles balance better, but cost more to schedule and trace less coherently
+    for (unsigned int tileSize : c_dispatchTileSizes)
+    {
+        std::vector<float4> image;
+        size_t firstHitMismatches, steals;
+        double utilization;
+        float seconds = PathTrace(numCores, tileSize, image, firstHitMismatches, steals, utilization);
+        printf("%-26s %2zu workers %2u x %-2u tiles %8.1f ms %6.2f Mpaths/s  (%3.0f%% utilization, %4zu steals)  %zu first hit mismatches  %zu pixel mismatches\n",
+            sceneName, numCores, tileSize, tileSize, seconds * 1000.0f, numPaths / seconds / 1000000.0f, 100.0 * utilization, steals, firstHitMismatches, ImageMismatches(image));
+    }
+}
+
+//======================================================================================
+// RMSE of the path trace output against a reference, of the values shown on screen, after the reinhard operator and
+// sRGB correction of ShowPathTrace.fx
+float DisplayRMSE (const std::vector<float4>& reference, size_t width, size_t height)
+{
+    double sum = 0.0;
+    for (size_t y = 0; y < height; ++y)
+    {
+        for (size_t x = 0; x < width; ++x)
+        {
+            const float4& texel = ShaderData::Textures::pathTraceOutput.Texel(x, y);
+            const float4& referenceTexel = reference[y * width + x];
+            for (size_t channel = 0; channel < 3; ++channel)
+            {
+                double value = std::sqrt(texel[channel] / (texel[channel] + 1.0f));
+                double referenceValue = std::sqrt(referenceTexel[channel] / (referenceTexel[channel] + 1.0f));
+                sum += (value - referenceValue) * (value - referenceValue);
+            }
+        }
+    }
+    return float(std::sqrt(sum / double(width * height * 3)));
+}
+
+//======================================================================================
+// DisplayRMSE() of the error after a 5x5 binomial blur, which is roughly what the eye sees from a distance. Error that
+// is blue noise is mostly high frequencies, which the blur takes out, while white noise error has as much of it left
+// at low frequencies as anywhere else. The blur clamps at the edges of the image.
+float DisplayFilteredRMSE (const std::vector<float4>& reference, size_t width, size_t height)
+{
+    static const float c_binomial[5] = { 1.0f / 16.0f, 4.0f / 16.0f, 6.0f / 16.0f, 4.0f / 16.0f, 1.0f / 16.0f };
+
+    std::vector<float3> error(width * height);
+    for (size_t y = 0; y < height; ++y)
+    {
+        for (size_t x = 0; x < width; ++x)
+        {
+            const float4& texel = ShaderData::Textures::pathTraceOutput.Texel(x, y);
+            const float4& referenceTexel = reference[y * width + x];
+            for (size_t channel = 0; channel < 3; ++channel)
+                error[y * width + x][channel] = std::sqrt(texel[channel] / (texel[channel] + 1.0f)) - std::sqrt(referenceTexel[channel] / (referenceTexel[channel] + 1.0f));
+        }
+    }
+
+    // blur horizontally, then vertically while summing up the squared error
+    std::vector<float3> blurred(width * height, { 0.0f, 0.0f, 0.0f });
+    for (size_t y = 0; y < height; ++y)
+    {
+        for (size_t x = 0; x < width; ++x)
+        {
+            for (int offset = -2; offset <= 2; ++offset)
+            {
+                size_t sourceX = size_t((std::min)((std::max)(int(x) + offset, 0), int(width) - 1));
+                blurred[y * width + x] = blurred[y * width + x] + error[y * width + sourceX] * c_binomial[offset + 2];
+            }
+        }
+    }
+
+    double sum = 0.0;
+    for (size_t y = 0; y < height; ++y)
+    {
+        for (size_t x = 0; x < width; ++x)
+        {
+            float3 value = { 0.0f, 0.0f, 0.0f };
+            for (int offset = -2; offset <= 2; ++offset)
+            {
+                size_t sourceY = size_t((std::min)((std::max)(int(y) + offset, 0), int(height) - 1));
+                value = value + blurred[sourceY * width + x] * c_binomial[offset + 2];
+            }
+            for (size_t channel = 0; channel < 3; ++channel)
+                sum += double(value[channel]) * double(value[channel]);
+        }
+    }
+    return float(std::sqrt(sum / double(width * height * 3)));
+}
+
+//======================================================================================
+// Time for uniform and adaptive sampling to get down to the same RMSE against a reference render. The target is the
+// RMSE uniform sampling has at c_adaptiveTargetSamples. RMSE is of the values shown on screen, after the reinhard
+// operator and sRGB correction of ShowPathTrace.fx, since that's what adaptive sampling's relative error is meant to
+// even out. Only the path tracing is timed, including finding which tiles to sample for adaptive, not the RMSE checks.
+void BenchmarkAdaptiveSampling (EScene scene, const char* sceneName)
+{
+    if (!FillSceneData(scene, nullptr))
+    {
+        printf("%-26s failed to fill scene data\n", sceneName);
+        return;
+    }
+
+    CComputeDispatcherCPU dispatcher;
+    ShaderData::Textures::pathTraceOutput.Create(c_adaptiveWidth, c_adaptiveHeight, 1);
+    ShaderData::Textures::pathTraceMoments.Create(c_adaptiveWidth, c_adaptiveHeight, 1);
+    SCamera camera = MakeCamera();
+    size_t dispatchX, dispatchY;
+    PathTraceDispatchSize(c_adaptiveTileSize, dispatchX, dispatchY);
+    uint3 numThreads = { c_adaptiveTileSize, c_adaptiveTileSize, 1 };
+    dispatcher.Dispatch(numThreads, dispatchX, dispatchY, 1,
+        [&] (const SComputeThreadIDs& ids)
+        {
+            PathTraceFirstHitKernel(ids, camera);
+        }
+    );
+
+    SPathTraceSettings pathTraceSettings;
+    pathTraceSettings.m_sampler = ESampler::BlueNoise;
+    pathTraceSettings.m_lightPicker = ELightPicker::None;
+
+    // path traces frames until done(frames, seconds, paths) says to stop, or maxFrames
+    auto Render = [&] (unsigned int seed, float adaptiveError, size_t maxFrames, const std::function<bool (size_t frames, float seconds, double paths)>& done)
+    {
+        std::vector<uint2> tiles;
+        float seconds = 0.0f;
+        double paths = 0.0;
+        for (size_t frame = 0; frame < maxFrames; ++frame)
+        {
+            ShaderData::ConstantBuffers::ConstantsPerFrame.Write(
+                nullptr,
+                [=] (ShaderTypes::ConstantBuffers::ConstantsPerFrame& data)
+                {
+                    data.rngSeed_yzw = { seed, 0, 0, 0 };
+                    data.sampleCount_samplesPerFrame_zw = { (unsigned int)frame + 1, 1, 0, 0 };
+                    data.adaptiveError_adaptiveMinSamples_zw = { adaptiveError, adaptiveError > 0.0f ? float(c_adaptiveMinSamples) : float(maxFrames), 0.0f, 0.0f };
+                }
+            );
+
+            STimer timer;
+            PathTraceAdaptiveTiles(dispatcher, c_adaptiveTileSize, tiles);
+            if (tiles.empty())
+                return;
+            PathTraceDispatchTiles(dispatcher, c_adaptiveTileSize, tiles,
+                [&] (const SComputeThreadIDs& ids)
+                {
+                    PathTraceKernel(ids, camera, pathTraceSettings);
+                }
+            );
+            seconds += timer.Seconds();
+
+            for (const uint2& tile : tiles)
+                paths += double(PathTraceTilePixels(tile, c_adaptiveTileSize));
+            if (done(frame + 1, seconds, paths))
+                return;
+        }
+    };
+
+    std::vector<float4> reference(c_adaptiveWidth * c_adaptiveHeight);
+    auto RMSE = [&reference] ()
+    {
+        return DisplayRMSE(reference, c_adaptiveWidth, c_adaptiveHeight);
+    };
+
+    // the reference uses a different seed so its noise isn't correlated with the renders it's compared against
+    Render(1, 0.0f, c_adaptiveReferenceSamples, [] (size_t, float, double) { return false; });
+    for (size_t y = 0; y < c_adaptiveHeight; ++y)
+    {
+        for (size_t x = 0; x < c_adaptiveWidth; ++x)
+            reference[y * c_adaptiveWidth + x] = ShaderData::Textures::pathTraceOutput.Texel(x, y);
+    }
+
+    float targetRMSE = 0.0f;
+    float uniformSeconds = 0.0f;
+    double uniformPaths = 0.0;
+    Render(0, 0.0f, c_adaptiveTargetSamples,
+        [&] (size_t, float seconds, double paths)
+        {
+            targetRMSE = RMSE();
+            uniformSeconds = seconds;
+            uniformPaths = paths;
+            return false;
+        }
+    );
+
+    size_t adaptiveFrames = 0;
+    float adaptiveSeconds = 0.0f;
+    float adaptiveRMSE = 0.0f;
+    double adaptivePaths = 0.0;
+    Render(0, c_adaptiveError, c_adaptiveMaxFrames,
+        [&] (size_t frames, float seconds, double paths)
+        {
+            adaptiveFrames = frames;
+            adaptiveSeconds = seconds;
+            adaptivePaths = paths;
+            adaptiveRMSE = RMSE();
+            return adaptiveRMSE <= targetRMSE;
+        }
+    );
+
+    double pixels = double(c_adaptiveWidth * c_adaptiveHeight);
+    printf("%-26s RMSE %0.4f  uniform %7.1f ms %5.1f spp   adaptive %7.1f ms %5.1f spp over %4zu frames  (%0.2fx)%s\n",
+        sceneName, targetRMSE, uniformSeconds * 1000.0f, uniformPaths / pixels, adaptiveSeconds * 1000.0f, adaptivePaths / pixels,
+        adaptiveFrames, uniformSeconds / adaptiveSeconds, adaptiveRMSE <= targetRMSE ? "" : "  did not reach the target RMSE");
+}
+
+//======================================================================================
+// Path throughput and efficiency of russian roulette and different bounce counts, against the fixed 3 bounce loop the
+// path tracer used to have. Variance is of the luminance of one path, from the per pixel moments the kernel keeps,
+// averaged over the pixels. Efficiency is 1 / (variance * time per path), so twice the efficiency reaches the same noise
+// in half the time. Roulette at the same bounce count has the same expected value, so the mean luminance should match;
+// more bounces add light. White noise, since blue noise makes the samples of a pixel correlated.
+void BenchmarkRussianRoulette (EScene scene, const char* sceneName)
+{
+    if (!FillSceneData(scene, nullptr))
+    {
+        printf("%-26s failed to fill scene data\n", sceneName);
+        return;
+    }
+
+    CComputeDispatcherCPU dispatcher;
+    ShaderData::Textures::pathTraceOutput.Create(c_sceneRayWidth, c_sceneRayHeight, 1);
+    ShaderData::Textures::pathTraceMoments.Create(c_sceneRayWidth, c_sceneRayHeight, 1);
+    SCamera camera = MakeCamera();
+    size_t dispatchX, dispatchY;
+    PathTraceDispatchSize(dispatchX, dispatchY);
+    dispatcher.Dispatch<c_pathTraceNumThreadsX, c_pathTraceNumThreadsY, 1>(dispatchX, dispatchY, 1,
+        [&] (const SComputeThreadIDs& ids)
+        {
+            PathTraceFirstHitKernel(ids, camera);
+        }
+    );
+
+    struct SSetting
+    {
+        const char* m_name;
+        unsigned int m_maxBounces;
+        unsigned int m_rouletteStartBounce;     // past m_maxBounces for no roulette
+        bool m_runtimeLoop;                     // use the c_runtimeBounces kernel instead of the one for the bounce count
+    };
+    static const SSetting c_settings[] =
+    {
+        { "3 bounces", 3, 4, false },
+        { "3 bounces, runtime loop", 3, 4, true },
+        { "3 bounces, roulette from 1", 3, 1, false },
+        { "3 bounces, roulette from 2", 3, 2, false },
+        { "8 bounces", 8, 9, false },
+        { "8 bounces, roulette from 1", 8, 1, false },
+        { "16 bounces, roulette from 1", 16, 1, false },
+    };
+
+    SPathTraceSettings pathTraceSettings;
+    pathTraceSettings.m_lightPicker = ELightPicker::None;
+    double pixels = double(c_sceneRayWidth * c_sceneRayHeight);
+    float referenceEfficiency = 0.0f;
+    for (const SSetting& setting : c_settings)
+    {
+        STimer timer;
+        for (size_t frame = 0; frame < c_rouletteFrames; ++frame)
+        {
+            ShaderData::ConstantBuffers::ConstantsPerFrame.Write(
+                nullptr,
+                [&] (ShaderTypes::ConstantBuffers::ConstantsPerFrame& data)
+                {
+                    data.rngSeed_yzw = { 0, 0, 0, 0 };
+                    data.sampleCount_samplesPerFrame_zw = { (unsigned int)frame + 1, 1, 0, 0 };
+                    data.maxBounces_rouletteStartBounce_zw = { setting.m_maxBounces, setting.m_rouletteStartBounce, 0, 0 };
+                }
+            );
+            dispatcher.Dispatch<c_pathTraceNumThreadsX, c_pathTraceNumThreadsY, 1>(dispatchX, dispatchY, 1,
+                [&] (const SComputeThreadIDs& ids)
+                {
+                    if (setting.m_runtimeLoop)
+                        PathTraceKernel<c_runtimeBounces>(ids, camera, pathTraceSettings);
+                    else
+                        PathTraceKernel(ids, camera, pathTraceSettings);
+                }
+            );
+        }
+        float seconds = timer.Seconds();
+
+        double meanLuminance = 0.0;
+        double variance = 0.0;
+        for (size_t y = 0; y < c_sceneRayHeight; ++y)
+        {
+            for (size_t x = 0; x < c_sceneRayWidth; ++x)
+            {
+                const float4& texel = ShaderData::Textures::pathTraceOutput.Texel(x, y);
+                const float4& moments = ShaderData::Textures::pathTraceMoments.Texel(x, y);
+                float luminance = Luminance({ texel[0], texel[1], texel[2] });
+                meanLuminance += luminance;
+                variance += (std::max)(moments[0] - luminance * luminance, 0.0f) * float(c_rouletteFrames) / float(c_rouletteFrames - 1);
+            }
+        }
+        meanLuminance /= pixels;
+        variance /= pixels;
+
+        double paths = pixels * double(c_rouletteFrames);
+        float efficiency = float(paths / (variance * double(seconds)));
+        if (referenceEfficiency == 0.0f)
+            referenceEfficiency = efficiency;
+
+        printf("%-26s %-28s %8.1f ms %6.2f Mpaths/s  mean %0.4f  variance %8.4f  efficiency %5.2fx\n",
+            sceneName, setting.m_name, seconds * 1000.0f, paths / double(seconds) / 1000000.0, meanLuminance, variance, efficiency / referenceEfficiency);
+    }
+}
+
+//======================================================================================
+// a torus with bumps on it, so the triangles vary in size and orientation
+void MakeSyntheticMesh (TTriangleList& triangles)
+{
+    auto Position = [] (size_t ring, size_t segment)
+    {
+        float u = 2.0f * c_pi * float(ring % c_syntheticMeshRings) / float(c_syntheticMeshRings);
+        float v = 2.0f * c_pi * float(segment % c_syntheticMeshSegments) / float(c_syntheticMeshSegments);
+        float minorRadius = 0.3f * (1.0f + 0.25f * std::sin(7.0f * u) * std::sin(11.0f * v));
+        float majorRadius = 1.0f + minorRadius * std::cos(u);
+        float3 ret = { majorRadius * std::cos(v), minorRadius * std::sin(u), majorRadius * std::sin(v) };
+        return ret;
+    };
+
+    triangles.resize(c_syntheticMeshRings * c_syntheticMeshSegments * 2);
+    size_t triangleIndex = 0;
+    for (size_t ring = 0; ring < c_syntheticMeshRings; ++ring)
+    {
+        for (size_t segment = 0; segment < c_syntheticMeshSegments; ++segment)
+        {
+            float3 a = Position(ring, segment);
+            float3 b = Position(ring + 1, segment);
+            float3 c = Position(ring + 1, segment + 1);
+            float3 d = Position(ring, segment + 1);
+            MakeTriangle(triangles[triangleIndex++], a, b, c, { 1.0f, 1.0f, 1.0f }, { 0.0f, 0.0f, 0.0f });
+            MakeTriangle(triangles[triangleIndex++], a, c, d, { 1.0f, 1.0f, 1.0f }, { 0.0f, 0.0f, 0.0f });
+        }
+    }
+    NormalizeMesh(triangles, 0, triangles.size());
+}
+
+//======================================================================================
+void BenchmarkBuildersSynthetic (const std::vector<SRay>& rays)
+{
+    TTriangleList triangles;
+    MakeSyntheticMesh(triangles);
+
+    std::vector<SBVHPrimitive> primitives(triangles.size());
+    for (size_t i = 0; i < triangles.size(); ++i)
+        MakeBVHPrimitive(primitives[i], triangles[i]);
+
+    ShaderTypes::StructuredBuffers::ModelPrim model;
+    model.worldToObjectX = { 1.0f, 0.0f, 0.0f, 0.0f };
+    model.worldToObjectY = { 0.0f, 1.0f, 0.0f, 0.0f };
+    model.worldToObjectZ = { 0.0f, 0.0f, 1.0f, 0.0f };
+    model.firstTriangle_lastTriangle_rootNode_firstLight = { 0, (unsigned int)triangles.size(), 0, 0 };
+
+    // the SAH build is the reference the others are checked against
+    std::vector<SRayHitInfo> referenceHits;
+    for (size_t builderIndex = 0; builderIndex < (size_t)EBVHBuilder::COUNT; ++builderIndex)
+    {
+        EBVHBuilder builder = (EBVHBuilder)builderIndex;
+        SBVH bvh;
+        STimer buildTimer;
+        BuildBVH(primitives, bvh, builder);
+        float buildSeconds = buildTimer.Seconds();
+
+        // put the triangles in leaf order and the nodes in the shader format
+        TTriangleList sortedTriangles(triangles.size());
+        for (size_t i = 0; i < triangles.size(); ++i)
+            sortedTriangles[i] = triangles[bvh.m_primOrder[i]];
+        TBVHNodeList nodes(bvh.m_nodes.size());
+        size_t nodeCount = 0;
+        WriteBVHNodes(bvh, nodes, nodeCount, 0);
+
+        std::vector<SRayHitInfo> hits;
+        float traceSeconds = TraceRays(rays, hits,
+            [&] (const SRay& ray, SRayHitInfo& hitInfo)
+            {
+                RayIntersectsModel(ray.m_pos, ray.m_dir, model, sortedTriangles, nodes, hitInfo);
+            }
+        );
+
+        if (builder == EBVHBuilder::SAH)
+            referenceHits = hits;
+        size_t mismatchCount = 0;
+        for (size_t i = 0; i < rays.size(); ++i)
+        {
+            if (std::abs(referenceHits[i].m_intersectTime - hits[i].m_intersectTime) > 0.0001f)
+                ++mismatchCount;
+        }
+
+        printf("%-16s %7zu nodes  SAH %6.2f  build %8.2f ms  trace %7.2f Mrays/s  %zu mismatches\n",
+            BVHBuilderName(builder), bvh.m_nodes.size(), BVHSAHCost(bvh), buildSeconds * 1000.0f,
+            float(rays.size()) / traceSeconds / 1000000.0f, mismatchCount);
+    }
+}
+
+//======================================================================================
+// animates the scene at 60 fps, refitting the scene BVH each frame, and checks the refit BVH against the linear loops.
+// The refit is compared to rebuilding all the BVHs every frame, and to re-making the scene from scratch.
+void BenchmarkAnimation (EScene scene, const char* sceneName)
+{
+    if (!FillSceneData(scene, nullptr))
+    {
+        printf("%-26s failed to fill scene data\n", sceneName);
+        return;
+    }
+
+    std::vector<SRay> rays(c_sceneRayWidth * c_sceneRayHeight);
+    for (size_t y = 0; y < c_sceneRayHeight; ++y)
+    {
+        for (size_t x = 0; x < c_sceneRayWidth; ++x)
+        {
+            SRay& ray = rays[y * c_sceneRayWidth + x];
+            CalculateRay((float(x) + 0.5f) / float(c_sceneRayWidth), 1.0f - (float(y) + 0.5f) / float(c_sceneRayHeight), ray.m_pos, ray.m_dir);
+        }
+    }
+
+    float animateSeconds = 0.0f;
+    float traceSeconds = 0.0f;
+    float maxCostRatio = 1.0f;
+    size_t rebuildCount = 0;
+    size_t mismatchCount = 0;
+    for (size_t frame = 0; frame < c_animationFrames; ++frame)
+    {
+        bool rebuilt = false;
+        float costRatio = 1.0f;
+        STimer animateTimer;
+        bool animated = AnimateScene(scene, float(frame) / 60.0f, nullptr, rebuilt, costRatio);
+        animateSeconds += animateTimer.Seconds();
+        if (!animated)
+        {
+            printf("%-26s failed to animate the scene\n", sceneName);
+            return;
+        }
+        maxCostRatio = (std::max)(maxCostRatio, costRatio);
+        if (rebuilt)
+            ++rebuildCount;
+
+        // check every 10th frame
+        if (frame % 10 != 0)
+            continue;
+        std::vector<SRayHitInfo> linearHits, bvhHits;
+        TraceRays(rays, linearHits,
+            [&] (const SRay& ray, SRayHitInfo& hitInfo)
+            {
+                hitInfo = ClosestIntersectionLinear(ray.m_pos, ray.m_dir);
+            }
+        );
+        traceSeconds += TraceRays(rays, bvhHits,
+            [&] (const SRay& ray, SRayHitInfo& hitInfo)
+            {
+                hitInfo = ClosestIntersection(ray.m_pos, ray.m_dir);
+            }
+        );
+        for (size_t i = 0; i < rays.size(); ++i)
+        {
+            if (std::abs(linearHits[i].m_intersectTime - bvhHits[i].m_intersectTime) > 0.0001f)
+                ++mismatchCount;
+        }
+    }
+
+    // the same frames with every BVH rebuilt, and with the scene made from scratch
+    float rebuildSeconds = 0.0f;
+    float rebuildTraceSeconds = 0.0f;
+    for (size_t frame = 0; frame < c_animationFrames; ++frame)
+    {
+        bool rebuilt = false;
+        float costRatio = 1.0f;
+        bool animated = AnimateScene(scene, float(frame) / 60.0f, nullptr, rebuilt, costRatio);
+        STimer rebuildTimer;
+        bool built = BuildSceneBVHs(nullptr, c_bvhBuilder);
+        rebuildSeconds += rebuildTimer.Seconds();
+        if (!animated || !built)
+        {
+            printf("%-26s failed to rebuild the scene BVHs\n", sceneName);
+            return;
+        }
+
+        if (frame % 10 != 0)
+            continue;
+        std::vector<SRayHitInfo> bvhHits;
+        rebuildTraceSeconds += TraceRays(rays, bvhHits,
+            [&] (const SRay& ray, SRayHitInfo& hitInfo)
+            {
+                hitInfo = ClosestIntersection(ray.m_pos, ray.m_dir);
+            }
+        );
+    }
+
+    STimer fillTimer;
+    bool filled = true;
+    for (size_t frame = 0; frame < c_animationFrames / 10; ++frame)
+        filled &= FillSceneData(scene, nullptr);
+    float fillSeconds = fillTimer.Seconds() * 10.0f;
+    if (!filled)
+    {
+        printf("%-26s failed to fill scene data\n", sceneName);
+        return;
+    }
+
+    printf("%-26s %zu frames  animate + refit %7.4f ms/frame (%zu rebuilds, SAH cost up to %4.2fx)  rebuild BVHs %7.4f ms/frame  FillSceneData %7.3f ms/frame  trace refit %6.2f vs rebuilt %6.2f Mrays/s  %zu mismatches\n",
+        sceneName, c_animationFrames, animateSeconds * 1000.0f / float(c_animationFrames), rebuildCount, maxCostRatio,
+        rebuildSeconds * 1000.0f / float(c_animationFrames), fillSeconds * 1000.0f / float(c_animationFrames),
+        float(rays.size() * (c_animationFrames / 10)) / traceSeconds / 1000000.0f, float(rays.size() * (c_animationFrames / 10)) / rebuildTraceSeconds / 1000000.0f,
+        mismatchCount);
+}
+
+//======================================================================================
+// twists the synthetic mesh further and further, refitting its BVH each time, to show how refitting compares to a
+// rebuild on a big tree and how the SAH cost drifts until it passes c_bvhRefitRebuildRatio
+void BenchmarkRefitSynthetic (const std::vector<SRay>& rays)
+{
+    TTriangleList triangles;
+    MakeSyntheticMesh(triangles);
+
+    std::vector<SBVHPrimitive> primitives(triangles.size());
+    for (size_t i = 0; i < triangles.size(); ++i)
+        MakeBVHPrimitive(primitives[i], triangles[i]);
+    SBVH bvh;
+    BuildBVHSAH(primitives, bvh);
+    float builtCost = BVHSAHCost(bvh);
+
+    ShaderTypes::StructuredBuffers::ModelPrim model;
+    model.worldToObjectX = { 1.0f, 0.0f, 0.0f, 0.0f };
+    model.worldToObjectY = { 0.0f, 1.0f, 0.0f, 0.0f };
+    model.worldToObjectZ = { 0.0f, 0.0f, 1.0f, 0.0f };
+    model.firstTriangle_lastTriangle_rootNode_firstLight = { 0, (unsigned int)triangles.size(), 0, 0 };
+
+    TTriangleList twisted(triangles.size());
+    for (size_t step = 1; step <= c_refitSyntheticSteps; ++step)
+    {
+        // rotate each vertex about the y axis by an angle that grows with its height
+        float twist = float(step) * c_pi / float(c_refitSyntheticSteps);
+        auto Twist = [twist] (float4& position)
+        {
+            float angle = position[1] * twist;
+            float x = position[0] * std::cos(angle) - position[2] * std::sin(angle);
+            float z = position[0] * std::sin(angle) + position[2] * std::cos(angle);
+            position[0] = x;
+            position[2] = z;
+        };
+        for (size_t i = 0; i < triangles.size(); ++i)
+        {
+            twisted[i] = triangles[i];
+            Twist(twisted[i].positionA_w);
+            Twist(twisted[i].positionB_w);
+            Twist(twisted[i].positionC_w);
+            MakeBVHPrimitive(primitives[i], twisted[i]);
+        }
+
+        STimer refitTimer;
+        RefitBVH(primitives, bvh);
+        float refitSeconds = refitTimer.Seconds();
+        float refitCost = BVHSAHCost(bvh);
+
+        SBVH rebuiltBVH;
+        STimer rebuildTimer;
+        BuildBVHSAH(primitives, rebuiltBVH);
+        float rebuildSeconds = rebuildTimer.Seconds();
+
+        // trace both, with the triangles in each BVH's leaf order
+        float traceSeconds[2];
+        std::vector<SRayHitInfo> hits[2];
+        const SBVH* bvhs[2] = { &bvh, &rebuiltBVH };
+        for (size_t i = 0; i < 2; ++i)
+        {
+            TTriangleList sortedTriangles(twisted.size());
+            for (size_t j = 0; j < twisted.size(); ++j)
+                sortedTriangles[j] = twisted[bvhs[i]->m_primOrder[j]];
+            TBVHNodeList nodes(bvhs[i]->m_nodes.size());
+            size_t nodeCount = 0;
+            WriteBVHNodes(*bvhs[i], nodes, nodeCount, 0);
+            traceSeconds[i] = TraceRays(rays, hits[i],
+                [&] (const SRay& ray, SRayHitInfo& hitInfo)
+                {
+                    RayIntersectsModel(ray.m_pos, ray.m_dir, model, sortedTriangles, nodes, hitInfo);
+                }
+            );
+        }
+
+        size_t mismatchCount = 0;
+        for (size_t i = 0; i < rays.size(); ++i)
+        {
+            if (std::abs(hits[0][i].m_intersectTime - hits[1][i].m_intersectTime) > 0.0001f)
+                ++mismatchCount;
+        }
+
+        printf("twist %4.0f deg  refit %7.2f ms  SAH cost %6.2f (%4.2fx of built%s)  rebuild %8.2f ms  SAH cost %6.2f  trace refit %6.2f vs rebuilt %6.2f Mrays/s  %zu mismatches\n",
+            twist * 180.0f / c_pi, refitSeconds * 1000.0f, refitCost, refitCost / builtCost, refitCost > builtCost * c_bvhRefitRebuildRatio ? ", would rebuild" : "",
+            rebuildSeconds * 1000.0f, BVHSAHCost(rebuiltBVH), float(rays.size()) / traceSeconds[0] / 1000000.0f, float(rays.size()) / traceSeconds[1] / 1000000.0f,
+            mismatchCount);
+    }
+}
+
+//======================================================================================
+// Path traces c_lightSamplingFrames frames of the scene already filled in, 3 bounces without roulette, and gives the
+// mean luminance, the average per pixel variance of a sample, and the efficiency, which is paths per second per unit
+// of variance. pathGuiding guides the bounces if it's not null.
+void MeasureLightSampling (ELightPicker lightPicker, CPathGuiding* pathGuiding, float& seconds, double& meanLuminance, double& variance, float& efficiency)
+{
+    CComputeDispatcherCPU dispatcher;
+    ShaderData::Textures::pathTraceOutput.Create(c_sceneRayWidth, c_sceneRayHeight, 1);
+    ShaderData::Textures::pathTraceMoments.Create(c_sceneRayWidth, c_sceneRayHeight, 1);
+    SCamera camera = MakeCamera();
+    size_t dispatchX, dispatchY;
+    PathTraceDispatchSize(dispatchX, dispatchY);
+    dispatcher.Dispatch<c_pathTraceNumThreadsX, c_pathTraceNumThreadsY, 1>(dispatchX, dispatchY, 1,
+        [&] (const SComputeThreadIDs& ids)
+        {
+            PathTraceFirstHitKernel(ids, camera);
+        }
+    );
+
+    SPathTraceSettings pathTraceSettings;
+    pathTraceSettings.m_lightPicker = lightPicker;
+    pathTraceSettings.m_pathGuiding = pathGuiding;
+    STimer timer;
+    for (size_t frame = 0; frame < c_lightSamplingFrames; ++frame)
+    {
+        ShaderData::ConstantBuffers::ConstantsPerFrame.Write(
+            nullptr,
+            [&] (ShaderTypes::ConstantBuffers::ConstantsPerFrame& data)
+            {
+                data.rngSeed_yzw = { 0, 0, 0, 0 };
+                data.sampleCount_samplesPerFrame_zw = { (unsigned int)frame + 1, 1, 0, 0 };
+                data.maxBounces_rouletteStartBounce_zw = { 3, 4, 0, 0 };
+            }
+        );
+        dispatcher.Dispatch<c_pathTraceNumThreadsX, c_pathTraceNumThreadsY, 1>(dispatchX, dispatchY, 1,
+            [&] (const SComputeThreadIDs& ids)
+            {
+                PathTraceKernel(ids, camera, pathTraceSettings);
+            }
+        );
+    }
+    seconds = timer.Seconds();
+
+    double pixels = double(c_sceneRayWidth * c_sceneRayHeight);
+    meanLuminance = 0.0;
+    variance = 0.0;
+    for (size_t y = 0; y < c_sceneRayHeight; ++y)
+    {
+        for (size_t x = 0; x < c_sceneRayWidth; ++x)
+        {
+            const float4& texel = ShaderData::Textures::pathTraceOutput.Texel(x, y);
+            const float4& moments = ShaderData::Textures::pathTraceMoments.Texel(x, y);
+            float luminance = Luminance({ texel[0], texel[1], texel[2] });
+            meanLuminance += luminance;
+            variance += (std::max)(moments[0] - luminance * luminance, 0.0f) * float(c_lightSamplingFrames) / float(c_lightSamplingFrames - 1);
+        }
+    }
+    meanLuminance /= pixels;
+    variance /= pixels;
+
+    double paths = pixels * double(c_lightSamplingFrames);
+    efficiency = float(paths / (variance * double(seconds)));
+}
+
+//======================================================================================
+// Convergence of next event estimation against finding lights only by bouncing into them, measured the same way as
+// BenchmarkRussianRoulette(). The speedup is the efficiency ratio, which is how many times less time light sampling takes
+// to get to the same noise. Both have the same expected value, so the mean luminance should match. 3 bounces without
+// roulette so only the light sampling changes.
+void BenchmarkLightSampling (EScene scene, const char* sceneName)
+{
+    if (!FillSceneData(scene, nullptr))
+    {
+        printf("%-26s failed to fill scene data\n", sceneName);
+        return;
+    }
+
+    double paths = double(c_sceneRayWidth * c_sceneRayHeight * c_lightSamplingFrames);
+    float bounceEfficiency = 0.0f;
+    for (bool lightSampling : { false, true })
+    {
+        float seconds, efficiency;
+        double meanLuminance, variance;
+        MeasureLightSampling(lightSampling ? ELightPicker::AliasTable : ELightPicker::None, nullptr, seconds, meanLuminance, variance, efficiency);
+        if (!lightSampling)
+            bounceEfficiency = efficiency;
+
+        printf("%-26s %-14s %8.1f ms %6.2f Mpaths/s  mean %0.4f  variance %8.4f  speedup %6.2fx\n",
+            sceneName, lightSampling ? "light sampling" : "bounces only", seconds * 1000.0f, paths / double(seconds) / 1000000.0, meanLuminance, variance, efficiency / bounceEfficiency);
+    }
+}
+
+//======================================================================================
+// Picking the light for next event estimation by power with the alias table, vs by importance to the shading point
+// with the light tree. Measured like BenchmarkLightSampling(), with the speedup against the alias table.
+void BenchmarkLightSelection (EScene scene, const char* sceneName)
+{
+    if (!FillSceneData(scene, nullptr))
+    {
+        printf("%-26s failed to fill scene data\n", sceneName);
+        return;
+    }
+
+    unsigned int numLights = ShaderData::ConstantBuffers::ConstantsOnce.Read().numModels_sceneRootNode_numScenePrims_numLights[3];
+    double paths = double(c_sceneRayWidth * c_sceneRayHeight * c_lightSamplingFrames);
+    float aliasEfficiency = 0.0f;
+    for (bool lightTree : { false, true })
+    {
+        float seconds, efficiency;
+        double meanLuminance, variance;
+        MeasureLightSampling(lightTree ? ELightPicker::LightTree : ELightPicker::AliasTable, nullptr, seconds, meanLuminance, variance, efficiency);
+        if (!lightTree)
+            aliasEfficiency = efficiency;
+
+        printf("%-26s %5u lights  %-11s %8.1f ms %6.2f Mpaths/s  mean %0.4f  variance %8.4f  speedup %6.2fx\n",
+            sceneName, numLights, lightTree ? "light tree" : "alias table", seconds * 1000.0f, paths / double(seconds) / 1000000.0, meanLuminance, variance, efficiency / aliasEfficiency);
+    }
+}
+
+//======================================================================================
+// Renders frames of the scene already filled in the same way as MeasureLightSampling() until path guiding has done
+// all of its training iterations, and gives how long it took.
+float TrainPathGuiding (CPathGuiding& pathGuiding)
+{
+    CComputeDispatcherCPU dispatcher;
+    ShaderData::Textures::pathTraceOutput.Create(c_sceneRayWidth, c_sceneRayHeight, 1);
+    ShaderData::Textures::pathTraceMoments.Create(c_sceneRayWidth, c_sceneRayHeight, 1);
+    SCamera camera = MakeCamera();
+    size_t dispatchX, dispatchY;
+    PathTraceDispatchSize(dispatchX, dispatchY);
+
+    SPathTraceSettings pathTraceSettings;
+    pathTraceSettings.m_pathGuiding = &pathGuiding;
+    STimer timer;
+    dispatcher.Dispatch<c_pathTraceNumThreadsX, c_pathTraceNumThreadsY, 1>(dispatchX, dispatchY, 1,
+        [&] (const SComputeThreadIDs& ids)
+        {
+            PathTraceFirstHitKernel(ids, camera);
+        }
+    );
+    for (size_t frame = 0; pathGuiding.Training(); ++frame)
+    {
+        ShaderData::ConstantBuffers::ConstantsPerFrame.Write(
+            nullptr,
+            [&] (ShaderTypes::ConstantBuffers::ConstantsPerFrame& data)
+            {
+                data.rngSeed_yzw = { 1, 0, 0, 0 };
+                data.sampleCount_samplesPerFrame_zw = { (unsigned int)frame + 1, 1, 0, 0 };
+                data.maxBounces_rouletteStartBounce_zw = { 3, 4, 0, 0 };
+            }
+        );
+        dispatcher.Dispatch<c_pathTraceNumThreadsX, c_pathTraceNumThreadsY, 1>(dispatchX, dispatchY, 1,
+            [&] (const SComputeThreadIDs& ids)
+            {
+                PathTraceKernel(ids, camera, pathTraceSettings);
+            }
+        );
+        pathGuiding.FrameDone();
+    }
+    return timer.Seconds();
+}
+
+//======================================================================================
+// Path guiding against cosine weighted bounces, both with next event estimation, measured like BenchmarkLightSampling().
+// The guide is trained on frames of its own first, with a different seed, and then stays the same while the
+// measured frames render, so the speedup is what guiding gives once it has learned. The training time is shown on its
+// own. Both have the same expected value, so the mean luminance should match.
+void BenchmarkPathGuiding (EScene scene, const char* sceneName)
+{
+    if (!FillSceneData(scene, nullptr))
+    {
+        printf("%-26s failed to fill scene data\n", sceneName);
+        return;
+    }
+
+    double paths = double(c_sceneRayWidth * c_sceneRayHeight * c_lightSamplingFrames);
+    float cosineEfficiency = 0.0f;
+    for (bool guided : { false, true })
+    {
+        CPathGuiding pathGuiding;
+        float trainingSeconds = 0.0f;
+        if (guided)
+        {
+            PathTraceResetGuiding(pathGuiding);
+            trainingSeconds = TrainPathGuiding(pathGuiding);
+        }
+
+        float seconds, efficiency;
+        double meanLuminance, variance;
+        MeasureLightSampling(ELightPicker::AliasTable, guided ? &pathGuiding : nullptr, seconds, meanLuminance, variance, efficiency);
+        if (!guided)
+            cosineEfficiency = efficiency;
+
+        printf("%-26s %-14s %8.1f ms %6.2f Mpaths/s  mean %0.4f  variance %8.4f  speedup %6.2fx",
+            sceneName, guided ? "guided" : "cosine", seconds * 1000.0f, paths / double(seconds) / 1000000.0, meanLuminance, variance, efficiency / cosineEfficiency);
+        if (guided)
+            printf("  (trained in %0.1f ms, %zu leaves)", trainingSeconds * 1000.0f, pathGuiding.NumLeaves());
+        printf("\n");
+    }
+}
+
+//======================================================================================
+// Noise of single frames with reservoir resampling lighting the first hits, against light sampling. 1 bounce without
+// roulette, so the light from the lights is what the first hit gets from light sampling or its reservoir, and what
+// the bounce finds. Each frame is measured on its own, like the app shows it at 1 sample per frame, as the DisplayRMSE()
+// against a light sampling reference averaged over the frames after c_restirWarmupFrames. The mean luminance is of
+// those frames, which shows the bias of biased reuse. Only the dispatches are timed. The speedup is at equal time:
+// light sampling's squared RMSE times its frame time over the method's, since light sampling would need that many times
+// more samples per frame to get to the method's noise.
+void BenchmarkRestir (EScene scene, const char* sceneName)
+{
+    if (!FillSceneData(scene, nullptr))
+    {
+        printf("%-26s failed to fill scene data\n", sceneName);
+        return;
+    }
+
+    CComputeDispatcherCPU dispatcher;
+    ShaderData::Textures::pathTraceOutput.Create(c_sceneRayWidth, c_sceneRayHeight, 1);
+    ShaderData::Textures::pathTraceMoments.Create(c_sceneRayWidth, c_sceneRayHeight, 1);
+    SCamera camera = MakeCamera();
+    size_t dispatchX, dispatchY;
+    PathTraceDispatchSize(dispatchX, dispatchY);
+    dispatcher.Dispatch<c_pathTraceNumThreadsX, c_pathTraceNumThreadsY, 1>(dispatchX, dispatchY, 1,
+        [&] (const SComputeThreadIDs& ids)
+        {
+            PathTraceFirstHitKernel(ids, camera);
+        }
+    );
+
+    // renders a frame, with the reservoirs for it first if restir, and gives how long it took
+    SPixelReservoirs reservoirs;
+    auto RenderFrame = [&] (unsigned int seed, size_t frame, bool restir, bool unbiased)
+    {
+        ShaderData::ConstantBuffers::ConstantsPerFrame.Write(
+            nullptr,
+            [=] (ShaderTypes::ConstantBuffers::ConstantsPerFrame& data)
+            {
+                data.rngSeed_yzw = { seed, 0, 0, 0 };
+                data.sampleCount_samplesPerFrame_zw = { (unsigned int)frame + 1, 1, 0, 0 };
+                data.maxBounces_rouletteStartBounce_zw = { 1, 2, 0, 0 };
+            }
+        );
+
+        SPathTraceSettings pathTraceSettings;
+        pathTraceSettings.m_reservoirs = restir ? &reservoirs : nullptr;
+        STimer timer;
+        if (restir)
+        {
+            dispatcher.Dispatch<c_pathTraceNumThreadsX, c_pathTraceNumThreadsY, 1>(dispatchX, dispatchY, 1,
+                [&] (const SComputeThreadIDs& ids)
+                {
+                    PathTraceReservoirKernel(ids, camera, camera, reservoirs, false, unbiased);
+                }
+            );
+            dispatcher.Dispatch<c_pathTraceNumThreadsX, c_pathTraceNumThreadsY, 1>(dispatchX, dispatchY, 1,
+                [&] (const SComputeThreadIDs& ids)
+                {
+                    PathTraceSpatialReuseKernel(ids, camera, reservoirs, unbiased);
+                }
+            );
+        }
+        dispatcher.Dispatch<c_pathTraceNumThreadsX, c_pathTraceNumThreadsY, 1>(dispatchX, dispatchY, 1,
+            [&] (const SComputeThreadIDs& ids)
+            {
+                PathTraceKernel(ids, camera, pathTraceSettings);
+            }
+        );
+        return timer.Seconds();
+    };
+
+    for (size_t frame = 0; frame < c_restirReferenceFrames; ++frame)
+        RenderFrame(1, frame, false, false);
+    std::vector<float4> reference(c_sceneRayWidth * c_sceneRayHeight);
+    double referenceLuminance = 0.0;
+    for (size_t y = 0; y < c_sceneRayHeight; ++y)
+    {
+        for (size_t x = 0; x < c_sceneRayWidth; ++x)
+        {
+            const float4& texel = ShaderData::Textures::pathTraceOutput.Texel(x, y);
+            reference[y * c_sceneRayWidth + x] = texel;
+            referenceLuminance += Luminance({ texel[0], texel[1], texel[2] });
+        }
+    }
+    referenceLuminance /= double(c_sceneRayWidth * c_sceneRayHeight);
+
+    unsigned int numLights = ShaderData::ConstantBuffers::ConstantsOnce.Read().numModels_sceneRootNode_numScenePrims_numLights[3];
+    const char* methodNames[] = { "light sampling", "ReSTIR biased", "ReSTIR unbiased" };
+    float lightSamplingEfficiency = 0.0f;
+    for (int method = 0; method < 3; ++method)
+    {
+        // each frame starts its own average, so the output is just that frame
+        PathTraceResetReservoirs(reservoirs);
+        float seconds = 0.0f;
+        double meanSquaredError = 0.0;
+        double meanLuminance = 0.0;
+        for (size_t frame = 0; frame < c_restirWarmupFrames + c_restirFrames; ++frame)
+        {
+            ShaderData::Textures::pathTraceMoments.Create(c_sceneRayWidth, c_sceneRayHeight, 1);
+            float frameSeconds = RenderFrame(0, frame, method > 0, method == 2);
+            if (frame < c_restirWarmupFrames)
+                continue;
+
+            seconds += frameSeconds;
+            float rmse = DisplayRMSE(reference, c_sceneRayWidth, c_sceneRayHeight);
+            meanSquaredError += double(rmse) * double(rmse);
+            for (size_t y = 0; y < c_sceneRayHeight; ++y)
+            {
+                for (size_t x = 0; x < c_sceneRayWidth; ++x)
+                {
+                    const float4& texel = ShaderData::Textures::pathTraceOutput.Texel(x, y);
+                    meanLuminance += Luminance({ texel[0], texel[1], texel[2] });
+                }
+            }
+        }
+        meanSquaredError /= double(c_restirFrames);
+        meanLuminance /= double(c_sceneRayWidth * c_sceneRayHeight * c_restirFrames);
+
+        float frameMilliseconds = seconds * 1000.0f / float(c_restirFrames);
+        float efficiency = float(1.0 / (meanSquaredError * double(frameMilliseconds)));
+        if (method == 0)
+            lightSamplingEfficiency = efficiency;
+
+        printf("%-26s %4u lights  %-15s %7.2f ms/frame  RMSE %0.4f  mean %0.4f (reference %0.4f)  speedup %5.2fx\n",
+            sceneName, numLights, methodNames[method], frameMilliseconds, std::sqrt(meanSquaredError), meanLuminance, referenceLuminance, efficiency / lightSamplingEfficiency);
+    }
+}
+
+//======================================================================================
+// Ending paths into the world space radiance cache, against tracing them out. 8 bounces with roulette from the 3rd, where
+// there's the most path to save. The cache is biased, so the error is the DisplayRMSE() of the accumulated frames
+// against a reference without it, which counts the bias as well as the noise. The cache starts empty and fills up
+// while the frames render, so that's timed too. The speedup is at equal time, like BenchmarkRestir().
+void BenchmarkRadianceCache (EScene scene, const char* sceneName)
+{
+    if (!FillSceneData(scene, nullptr))
+    {
+        printf("%-26s failed to fill scene data\n", sceneName);
+        return;
+    }
+
+    CComputeDispatcherCPU dispatcher;
+    ShaderData::Textures::pathTraceOutput.Create(c_sceneRayWidth, c_sceneRayHeight, 1);
+    SCamera camera = MakeCamera();
+    size_t dispatchX, dispatchY;
+    PathTraceDispatchSize(dispatchX, dispatchY);
+    dispatcher.Dispatch<c_pathTraceNumThreadsX, c_pathTraceNumThreadsY, 1>(dispatchX, dispatchY, 1,
+        [&] (const SComputeThreadIDs& ids)
+        {
+            PathTraceFirstHitKernel(ids, camera);
+        }
+    );
+
+    // renders the frames into a fresh accumulation, and gives how long it took
+    auto Render = [&] (unsigned int seed, size_t numFrames, CRadianceCache* radianceCache)
+    {
+        ShaderData::Textures::pathTraceMoments.Create(c_sceneRayWidth, c_sceneRayHeight, 1);
+        SPathTraceSettings pathTraceSettings;
+        pathTraceSettings.m_radianceCache = radianceCache;
+        STimer timer;
+        for (size_t frame = 0; frame < numFrames; ++frame)
+        {
+            ShaderData::ConstantBuffers::ConstantsPerFrame.Write(
+                nullptr,
+                [=] (ShaderTypes::ConstantBuffers::ConstantsPerFrame& data)
+                {
+                    data.rngSeed_yzw = { seed, 0, 0, 0 };
+                    data.sampleCount_samplesPerFrame_zw = { (unsigned int)frame + 1, 1, 0, 0 };
+                    data.maxBounces_rouletteStartBounce_zw = { 8, 3, 0, 0 };
+                }
+            );
+            dispatcher.Dispatch<c_pathTraceNumThreadsX, c_pathTraceNumThreadsY, 1>(dispatchX, dispatchY, 1,
+                [&] (const SComputeThreadIDs& ids)
+                {
+                    PathTraceKernel(ids, camera, pathTraceSettings);
+                }
+            );
+            if (radianceCache)
+                radianceCache->FrameDone();
+        }
+        return timer.Seconds();
+    };
+
+    Render(1, c_radianceCacheReferenceFrames, nullptr);
+    std::vector<float4> reference(c_sceneRayWidth * c_sceneRayHeight);
+    double referenceLuminance = 0.0;
+    for (size_t y = 0; y < c_sceneRayHeight; ++y)
+    {
+        for (size_t x = 0; x < c_sceneRayWidth; ++x)
+        {
+            const float4& texel = ShaderData::Textures::pathTraceOutput.Texel(x, y);
+            reference[y * c_sceneRayWidth + x] = texel;
+            referenceLuminance += Luminance({ texel[0], texel[1], texel[2] });
+        }
+    }
+    referenceLuminance /= double(c_sceneRayWidth * c_sceneRayHeight);
+
+    CRadianceCache radianceCache;
+    float tracedEfficiency = 0.0f;
+    for (bool cached : { false, true })
+    {
+        PathTraceResetRadianceCache(radianceCache);
+        float seconds = Render(0, c_radianceCacheFrames, cached ? &radianceCache : nullptr);
+        float rmse = DisplayRMSE(reference, c_sceneRayWidth, c_sceneRayHeight);
+        double meanLuminance = 0.0;
+        for (size_t y = 0; y < c_sceneRayHeight; ++y)
+        {
+            for (size_t x = 0; x < c_sceneRayWidth; ++x)
+            {
+                const float4& texel = ShaderData::Textures::pathTraceOutput.Texel(x, y);
+                meanLuminance += Luminance({ texel[0], texel[1], texel[2] });
+            }
+        }
+        meanLuminance /= double(c_sceneRayWidth * c_sceneRayHeight);
+
+        float efficiency = 1.0f / (rmse * rmse * seconds);
+        if (!cached)
+            tracedEfficiency = efficiency;
+
+        printf("%-26s %-6s %8.1f ms  RMSE %0.4f  mean %0.4f (reference %0.4f)  speedup %5.2fx",
+            sceneName, cached ? "cached" : "traced", seconds * 1000.0f, rmse, meanLuminance, referenceLuminance, efficiency / tracedEfficiency);
+        if (cached)
+        {
+            SRadianceCacheStats stats = radianceCache.Stats();
+            printf("  (%0.1f%% of lookups hit, %zu entries, %llu evictions)", stats.m_lookups ? 100.0 * double(stats.m_hits) / double(stats.m_lookups) : 0.0,
+                stats.m_entries, (unsigned long long)stats.m_evictions);
+        }
+        printf("\n");
+    }
+}
+
+//======================================================================================
+// The camera moving after the lightmap has accumulated c_lightmapWarmupFrames, so the charts seen are done, against the
+// path tracer, which has to start over from nothing at the new view. The camera moves sideways by 15% of its distance to what it's looking at,
+// which brings surfaces the lightmap hasn't seen yet into view. The error is the DisplayRMSE() against a path traced
+// reference from the new view, which counts the lightmap's bias as well as its noise, at each of c_lightmapMovedFrames
+// after the move. The time is per frame after the move, with the first hits when it moves left out for both.
+void BenchmarkLightmap (EScene scene, const char* sceneName)
+{
+    if (!FillSceneData(scene, nullptr))
+    {
+        printf("%-26s failed to fill scene data\n", sceneName);
+        return;
+    }
+
+    CComputeDispatcherCPU dispatcher;
+    ShaderData::Textures::pathTraceOutput.Create(c_sceneRayWidth, c_sceneRayHeight, 1);
+    ShaderData::Textures::pathTraceMoments.Create(c_sceneRayWidth, c_sceneRayHeight, 1);
+    SCamera camera = MakeCamera();
+    SCamera movedCamera = camera;
+    const ShaderTypes::ConstantBuffers::ConstantsOnce& constants = ShaderData::ConstantBuffers::ConstantsOnce.Read();
+    movedCamera.m_pos = movedCamera.m_pos + movedCamera.m_right * (Length(XYZ(constants.cameraAt_FOVY) - XYZ(constants.cameraPos_FOVX)) * 0.15f);
+    size_t dispatchX, dispatchY;
+    PathTraceDispatchSize(dispatchX, dispatchY);
+
+    auto FirstHits = [&] (const SCamera& view, CLightmap* lightmap)
+    {
+        dispatcher.Dispatch<c_pathTraceNumThreadsX, c_pathTraceNumThreadsY, 1>(dispatchX, dispatchY, 1,
+            [&] (const SComputeThreadIDs& ids)
+            {
+                if (lightmap)
+                    PathTraceLightmapFirstHitKernel(ids, view, *lightmap);
+                else
+                    PathTraceFirstHitKernel(ids, view);
+            }
+        );
+    };
+
+    // renders a frame, numbered from the last time the accumulation started over, and gives how long it took
+    SPathTraceSettings pathTraceSettings;
+    std::vector<uint2> blocks;
+    auto RenderFrame = [&] (const SCamera& view, unsigned int seed, size_t frame, CLightmap* lightmap)
+    {
+        ShaderData::ConstantBuffers::ConstantsPerFrame.Write(
+            nullptr,
+            [=] (ShaderTypes::ConstantBuffers::ConstantsPerFrame& data)
+            {
+                data.rngSeed_yzw = { seed, 0, 0, 0 };
+                data.sampleCount_samplesPerFrame_zw = { (unsigned int)frame + 1, 1, 0, 0 };
+                data.maxBounces_rouletteStartBounce_zw = { c_maxBounces, c_rouletteStartBounce, 0, 0 };
+            }
+        );
+
+        STimer timer;
+        if (!lightmap)
+        {
+            dispatcher.Dispatch<c_pathTraceNumThreadsX, c_pathTraceNumThreadsY, 1>(dispatchX, dispatchY, 1,
+                [&] (const SComputeThreadIDs& ids)
+                {
+                    PathTraceKernel(ids, view, pathTraceSettings);
+                }
+            );
+            return timer.Seconds();
+        }
+
+        lightmap->SeenBlocks(blocks);
+        dispatcher.Dispatch<c_lightmapBlockSize, 1, 1>(blocks.size(), 1, 1,
+            [&] (const SComputeThreadIDs& ids)
+            {
+                PathTraceLightmapKernel(ids, *lightmap, blocks, pathTraceSettings);
+            }
+        );
+        dispatcher.Dispatch<c_pathTraceNumThreadsX, c_pathTraceNumThreadsY, 1>(dispatchX, dispatchY, 1,
+            [&] (const SComputeThreadIDs& ids)
+            {
+                PathTraceLightmapViewKernel(ids, view, *lightmap);
+            }
+        );
+        return timer.Seconds();
+    };
+
+    FirstHits(movedCamera, nullptr);
+    for (size_t frame = 0; frame < c_lightmapReferenceFrames; ++frame)
+        RenderFrame(movedCamera, 1, frame, nullptr);
+    std::vector<float4> reference(c_sceneRayWidth * c_sceneRayHeight);
+    for (size_t y = 0; y < c_sceneRayHeight; ++y)
+    {
+        for (size_t x = 0; x < c_sceneRayWidth; ++x)
+            reference[y * c_sceneRayWidth + x] = ShaderData::Textures::pathTraceOutput.Texel(x, y);
+    }
+
+    CLightmap lightmap;
+    for (bool useLightmap : { false, true })
+    {
+        // the path tracer's accumulation before the move is thrown away, so only the lightmap needs it
+        CLightmap* lightmapUsed = useLightmap ? &lightmap : nullptr;
+        if (useLightmap)
+        {
+            lightmap.Build(c_lightmapDefaultTexels, c_sceneRayWidth * c_sceneRayHeight);
+            FirstHits(camera, lightmapUsed);
+            for (size_t frame = 0; frame < c_lightmapWarmupFrames; ++frame)
+                RenderFrame(camera, 0, frame, lightmapUsed);
+        }
+        FirstHits(movedCamera, lightmapUsed);
+
+        printf("%-26s %-8s", sceneName, useLightmap ? "lightmap" : "traced");
+        float seconds = 0.0f;
+        size_t frame = 0;
+        for (size_t movedFrames : c_lightmapMovedFrames)
+        {
+            for (; frame < movedFrames; ++frame)
+                seconds += RenderFrame(movedCamera, 0, frame, lightmapUsed);
+            printf("  RMSE after %2zu %0.4f", movedFrames, DisplayRMSE(reference, c_sceneRayWidth, c_sceneRayHeight));
+        }
+        printf("  %7.2f ms/frame", seconds * 1000.0f / float(frame));
+        if (useLightmap)
+        {
+            printf("  (%zu of %zu charts seen, %zu of %zu texels still being traced)", lightmap.NumSeenCharts(), lightmap.NumCharts(),
+                lightmap.SeenBlocks(blocks), lightmap.NumTexels());
+        }
+        printf("\n");
+    }
+}
+
+//======================================================================================
+// the chance of walking the light tree from the root down to the leaf, like LightTreeProbability() in PathTraceCPU.h
+float SyntheticLightTreeProbability (const SLightTree& tree, const float3& pos, const float3& normal, uint32_t light)
+{
+    float probability = 1.0f;
+    uint32_t nodeIndex = tree.m_lightLeaves[light];
+    while (nodeIndex != 0)
+    {
+        uint32_t parent = tree.m_nodes[nodeIndex].m_parent;
+        const SLightTreeNode& left = tree.m_nodes[parent + 1];
+        const SLightTreeNode& right = tree.m_nodes[tree.m_nodes[parent].m_rightChild];
+        float leftImportance = LightBoundsImportance(pos, normal, left.m_bounds.m_min, left.m_bounds.m_max, left.m_bounds.m_axis, left.m_bounds.m_cosTheta, left.m_bounds.m_power);
+        float rightImportance = LightBoundsImportance(pos, normal, right.m_bounds.m_min, right.m_bounds.m_max, right.m_bounds.m_axis, right.m_bounds.m_cosTheta, right.m_bounds.m_power);
+        if (leftImportance + rightImportance <= 0.0f)
+            return 0.0f;
+        probability *= ((nodeIndex == parent + 1) ? leftImportance : rightImportance) / (leftImportance + rightImportance);
+        nodeIndex = parent;
+    }
+    return probability;
+}
+
+//======================================================================================
+// Build times of the alias table and the light tree for many small emitting triangles scattered in a box, far more than
+// the scenes have room for. The tree is built on one thread and then on every core, and the two have to come out the
+// same. The alias table is checked to give each emitter its share of the power, and the tree to give probabilities that
+// sum to 1 at random shading points.
+void BenchmarkLightTreeBuild ()
+{
+    for (size_t numEmitters : c_syntheticEmitterCounts)
+    {
+        std::mt19937 rng(1337);
+        std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+        std::vector<SLightEmitter> emitters(numEmitters);
+        std::vector<float> weights(numEmitters);
+        for (size_t i = 0; i < numEmitters; ++i)
+        {
+            float3 center = { dist(rng) * 10.0f, dist(rng) * 10.0f, dist(rng) * 10.0f };
+            float3 a = center + float3{ dist(rng), dist(rng), dist(rng) } * 0.1f;
+            float3 b = center + float3{ dist(rng), dist(rng), dist(rng) } * 0.1f;
+            float3 c = center + float3{ dist(rng), dist(rng), dist(rng) } * 0.1f;
+            float3 normal = Cross(b - a, c - a);
+            float area = 0.5f * Length(normal);
+            Normalize(normal);
+
+            SLightEmitter& emitter = emitters[i];
+            emitter.m_min = a;
+            emitter.m_max = a;
+            GrowBounds(emitter.m_min, emitter.m_max, b, b);
+            GrowBounds(emitter.m_min, emitter.m_max, c, c);
+            emitter.m_axis = normal;
+            emitter.m_cosTheta = 1.0f;
+            emitter.m_power = area * (dist(rng) + 1.5f);
+            weights[i] = emitter.m_power;
+        }
+
+        std::vector<float> thresholds;
+        std::vector<uint32_t> aliases;
+        STimer aliasTimer;
+        BuildLightAliasTable(weights, thresholds, aliases);
+        float aliasSeconds = aliasTimer.Seconds();
+
+        // each slot gives its threshold to itself and the rest to its alias
+        double weightSum = 0.0;
+        for (float weight : weights)
+            weightSum += weight;
+        std::vector<double> aliasProbabilities(numEmitters, 0.0);
+        for (size_t i = 0; i < numEmitters; ++i)
+        {
+            aliasProbabilities[i] += double(thresholds[i]) / double(numEmitters);
+            aliasProbabilities[aliases[i]] += (1.0 - double(thresholds[i])) / double(numEmitters);
+        }
+        double aliasMaxError = 0.0;
+        for (size_t i = 0; i < numEmitters; ++i)
+            aliasMaxError = (std::max)(aliasMaxError, std::abs(aliasProbabilities[i] / (double(weights[i]) / weightSum) - 1.0));
+
+        SLightTree singleThreadTree;
+        STimer singleThreadTimer;
+        BuildLightTree(emitters, singleThreadTree, 1);
+        float singleThreadSeconds = singleThreadTimer.Seconds();
+
+        SLightTree tree;
+        STimer timer;
+        BuildLightTree(emitters, tree);
+        float seconds = timer.Seconds();
+
+        size_t mismatchCount = 0;
+        for (size_t i = 0; i < tree.m_nodes.size(); ++i)
+        {
+            const SLightTreeNode& a = tree.m_nodes[i];
+            const SLightTreeNode& b = singleThreadTree.m_nodes[i];
+            if (a.m_rightChild != b.m_rightChild || a.m_light != b.m_light || a.m_parent != b.m_parent || a.m_bounds.m_power != b.m_bounds.m_power)
+                ++mismatchCount;
+        }
+
+        float probabilityMaxError = 0.0f;
+        for (size_t point = 0; point < c_lightTreeCheckPoints; ++point)
+        {
+            float3 pos = { dist(rng) * 12.0f, dist(rng) * 12.0f, dist(rng) * 12.0f };
+            float3 normal = { dist(rng), dist(rng), dist(rng) };
+            Normalize(normal);
+            double probabilitySum = 0.0;
+            for (uint32_t light = 0; light < numEmitters; ++light)
+                probabilitySum += SyntheticLightTreeProbability(tree, pos, normal, light);
+            probabilityMaxError = (std::max)(probabilityMaxError, float(std::abs(probabilitySum - 1.0)));
+        }
+
+        printf("%7zu emitters  alias table %7.2f ms (max error %0.1e)  light tree %8.2f ms on 1 thread, %8.2f ms on %u (%4.2fx)  %zu mismatches  probability sum error %0.1e\n",
+            numEmitters, aliasSeconds * 1000.0f, aliasMaxError, singleThreadSeconds * 1000.0f, seconds * 1000.0f, (std::max)(std::thread::hardware_concurrency(), 1u),
+            singleThreadSeconds / seconds, mismatchCount, probabilityMaxError);
+    }
+}
+
+//======================================================================================
+// Estimates the light arriving from the whole environment of the scene, by picking directions uniformly over the sphere
+// and by importance sampling the environment map, and compares both to the exact sum over the texels. The speedup is
+// the variance ratio, which is how many times fewer samples importance sampling needs for the same noise. Also counts
+// the directions where the pdf SampleEnvironment() gives isn't the one EnvironmentPdf() finds again for MIS, which
+// should only be a few that land right on a texel edge and round into the neighbor.
+void BenchmarkEnvironmentSampling (EScene scene, const char* sceneName)
+{
+    if (!FillSceneData(scene, nullptr))
+    {
+        printf("%-26s failed to fill scene data\n", sceneName);
+        return;
+    }
+
+    const uint4& environmentSize = ShaderData::ConstantBuffers::ConstantsOnce.Read().environmentWidth_environmentHeight_zw;
+    if (environmentSize[0] == 0)
+    {
+        printf("%-26s has no environment map\n", sceneName);
+        return;
+    }
+
+    // each texel covers 2 pi / width of the band of latitudes its row is in
+    const ShaderTypes::StructuredBuffers::TEnvironmentTexels& texels = ShaderData::StructuredBuffers::EnvironmentTexels.Read();
+    double exact = 0.0;
+    for (size_t y = 0; y < environmentSize[1]; ++y)
+    {
+        double solidAngle = (std::cos(c_pi * double(y) / double(environmentSize[1])) - std::cos(c_pi * double(y + 1) / double(environmentSize[1]))) * 2.0 * c_pi / double(environmentSize[0]);
+        for (size_t x = 0; x < environmentSize[0]; ++x)
+            exact += Luminance(XYZ(texels[y * environmentSize[0] + x].radiance_conditionalCDF)) * solidAngle;
+    }
+
+    std::mt19937 rng(1337);
+    std::uniform_real_distribution<float> dist(0.0f, 1.0f);
+    double seconds[2];
+    double means[2];
+    double variances[2];
+    size_t pdfMismatchCount = 0;
+    for (int importanceSampled = 0; importanceSampled < 2; ++importanceSampled)
+    {
+        double sum = 0.0;
+        double sumSquared = 0.0;
+        STimer timer;
+        for (size_t i = 0; i < c_environmentSamples; ++i)
+        {
+            float2 rnd = { dist(rng), dist(rng) };
+            float estimate = 0.0f;
+            if (importanceSampled)
+            {
+                float3 radiance;
+                float pdf;
+                float3 dir = SampleEnvironment(rnd, radiance, pdf);
+                if (pdf > 0.0f)
+                {
+                    estimate = Luminance(radiance) / pdf;
+                    if (std::abs(EnvironmentPdf(dir) / pdf - 1.0f) > 0.001f)
+                        ++pdfMismatchCount;
+                }
+            }
+            else
+            {
+                float cosTheta = 1.0f - 2.0f * rnd[0];
+                float sinTheta = std::sqrt((std::max)(1.0f - cosTheta * cosTheta, 0.0f));
+                float phi = 2.0f * c_pi * rnd[1];
+                estimate = Luminance(MissColor({ sinTheta * std::cos(phi), cosTheta, sinTheta * std::sin(phi) })) * 4.0f * c_pi;
+            }
+            sum += estimate;
+            sumSquared += double(estimate) * double(estimate);
+        }
+        seconds[importanceSampled] = timer.Seconds();
+        means[importanceSampled] = sum / double(c_environmentSamples);
+        variances[importanceSampled] = sumSquared / double(c_environmentSamples) - means[importanceSampled] * means[importanceSampled];
+
+        printf("%-26s %-18s %8.1f ms  estimate %10.4f (exact %10.4f)  variance %14.4f  speedup %8.2fx\n",
+            sceneName, importanceSampled ? "importance sampled" : "uniform sphere", seconds[importanceSampled] * 1000.0, means[importanceSampled], exact,
+            variances[importanceSampled], variances[0] / variances[importanceSampled]);
+    }
+    printf("%-26s %zu pdf mismatches\n", sceneName, pdfMismatchCount);
+}
+
+//======================================================================================
+// RMSE against a reference at each power of 2 samples per pixel, for white noise, blue noise and the golden ratio,
+// spatiotemporal blue noise and the golden ratio, and Owen scrambled Sobol. 3 bounces without roulette, with next event
+// estimation, so every random number a path uses comes from the sampler. The reference is Sobol with another seed, so
+// its own error is as low as it can be and it isn't correlated with the Sobol render. The last column is how many times
+// more samples the sampler is worth than white noise at c_samplerMaxSamples, which is the square of the RMSE ratio. The
+// second row of each sampler is the RMSE after a blur, from DisplayFilteredRMSE(), which is where blue noise makes its
+// difference in the early frames.
+void BenchmarkSamplerConvergence (EScene scene, const char* sceneName)
+{
+    if (!FillSceneData(scene, nullptr))
+    {
+        printf("%-26s failed to fill scene data\n", sceneName);
+        return;
+    }
+
+    CComputeDispatcherCPU dispatcher;
+    ShaderData::Textures::pathTraceOutput.Create(c_adaptiveWidth, c_adaptiveHeight, 1);
+    ShaderData::Textures::pathTraceMoments.Create(c_adaptiveWidth, c_adaptiveHeight, 1);
+    SCamera camera = MakeCamera();
+    size_t dispatchX, dispatchY;
+    PathTraceDispatchSize(dispatchX, dispatchY);
+    dispatcher.Dispatch<c_pathTraceNumThreadsX, c_pathTraceNumThreadsY, 1>(dispatchX, dispatchY, 1,
+        [&] (const SComputeThreadIDs& ids)
+        {
+            PathTraceFirstHitKernel(ids, camera);
+        }
+    );
+
+    // path traces the samples, calling frameDone after each
+    auto Render = [&] (unsigned int seed, ESampler sampler, size_t samples, const std::function<void (size_t samples)>& frameDone)
+    {
+        SPathTraceSettings pathTraceSettings;
+        pathTraceSettings.m_sampler = sampler;
+        for (size_t frame = 0; frame < samples; ++frame)
+        {
+            ShaderData::ConstantBuffers::ConstantsPerFrame.Write(
+                nullptr,
+                [=] (ShaderTypes::ConstantBuffers::ConstantsPerFrame& data)
+                {
+                    data.rngSeed_yzw = { seed, 0, 0, 0 };
+                    data.sampleCount_samplesPerFrame_zw = { (unsigned int)frame + 1, 1, 0, 0 };
+                    data.maxBounces_rouletteStartBounce_zw = { 3, 4, 0, 0 };
+                }
+            );
+            dispatcher.Dispatch<c_pathTraceNumThreadsX, c_pathTraceNumThreadsY, 1>(dispatchX, dispatchY, 1,
+                [&] (const SComputeThreadIDs& ids)
+                {
+                    PathTraceKernel(ids, camera, pathTraceSettings);
+                }
+            );
+            frameDone(frame + 1);
+        }
+    };
+
+    Render(1, ESampler::Sobol, c_samplerReferenceSamples, [] (size_t) {});
+    std::vector<float4> reference(c_adaptiveWidth * c_adaptiveHeight);
+    for (size_t y = 0; y < c_adaptiveHeight; ++y)
+    {
+        for (size_t x = 0; x < c_adaptiveWidth; ++x)
+            reference[y * c_adaptiveWidth + x] = ShaderData::Textures::pathTraceOutput.Texel(x, y);
+    }
+
+    const char* samplerNames[] = { "white noise", "blue noise & golden ratio", "spatiotemporal blue noise", "Owen scrambled Sobol" };
+    static_assert(sizeof(samplerNames) / sizeof(samplerNames[0]) == (size_t)ESampler::COUNT, "samplerNames needs a name for each ESampler");
+    float whiteNoiseRMSE = 0.0f;
+    float whiteNoiseFilteredRMSE = 0.0f;
+    for (size_t sampler = 0; sampler < (size_t)ESampler::COUNT; ++sampler)
+    {
+        std::vector<float> rmse, filteredRMSE;
+        Render(0, (ESampler)sampler, c_samplerMaxSamples,
+            [&] (size_t samples)
+            {
+                if (samples & (samples - 1))
+                    return;
+                rmse.push_back(DisplayRMSE(reference, c_adaptiveWidth, c_adaptiveHeight));
+                filteredRMSE.push_back(DisplayFilteredRMSE(reference, c_adaptiveWidth, c_adaptiveHeight));
+            }
+        );
+        if ((ESampler)sampler == ESampler::WhiteNoise)
+        {
+            whiteNoiseRMSE = rmse.back();
+            whiteNoiseFilteredRMSE = filteredRMSE.back();
+        }
+
+        printf("%-26s %-26s", sceneName, samplerNames[sampler]);
+        for (float value : rmse)
+            printf(" %7.4f", value);
+        printf("  %5.2fx\n", (whiteNoiseRMSE / rmse.back()) * (whiteNoiseRMSE / rmse.back()));
+
+        printf("%-26s %-26s", "", "  filtered");
+        for (float value : filteredRMSE)
+            printf(" %7.4f", value);
+        printf("  %5.2fx\n", (whiteNoiseFilteredRMSE / filteredRMSE.back()) * (whiteNoiseFilteredRMSE / filteredRMSE.back()));
+    }
+}
+
+//======================================================================================
+// Checks that the first 2^m Owen scrambled Sobol points of every key are still a (0,m,2)-net, with one point in each
+// of the 2^m boxes of every shape 2^a x 2^(m-a) the unit square can be cut into, for every m up to
+// c_sobolNetLog2Samples. The shuffled index and the scrambling are meant to keep that. Also times making the 2D points,
+// against hashing them as white noise, and gives their means, which should be 0.5.
+void BenchmarkSobolNets ()
+{
+    size_t numSamples = size_t(1) << c_sobolNetLog2Samples;
+    std::vector<uint2> points(numSamples);
+    std::vector<uint8_t> boxes(numSamples);
+    size_t stratifiedCount = 0;
+    for (uint32_t key = 0; key < c_sobolNetKeys; ++key)
+    {
+        uint4 scramble = pcg4d({ key, 0, key >> 4, 1337 });
+        for (size_t i = 0; i < numSamples; ++i)
+        {
+            uint32_t index = NestedUniformScramble(uint32_t(i), scramble[0]);
+            points[i] = { NestedUniformScramble(Sobol(index, 0), scramble[1]), NestedUniformScramble(Sobol(index, 1), scramble[2]) };
+        }
+
+        bool stratified = true;
+        for (size_t log2Samples = 1; log2Samples <= c_sobolNetLog2Samples && stratified; ++log2Samples)
+        {
+            for (size_t xBits = 0; xBits <= log2Samples && stratified; ++xBits)
+            {
+                size_t yBits = log2Samples - xBits;
+                std::fill(boxes.begin(), boxes.begin() + (size_t(1) << log2Samples), 0);
+                for (size_t i = 0; i < (size_t(1) << log2Samples); ++i)
+                {
+                    size_t x = xBits ? points[i][0] >> (32 - xBits) : 0;
+                    size_t y = yBits ? points[i][1] >> (32 - yBits) : 0;
+                    if (boxes[(y << xBits) | x]++)
+                        stratified = false;
+                }
+            }
+        }
+        if (stratified)
+            ++stratifiedCount;
+    }
+
+    double sobolSum = 0.0;
+    STimer sobolTimer;
+    for (uint32_t key = 0; key < c_sobolNetKeys; ++key)
+    {
+        SRNG rng(key, 0, 0, -1.0f, true);
+        for (size_t i = 0; i < numSamples; ++i)
+        {
+            rng.m_sampleIndex = uint32_t(i);
+            rng.m_dimension = 0;
+            sobolSum += RandomFloat2(rng)[0];
+        }
+    }
+    float sobolSeconds = sobolTimer.Seconds();
+
+    double whiteNoiseSum = 0.0;
+    STimer whiteNoiseTimer;
+    for (uint32_t key = 0; key < c_sobolNetKeys; ++key)
+    {
+        SRNG rng(key, 0, 0, -1.0f, false);
+        for (size_t i = 0; i < numSamples; ++i)
+        {
+            rng.m_sampleIndex = uint32_t(i);
+            rng.m_dimension = 0;
+            whiteNoiseSum += RandomFloat2(rng)[0];
+        }
+    }
+    float whiteNoiseSeconds = whiteNoiseTimer.Seconds();
+
+    double points2D = double(c_sobolNetKeys * numSamples);
+    printf("%zu of %zu keys stratified up to %zu points.  2D points: Sobol %5.1f ns mean %0.4f, white noise %5.1f ns mean %0.4f\n",
+        stratifiedCount, c_sobolNetKeys, numSamples, sobolSeconds / points2D * 1e9, sobolSum / points2D, whiteNoiseSeconds / points2D * 1e9, whiteNoiseSum / points2D);
+}
+
+//======================================================================================
+int main (int argc, char** argv)
+{
+    // the same camera settings as the app. The scenes set the camera position, but not the field of view.
+    ShaderData::ConstantBuffers::ConstantsOnce.Write(
+        nullptr,
+        [] (ShaderTypes::ConstantBuffers::ConstantsOnce& data)
+        {
+            data.width_height_zw = { float(c_width), float(c_height), 0.0f, 0.0f };
+            data.cameraPos_FOVX = { 0.0f, 0.0f, 0.0f, c_fovX };
+            data.cameraAt_FOVY = { 0.0f, 0.0f, 0.0f, c_fovY };
+            data.uvmultiplier_blackPoint_whitePoint_triplanarPow = { 0.25f, 0.0f, 1.0f, 4.0f };
+            data.overlayOpacity_yzw = { 1.0f, 0.0f, 0.0f, 0.0f };
+        }
+    );
+    ShaderData::ConstantBuffers::ConstantsPerFrame.Write(
+        nullptr,
+        [] (ShaderTypes::ConstantBuffers::ConstantsPerFrame& data)
+        {
+            data.maxBounces_rouletteStartBounce_zw = { c_maxBounces, c_rouletteStartBounce, 0, 0 };
+        }
+    );
+
+    std::vector<SRay> rays;
+    MakeRays(rays);
+
+    printf("Tracing %zu rays per model, linear triangle loop vs SAH BVH\n\n", rays.size());
+    BenchmarkModel("../Art/Models/cornell_box.obj", rays);
+    BenchmarkModel("../Art/Models/barel0-0.obj", rays);
+    BenchmarkModel("../Art/Models/barel0-1.obj", rays);
+    BenchmarkModel("../Art/Models/barel0-2.obj", rays);
+    BenchmarkModel("../Art/Models/cone0-0.obj", rays);
+    BenchmarkModel("../Art/Models/cone0-1.obj", rays);
+    BenchmarkModel("../Art/Models/bike0-0.obj", rays);
+    BenchmarkModel("../Art/Models/car0-0.obj", rays);
+    BenchmarkModel("../Art/Models/jugga0-0.obj", rays);
+    BenchmarkModel("../Art/Models/tank0-0.obj", rays);
+    BenchmarkModel("../Art/Models/jet0-0.obj", rays);
+    BenchmarkModel("../Art/Models/track0-0.obj", rays);
+    BenchmarkModel("../Art/Models/cat.obj", rays);
+
+    printf("\nSynthetic mesh of %zu triangles, %zu rays, each BVH builder\n\n", c_syntheticMeshRings * c_syntheticMeshSegments * 2, rays.size());
+    BenchmarkBuildersSynthetic(rays);
+
+    printf("\nRefitting the synthetic mesh BVH as it twists, vs rebuilding it, %zu rays\n\n", rays.size());
+    BenchmarkRefitSynthetic(rays);
+
+    printf("\nBinary SAH BVH vs BVH8 with quantized child boxes, %zu rays per model\n\n", rays.size());
+    BenchmarkModelBVH8("../Art/Models/cornell_box.obj", rays);
+    BenchmarkModelBVH8("../Art/Models/barel0-0.obj", rays);
+    BenchmarkModelBVH8("../Art/Models/cone0-0.obj", rays);
+    BenchmarkModelBVH8("../Art/Models/bike0-0.obj", rays);
+    BenchmarkModelBVH8("../Art/Models/car0-0.obj", rays);
+    BenchmarkModelBVH8("../Art/Models/jugga0-0.obj", rays);
+    BenchmarkModelBVH8("../Art/Models/tank0-0.obj", rays);
+    BenchmarkModelBVH8("../Art/Models/jet0-0.obj", rays);
+    BenchmarkModelBVH8("../Art/Models/track0-0.obj", rays);
+    BenchmarkModelBVH8("../Art/Models/cat.obj", rays);
+    {
+        TTriangleList triangles;
+        MakeSyntheticMesh(triangles);
+        BenchmarkBVH8("synthetic", triangles, rays);
+    }
+
+#if defined(__AVX2__)
+    const char* triangleBlockKernel = "AVX2";
+#elif defined(__SSE4_1__)
+    const char* triangleBlockKernel = "SSE4";
+#else
+    const char* triangleBlockKernel = "scalar";
+#endif
+    printf("\nScalar ray triangle test vs %s kernel on 8 triangle blocks, %zu rays per model\n\n", triangleBlockKernel, (std::min)(rays.size(), c_triangleBlockRays));
+    BenchmarkTriangleBlocks("../Art/Models/cornell_box.obj", rays);
+    BenchmarkTriangleBlocks("../Art/Models/barel0-0.obj", rays);
+    BenchmarkTriangleBlocks("../Art/Models/cone0-0.obj", rays);
+    BenchmarkTriangleBlocks("../Art/Models/bike0-0.obj", rays);
+    BenchmarkTriangleBlocks("../Art/Models/car0-0.obj", rays);
+    BenchmarkTriangleBlocks("../Art/Models/jet0-0.obj", rays);
+    BenchmarkTriangleBlocks("../Art/Models/cat.obj", rays);
+
+    printf("\nGraphicsCodex triangle test vs precomputed Woop transform, %zu rays per model for the per test cost, %zu through the SAH BVH\n\n", (std::min)(rays.size(), c_triangleBlockRays), rays.size());
+    BenchmarkWoopTriangles("../Art/Models/cornell_box.obj", rays);
+    BenchmarkWoopTriangles("../Art/Models/barel0-0.obj", rays);
+    BenchmarkWoopTriangles("../Art/Models/barel0-1.obj", rays);
+    BenchmarkWoopTriangles("../Art/Models/barel0-2.obj", rays);
+    BenchmarkWoopTriangles("../Art/Models/cone0-0.obj", rays);
+    BenchmarkWoopTriangles("../Art/Models/cone0-1.obj", rays);
+    BenchmarkWoopTriangles("../Art/Models/bike0-0.obj", rays);
+    BenchmarkWoopTriangles("../Art/Models/car0-0.obj", rays);
+    BenchmarkWoopTriangles("../Art/Models/jugga0-0.obj", rays);
+    BenchmarkWoopTriangles("../Art/Models/tank0-0.obj", rays);
+    BenchmarkWoopTriangles("../Art/Models/jet0-0.obj", rays);
+    BenchmarkWoopTriangles("../Art/Models/track0-0.obj", rays);
+    BenchmarkWoopTriangles("../Art/Models/cat.obj", rays);
+
+    printf("\nSAH BVH vs spatial split BVH at different reference budgets, %zu rays per model\n\n", rays.size());
+    BenchmarkSBVH("../Art/Models/cornell_box.obj", rays);
+    BenchmarkSBVH("../Art/Models/barel0-0.obj", rays);
+    BenchmarkSBVH("../Art/Models/barel0-1.obj", rays);
+    BenchmarkSBVH("../Art/Models/barel0-2.obj", rays);
+    BenchmarkSBVH("../Art/Models/cone0-0.obj", rays);
+    BenchmarkSBVH("../Art/Models/cone0-1.obj", rays);
+    BenchmarkSBVH("../Art/Models/bike0-0.obj", rays);
+    BenchmarkSBVH("../Art/Models/car0-0.obj", rays);
+    BenchmarkSBVH("../Art/Models/jugga0-0.obj", rays);
+    BenchmarkSBVH("../Art/Models/tank0-0.obj", rays);
+    BenchmarkSBVH("../Art/Models/jet0-0.obj", rays);
+    BenchmarkSBVH("../Art/Models/track0-0.obj", rays);
+    BenchmarkSBVH("../Art/Models/cat.obj", rays);
+
+    // the scenes load their models relative to the repo root
+    if (chdir("..") != 0)
+    {
+        printf("Could not change to the repo root directory\n");
+        WaitForEnter();
+        return 1;
+    }
+
+    printf("\nTracing %zux%zu camera rays per scene, linear loops over each primitive type vs scene BVH, then each BVH builder\n\n", c_sceneRayWidth, c_sceneRayHeight);
+    BenchmarkScene(EScene::SphereOnPlane_LowLight, "SphereOnPlane_LowLight");
+    BenchmarkScene(EScene::SphereOnPlane_RegularLight, "SphereOnPlane_RegularLight");
+    BenchmarkScene(EScene::CornellBox_SmallLight, "CornellBox_SmallLight");
+    BenchmarkScene(EScene::CornellBox_BigLight, "CornellBox_BigLight");
+    BenchmarkScene(EScene::FurnaceTest, "FurnaceTest");
+    BenchmarkScene(EScene::CornellObj, "CornellObj");
+    BenchmarkScene(EScene::ObjTest, "ObjTest");
+    BenchmarkScene(EScene::Spheres, "Spheres");
+
+    printf("\nOccludedBetween vs ClosestIntersection from camera ray hits to random points in the scene\n\n");
+    BenchmarkOcclusion(EScene::SphereOnPlane_LowLight, "SphereOnPlane_LowLight");
+    BenchmarkOcclusion(EScene::SphereOnPlane_RegularLight, "SphereOnPlane_RegularLight");
+    BenchmarkOcclusion(EScene::CornellBox_SmallLight, "CornellBox_SmallLight");
+    BenchmarkOcclusion(EScene::CornellBox_BigLight, "CornellBox_BigLight");
+    BenchmarkOcclusion(EScene::FurnaceTest, "FurnaceTest");
+    BenchmarkOcclusion(EScene::CornellObj, "CornellObj");
+    BenchmarkOcclusion(EScene::ObjTest, "ObjTest");
+    BenchmarkOcclusion(EScene::Spheres, "Spheres");
+
+    printf("\nFirst hit pass at %ux%u, one ray per pixel vs %zux%zu ray packets\n\n", c_width, c_height, c_packetTileSize, c_packetTileSize);
+    BenchmarkFirstHit(EScene::SphereOnPlane_LowLight, "SphereOnPlane_LowLight");
+    BenchmarkFirstHit(EScene::SphereOnPlane_RegularLight, "SphereOnPlane_RegularLight");
+    BenchmarkFirstHit(EScene::CornellBox_SmallLight, "CornellBox_SmallLight");
+    BenchmarkFirstHit(EScene::CornellBox_BigLight, "CornellBox_BigLight");
+    BenchmarkFirstHit(EScene::FurnaceTest, "FurnaceTest");
+    BenchmarkFirstHit(EScene::CornellObj, "CornellObj");
+    BenchmarkFirstHit(EScene::ObjTest, "ObjTest");
+    BenchmarkFirstHit(EScene::Spheres, "Spheres");
+
+    printf("\nPath trace kernels at %ux%u on the CPU compute dispatcher, %zu frames, by worker count and tile size\n\n", c_width, c_height, c_dispatchFrames);
+    if (ShaderTypesInitTexturesCPU())
+    {
+        BenchmarkComputeDispatch(EScene::CornellBox_SmallLight, "CornellBox_SmallLight");
+        BenchmarkComputeDispatch(EScene::CornellObj, "CornellObj");
+        BenchmarkComputeDispatch(EScene::ObjTest, "ObjTest");
+
+        printf("\nTime to reach the RMSE of %zu spp uniform sampling with adaptive sampling, at %zux%zu against a %zu spp reference\n\n", c_adaptiveTargetSamples, c_adaptiveWidth, c_adaptiveHeight, c_adaptiveReferenceSamples);
+        BenchmarkAdaptiveSampling(EScene::CornellBox_SmallLight, "CornellBox_SmallLight");
+        BenchmarkAdaptiveSampling(EScene::CornellBox_BigLight, "CornellBox_BigLight");
+        BenchmarkAdaptiveSampling(EScene::CornellObj, "CornellObj");
+
+        printf("\nRussian roulette and bounce counts at %zux%zu, %zu frames, efficiency against the fixed 3 bounce loop\n\n", c_sceneRayWidth, c_sceneRayHeight, c_rouletteFrames);
+        BenchmarkRussianRoulette(EScene::SphereOnPlane_RegularLight, "SphereOnPlane_RegularLight");
+        BenchmarkRussianRoulette(EScene::CornellBox_SmallLight, "CornellBox_SmallLight");
+        BenchmarkRussianRoulette(EScene::CornellBox_BigLight, "CornellBox_BigLight");
+        BenchmarkRussianRoulette(EScene::CornellObj, "CornellObj");
+        BenchmarkRussianRoulette(EScene::Spheres, "Spheres");
+
+        printf("\nNext event estimation with MIS at %zux%zu, %zu frames, efficiency against only bouncing into lights\n\n", c_sceneRayWidth, c_sceneRayHeight, c_lightSamplingFrames);
+        BenchmarkLightSampling(EScene::SphereOnPlane_LowLight, "SphereOnPlane_LowLight");
+        BenchmarkLightSampling(EScene::SphereOnPlane_RegularLight, "SphereOnPlane_RegularLight");
+        BenchmarkLightSampling(EScene::CornellBox_SmallLight, "CornellBox_SmallLight");
+        BenchmarkLightSampling(EScene::CornellBox_BigLight, "CornellBox_BigLight");
+        BenchmarkLightSampling(EScene::CornellObj, "CornellObj");
+        BenchmarkLightSampling(EScene::ObjTest, "ObjTest");
+        BenchmarkLightSampling(EScene::Spheres, "Spheres");
+        BenchmarkLightSampling(EScene::GlowingJets, "GlowingJets");
+        BenchmarkLightSampling(EScene::SunSky, "SunSky");
+
+        printf("\nLight selection for next event estimation at %zux%zu, %zu frames, light tree efficiency against the alias table\n\n", c_sceneRayWidth, c_sceneRayHeight, c_lightSamplingFrames);
+        BenchmarkLightSelection(EScene::SphereOnPlane_RegularLight, "SphereOnPlane_RegularLight");
+        BenchmarkLightSelection(EScene::CornellObj, "CornellObj");
+        BenchmarkLightSelection(EScene::ObjTest, "ObjTest");
+        BenchmarkLightSelection(EScene::Spheres, "Spheres");
+        BenchmarkLightSelection(EScene::GlowingJets, "GlowingJets");
+
+        printf("\nRMSE by samples per pixel at %zux%zu against a %zu spp reference, and how many samples each is worth against white noise\n\n", c_adaptiveWidth, c_adaptiveHeight, c_samplerReferenceSamples);
+        printf("%-26s %-26s", "", "spp");
+        for (size_t samples = 1; samples <= c_samplerMaxSamples; samples *= 2)
+            printf(" %7zu", samples);
+        printf("\n");
+        BenchmarkSamplerConvergence(EScene::CornellBox_SmallLight, "CornellBox_SmallLight");
+        BenchmarkSamplerConvergence(EScene::Spheres, "Spheres");
+        BenchmarkSamplerConvergence(EScene::SunSky, "SunSky");
+
+        printf("\nPath guiding at %zux%zu, %zu frames after %zu training iterations, efficiency against cosine weighted bounces\n\n", c_sceneRayWidth, c_sceneRayHeight, c_lightSamplingFrames, c_pathGuidingTrainingIterations);
+        BenchmarkPathGuiding(EScene::SphereOnPlane_LowLight, "SphereOnPlane_LowLight");
+        BenchmarkPathGuiding(EScene::SphereOnPlane_RegularLight, "SphereOnPlane_RegularLight");
+        BenchmarkPathGuiding(EScene::CornellBox_SmallLight, "CornellBox_SmallLight");
+        BenchmarkPathGuiding(EScene::CornellBox_BigLight, "CornellBox_BigLight");
+        BenchmarkPathGuiding(EScene::FurnaceTest, "FurnaceTest");
+        BenchmarkPathGuiding(EScene::CornellObj, "CornellObj");
+        BenchmarkPathGuiding(EScene::ObjTest, "ObjTest");
+        BenchmarkPathGuiding(EScene::Spheres, "Spheres");
+        BenchmarkPathGuiding(EScene::GlowingJets, "GlowingJets");
+        BenchmarkPathGuiding(EScene::SunSky, "SunSky");
+
+        printf("\nSpatiotemporal reservoir resampling for the first hits at %zux%zu, RMSE of single frames against a %zu spp reference, efficiency against light sampling at equal time\n\n", c_sceneRayWidth, c_sceneRayHeight, c_restirReferenceFrames);
+        BenchmarkRestir(EScene::SphereOnPlane_RegularLight, "SphereOnPlane_RegularLight");
+        BenchmarkRestir(EScene::CornellBox_SmallLight, "CornellBox_SmallLight");
+        BenchmarkRestir(EScene::CornellObj, "CornellObj");
+        BenchmarkRestir(EScene::Spheres, "Spheres");
+        BenchmarkRestir(EScene::GlowingJets, "GlowingJets");
+
+        printf("\nWorld space radiance cache at %zux%zu, %zu frames, RMSE against a %zu spp reference, efficiency against tracing every path out at equal time\n\n", c_sceneRayWidth, c_sceneRayHeight, c_radianceCacheFrames, c_radianceCacheReferenceFrames);
+        BenchmarkRadianceCache(EScene::SphereOnPlane_RegularLight, "SphereOnPlane_RegularLight");
+        BenchmarkRadianceCache(EScene::CornellBox_BigLight, "CornellBox_BigLight");
+        BenchmarkRadianceCache(EScene::CornellObj, "CornellObj");
+        BenchmarkRadianceCache(EScene::Spheres, "Spheres");
+        BenchmarkRadianceCache(EScene::SunSky, "SunSky");
+
+        printf("\nObject space lightmap at %zux%zu after the camera moves, RMSE against a %zu spp reference from the new view, against the path tracer starting over\n\n", c_sceneRayWidth, c_sceneRayHeight, c_lightmapReferenceFrames);
+        BenchmarkLightmap(EScene::CornellBox_BigLight, "CornellBox_BigLight");
+        BenchmarkLightmap(EScene::CornellObj, "CornellObj");
+        BenchmarkLightmap(EScene::Spheres, "Spheres");
+        BenchmarkLightmap(EScene::SunSky, "SunSky");
+    }
+
+    printf("\nAlias table and light tree builds over synthetic emitters\n\n");
+    BenchmarkLightTreeBuild();
+
+    printf("\nEnvironment map light over the whole sphere, %zu directions, variance against uniform directions\n\n", c_environmentSamples);
+    BenchmarkEnvironmentSampling(EScene::SunSky, "SunSky");
+
+    printf("\nOwen scrambled Sobol points\n\n");
+    BenchmarkSobolNets();
+
+    printf("\nAnimated scenes at 60 fps, refitting the scene BVH vs rebuilding\n\n");
+    BenchmarkAnimation(EScene::ObjTest, "ObjTest");
+
+    WaitForEnter();
+
+    return 0;
+}
\ No newline at end of file
@@ -0,0 +1,170 @@
+#include "ComputeDispatchCPU.h"
+#include <algorithm>
+#include <chrono>
+
+static uint64_t PackRun (size_t begin, size_t end)
+{
+    return (uint64_t(begin) << 32) | uint64_t(end);
+}
+
+static void UnpackRun (uint64_t run, size_t& begin, size_t& end)
+{
+    begin = size_t(run >> 32);
+    end = size_t(run & 0xFFFFFFFF);
+}
+
+CComputeDispatcherCPU::CComputeDispatcherCPU (size_t numWorkers)
+{
+    if (numWorkers == 0)
+        numWorkers = (std::max)(std::thread::hardware_concurrency(), 1u);
+
+    m_runs.reset(new SWorkerRun[numWorkers]);
+    for (size_t i = 0; i < numWorkers; ++i)
+        m_runs[i].m_run = 0;
+    m_workerStats.resize(numWorkers);
+    for (size_t i = 1; i < numWorkers; ++i)
+        m_threads.emplace_back(&CComputeDispatcherCPU::WorkerThread, this, i);
+}
+
+CComputeDispatcherCPU::~CComputeDispatcherCPU ()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_quit = true;
+    }
+    m_startDispatch.notify_all();
+    for (std::thread& thread : m_threads)
+        thread.join();
+}
+
+void CComputeDispatcherCPU::ResetStats ()
+{
+    std::fill(m_workerStats.begin(), m_workerStats.end(), SComputeWorkerStats());
+    m_dispatchSeconds = 0.0;
+}
+
+void CComputeDispatcherCPU::RunGroups (size_t x, size_t y, size_t z, const TGroupFunction& groupFunction)
+{
+    if (x == 0 || y == 0 || z == 0)
+        return;
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    // give each worker an even share of the groups, and start the pool on the dispatch
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_groupFunction = &groupFunction;
+        m_dispatchX = x;
+        m_dispatchY = y;
+        size_t numGroups = x * y * z;
+        size_t numWorkers = NumWorkers();
+        for (size_t i = 0; i < numWorkers; ++i)
+            m_runs[i].m_run = PackRun(numGroups * i / numWorkers, numGroups * (i + 1) / numWorkers);
+        m_workersRunning = m_threads.size();
+        ++m_dispatchCount;
+    }
+    m_startDispatch.notify_all();
+
+    // work on it too, then wait for the others to run out of groups
+    RunWorker(0);
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_dispatchDone.wait(lock, [this] () { return m_workersRunning == 0; });
+    m_groupFunction = nullptr;
+    m_dispatchSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+void CComputeDispatcherCPU::RunWorker (size_t workerIndex)
+{
+    // run our own groups, and when they run out steal more, until there's nothing left to steal
+    SComputeWorkerStats& stats = m_workerStats[workerIndex];
+    size_t group;
+    while (TakeGroup(workerIndex, group) || (StealGroups(workerIndex) && TakeGroup(workerIndex, group)))
+    {
+        // groups are numbered x fastest, then y, then z
+        uint3 groupID;
+        groupID[0] = (unsigned int)(group % m_dispatchX);
+        groupID[1] = (unsigned int)((group / m_dispatchX) % m_dispatchY);
+        groupID[2] = (unsigned int)(group / (m_dispatchX * m_dispatchY));
+
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        (*m_groupFunction)(groupID);
+        stats.m_busySeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        ++stats.m_groupsRun;
+    }
+}
+
+bool CComputeDispatcherCPU::TakeGroup (size_t workerIndex, size_t& group)
+{
+    // take from the front of our run. Thieves may be taking from the back at the same time.
+    std::atomic<uint64_t>& run = m_runs[workerIndex].m_run;
+    uint64_t packed = run;
+    size_t begin, end;
+    do
+    {
+        UnpackRun(packed, begin, end);
+        if (begin >= end)
+            return false;
+    }
+    while (!run.compare_exchange_weak(packed, PackRun(begin + 1, end)));
+
+    group = begin;
+    return true;
+}
+
+bool CComputeDispatcherCPU::StealGroups (size_t workerIndex)
+{
+    // Look at the other workers in order starting after this one, so thieves spread out over victims, and take the back
+    // half of the first run that isn't empty. Our own run is empty, so nobody is stealing from it and it's safe to set.
+    // Groups only move between runs, so when every run is empty the dispatch has no groups left that aren't running or
+    // in the middle of being stolen, and those will be run by whoever has them.
+    size_t numWorkers = NumWorkers();
+    for (size_t offset = 1; offset < numWorkers; ++offset)
+    {
+        std::atomic<uint64_t>& victimRun = m_runs[(workerIndex + offset) % numWorkers].m_run;
+        uint64_t packed = victimRun;
+        size_t begin, end;
+        while (true)
+        {
+            UnpackRun(packed, begin, end);
+            if (begin >= end)
+                break;
+
+            size_t count = (end - begin + 1) / 2;
+            if (victimRun.compare_exchange_weak(packed, PackRun(begin, end - count)))
+            {
+                m_runs[workerIndex].m_run = PackRun(end - count, end);
+                SComputeWorkerStats& stats = m_workerStats[workerIndex];
+                ++stats.m_steals;
+                stats.m_groupsStolen += count;
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+void CComputeDispatcherCPU::WorkerThread (size_t workerIndex)
+{
+    size_t dispatchesSeen = 0;
+    while (true)
+    {
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_startDispatch.wait(lock, [&] () { return m_quit || m_dispatchCount != dispatchesSeen; });
+            if (m_quit)
+                return;
+            dispatchesSeen = m_dispatchCount;
+        }
+
+        RunWorker(workerIndex);
+
+        bool lastWorker;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            --m_workersRunning;
+            lastWorker = m_workersRunning == 0;
+        }
+        if (lastWorker)
+            m_dispatchDone.notify_one();
+    }
+}
\ No newline at end of file
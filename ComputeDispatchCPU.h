@@ -0,0 +1,129 @@
+#pragma once
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <stdint.h>
+#include "ShaderTypes.h"
+
+// Runs compute kernels written in C++ the way CComputeShader::Dispatch() runs them on the GPU. A kernel is a functor
+// taking the system values of one thread. The threads of a group run one after another on the worker that takes it, so
+// kernels can't use groupshared memory or barriers.
+// Nothing in PathTrace.fx or PathTraceFirstHit.fx does. Buffers and textures are bound by the kernel reading and
+// writing ShaderData storage directly.
+//
+// Groups are scheduled by work stealing. Each worker starts a dispatch owning a contiguous run of groups, which are
+// screen tiles for the path tracer, and takes them from the front in order. A worker that runs out steals the back half
+// of another worker's remaining run. A run is a begin / end pair packed in one atomic, so taking and stealing are both
+// a compare and swap, with no locks held while groups run. Groups are numbered x fastest, so a run is a band of the
+// screen, and expensive parts of the image get spread over the workers by stealing instead of by a shared counter that
+// every worker hits once per group.
+// the system values of one thread of a dispatch
+struct SComputeThreadIDs
+{
+    uint3 dispatchThreadID;     // SV_DispatchThreadID
+    uint3 groupID;              // SV_GroupID
+    uint3 groupThreadID;        // SV_GroupThreadID
+    unsigned int groupIndex;    // SV_GroupIndex
+};
+
+// what one worker did, summed over dispatches since CComputeDispatcherCPU::ResetStats()
+struct SComputeWorkerStats
+{
+    size_t m_groupsRun = 0;
+    size_t m_steals = 0;            // times it took groups from another worker
+    size_t m_groupsStolen = 0;      // groups it took in those steals
+    double m_busySeconds = 0.0;     // time spent running groups. Divide by DispatchSeconds() for utilization.
+};
+
+class CComputeDispatcherCPU
+{
+public:
+    // numWorkers of 0 is one per core. The thread calling Dispatch() is one of the workers.
+    CComputeDispatcherCPU (size_t numWorkers = 0);
+    ~CComputeDispatcherCPU ();
+
+    CComputeDispatcherCPU (const CComputeDispatcherCPU&) = delete;
+    CComputeDispatcherCPU& operator = (const CComputeDispatcherCPU&) = delete;
+
+    // Runs x * y * z groups of kernel(const SComputeThreadIDs&), like [numthreads(NUMTHREADSX, NUMTHREADSY, NUMTHREADSZ)]
+    // and Dispatch(x, y, z). Returns when all groups are done.
+    template <unsigned int NUMTHREADSX, unsigned int NUMTHREADSY, unsigned int NUMTHREADSZ, typename KERNEL>
+    void Dispatch (size_t x, size_t y, size_t z, KERNEL&& kernel)
+    {
+        Dispatch({ NUMTHREADSX, NUMTHREADSY, NUMTHREADSZ }, x, y, z, kernel);
+    }
+
+    // Same, but with the group size given at runtime. Kernels that only use dispatchThreadID, like the path tracer, can
+    // be run with any tile size this way.
+    template <typename KERNEL>
+    void Dispatch (const uint3& numThreads, size_t x, size_t y, size_t z, KERNEL&& kernel)
+    {
+        RunGroups(x, y, z,
+            [&kernel, &numThreads] (const uint3& groupID)
+            {
+                SComputeThreadIDs ids;
+                ids.groupID = groupID;
+                ids.groupIndex = 0;
+                for (unsigned int threadZ = 0; threadZ < numThreads[2]; ++threadZ)
+                {
+                    for (unsigned int threadY = 0; threadY < numThreads[1]; ++threadY)
+                    {
+                        for (unsigned int threadX = 0; threadX < numThreads[0]; ++threadX)
+                        {
+                            ids.groupThreadID = { threadX, threadY, threadZ };
+                            ids.dispatchThreadID = { groupID[0] * numThreads[0] + threadX, groupID[1] * numThreads[1] + threadY, groupID[2] * numThreads[2] + threadZ };
+                            kernel(ids);
+                            ++ids.groupIndex;
+                        }
+                    }
+                }
+            }
+        );
+    }
+
+    size_t NumWorkers () const { return m_threads.size() + 1; }
+
+    // per worker stats and the wall clock time of the dispatches since the last ResetStats(), worker 0 being the calling thread
+    const std::vector<SComputeWorkerStats>& WorkerStats () const { return m_workerStats; }
+    double DispatchSeconds () const { return m_dispatchSeconds; }
+    void ResetStats ();
+
+private:
+    typedef std::function<void (const uint3& groupID)> TGroupFunction;
+
+    // the groups [begin, end) a worker has left, packed as begin << 32 | end. On its own cache line so workers taking
+    // groups from their own runs don't slow each other down.
+    struct alignas(64) SWorkerRun
+    {
+        std::atomic<uint64_t> m_run;
+    };
+
+    void RunGroups (size_t x, size_t y, size_t z, const TGroupFunction& groupFunction);
+    void RunWorker (size_t workerIndex);
+    void WorkerThread (size_t workerIndex);
+    bool TakeGroup (size_t workerIndex, size_t& group);
+    bool StealGroups (size_t workerIndex);
+
+    std::vector<std::thread> m_threads;
+    std::unique_ptr<SWorkerRun[]> m_runs;
+    std::vector<SComputeWorkerStats> m_workerStats;
+    double m_dispatchSeconds = 0.0;
+
+    // the dispatch being run
+    const TGroupFunction* m_groupFunction = nullptr;
+    size_t m_dispatchX = 0;
+    size_t m_dispatchY = 0;
+
+    // workers wait for m_dispatchCount to change to start a dispatch, and the caller waits for m_workersRunning to get to 0
+    std::mutex m_mutex;
+    std::condition_variable m_startDispatch;
+    std::condition_variable m_dispatchDone;
+    size_t m_dispatchCount = 0;
+    size_t m_workersRunning = 0;
+    bool m_quit = false;
+};
\ No newline at end of file
@@ -1,12 +1,15 @@
 #pragma once
 
+#ifndef CPU_ONLY
 #include <d3d11.h>
+#endif
 #include "Utils.h"
 
 template <typename T>
 class CConstantBuffer
 {
 public:
+#ifndef CPU_ONLY
     bool Create (ID3D11Device* device, const char* debugName)
     {
         // set up the description
@@ -28,13 +31,18 @@ public:
 
         return true;
     }
+#endif
     
     template <typename LAMBDA>
-    bool Write (ID3D11DeviceContext* deviceContext, LAMBDA& lambda)
+    bool Write (ID3D11DeviceContext* deviceContext, LAMBDA&& lambda)
     {
         // let the caller write to the storage. They can accept it as a reference
         lambda(m_storage);
 
+#ifdef CPU_ONLY
+        // CPU only builds just use the storage
+        return true;
+#else
         // prepare to write to the constant buffer
         HRESULT result;
         D3D11_MAPPED_SUBRESOURCE mappedResource;
@@ -52,6 +60,7 @@ public:
         // We are done writing
         deviceContext->Unmap(m_constantBuffer.m_ptr, 0);
         return true;
+#endif
     }
 
     const T& Read () const
@@ -59,10 +68,14 @@ public:
         return m_storage;
     }
 
+#ifndef CPU_ONLY
     ID3D11Buffer* Get () { return m_constantBuffer.m_ptr; }
+#endif
 
 private:
+#ifndef CPU_ONLY
     CAutoReleasePointer<ID3D11Buffer> m_constantBuffer;
+#endif
 
     T m_storage;
 };
\ No newline at end of file
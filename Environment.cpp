@@ -0,0 +1,189 @@
+#define _CRT_SECURE_NO_WARNINGS
+
+#include "Environment.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <algorithm>
+
+void MakeSkyEnvironment (const float3& sunDirection, const float3& sunColor, const float3& skyColor, const float3& groundColor, std::vector<float3>& texels)
+{
+    float3 sunDir = sunDirection;
+    Normalize(sunDir);
+    float cosSunRadius = std::cos(DegreesToRadians(c_skySunAngularRadius));
+
+    texels.resize(c_environmentWidth * c_environmentHeight);
+    for (size_t y = 0; y < c_environmentHeight; ++y)
+    {
+        for (size_t x = 0; x < c_environmentWidth; ++x)
+        {
+            float3 dir = EnvironmentUVToDirection((float(x) + 0.5f) / float(c_environmentWidth), (float(y) + 0.5f) / float(c_environmentHeight));
+            float3& texel = texels[y * c_environmentWidth + x];
+            if (dir[1] < 0.0f)
+                texel = groundColor;
+            else
+                texel = skyColor * (2.0f - dir[1]);
+
+            if (Dot(dir, sunDir) >= cosSunRadius)
+                texel = texel + sunColor;
+        }
+    }
+}
+
+// reads one scanline, flat or in the new run length encoding where each channel is encoded on its own
+static bool ReadHDRScanline (FILE* file, size_t width, std::vector<uint8_t>& rgbe)
+{
+    rgbe.resize(width * 4);
+    uint8_t start[4];
+    if (fread(start, 1, 4, file) != 4)
+        return false;
+
+    bool runLengthEncoded = width >= 8 && width < 0x8000 && start[0] == 2 && start[1] == 2 && !(start[2] & 0x80) && size_t((start[2] << 8) | start[3]) == width;
+    if (!runLengthEncoded)
+    {
+        memcpy(rgbe.data(), start, 4);
+        return width == 1 || fread(&rgbe[4], 1, (width - 1) * 4, file) == (width - 1) * 4;
+    }
+
+    for (size_t channel = 0; channel < 4; ++channel)
+    {
+        size_t x = 0;
+        while (x < width)
+        {
+            int count = fgetc(file);
+            if (count == EOF || count == 0)
+                return false;
+
+            // a count over 128 is a run of one value, else that many values follow
+            if (count > 128)
+            {
+                count -= 128;
+                int value = fgetc(file);
+                if (value == EOF || x + count > width)
+                    return false;
+                for (int i = 0; i < count; ++i)
+                    rgbe[(x++) * 4 + channel] = (uint8_t)value;
+            }
+            else
+            {
+                if (x + count > width)
+                    return false;
+                for (int i = 0; i < count; ++i)
+                {
+                    int value = fgetc(file);
+                    if (value == EOF)
+                        return false;
+                    rgbe[(x++) * 4 + channel] = (uint8_t)value;
+                }
+            }
+        }
+    }
+    return true;
+}
+
+bool LoadEnvironmentHDR (const char* fileName, std::vector<float3>& texels)
+{
+    FILE* file = fopen(fileName, "rb");
+    if (!file)
+        return false;
+
+    // the header is lines of text ending with a blank line, then the resolution line. Only the standard orientation is
+    // supported, which is rows from the top down.
+    char line[256];
+    if (!fgets(line, sizeof(line), file) || strncmp(line, "#?", 2) != 0)
+    {
+        fclose(file);
+        return false;
+    }
+    while (fgets(line, sizeof(line), file) && line[0] != '\n')
+    {
+        if (!strncmp(line, "FORMAT=", 7) && strncmp(line, "FORMAT=32-bit_rle_rgbe", 22) != 0)
+        {
+            fclose(file);
+            return false;
+        }
+    }
+
+    size_t width = 0, height = 0;
+    if (!fgets(line, sizeof(line), file) || sscanf(line, "-Y %zu +X %zu", &height, &width) != 2 || width == 0 || height == 0)
+    {
+        fclose(file);
+        return false;
+    }
+
+    std::vector<float3> pixels(width * height);
+    std::vector<uint8_t> rgbe;
+    for (size_t y = 0; y < height; ++y)
+    {
+        if (!ReadHDRScanline(file, width, rgbe))
+        {
+            fclose(file);
+            return false;
+        }
+        for (size_t x = 0; x < width; ++x)
+        {
+            const uint8_t* texel = &rgbe[x * 4];
+            float scale = texel[3] ? std::ldexp(1.0f, int(texel[3]) - (128 + 8)) : 0.0f;
+            pixels[y * width + x] = { float(texel[0]) * scale, float(texel[1]) * scale, float(texel[2]) * scale };
+        }
+    }
+    fclose(file);
+
+    // each texel averages the pixels whose centers are in it, or takes the nearest pixel if there aren't any
+    texels.resize(c_environmentWidth * c_environmentHeight);
+    for (size_t y = 0; y < c_environmentHeight; ++y)
+    {
+        size_t firstRow = y * height / c_environmentHeight;
+        size_t lastRow = (std::max)((y + 1) * height / c_environmentHeight, firstRow + 1);
+        for (size_t x = 0; x < c_environmentWidth; ++x)
+        {
+            size_t firstColumn = x * width / c_environmentWidth;
+            size_t lastColumn = (std::max)((x + 1) * width / c_environmentWidth, firstColumn + 1);
+            float3 sum = { 0.0f, 0.0f, 0.0f };
+            for (size_t row = firstRow; row < lastRow; ++row)
+            {
+                for (size_t column = firstColumn; column < lastColumn; ++column)
+                    sum = sum + pixels[row * width + column];
+            }
+            texels[y * c_environmentWidth + x] = sum * (1.0f / float((lastRow - firstRow) * (lastColumn - firstColumn)));
+        }
+    }
+    return true;
+}
+
+void BuildEnvironmentCDFs (const std::vector<float3>& texels, std::vector<float>& conditionalCDF, std::vector<float>& marginalCDF)
+{
+    conditionalCDF.resize(c_environmentWidth * c_environmentHeight);
+    marginalCDF.resize(c_environmentHeight);
+
+    std::vector<double> rowSums(c_environmentHeight);
+    double totalSum = 0.0;
+    for (size_t y = 0; y < c_environmentHeight; ++y)
+    {
+        float sinTheta = std::sin(c_pi * (float(y) + 0.5f) / float(c_environmentHeight));
+        double sum = 0.0;
+        for (size_t x = 0; x < c_environmentWidth; ++x)
+        {
+            const float3& texel = texels[y * c_environmentWidth + x];
+            sum += (std::max)(0.299f * texel[0] + 0.587f * texel[1] + 0.114f * texel[2], 0.0f) * sinTheta;
+            conditionalCDF[y * c_environmentWidth + x] = float(sum);
+        }
+
+        for (size_t x = 0; x < c_environmentWidth; ++x)
+        {
+            float& cdf = conditionalCDF[y * c_environmentWidth + x];
+            cdf = (sum > 0.0) ? float(double(cdf) / sum) : float(x + 1) / float(c_environmentWidth);
+        }
+        conditionalCDF[y * c_environmentWidth + c_environmentWidth - 1] = 1.0f;
+
+        rowSums[y] = sum;
+        totalSum += sum;
+    }
+
+    double runningSum = 0.0;
+    for (size_t y = 0; y < c_environmentHeight; ++y)
+    {
+        runningSum += rowSums[y];
+        marginalCDF[y] = (totalSum > 0.0) ? float(runningSum / totalSum) : float(y + 1) / float(c_environmentHeight);
+    }
+    marginalCDF[c_environmentHeight - 1] = 1.0f;
+}
\ No newline at end of file
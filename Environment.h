@@ -0,0 +1,49 @@
+#pragma once
+
+#include <vector>
+#include <cmath>
+#include "ShaderTypes.h"
+
+// Environment maps are lat-long images of the light arriving from infinitely far away, which is what rays that miss
+// the scene see instead of the flat miss color. They are c_environmentWidth x c_environmentHeight (see Settings.h),
+// with u going around the y axis starting at +x, and v going from straight up (+y) at the top row to straight down at
+// the bottom.
+//
+// For importance sampling, each texel is weighted by its luminance times the sine of its latitude, which is how much
+// solid angle it covers, and that's made into a piecewise constant 2D distribution: a marginal CDF picks the row, then
+// the row's conditional CDF picks the texel in it. Each CDF value is the running sum up to and including its row or
+// texel, so the probability of a texel is the difference to the one before it.
+
+static const float c_skySunAngularRadius = 2.0f;    // degrees. Bigger than the real sun so it covers a few texels.
+
+//----------------------------------------------------------------------------
+inline float3 EnvironmentUVToDirection (float u, float v)
+{
+    float phi = 2.0f * c_pi * u;
+    float theta = c_pi * v;
+    float sinTheta = std::sin(theta);
+    return { sinTheta * std::cos(phi), std::cos(theta), sinTheta * std::sin(phi) };
+}
+
+//----------------------------------------------------------------------------
+inline float2 EnvironmentDirectionToUV (const float3& dir)
+{
+    float u = std::atan2(dir[2], dir[0]) / (2.0f * c_pi);
+    if (u < 0.0f)
+        u += 1.0f;
+    float v = std::acos((std::min)((std::max)(dir[1], -1.0f), 1.0f)) / c_pi;
+    return { u, v };
+}
+
+// A procedural sky: a small, very bright sun in sunDirection, over a sky that fades from skyColor at the zenith to twice
+// as bright at the horizon, and groundColor below the horizon.
+void MakeSkyEnvironment (const float3& sunDirection, const float3& sunColor, const float3& skyColor, const float3& groundColor, std::vector<float3>& texels);
+
+// Loads a Radiance .hdr file, flat or run length encoded, and resamples it to c_environmentWidth x c_environmentHeight
+// by averaging the texels that fall in each texel.
+bool LoadEnvironmentHDR (const char* fileName, std::vector<float3>& texels);
+
+// Makes the marginal CDF over the rows and the conditional CDF of each row described above. Rows with no light in them
+// get a uniform conditional CDF, so every texel can be found, and an environment with no light at all a uniform marginal
+// CDF.
+void BuildEnvironmentCDFs (const std::vector<float3>& texels, std::vector<float>& conditionalCDF, std::vector<float>& marginalCDF);
\ No newline at end of file
@@ -0,0 +1,275 @@
+#include "LightTree.h"
+#include "Utils.h"
+#include <thread>
+#include <numeric>
+
+void BuildLightAliasTable (const std::vector<float>& weights, std::vector<float>& thresholds, std::vector<uint32_t>& aliases)
+{
+    size_t count = weights.size();
+    thresholds.assign(count, 1.0f);
+    aliases.resize(count);
+    std::iota(aliases.begin(), aliases.end(), 0);
+
+    double sum = 0.0;
+    for (float weight : weights)
+        sum += weight;
+    if (count == 0 || sum <= 0.0)
+        return;
+
+    // scale the weights so they average 1, then fill each slot that's under 1 with some of a slot that's over
+    std::vector<double> scaled(count);
+    std::vector<uint32_t> small, large;
+    for (size_t i = 0; i < count; ++i)
+    {
+        scaled[i] = double(weights[i]) * double(count) / sum;
+        if (scaled[i] < 1.0)
+            small.push_back((uint32_t)i);
+        else
+            large.push_back((uint32_t)i);
+    }
+
+    while (!small.empty() && !large.empty())
+    {
+        uint32_t smallIndex = small.back();
+        small.pop_back();
+        uint32_t largeIndex = large.back();
+
+        thresholds[smallIndex] = float(scaled[smallIndex]);
+        aliases[smallIndex] = largeIndex;
+        scaled[largeIndex] = (scaled[largeIndex] + scaled[smallIndex]) - 1.0;
+        if (scaled[largeIndex] < 1.0)
+        {
+            large.pop_back();
+            small.push_back(largeIndex);
+        }
+    }
+
+    // whatever is left is 1 up to rounding, and keeps itself
+}
+
+void LightConeUnion (const float3& axisA, float cosThetaA, const float3& axisB, float cosThetaB, float3& axis, float& cosTheta)
+{
+    // cosines over 1 are empty cones
+    if (cosThetaA > 1.0f || cosThetaB > 1.0f)
+    {
+        axis = cosThetaA > 1.0f ? axisB : axisA;
+        cosTheta = cosThetaA > 1.0f ? cosThetaB : cosThetaA;
+        return;
+    }
+
+    // if one cone holds the other, that's the union
+    float thetaA = std::acos((std::max)(cosThetaA, -1.0f));
+    float thetaB = std::acos((std::max)(cosThetaB, -1.0f));
+    float cosThetaD = (std::min)((std::max)(Dot(axisA, axisB), -1.0f), 1.0f);
+    float thetaD = std::acos(cosThetaD);
+    if ((std::min)(thetaD + thetaB, c_pi) <= thetaA)
+    {
+        axis = axisA;
+        cosTheta = cosThetaA;
+        return;
+    }
+    if ((std::min)(thetaD + thetaA, c_pi) <= thetaB)
+    {
+        axis = axisB;
+        cosTheta = cosThetaB;
+        return;
+    }
+
+    // else the union's half angle covers both, and its axis is turned from a's towards b's in the plane they're in
+    float thetaO = (thetaA + thetaD + thetaB) * 0.5f;
+    float3 perpendicular = axisB - axisA * cosThetaD;
+    if (thetaO >= c_pi || LengthSq(perpendicular) <= 0.0f)
+    {
+        axis = axisA;
+        cosTheta = -1.0f;
+        return;
+    }
+
+    Normalize(perpendicular);
+    float thetaR = thetaO - thetaA;
+    axis = axisA * std::cos(thetaR) + perpendicular * std::sin(thetaR);
+    Normalize(axis);
+    cosTheta = std::cos(thetaO);
+}
+
+// bounds that nothing has been added to yet
+static SLightEmitter EmptyLightBounds ()
+{
+    SLightEmitter bounds;
+    bounds.m_min = { FLT_MAX, FLT_MAX, FLT_MAX };
+    bounds.m_max = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+    bounds.m_axis = { 0.0f, 0.0f, 1.0f };
+    bounds.m_cosTheta = 2.0f;
+    bounds.m_power = 0.0f;
+    return bounds;
+}
+
+static void GrowLightBounds (SLightEmitter& bounds, const SLightEmitter& emitter)
+{
+    GrowBounds(bounds.m_min, bounds.m_max, emitter.m_min, emitter.m_max);
+    LightConeUnion(bounds.m_axis, bounds.m_cosTheta, emitter.m_axis, emitter.m_cosTheta, bounds.m_axis, bounds.m_cosTheta);
+    bounds.m_power += emitter.m_power;
+}
+
+// The SAOH cost of a child, for a split of a node whose bounds have the given extent along axis. The orientation term
+// is the solid angle measure of the normal cone widened by the 90 degrees a lambertian emitter emits into.
+static float LightBoundsCost (const SLightEmitter& bounds, const float3& nodeExtent, size_t axis)
+{
+    float thetaO = std::acos((std::min)((std::max)(bounds.m_cosTheta, -1.0f), 1.0f));
+    float thetaW = (std::min)(thetaO + c_pi * 0.5f, c_pi);
+    float sinThetaO = std::sin(thetaO);
+    float orientation = 2.0f * c_pi * (1.0f - bounds.m_cosTheta) +
+        c_pi * 0.5f * (2.0f * thetaW * sinThetaO - std::cos(thetaO - 2.0f * thetaW) - 2.0f * thetaO * sinThetaO + bounds.m_cosTheta);
+
+    // long thin nodes are penalized for splitting across their short axes
+    float maxExtent = (std::max)((std::max)(nodeExtent[0], nodeExtent[1]), nodeExtent[2]);
+    float regularization = maxExtent / nodeExtent[axis];
+    return bounds.m_power * orientation * regularization * SurfaceArea(bounds.m_min, bounds.m_max);
+}
+
+static float3 LightCentroid (const SLightEmitter& emitter)
+{
+    return (emitter.m_min + emitter.m_max) * 0.5f;
+}
+
+struct SLightTreeBuild
+{
+    const std::vector<SLightEmitter>& m_emitters;
+    std::vector<uint32_t> m_order;      // emitter indices, partitioned in place as the tree is built
+    SLightTree& m_tree;
+    size_t m_parallelDepth;
+};
+
+// Builds the sub tree over m_order[begin, end) into the nodes from nodeIndex on. A sub tree over n emitters is always
+// 2n - 1 nodes, so the right child's index is known before the left sub tree is built, and both can be built at once.
+static void BuildLightTreeNode (SLightTreeBuild& build, uint32_t nodeIndex, uint32_t parent, size_t begin, size_t end, size_t depth)
+{
+    SLightTreeNode& node = build.m_tree.m_nodes[nodeIndex];
+    node.m_parent = parent;
+    if (end - begin == 1)
+    {
+        uint32_t light = build.m_order[begin];
+        node.m_bounds = build.m_emitters[light];
+        node.m_rightChild = 0;
+        node.m_light = light;
+        build.m_tree.m_lightLeaves[light] = nodeIndex;
+        return;
+    }
+
+    float3 boundsMin = { FLT_MAX, FLT_MAX, FLT_MAX };
+    float3 boundsMax = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+    float3 centroidMin = boundsMin;
+    float3 centroidMax = boundsMax;
+    for (size_t i = begin; i < end; ++i)
+    {
+        const SLightEmitter& emitter = build.m_emitters[build.m_order[i]];
+        float3 centroid = LightCentroid(emitter);
+        GrowBounds(boundsMin, boundsMax, emitter.m_min, emitter.m_max);
+        GrowBounds(centroidMin, centroidMax, centroid, centroid);
+    }
+    float3 nodeExtent = boundsMax - boundsMin;
+
+    // bin the centroids on each axis and find the cheapest split between bins
+    float bestCost = FLT_MAX;
+    size_t bestAxis = 3;
+    size_t bestBin = 0;
+    for (size_t axis = 0; axis < 3; ++axis)
+    {
+        if (centroidMax[axis] <= centroidMin[axis] || nodeExtent[axis] <= 0.0f)
+            continue;
+
+        SLightEmitter bins[c_lightTreeNumBins];
+        for (SLightEmitter& bin : bins)
+            bin = EmptyLightBounds();
+        float binScale = float(c_lightTreeNumBins) / (centroidMax[axis] - centroidMin[axis]);
+        for (size_t i = begin; i < end; ++i)
+        {
+            const SLightEmitter& emitter = build.m_emitters[build.m_order[i]];
+            size_t bin = (std::min)(size_t((LightCentroid(emitter)[axis] - centroidMin[axis]) * binScale), c_lightTreeNumBins - 1);
+            GrowLightBounds(bins[bin], emitter);
+        }
+
+        // costs of everything right of each split, -1 if there's nothing there, then sweep from the left
+        float rightCosts[c_lightTreeNumBins];
+        SLightEmitter right = EmptyLightBounds();
+        for (size_t bin = c_lightTreeNumBins - 1; bin > 0; --bin)
+        {
+            if (bins[bin].m_cosTheta <= 1.0f)
+                GrowLightBounds(right, bins[bin]);
+            rightCosts[bin] = right.m_cosTheta <= 1.0f ? LightBoundsCost(right, nodeExtent, axis) : -1.0f;
+        }
+
+        SLightEmitter left = EmptyLightBounds();
+        for (size_t bin = 0; bin + 1 < c_lightTreeNumBins; ++bin)
+        {
+            if (bins[bin].m_cosTheta <= 1.0f)
+                GrowLightBounds(left, bins[bin]);
+            if (left.m_cosTheta > 1.0f || rightCosts[bin + 1] < 0.0f)
+                continue;
+            float cost = LightBoundsCost(left, nodeExtent, axis) + rightCosts[bin + 1];
+            if (cost < bestCost)
+            {
+                bestCost = cost;
+                bestAxis = axis;
+                bestBin = bin;
+            }
+        }
+    }
+
+    // split at the best bin, or in the middle if there was nothing to choose between
+    size_t split = begin;
+    if (bestAxis < 3)
+    {
+        float binScale = float(c_lightTreeNumBins) / (centroidMax[bestAxis] - centroidMin[bestAxis]);
+        split = std::partition(build.m_order.begin() + begin, build.m_order.begin() + end,
+            [&] (uint32_t light)
+            {
+                size_t bin = (std::min)(size_t((LightCentroid(build.m_emitters[light])[bestAxis] - centroidMin[bestAxis]) * binScale), c_lightTreeNumBins - 1);
+                return bin <= bestBin;
+            }
+        ) - build.m_order.begin();
+    }
+    if (split == begin || split == end)
+        split = (begin + end) / 2;
+
+    uint32_t leftChild = nodeIndex + 1;
+    uint32_t rightChild = nodeIndex + uint32_t(2 * (split - begin));
+    node.m_rightChild = rightChild;
+    node.m_light = c_lightTreeInterior;
+
+    if (depth < build.m_parallelDepth && end - begin >= c_lightTreeParallelMinLights)
+    {
+        std::thread leftThread([&] () { BuildLightTreeNode(build, leftChild, nodeIndex, begin, split, depth + 1); });
+        BuildLightTreeNode(build, rightChild, nodeIndex, split, end, depth + 1);
+        leftThread.join();
+    }
+    else
+    {
+        BuildLightTreeNode(build, leftChild, nodeIndex, begin, split, depth + 1);
+        BuildLightTreeNode(build, rightChild, nodeIndex, split, end, depth + 1);
+    }
+
+    node.m_bounds = build.m_tree.m_nodes[leftChild].m_bounds;
+    GrowLightBounds(node.m_bounds, build.m_tree.m_nodes[rightChild].m_bounds);
+}
+
+void BuildLightTree (const std::vector<SLightEmitter>& emitters, SLightTree& tree, size_t numThreads)
+{
+    tree.m_nodes.clear();
+    tree.m_lightLeaves.clear();
+    if (emitters.empty())
+        return;
+
+    if (numThreads == 0)
+        numThreads = (std::max)(size_t(std::thread::hardware_concurrency()), size_t(1));
+
+    tree.m_nodes.resize(2 * emitters.size() - 1);
+    tree.m_lightLeaves.resize(emitters.size());
+
+    SLightTreeBuild build = { emitters, std::vector<uint32_t>(emitters.size()), tree, 0 };
+    std::iota(build.m_order.begin(), build.m_order.end(), 0);
+    while ((size_t(1) << build.m_parallelDepth) < numThreads)
+        ++build.m_parallelDepth;
+
+    BuildLightTreeNode(build, 0, 0, 0, emitters.size(), 0);
+}
\ No newline at end of file
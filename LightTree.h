@@ -0,0 +1,117 @@
+#pragma once
+
+#include <vector>
+#include <stdint.h>
+#include "BVH.h"
+
+// Light selection for next event estimation, over the emitters of the Lights buffer.
+//
+// The alias table picks emitters proportionally to power in constant time with one random number: pick a slot
+// uniformly, then keep it if the rest of the random number is under the slot's threshold, else take the slot's alias.
+// Vose's method builds it in linear time.
+//
+// The light tree is a BVH over the emitters whose nodes also bound power and the directions the emitters face. Sampling
+// walks it from the root, choosing between the children by an importance that bounds how much light each could send
+// to the shading point, so nearby emitters facing the point get picked more than the alias table would pick them. The
+// probability of having picked an emitter is found again for MIS by walking back up from its leaf to the root through
+// the parent links.
+
+static const size_t c_lightTreeNumBins = 12;                // how many buckets the split search evaluates per axis
+static const size_t c_lightTreeParallelMinLights = 1024;    // light tree sub trees smaller than this are built on a single thread
+static const uint32_t c_lightTreeInterior = 0xFFFFFFFF;     // the light index of interior nodes
+
+// what the light tree needs to know about each emitter. The emitters are all two sided, so the normal cone holds the
+// directions one of the sides faces. A cosine of -1 is every direction.
+struct SLightEmitter
+{
+    float3 m_min;
+    float3 m_max;
+    float3 m_axis;
+    float m_cosTheta;   // cosine of the normal cone's half angle
+    float m_power;
+};
+
+// Nodes are stored depth first like SBVHNode, so the left child of an interior node is the node right after it.
+// Leaves hold one emitter each.
+struct SLightTreeNode
+{
+    SLightEmitter m_bounds;     // of everything under the node
+    uint32_t m_rightChild;
+    uint32_t m_light;           // c_lightTreeInterior for interior nodes
+    uint32_t m_parent;          // the root's parent is itself
+};
+
+struct SLightTree
+{
+    std::vector<SLightTreeNode> m_nodes;
+    std::vector<uint32_t> m_lightLeaves;    // the leaf node of each emitter
+};
+
+// Builds the alias table for picking index i with probability weights[i] / sum of weights. Slot i keeps i if the
+// rest of the random number is under thresholds[i], else it's aliases[i].
+void BuildLightAliasTable (const std::vector<float>& weights, std::vector<float>& thresholds, std::vector<uint32_t>& aliases);
+
+// Builds a binary light tree with the SAOH (surface area orientation heuristic) of Conty Estevez and Kulla's "Importance
+// Sampling of Many Lights with Adaptive Tree Splitting". Sub trees are built on their own threads a few levels down.
+// numThreads of 0 is one per core.
+void BuildLightTree (const std::vector<SLightEmitter>& emitters, SLightTree& tree, size_t numThreads = 0);
+
+// the normal cone holding the directions of both a and b
+void LightConeUnion (const float3& axisA, float cosThetaA, const float3& axisB, float cosThetaB, float3& axis, float& cosTheta);
+
+//----------------------------------------------------------------------------
+// cos(a - b) for angles given as sines and cosines, which is 1 if a is smaller than b
+inline float CosSubClamped (float sinA, float cosA, float sinB, float cosB)
+{
+    if (cosA > cosB)
+        return 1.0f;
+    return cosA * cosB + sinA * sinB;
+}
+
+//----------------------------------------------------------------------------
+// sin(a - b), which is 0 if a is smaller than b
+inline float SinSubClamped (float sinA, float cosA, float sinB, float cosB)
+{
+    if (cosA > cosB)
+        return 0.0f;
+    return sinA * cosB - cosA * sinB;
+}
+
+//----------------------------------------------------------------------------
+// An upper bound on the light emitters in the bounds could send to a surface at pos facing normal, up to a constant.
+// From pbrt-v4's LightBounds::Importance(), with the emitters being two sided lambertian.
+inline float LightBoundsImportance (const float3& pos, const float3& normal, const float3& boundsMin, const float3& boundsMax, const float3& axis, float cosTheta, float power)
+{
+    if (power <= 0.0f)
+        return 0.0f;
+
+    // distance to the center, but not less than the size of the bounds, so points inside or near them don't blow up
+    float3 center = (boundsMin + boundsMax) * 0.5f;
+    float3 toPos = pos - center;
+    float distSquared = (std::max)(LengthSq(toPos), Length(boundsMax - boundsMin) * 0.5f);
+
+    // the cone of directions from pos that the bounds subtend
+    float radiusSquared = LengthSq(boundsMax - center);
+    float cosThetaB = -1.0f;
+    if (LengthSq(toPos) > radiusSquared)
+        cosThetaB = std::sqrt((std::max)(1.0f - radiusSquared / LengthSq(toPos), 0.0f));
+    float sinThetaB = std::sqrt((std::max)(1.0f - cosThetaB * cosThetaB, 0.0f));
+
+    // the smallest angle between the normal cone and the direction to pos, over all points in the bounds
+    float3 dir = toPos * (1.0f / (std::max)(std::sqrt(LengthSq(toPos)), 1e-12f));
+    float cosThetaW = std::abs(Dot(axis, dir));
+    float sinThetaW = std::sqrt((std::max)(1.0f - cosThetaW * cosThetaW, 0.0f));
+    float sinThetaO = std::sqrt((std::max)(1.0f - cosTheta * cosTheta, 0.0f));
+    float cosThetaX = CosSubClamped(sinThetaW, cosThetaW, sinThetaO, cosTheta);
+    float sinThetaX = SinSubClamped(sinThetaW, cosThetaW, sinThetaO, cosTheta);
+    float cosThetaP = CosSubClamped(sinThetaX, cosThetaX, sinThetaB, cosThetaB);
+    if (cosThetaP <= 0.0f)
+        return 0.0f;
+
+    // and the smallest angle between the surface normal and a direction into the bounds
+    float cosThetaI = std::abs(Dot(dir, normal));
+    float sinThetaI = std::sqrt((std::max)(1.0f - cosThetaI * cosThetaI, 0.0f));
+    float cosThetaPI = CosSubClamped(sinThetaI, cosThetaI, sinThetaB, cosThetaB);
+
+    return (std::max)(power * cosThetaP * cosThetaPI / distSquared, 0.0f);
+}
\ No newline at end of file
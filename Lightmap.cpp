@@ -0,0 +1,411 @@
+#include "Lightmap.h"
+#include "PathTraceCPU.h"
+
+//----------------------------------------------------------------------------
+// texels along a side of a chart for a surface that long
+static uint32_t ChartSize (float length, float texelSize)
+{
+    float texels = std::ceil(length / texelSize);
+    if (!(texels > float(c_lightmapMinChartSize)))
+        return c_lightmapMinChartSize;
+    return (uint32_t)(std::min)(texels, float(c_lightmapMaxChartSize));
+}
+
+//----------------------------------------------------------------------------
+static size_t TotalTexels (const std::vector<float2>& lengths, float texelSize)
+{
+    size_t total = 0;
+    for (const float2& length : lengths)
+        total += size_t(ChartSize(length[0], texelSize)) * size_t(ChartSize(length[1], texelSize));
+    return total;
+}
+
+//----------------------------------------------------------------------------
+static float2 ClampUV (const float2& uv)
+{
+    return { (std::min)((std::max)(uv[0], 0.0f), 1.0f), (std::min)((std::max)(uv[1], 0.0f), 1.0f) };
+}
+
+//----------------------------------------------------------------------------
+// u and v of pos in the plane of the triangle, so that pos = a + (b - a) * u + (c - a) * v
+static float2 TriangleUV (const float3& a, const float3& b, const float3& c, const float3& pos)
+{
+    float3 e1 = b - a;
+    float3 e2 = c - a;
+    float3 d = pos - a;
+    float d00 = Dot(e1, e1);
+    float d01 = Dot(e1, e2);
+    float d11 = Dot(e2, e2);
+    float d20 = Dot(d, e1);
+    float d21 = Dot(d, e2);
+    float denom = d00 * d11 - d01 * d01;
+    if (denom == 0.0f)
+        return { 0.0f, 0.0f };
+    return { (d11 * d20 - d01 * d21) / denom, (d00 * d21 - d01 * d20) / denom };
+}
+
+//----------------------------------------------------------------------------
+// the points of a triangle's chart over the diagonal are mirrored back across it
+static float3 TrianglePoint (const float3& a, const float3& b, const float3& c, float2 uv)
+{
+    if (uv[0] + uv[1] > 1.0f)
+        uv = { 1.0f - uv[1], 1.0f - uv[0] };
+    return a + (b - a) * uv[0] + (c - a) * uv[1];
+}
+
+//----------------------------------------------------------------------------
+static float3 QuadPoint (const ShaderTypes::StructuredBuffers::QuadPrim& quad, const float2& uv)
+{
+    float3 ab = XYZ(quad.positionA_w) + (XYZ(quad.positionB_w) - XYZ(quad.positionA_w)) * uv[0];
+    float3 dc = XYZ(quad.positionD_w) + (XYZ(quad.positionC_w) - XYZ(quad.positionD_w)) * uv[0];
+    return ab + (dc - ab) * uv[1];
+}
+
+//----------------------------------------------------------------------------
+// The inverse of QuadPoint(). Starts from where pos is in the parallelogram A, B, D and takes least squares Newton
+// steps from there, which converge quickly since the quads of the scenes are close to parallelograms.
+static float2 QuadUV (const ShaderTypes::StructuredBuffers::QuadPrim& quad, const float3& pos)
+{
+    float3 a = XYZ(quad.positionA_w);
+    float3 b = XYZ(quad.positionB_w);
+    float3 c = XYZ(quad.positionC_w);
+    float3 d = XYZ(quad.positionD_w);
+    float3 twist = a - b + c - d;
+
+    float2 uv = TriangleUV(a, b, d, pos);
+    for (int step = 0; step < 4; ++step)
+    {
+        float3 error = QuadPoint(quad, uv) - pos;
+        float3 du = (b - a) + twist * uv[1];
+        float3 dv = (d - a) + twist * uv[0];
+        float j00 = Dot(du, du);
+        float j01 = Dot(du, dv);
+        float j11 = Dot(dv, dv);
+        float g0 = Dot(du, error);
+        float g1 = Dot(dv, error);
+        float det = j00 * j11 - j01 * j01;
+        if (det == 0.0f)
+            break;
+        uv[0] -= (j11 * g0 - j01 * g1) / det;
+        uv[1] -= (j00 * g1 - j01 * g0) / det;
+    }
+    return uv;
+}
+
+//----------------------------------------------------------------------------
+static void ModelTriangleCorners (const ShaderTypes::StructuredBuffers::ModelPrim& model, const ShaderTypes::StructuredBuffers::ModelTrianglePrim& triangle, float3 corners[3])
+{
+    corners[0] = TransformPoint(model.objectToWorldX, model.objectToWorldY, model.objectToWorldZ, XYZ(triangle.positionA_w));
+    corners[1] = TransformPoint(model.objectToWorldX, model.objectToWorldY, model.objectToWorldZ, XYZ(triangle.positionB_w));
+    corners[2] = TransformPoint(model.objectToWorldX, model.objectToWorldY, model.objectToWorldZ, XYZ(triangle.positionC_w));
+}
+
+//----------------------------------------------------------------------------
+void CLightmap::Build (size_t texelBudget, size_t numPixels)
+{
+    const ShaderTypes::ConstantBuffers::ConstantsOnce& constants = ShaderData::ConstantBuffers::ConstantsOnce.Read();
+    const uint4& counts = constants.numSpheres_numTris_numOBBs_numQuads;
+    const unsigned int numModels = constants.numModels_sceneRootNode_numScenePrims_numLights[0];
+
+    m_charts.clear();
+    m_sphereCharts.clear();
+    m_triangleCharts.clear();
+    m_quadCharts.clear();
+    m_obbCharts.clear();
+    m_modelCharts.clear();
+
+    // how long the surface of each chart is along u and v
+    std::vector<float2> lengths;
+    auto AddChart = [&] (EScenePrimitive type, uint32_t index, uint32_t sub, bool backSide, float lengthU, float lengthV)
+    {
+        SLightmapChart chart;
+        chart.m_type = type;
+        chart.m_index = index;
+        chart.m_sub = sub;
+        chart.m_backSide = backSide;
+        chart.m_firstTexel = 0;
+        chart.m_width = chart.m_height = 0;
+        m_charts.push_back(chart);
+        lengths.push_back({ lengthU, lengthV });
+    };
+
+    for (uint32_t i = 0; i < counts[0]; ++i)
+    {
+        const ShaderTypes::StructuredBuffers::SpherePrim& sphere = ShaderData::StructuredBuffers::Spheres.Read()[i];
+        m_sphereCharts.push_back((uint32_t)m_charts.size());
+        AddChart(EScenePrimitive::Sphere, i, 0, false, 2.0f * c_pi * sphere.position_Radius[3], c_pi * sphere.position_Radius[3]);
+    }
+
+    for (uint32_t i = 0; i < counts[1]; ++i)
+    {
+        const ShaderTypes::StructuredBuffers::TrianglePrim& triangle = ShaderData::StructuredBuffers::Triangles.Read()[i];
+        m_triangleCharts.push_back((uint32_t)m_charts.size());
+        for (bool backSide : { false, true })
+            AddChart(EScenePrimitive::Triangle, i, 0, backSide, Length(XYZ(triangle.positionB_w) - XYZ(triangle.positionA_w)), Length(XYZ(triangle.positionC_w) - XYZ(triangle.positionA_w)));
+    }
+
+    for (uint32_t i = 0; i < counts[3]; ++i)
+    {
+        const ShaderTypes::StructuredBuffers::QuadPrim& quad = ShaderData::StructuredBuffers::Quads.Read()[i];
+        float lengthU = (Length(XYZ(quad.positionB_w) - XYZ(quad.positionA_w)) + Length(XYZ(quad.positionC_w) - XYZ(quad.positionD_w))) * 0.5f;
+        float lengthV = (Length(XYZ(quad.positionD_w) - XYZ(quad.positionA_w)) + Length(XYZ(quad.positionC_w) - XYZ(quad.positionB_w))) * 0.5f;
+        m_quadCharts.push_back((uint32_t)m_charts.size());
+        for (bool backSide : { false, true })
+            AddChart(EScenePrimitive::Quad, i, 0, backSide, lengthU, lengthV);
+    }
+
+    for (uint32_t i = 0; i < counts[2]; ++i)
+    {
+        const ShaderTypes::StructuredBuffers::OBBPrim& obb = ShaderData::StructuredBuffers::OBBs.Read()[i];
+        m_obbCharts.push_back((uint32_t)m_charts.size());
+        for (uint32_t face = 0; face < 6; ++face)
+        {
+            size_t axis = face / 2;
+            AddChart(EScenePrimitive::OBB, i, face, false, 2.0f * obb.radius_w[(axis + 1) % 3], 2.0f * obb.radius_w[(axis + 2) % 3]);
+        }
+    }
+
+    // One chart per triangle per side, not a parameterization of the mesh. See the comment in Lightmap.h about the cost.
+    for (uint32_t i = 0; i < numModels; ++i)
+    {
+        const ShaderTypes::StructuredBuffers::ModelPrim& model = ShaderData::StructuredBuffers::Models.Read()[i];
+        m_modelCharts.push_back((uint32_t)m_charts.size());
+        for (uint32_t triangleIndex = model.firstTriangle_lastTriangle_rootNode_firstLight[0]; triangleIndex < model.firstTriangle_lastTriangle_rootNode_firstLight[1]; ++triangleIndex)
+        {
+            float3 corners[3];
+            ModelTriangleCorners(model, ShaderData::StructuredBuffers::ModelTriangles.Read()[triangleIndex], corners);
+            for (bool backSide : { false, true })
+                AddChart(EScenePrimitive::Model, i, triangleIndex, backSide, Length(corners[1] - corners[0]), Length(corners[2] - corners[0]));
+        }
+    }
+
+    // The smallest texel size that keeps the charts in the budget. A texel as long as the longest surface gives every
+    // chart its smallest size, so that's the biggest it needs to be, and the search halves the ratio of the bounds each
+    // step in between that and a millionth of it.
+    float maxLength = 0.0f;
+    for (const float2& length : lengths)
+        maxLength = (std::max)((std::max)(maxLength, length[0]), length[1]);
+    float texelSizeMax = maxLength > 0.0f ? maxLength : 1.0f;
+    float texelSizeMin = texelSizeMax * 1e-6f;
+    for (int step = 0; step < 32; ++step)
+    {
+        float texelSize = std::sqrt(texelSizeMin * texelSizeMax);
+        if (TotalTexels(lengths, texelSize) <= texelBudget)
+            texelSizeMax = texelSize;
+        else
+            texelSizeMin = texelSize;
+    }
+    m_texelSize = texelSizeMax;
+
+    uint32_t numTexels = 0;
+    for (size_t i = 0; i < m_charts.size(); ++i)
+    {
+        SLightmapChart& chart = m_charts[i];
+        chart.m_width = ChartSize(lengths[i][0], m_texelSize);
+        chart.m_height = ChartSize(lengths[i][1], m_texelSize);
+        chart.m_firstTexel = numTexels;
+        numTexels += chart.m_width * chart.m_height;
+    }
+
+    m_texels.assign(numTexels, { 0.0f, 0.0f, 0.0f, 0.0f });
+    std::vector<std::atomic<uint8_t>>(m_charts.size()).swap(m_seen);
+    m_pixels.assign(numPixels, SLightmapPixel());
+}
+
+//----------------------------------------------------------------------------
+uint32_t CLightmap::ChartUV (EScenePrimitive type, uint32_t index, uint32_t modelTriangle, const float3& pos, const float3& hitNormal, float2& uv) const
+{
+    switch (type)
+    {
+        case EScenePrimitive::Sphere:
+        {
+            const ShaderTypes::StructuredBuffers::SpherePrim& sphere = ShaderData::StructuredBuffers::Spheres.Read()[index];
+            float3 dir = pos - XYZ(sphere.position_Radius);
+            Normalize(dir);
+            float u = std::atan2(dir[2], dir[0]) / (2.0f * c_pi);
+            if (u < 0.0f)
+                u += 1.0f;
+            uv = ClampUV({ u, std::acos((std::min)((std::max)(dir[1], -1.0f), 1.0f)) / c_pi });
+            return m_sphereCharts[index];
+        }
+        case EScenePrimitive::Triangle:
+        {
+            const ShaderTypes::StructuredBuffers::TrianglePrim& triangle = ShaderData::StructuredBuffers::Triangles.Read()[index];
+            uv = ClampUV(TriangleUV(XYZ(triangle.positionA_w), XYZ(triangle.positionB_w), XYZ(triangle.positionC_w), pos));
+            return m_triangleCharts[index] + (Dot(hitNormal, XYZ(triangle.normal_w)) < 0.0f ? 1 : 0);
+        }
+        case EScenePrimitive::Quad:
+        {
+            const ShaderTypes::StructuredBuffers::QuadPrim& quad = ShaderData::StructuredBuffers::Quads.Read()[index];
+            uv = ClampUV(QuadUV(quad, pos));
+            return m_quadCharts[index] + (Dot(hitNormal, XYZ(quad.normal_w)) < 0.0f ? 1 : 0);
+        }
+        case EScenePrimitive::OBB:
+        {
+            // the face is the axis the point is furthest out along, relative to the box's size
+            const ShaderTypes::StructuredBuffers::OBBPrim& obb = ShaderData::StructuredBuffers::OBBs.Read()[index];
+            float3 local = ChangeBasis(pos - XYZ(obb.position_w), XYZ(obb.XAxis_w), XYZ(obb.YAxis_w), XYZ(obb.ZAxis_w));
+            size_t axis = 0;
+            float furthest = -1.0f;
+            for (size_t i = 0; i < 3; ++i)
+            {
+                float out = std::abs(local[i]) / obb.radius_w[i];
+                if (out > furthest)
+                {
+                    furthest = out;
+                    axis = i;
+                }
+            }
+            size_t axisU = (axis + 1) % 3;
+            size_t axisV = (axis + 2) % 3;
+            uv = ClampUV({ (local[axisU] / obb.radius_w[axisU] + 1.0f) * 0.5f, (local[axisV] / obb.radius_w[axisV] + 1.0f) * 0.5f });
+            return m_obbCharts[index] + uint32_t(axis * 2) + (local[axis] >= 0.0f ? 1 : 0);
+        }
+        case EScenePrimitive::Model:
+        {
+            const ShaderTypes::StructuredBuffers::ModelPrim& model = ShaderData::StructuredBuffers::Models.Read()[index];
+            const ShaderTypes::StructuredBuffers::ModelTrianglePrim& triangle = ShaderData::StructuredBuffers::ModelTriangles.Read()[modelTriangle];
+            float3 objectPos = TransformPoint(model.worldToObjectX, model.worldToObjectY, model.worldToObjectZ, pos);
+            uv = ClampUV(TriangleUV(XYZ(triangle.positionA_w), XYZ(triangle.positionB_w), XYZ(triangle.positionC_w), objectPos));
+            uint32_t chart = m_modelCharts[index] + (modelTriangle - model.firstTriangle_lastTriangle_rootNode_firstLight[0]) * 2;
+            return chart + (Dot(hitNormal, ModelNormalToWorld(model, XYZ(triangle.normal_w))) < 0.0f ? 1 : 0);
+        }
+    }
+    return c_lightmapNoChart;
+}
+
+//----------------------------------------------------------------------------
+SLightmapSurface CLightmap::Surface (uint32_t chartIndex, float2 uv) const
+{
+    const SLightmapChart& chart = m_charts[chartIndex];
+    float side = chart.m_backSide ? -1.0f : 1.0f;
+    SLightmapSurface surface;
+    switch (chart.m_type)
+    {
+        case EScenePrimitive::Sphere:
+        {
+            const ShaderTypes::StructuredBuffers::SpherePrim& sphere = ShaderData::StructuredBuffers::Spheres.Read()[chart.m_index];
+            float theta = uv[1] * c_pi;
+            float phi = uv[0] * 2.0f * c_pi;
+            surface.m_normal = { std::sin(theta) * std::cos(phi), std::cos(theta), std::sin(theta) * std::sin(phi) };
+            surface.m_position = XYZ(sphere.position_Radius) + surface.m_normal * sphere.position_Radius[3];
+            surface.m_albedo = XYZ(sphere.albedo_w);
+            break;
+        }
+        case EScenePrimitive::Triangle:
+        {
+            const ShaderTypes::StructuredBuffers::TrianglePrim& triangle = ShaderData::StructuredBuffers::Triangles.Read()[chart.m_index];
+            surface.m_position = TrianglePoint(XYZ(triangle.positionA_w), XYZ(triangle.positionB_w), XYZ(triangle.positionC_w), uv);
+            surface.m_normal = XYZ(triangle.normal_w) * side;
+            surface.m_albedo = XYZ(triangle.albedo_w);
+            break;
+        }
+        case EScenePrimitive::Quad:
+        {
+            const ShaderTypes::StructuredBuffers::QuadPrim& quad = ShaderData::StructuredBuffers::Quads.Read()[chart.m_index];
+            surface.m_position = QuadPoint(quad, uv);
+            surface.m_normal = XYZ(quad.normal_w) * side;
+            surface.m_albedo = XYZ(quad.albedo_w);
+            break;
+        }
+        case EScenePrimitive::OBB:
+        {
+            const ShaderTypes::StructuredBuffers::OBBPrim& obb = ShaderData::StructuredBuffers::OBBs.Read()[chart.m_index];
+            size_t axis = chart.m_sub / 2;
+            size_t axisU = (axis + 1) % 3;
+            size_t axisV = (axis + 2) % 3;
+            float3 local = { 0.0f, 0.0f, 0.0f };
+            float3 localNormal = { 0.0f, 0.0f, 0.0f };
+            localNormal[axis] = (chart.m_sub & 1) ? 1.0f : -1.0f;
+            local[axis] = localNormal[axis] * obb.radius_w[axis];
+            local[axisU] = (uv[0] * 2.0f - 1.0f) * obb.radius_w[axisU];
+            local[axisV] = (uv[1] * 2.0f - 1.0f) * obb.radius_w[axisV];
+            surface.m_position = UndoChangeBasis(local, XYZ(obb.XAxis_w), XYZ(obb.YAxis_w), XYZ(obb.ZAxis_w)) + XYZ(obb.position_w);
+            surface.m_normal = UndoChangeBasis(localNormal, XYZ(obb.XAxis_w), XYZ(obb.YAxis_w), XYZ(obb.ZAxis_w));
+            surface.m_albedo = XYZ(obb.albedo_w);
+            break;
+        }
+        case EScenePrimitive::Model:
+        {
+            const ShaderTypes::StructuredBuffers::ModelPrim& model = ShaderData::StructuredBuffers::Models.Read()[chart.m_index];
+            const ShaderTypes::StructuredBuffers::ModelTrianglePrim& triangle = ShaderData::StructuredBuffers::ModelTriangles.Read()[chart.m_sub];
+            float3 objectPos = TrianglePoint(XYZ(triangle.positionA_w), XYZ(triangle.positionB_w), XYZ(triangle.positionC_w), uv);
+            surface.m_position = TransformPoint(model.objectToWorldX, model.objectToWorldY, model.objectToWorldZ, objectPos);
+            surface.m_normal = ModelNormalToWorld(model, XYZ(triangle.normal_w)) * side;
+            surface.m_albedo = XYZ(triangle.albedo_w);
+            break;
+        }
+    }
+    return surface;
+}
+
+//----------------------------------------------------------------------------
+// Texel centers are at (x + 0.5) / width. Sphere charts wrap around in u, the rest clamp at their edges.
+float3 CLightmap::Lookup (uint32_t chartIndex, const float2& uv) const
+{
+    const SLightmapChart& chart = m_charts[chartIndex];
+    int width = int(chart.m_width);
+    int height = int(chart.m_height);
+    bool wrap = chart.m_type == EScenePrimitive::Sphere;
+
+    float x = uv[0] * float(width) - 0.5f;
+    float y = (std::min)((std::max)(uv[1] * float(height) - 0.5f, 0.0f), float(height - 1));
+    if (!wrap)
+        x = (std::min)((std::max)(x, 0.0f), float(width - 1));
+
+    float floorX = std::floor(x);
+    float floorY = std::floor(y);
+    float fracX = x - floorX;
+    float fracY = y - floorY;
+    int x0 = int(floorX);
+    int y0 = int(floorY);
+    int x1 = x0 + 1;
+    int y1 = (std::min)(y0 + 1, height - 1);
+    if (wrap)
+    {
+        x0 = (x0 + width) % width;
+        x1 = x1 % width;
+    }
+    else
+        x1 = (std::min)(x1, width - 1);
+
+    auto Texel = [&] (int tx, int ty)
+    {
+        return XYZ(m_texels[chart.m_firstTexel + size_t(ty) * chart.m_width + size_t(tx)]);
+    };
+    float3 top = Texel(x0, y0) * (1.0f - fracX) + Texel(x1, y0) * fracX;
+    float3 bottom = Texel(x0, y1) * (1.0f - fracX) + Texel(x1, y1) * fracX;
+    return top * (1.0f - fracY) + bottom * fracY;
+}
+
+//----------------------------------------------------------------------------
+size_t CLightmap::SeenBlocks (std::vector<uint2>& blocks) const
+{
+    blocks.clear();
+    size_t numTexels = 0;
+    for (uint32_t chartIndex = 0; chartIndex < m_charts.size(); ++chartIndex)
+    {
+        // every texel of a chart has had the same number of samples, since they are all traced from when it's seen
+        const SLightmapChart& chart = m_charts[chartIndex];
+        if (!m_seen[chartIndex].load(std::memory_order_relaxed) || m_texels[chart.m_firstTexel][3] >= float(c_lightmapMaxSamples))
+            continue;
+
+        uint32_t chartTexels = chart.m_width * chart.m_height;
+        for (uint32_t texel = 0; texel < chartTexels; texel += c_lightmapBlockSize)
+            blocks.push_back({ chartIndex, chart.m_firstTexel + texel });
+        numTexels += chartTexels;
+    }
+    return numTexels;
+}
+
+//----------------------------------------------------------------------------
+size_t CLightmap::NumSeenCharts () const
+{
+    size_t seen = 0;
+    for (const std::atomic<uint8_t>& chartSeen : m_seen)
+    {
+        if (chartSeen.load(std::memory_order_relaxed))
+            ++seen;
+    }
+    return seen;
+}
@@ -0,0 +1,131 @@
+#pragma once
+
+#include <vector>
+#include <atomic>
+#include <algorithm>
+#include <cmath>
+#include <stdint.h>
+#include "ShaderTypes.h"
+#include "BVH.h"
+
+// An object space lighting cache for the CPU path tracer, the "object space path tracing" idea in notes.txt. The scenes
+// are static and diffuse, so the light a surface reflects doesn't depend on where it's seen from, and it can be path
+// traced into texels on the surfaces instead of into the pixels. The camera can then move without throwing away what
+// has been accumulated: pixels only need to find which texels they see and look them up.
+//
+// Each side of each surface gets a chart, a block of texels covering it with a parameterization of its own. Spheres
+// are latitude and longitude, with u going around the y axis starting at +x and v going down from +y. Quads have u
+// from A to B and v from A to D, bilinearly. Each of the six faces of an OBB is a chart, with u and v along the two
+// other axes of the box. Triangles have u from A to B and v from A to C, which covers the triangle with the half of
+// the chart under the diagonal. The texels over the diagonal are lit at the points mirrored back across it, so that
+// bilinear lookups near the diagonal read points on the triangle. Model triangles get a chart for each model, since
+// instances of a mesh are lit differently. Spheres and OBBs are only seen from outside and get one chart per surface,
+// while quads and triangles get one for each side.
+//
+// The charts are sized to their surfaces with one texel size for the whole scene, picked so that all of the charts
+// come to about the texel budget, except that no side of a chart is less than c_lightmapMinChartSize texels or more than
+// c_lightmapMaxChartSize. Each texel holds the average of the radiance that paths starting from random points in it
+// found, like a pixel of pathTraceOutput, and how many samples that is.
+//
+// Only the charts the camera has seen are traced, so a frame costs a path per texel of the surfaces that have been in
+// view, not of the whole scene, and only until they have c_lightmapMaxSamples. After that, views of them only cost the
+// lookups. Newly seen charts start black and converge from there while the rest stay converged.
+// Texels are lit at points that can be inside other geometry, like where a box sits on the floor, and the bilinear
+// lookup bleeds that darkness up to a texel into the surface that can be seen.
+//
+// This is a CPU prototype, used by the Renderer's -lightmap and the benchmark. The D3D11 app doesn't use it and still
+// starts accumulating over when the camera moves. Using it there would need the first hit shader to write each pixel's
+// chart and uv, a lightmap buffer and a compute shader doing PathTraceLightmapKernel() over the seen blocks, and the
+// shader that resolves pathTraceOutput to do the lookups instead of the camera move clearing it.
+//
+// There's no automatic parameterization or chart packing either. Every model triangle gets a chart of its own per
+// side, and per instance of the mesh, so every one of them costs a chart and at least 2x2 texels no matter how small it
+// is. The texels are one array, so charts don't need to be packed into a texture, but a dense mesh spends the budget
+// on minimum size charts. Of the 1360 model triangle charts, 590 are at the minimum size in ObjTest and 1212 in
+// GlowingJets, and one instance of cat.obj's 2082 triangles would be 4164 charts and at least 16656 texels.
+
+static const size_t c_lightmapDefaultTexels = 256 * 1024;
+static const uint32_t c_lightmapMinChartSize = 2;               // texels along a side of a chart, so there are texels to interpolate
+static const uint32_t c_lightmapMaxChartSize = 512;
+static const uint32_t c_lightmapBlockSize = 64;                 // texels per group of PathTraceLightmapKernel()
+static const uint32_t c_lightmapMaxSamples = 256;               // texels stop being traced at this many samples
+static const uint32_t c_lightmapNoChart = 0xFFFFFFFF;
+static const uint32_t c_lightmapRandomBounce = 0xFFFC;          // PathTraceLightmapKernel() keys the random point in the texel with this bounce
+
+// The texels of a chart are width x height, row by row, starting at firstTexel. sub is the face of an OBB, from 0 to 5
+// for -x, +x, -y, +y, -z, +z, or which of ModelTriangles it is for a model.
+struct SLightmapChart
+{
+    EScenePrimitive m_type;
+    uint32_t m_index;
+    uint32_t m_sub;
+    bool m_backSide;        // the side of a quad or triangle facing away from its normal
+    uint32_t m_firstTexel;
+    uint32_t m_width;
+    uint32_t m_height;
+};
+
+// which chart a pixel's first hit is in and where in it, or c_lightmapNoChart if the camera ray missed
+struct SLightmapPixel
+{
+    uint32_t m_chart = c_lightmapNoChart;
+    float2 m_uv = { 0.0f, 0.0f };
+};
+
+// a point on a chart's surface, with the normal of the chart's side
+struct SLightmapSurface
+{
+    float3 m_position;
+    float3 m_normal;
+    float3 m_albedo;
+};
+
+class CLightmap
+{
+public:
+    // makes the charts of the scene in ShaderData with about texelBudget texels in all, all unseen and black, and the
+    // pixels of a numPixels image, all missing
+    void Build (size_t texelBudget, size_t numPixels);
+
+    // which chart a ray hit at pos on the primitive, and where in it, for rays hitting the side that hitNormal faces.
+    // modelTriangle is which of ModelTriangles was hit for models.
+    uint32_t ChartUV (EScenePrimitive type, uint32_t index, uint32_t modelTriangle, const float3& pos, const float3& hitNormal, float2& uv) const;
+
+    // the point at uv in the chart, where uv is in [0, 1]
+    SLightmapSurface Surface (uint32_t chart, float2 uv) const;
+
+    // the radiance at uv in the chart, interpolated bilinearly between the texel centers
+    float3 Lookup (uint32_t chart, const float2& uv) const;
+
+    // charts are traced from the frame after they are first seen on
+    void MarkSeen (uint32_t chart) { m_seen[chart].store(1, std::memory_order_relaxed); }
+
+    // Fills blocks with the texels of the seen charts that have fewer than c_lightmapMaxSamples, in blocks of
+    // c_lightmapBlockSize for PathTraceLightmapKernel(). Each block is the chart and the first texel of the block. Gives
+    // how many texels that is.
+    size_t SeenBlocks (std::vector<uint2>& blocks) const;
+
+    const SLightmapChart& Chart (uint32_t chart) const { return m_charts[chart]; }
+    float4& Texel (size_t texel) { return m_texels[texel]; }
+    SLightmapPixel& Pixel (size_t pixel) { return m_pixels[pixel]; }
+    const SLightmapPixel& Pixel (size_t pixel) const { return m_pixels[pixel]; }
+
+    size_t NumCharts () const { return m_charts.size(); }
+    size_t NumTexels () const { return m_texels.size(); }
+    size_t NumSeenCharts () const;
+    float TexelSize () const { return m_texelSize; }
+
+private:
+    std::vector<SLightmapChart> m_charts;
+    std::vector<float4> m_texels;       // the average radiance, and the samples in w
+    std::vector<std::atomic<uint8_t>> m_seen;
+    std::vector<SLightmapPixel> m_pixels;   // written by PathTraceLightmapFirstHitKernel()
+    float m_texelSize = 1.0f;
+
+    // the first chart of each primitive, and of each model's triangles
+    std::vector<uint32_t> m_sphereCharts;
+    std::vector<uint32_t> m_triangleCharts;
+    std::vector<uint32_t> m_quadCharts;
+    std::vector<uint32_t> m_obbCharts;
+    std::vector<uint32_t> m_modelCharts;
+};
@@ -0,0 +1,294 @@
+#include "PathGuiding.h"
+
+static const float c_pathGuidingOneMinusEpsilon = 0.99999994f;  // the largest float under 1
+static const uint32_t c_pathGuidingNoNode = 0xFFFFFFFF;
+
+//----------------------------------------------------------------------------
+static void AtomicAdd (std::atomic<float>& sum, float value)
+{
+    float old = sum.load(std::memory_order_relaxed);
+    while (!sum.compare_exchange_weak(old, old + value, std::memory_order_relaxed));
+}
+
+//----------------------------------------------------------------------------
+static float NodeTotal (const SPathGuidingQuadNode& node)
+{
+    return node.m_sums[0].load(std::memory_order_relaxed) + node.m_sums[1].load(std::memory_order_relaxed) +
+        node.m_sums[2].load(std::memory_order_relaxed) + node.m_sums[3].load(std::memory_order_relaxed);
+}
+
+//----------------------------------------------------------------------------
+// which quadrant of a node uv is in, and where uv is inside of that quadrant
+static uint32_t Quadrant (float2& uv)
+{
+    uint32_t x = uv[0] >= 0.5f ? 1 : 0;
+    uint32_t y = uv[1] >= 0.5f ? 1 : 0;
+    uv[0] = uv[0] * 2.0f - float(x);
+    uv[1] = uv[1] * 2.0f - float(y);
+    return (y << 1) | x;
+}
+
+//----------------------------------------------------------------------------
+void CPathGuidingQuadtree::Record (float2 uv, float value)
+{
+    uint32_t nodeIndex = 0;
+    while (true)
+    {
+        SPathGuidingQuadNode& node = m_nodes[nodeIndex];
+        uint32_t quadrant = Quadrant(uv);
+        if (node.m_children[quadrant] == 0)
+        {
+            AtomicAdd(node.m_sums[quadrant], value);
+            return;
+        }
+        nodeIndex = node.m_children[quadrant];
+    }
+}
+
+//----------------------------------------------------------------------------
+void CPathGuidingQuadtree::Sum ()
+{
+    // children come after their parents, so going backwards sums the children first
+    for (size_t nodeIndex = m_nodes.size(); nodeIndex-- > 0; )
+    {
+        SPathGuidingQuadNode& node = m_nodes[nodeIndex];
+        for (size_t quadrant = 0; quadrant < 4; ++quadrant)
+        {
+            if (node.m_children[quadrant] != 0)
+                node.m_sums[quadrant] = NodeTotal(m_nodes[node.m_children[quadrant]]);
+        }
+    }
+}
+
+//----------------------------------------------------------------------------
+float CPathGuidingQuadtree::Total () const
+{
+    return NodeTotal(m_nodes[0]);
+}
+
+//----------------------------------------------------------------------------
+void CPathGuidingQuadtree::Build (const CPathGuidingQuadtree& from)
+{
+    float total = from.Total();
+    m_nodes.clear();
+    BuildNode(from, 0, total, total, 1);
+}
+
+//----------------------------------------------------------------------------
+// fromNode is c_pathGuidingNoNode where from wasn't subdivided as far, and its radiance is taken to be spread evenly
+uint32_t CPathGuidingQuadtree::BuildNode (const CPathGuidingQuadtree& from, uint32_t fromNode, float nodeSum, float total, size_t depth)
+{
+    uint32_t nodeIndex = (uint32_t)m_nodes.size();
+    m_nodes.emplace_back();
+    if (depth >= c_pathGuidingMaxDirectionalDepth || total <= 0.0f)
+        return nodeIndex;
+
+    for (size_t quadrant = 0; quadrant < 4; ++quadrant)
+    {
+        float quadrantSum = nodeSum * 0.25f;
+        uint32_t fromChild = c_pathGuidingNoNode;
+        if (fromNode != c_pathGuidingNoNode)
+        {
+            const SPathGuidingQuadNode& node = from.m_nodes[fromNode];
+            quadrantSum = node.m_sums[quadrant].load(std::memory_order_relaxed);
+            if (node.m_children[quadrant] != 0)
+                fromChild = node.m_children[quadrant];
+        }
+
+        if (quadrantSum > total * c_pathGuidingSplitFraction)
+        {
+            uint32_t child = BuildNode(from, fromChild, quadrantSum, total, depth + 1);
+            m_nodes[nodeIndex].m_children[quadrant] = child;
+        }
+    }
+    return nodeIndex;
+}
+
+//----------------------------------------------------------------------------
+float2 CPathGuidingQuadtree::Sample (float2 rnd, float& pdf) const
+{
+    pdf = 1.0f;
+    float2 origin = { 0.0f, 0.0f };
+    float size = 1.0f;
+    uint32_t nodeIndex = 0;
+    while (true)
+    {
+        const SPathGuidingQuadNode& node = m_nodes[nodeIndex];
+        float sums[4];
+        for (size_t quadrant = 0; quadrant < 4; ++quadrant)
+            sums[quadrant] = node.m_sums[quadrant].load(std::memory_order_relaxed);
+
+        // a node with nothing recorded in it is sampled uniformly
+        float total = sums[0] + sums[1] + sums[2] + sums[3];
+        if (total <= 0.0f)
+            break;
+
+        // pick the column from the sums of the two quadrants in it, then the quadrant in the column, and keep what's
+        // left of each random number for further down
+        float leftProbability = (sums[0] + sums[2]) / total;
+        uint32_t x = rnd[0] < leftProbability ? 0 : 1;
+        rnd[0] = x == 0 ? rnd[0] / leftProbability : (rnd[0] - leftProbability) / (1.0f - leftProbability);
+
+        float columnSum = sums[x] + sums[2 + x];
+        float bottomProbability = columnSum > 0.0f ? sums[x] / columnSum : 0.5f;
+        uint32_t y = rnd[1] < bottomProbability ? 0 : 1;
+        rnd[1] = y == 0 ? rnd[1] / bottomProbability : (rnd[1] - bottomProbability) / (1.0f - bottomProbability);
+
+        rnd[0] = (std::min)((std::max)(rnd[0], 0.0f), c_pathGuidingOneMinusEpsilon);
+        rnd[1] = (std::min)((std::max)(rnd[1], 0.0f), c_pathGuidingOneMinusEpsilon);
+
+        pdf *= 4.0f * sums[(y << 1) | x] / total;
+        size *= 0.5f;
+        origin[0] += float(x) * size;
+        origin[1] += float(y) * size;
+
+        uint32_t child = node.m_children[(y << 1) | x];
+        if (child == 0)
+            break;
+        nodeIndex = child;
+    }
+    return { origin[0] + rnd[0] * size, origin[1] + rnd[1] * size };
+}
+
+//----------------------------------------------------------------------------
+// Each level down the quadrant's share of the node's radiance is spread over a quarter of the node's area
+float CPathGuidingQuadtree::Pdf (float2 uv) const
+{
+    float pdf = 1.0f;
+    uint32_t nodeIndex = 0;
+    while (true)
+    {
+        const SPathGuidingQuadNode& node = m_nodes[nodeIndex];
+        float total = NodeTotal(node);
+        if (total <= 0.0f)
+            return pdf;
+
+        uint32_t quadrant = Quadrant(uv);
+        pdf *= 4.0f * node.m_sums[quadrant].load(std::memory_order_relaxed) / total;
+        if (pdf <= 0.0f || node.m_children[quadrant] == 0)
+            return pdf;
+        nodeIndex = node.m_children[quadrant];
+    }
+}
+
+//----------------------------------------------------------------------------
+void CPathGuiding::Reset (const float3& boundsMin, const float3& boundsMax)
+{
+    // cubify the bounds, a little bigger so the points on the far sides are inside
+    m_boundsMin = boundsMin;
+    m_boundsSize = (std::max)((std::max)(boundsMax[0] - boundsMin[0], boundsMax[1] - boundsMin[1]), boundsMax[2] - boundsMin[2]) * 1.001f;
+    if (!(m_boundsSize > 0.0f))
+        m_boundsSize = 1.0f;
+
+    m_nodes.clear();
+    m_nodes.emplace_back();
+    m_leaves.clear();
+    m_leaves.emplace_back();
+    m_iteration = 0;
+    m_iterationFrames = 0;
+}
+
+//----------------------------------------------------------------------------
+SPathGuidingLeaf& CPathGuiding::FindLeaf (const float3& pos)
+{
+    float3 p;
+    for (size_t axis = 0; axis < 3; ++axis)
+        p[axis] = (std::min)((std::max)((pos[axis] - m_boundsMin[axis]) / m_boundsSize, 0.0f), 1.0f);
+
+    uint32_t nodeIndex = 0;
+    size_t depth = 0;
+    while (!m_nodes[nodeIndex].m_isLeaf)
+    {
+        size_t axis = depth % 3;
+        uint32_t side = p[axis] >= 0.5f ? 1 : 0;
+        p[axis] = p[axis] * 2.0f - float(side);
+        nodeIndex = m_nodes[nodeIndex].m_children[side];
+        ++depth;
+    }
+    return m_leaves[m_nodes[nodeIndex].m_leaf];
+}
+
+//----------------------------------------------------------------------------
+// Records the average of the color channels, like the paper
+void CPathGuiding::Record (const float3& pos, const float3& dir, const float3& radiance, float pdf)
+{
+    if (pdf <= 0.0f)
+        return;
+
+    float value = (radiance[0] + radiance[1] + radiance[2]) / (3.0f * pdf);
+    if (!std::isfinite(value) || value < 0.0f)
+        return;
+
+    SPathGuidingLeaf& leaf = FindLeaf(pos);
+    if (value > 0.0f)
+        leaf.m_training.Record(PathGuidingDirectionToSquare(dir), value);
+    leaf.m_records.fetch_add(1, std::memory_order_relaxed);
+}
+
+//----------------------------------------------------------------------------
+void CPathGuiding::FrameDone ()
+{
+    if (!Training())
+        return;
+
+    ++m_iterationFrames;
+    if (m_iterationFrames >= (size_t(1) << m_iteration))
+        EndIteration();
+}
+
+//----------------------------------------------------------------------------
+void CPathGuiding::SplitNode (uint32_t nodeIndex, size_t depth, uint32_t threshold)
+{
+    if (!m_nodes[nodeIndex].m_isLeaf)
+    {
+        uint32_t children[2] = { m_nodes[nodeIndex].m_children[0], m_nodes[nodeIndex].m_children[1] };
+        SplitNode(children[0], depth + 1, threshold);
+        SplitNode(children[1], depth + 1, threshold);
+        return;
+    }
+
+    uint32_t leafIndex = m_nodes[nodeIndex].m_leaf;
+    if (depth >= c_pathGuidingMaxSpatialDepth || m_leaves[leafIndex].m_records.load(std::memory_order_relaxed) <= threshold)
+        return;
+
+    // both halves start out with the quadtrees of the whole, and are assumed to have gotten half of its records each
+    m_leaves[leafIndex].m_records = m_leaves[leafIndex].m_records.load(std::memory_order_relaxed) / 2;
+    SPathGuidingLeaf copy(m_leaves[leafIndex]);
+    m_leaves.push_back(copy);
+
+    SPathGuidingSpatialNode child;
+    child.m_leaf = leafIndex;
+    m_nodes.push_back(child);
+    child.m_leaf = (uint32_t)m_leaves.size() - 1;
+    m_nodes.push_back(child);
+
+    SPathGuidingSpatialNode& node = m_nodes[nodeIndex];
+    node.m_isLeaf = false;
+    node.m_children[0] = (uint32_t)m_nodes.size() - 2;
+    node.m_children[1] = (uint32_t)m_nodes.size() - 1;
+
+    SplitNode(node.m_children[0], depth + 1, threshold);
+    SplitNode(m_nodes[nodeIndex].m_children[1], depth + 1, threshold);
+}
+
+//----------------------------------------------------------------------------
+void CPathGuiding::EndIteration ()
+{
+    uint32_t threshold = uint32_t(c_pathGuidingSpatialThreshold * std::sqrt(float(size_t(1) << m_iteration)));
+    SplitNode(0, 0, threshold);
+
+    // a leaf that got no radiance keeps guiding with what it had before
+    for (SPathGuidingLeaf& leaf : m_leaves)
+    {
+        leaf.m_training.Sum();
+        if (leaf.m_training.Total() > 0.0f)
+        {
+            leaf.m_sampling = leaf.m_training;
+            leaf.m_training.Build(leaf.m_sampling);
+        }
+        leaf.m_records = 0;
+    }
+
+    ++m_iteration;
+    m_iterationFrames = 0;
+}
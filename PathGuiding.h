@@ -0,0 +1,226 @@
+#pragma once
+
+#include <vector>
+#include <atomic>
+#include <algorithm>
+#include <cmath>
+#include <stdint.h>
+#include "ShaderTypes.h"
+
+// Path guiding for the CPU path tracer, after Muller, Gross and Novak's "Practical Path Guiding for Efficient
+// Light-Transport Simulation". It learns the incoming radiance at every point of the scene while rendering, and bounces
+// are sampled from it, mixed with cosine weighted sampling, so paths go where the light comes from.
+//
+// The scene's bounds are cubified and split in half along x, y and z in turn by a binary spatial tree. Each leaf holds
+// a directional quadtree over the sphere of directions, mapped to the unit square with an equal area mapping: u is
+// (cos(theta) + 1) / 2, with theta from +y, and v is phi / 2 pi, going around the y axis starting at +x. Each quadtree
+// node holds how much radiance arrived through each of its four quadrants.
+//
+// Learning happens in iterations that each render twice as many frames as the one before. Finished paths deposit the
+// radiance they found at each vertex, times the cosine to the vertex's normal and over the pdf the bounce was taken
+// with, into the training quadtree of the leaf the vertex is in. The paper learns just the radiance, but the surfaces
+// here are all diffuse, so this learns the product that the bounces should be sampled by, and the cosine tames the
+// records of grazing cosine weighted bounces, which would otherwise be very noisy.
+//
+// At the end of an iteration, leaves that got more than c_pathGuidingSpatialThreshold * sqrt(2^k) records in iteration
+// k are split in two, and the training quadtrees become the sampling quadtrees. The new training quadtrees subdivide
+// the quadrants holding more than c_pathGuidingSplitFraction of the radiance and merge the rest.
+//
+// Rendering threads record into the training quadtrees at the same time with atomics, while the trees only change
+// shape between frames, in FrameDone().
+
+static const float c_pathGuidingCosineFraction = 0.75f;         // the probability of a bounce being cosine weighted instead of guided
+static const float c_pathGuidingSpatialThreshold = 2000.0f;     // c in the records a leaf can get before splitting, c * sqrt(2^k). The paper's 12000 is for many more paths per frame.
+static const float c_pathGuidingSplitFraction = 0.01f;          // the fraction of a quadtree's radiance a quadrant can hold before being subdivided
+static const size_t c_pathGuidingMaxDirectionalDepth = 20;
+static const size_t c_pathGuidingMaxSpatialDepth = 24;
+static const size_t c_pathGuidingTrainingIterations = 7;        // iterations 0 to 6 train for 1 + 2 + 4 + ... + 64 = 127 frames
+static const size_t c_pathGuidingMaxVertices = 32;              // path vertices past this many aren't recorded
+
+//----------------------------------------------------------------------------
+inline float2 PathGuidingDirectionToSquare (const float3& dir)
+{
+    float u = ((std::min)((std::max)(dir[1], -1.0f), 1.0f) + 1.0f) * 0.5f;
+    float v = std::atan2(dir[2], dir[0]) / (2.0f * c_pi);
+    if (v < 0.0f)
+        v += 1.0f;
+    return { u, v };
+}
+
+//----------------------------------------------------------------------------
+inline float3 PathGuidingSquareToDirection (const float2& uv)
+{
+    float cosTheta = 2.0f * uv[0] - 1.0f;
+    float sinTheta = std::sqrt((std::max)(1.0f - cosTheta * cosTheta, 0.0f));
+    float phi = 2.0f * c_pi * uv[1];
+    return { sinTheta * std::cos(phi), cosTheta, sinTheta * std::sin(phi) };
+}
+
+// A quadtree node. Quadrant (y << 1) | x covers [x/2, (x+1)/2) x [y/2, (y+1)/2) of the node, and a child index of 0 means
+// the quadrant isn't subdivided, since the root is node 0.
+struct SPathGuidingQuadNode
+{
+    SPathGuidingQuadNode ()
+    {
+        for (size_t i = 0; i < 4; ++i)
+        {
+            m_sums[i] = 0.0f;
+            m_children[i] = 0;
+        }
+    }
+
+    SPathGuidingQuadNode (const SPathGuidingQuadNode& other)
+    {
+        for (size_t i = 0; i < 4; ++i)
+        {
+            m_sums[i] = other.m_sums[i].load(std::memory_order_relaxed);
+            m_children[i] = other.m_children[i];
+        }
+    }
+
+    SPathGuidingQuadNode& operator = (const SPathGuidingQuadNode& other)
+    {
+        for (size_t i = 0; i < 4; ++i)
+        {
+            m_sums[i] = other.m_sums[i].load(std::memory_order_relaxed);
+            m_children[i] = other.m_children[i];
+        }
+        return *this;
+    }
+
+    std::atomic<float> m_sums[4];
+    uint32_t m_children[4];
+};
+
+class CPathGuidingQuadtree
+{
+public:
+    CPathGuidingQuadtree () : m_nodes(1) { }
+
+    // adds value to the quadrant at the bottom of the tree holding uv
+    void Record (float2 uv, float value);
+
+    // Makes the sums of the subdivided quadrants the totals of their children, after recording
+    void Sum ();
+
+    // Rebuilds the tree with no radiance in it, subdividing where from had more than the split fraction of its radiance
+    void Build (const CPathGuidingQuadtree& from);
+
+    // picks a point of the unit square proportionally to the radiance, and gives the same density Pdf() would
+    float2 Sample (float2 rnd, float& pdf) const;
+    float Pdf (float2 uv) const;
+
+    float Total () const;
+
+private:
+    uint32_t BuildNode (const CPathGuidingQuadtree& from, uint32_t fromNode, float nodeSum, float total, size_t depth);
+
+    std::vector<SPathGuidingQuadNode> m_nodes;
+};
+
+// A spatial tree leaf. The records count the training quadtree's records this iteration.
+struct SPathGuidingLeaf
+{
+    SPathGuidingLeaf () : m_records(0) { }
+    SPathGuidingLeaf (const SPathGuidingLeaf& other)
+        : m_sampling(other.m_sampling)
+        , m_training(other.m_training)
+        , m_records(other.m_records.load(std::memory_order_relaxed))
+    { }
+
+    CPathGuidingQuadtree m_sampling;
+    CPathGuidingQuadtree m_training;
+    std::atomic<uint32_t> m_records;
+};
+
+// Interior spatial tree nodes split their box in half along axis depth % 3, into m_children[0] below the middle and
+// m_children[1] above it. Leaves have m_leaf set instead.
+struct SPathGuidingSpatialNode
+{
+    uint32_t m_children[2] = { 0, 0 };
+    uint32_t m_leaf = 0;
+    bool m_isLeaf = true;
+};
+
+class CPathGuiding
+{
+public:
+    // starts learning over from nothing, inside the box from boundsMin to boundsMax
+    void Reset (const float3& boundsMin, const float3& boundsMax);
+
+    SPathGuidingLeaf& FindLeaf (const float3& pos);
+
+    void Record (const float3& pos, const float3& dir, const float3& radiance, float pdf);
+
+    // call when a frame is done rendering, to end the iteration when it's rendered all of its frames
+    void FrameDone ();
+
+    // bounces are guided once the first iteration is done, and paths are recorded until the last one is
+    bool Sampling () const { return m_iteration > 0; }
+    bool Training () const { return m_iteration < c_pathGuidingTrainingIterations; }
+
+    size_t Iteration () const { return m_iteration; }
+    size_t NumLeaves () const { return m_leaves.size(); }
+
+private:
+    void EndIteration ();
+    void SplitNode (uint32_t nodeIndex, size_t depth, uint32_t threshold);
+
+    float3 m_boundsMin = { 0.0f, 0.0f, 0.0f };
+    float m_boundsSize = 1.0f;
+    std::vector<SPathGuidingSpatialNode> m_nodes;
+    std::vector<SPathGuidingLeaf> m_leaves;
+    size_t m_iteration = 0;
+    size_t m_iterationFrames = 0;
+};
+
+// The vertices of a path being traced, so that the radiance each one receives from the rest of the path can be
+// recorded when the path is done. m_throughput is what light arriving at the vertex is multiplied by on its way to
+// the camera, so dividing the path's later contributions by it gives the radiance arriving at the vertex.
+struct SPathGuidingVertex
+{
+    float3 m_position;
+    float3 m_direction;
+    float3 m_throughput;
+    float3 m_radiance;
+    float m_cosine;
+    float m_pdf;
+};
+
+struct SPathGuidingPath
+{
+    void AddVertex (const float3& position, const float3& direction, const float3& throughput, float cosine, float pdf)
+    {
+        if (m_numVertices >= c_pathGuidingMaxVertices)
+            return;
+        SPathGuidingVertex& vertex = m_vertices[m_numVertices++];
+        vertex.m_position = position;
+        vertex.m_direction = direction;
+        vertex.m_throughput = throughput;
+        vertex.m_radiance = { 0.0f, 0.0f, 0.0f };
+        vertex.m_cosine = cosine;
+        vertex.m_pdf = pdf;
+    }
+
+    void AddLight (const float3& light)
+    {
+        for (size_t i = 0; i < m_numVertices; ++i)
+        {
+            SPathGuidingVertex& vertex = m_vertices[i];
+            for (size_t channel = 0; channel < 3; ++channel)
+            {
+                if (vertex.m_throughput[channel] > 0.0f)
+                    vertex.m_radiance[channel] += light[channel] / vertex.m_throughput[channel];
+            }
+        }
+    }
+
+    void Commit (CPathGuiding& pathGuiding) const
+    {
+        for (size_t i = 0; i < m_numVertices; ++i)
+            pathGuiding.Record(m_vertices[i].m_position, m_vertices[i].m_direction, m_vertices[i].m_radiance * m_vertices[i].m_cosine, m_vertices[i].m_pdf);
+    }
+
+    SPathGuidingVertex m_vertices[c_pathGuidingMaxVertices];
+    size_t m_numVertices = 0;
+};
@@ -0,0 +1,2125 @@
+#pragma once
+
+// C++ versions of the ray tracing routines in Shaders/PathTrace.h, working on the same ShaderTypes structs.
+// Keep these in sync with the shader code.
+
+#include <float.h>
+#include "ShaderTypes.h"
+#include "BVH.h"
+#include "BVH8.h"
+#include "LightTree.h"
+#include "Environment.h"
+#include "PathGuiding.h"
+#include "RadianceCache.h"
+#include "TriangleBlock.h"
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+static const float c_rayEpsilon = 0.001f;
+static const float c_oneMinusEpsilon = 0.99999994f;    // the largest float under 1
+static const float c_environmentDistance = 10000.0f;   // how far shadow rays towards the environment go
+
+//----------------------------------------------------------------------------
+struct SRayHitInfo
+{
+    float  m_intersectTime = -1.0f;
+    float3 m_surfaceNormal = { 0.0f, 0.0f, 0.0f };
+    float3 m_albedo = { 0.0f, 0.0f, 0.0f };
+    float3 m_emissive = { 0.0f, 0.0f, 0.0f };
+    int    m_lightIndex = -1;   // where the emitter is in the Lights buffer, or -1 if light sampling doesn't know about it
+};
+
+//----------------------------------------------------------------------------
+inline bool RayIntersectsSphereBoolean (const float3& rayPos, const float3& rayDir, const float3& position, float radius, float maxIntersectTime)
+{
+    //get the vector from the center of this circle to where the ray begins.
+    float3 m = rayPos - position;
+
+    //get the dot product of the above vector and the ray's vector
+    float b = Dot(m, rayDir);
+
+    float c = Dot(m, m) - radius * radius;
+
+    //exit if r's origin outside s (c > 0) and r pointing away from s (b > 0)
+    if (c > 0.0f && b > 0.0f)
+        return false;
+
+    //calculate discriminant
+    float discr = b * b - c;
+
+    //a negative discriminant corresponds to ray missing sphere
+    if (discr <= 0.0f)
+        return false;
+
+    //ray now found to intersect sphere, compute smallest t value of intersection
+    float collisionTime = -b - std::sqrt(discr);
+
+    //if t is negative, ray started inside sphere so clamp t to zero and remember that we hit from the inside
+    if (collisionTime < 0.0f)
+        collisionTime = -b + std::sqrt(discr);
+
+    //enforce a max distance if we should
+    if (maxIntersectTime >= 0.0f && collisionTime > maxIntersectTime)
+        return false;
+
+    return true;
+}
+
+//----------------------------------------------------------------------------
+inline bool RayIntersectsBox (const float3& rayPos, const float3& rayInvDir, const float4& boxMin, const float4& boxMax, float maxIntersectTime)
+{
+    // slab test. infinities from axis aligned rays work out correctly.
+    float enter = 0.0f;
+    float exit = FLT_MAX;
+    for (size_t axis = 0; axis < 3; ++axis)
+    {
+        float t0 = (boxMin[axis] - rayPos[axis]) * rayInvDir[axis];
+        float t1 = (boxMax[axis] - rayPos[axis]) * rayInvDir[axis];
+        enter = (std::max)(enter, (std::min)(t0, t1));
+        exit = (std::min)(exit, (std::max)(t0, t1));
+    }
+
+    //enforce a max distance if we should
+    if (maxIntersectTime >= 0.0f && enter > maxIntersectTime)
+        return false;
+
+    return enter <= exit;
+}
+
+//----------------------------------------------------------------------------
+inline float3 UndoChangeBasis (const float3& v, const float3& xAxis, const float3& yAxis, const float3& zAxis)
+{
+    return { Dot(v, xAxis), Dot(v, yAxis), Dot(v, zAxis) };
+}
+
+//----------------------------------------------------------------------------
+inline float ScalarTriple (const float3& a, const float3& b, const float3& c)
+{
+    return Dot(Cross(a, b), c);
+}
+
+//----------------------------------------------------------------------------
+inline bool RayIntersectsAABB (const float3& rayPos, const float3& rayDir, const ShaderTypes::StructuredBuffers::OBBPrim& obb, SRayHitInfo& rayHitInfo)
+{
+    float rayMinTime = 0.0f;
+    float rayMaxTime = FLT_MAX;
+
+    // find the intersection of the intersection times of each axis to see if / where the
+    // ray hits.
+    for (size_t axis = 0; axis < 3; ++axis)
+    {
+        //calculate the min and max of the box on this axis
+        float axisMin = obb.position_w[axis] - obb.radius_w[axis];
+        float axisMax = obb.position_w[axis] + obb.radius_w[axis];
+
+        //if the ray is paralel with this axis
+        if (std::abs(rayDir[axis]) < 0.0001f)
+        {
+            //if the ray isn't in the box, bail out we know there's no intersection
+            if (rayPos[axis] < axisMin || rayPos[axis] > axisMax)
+                return false;
+        }
+        else
+        {
+            //figure out the intersection times of the ray with the 2 values of this axis
+            float axisMinTime = (axisMin - rayPos[axis]) / rayDir[axis];
+            float axisMaxTime = (axisMax - rayPos[axis]) / rayDir[axis];
+
+            //make sure min < max
+            if (axisMinTime > axisMaxTime)
+                std::swap(axisMinTime, axisMaxTime);
+
+            //union this time slice with our running total time slice
+            if (axisMinTime > rayMinTime)
+                rayMinTime = axisMinTime;
+
+            if (axisMaxTime < rayMaxTime)
+                rayMaxTime = axisMaxTime;
+
+            //if our time slice shrinks to below zero of a time window, we don't intersect
+            if (rayMinTime > rayMaxTime)
+                return false;
+        }
+    }
+
+    //if we got here, we do intersect, return our collision info
+    bool fromInside = (rayMinTime == 0.0f);
+    float collisionTime = fromInside ? rayMaxTime : rayMinTime;
+
+    //enforce a max distance if we should
+    if (rayHitInfo.m_intersectTime >= 0.0f && collisionTime > rayHitInfo.m_intersectTime)
+        return false;
+
+    if (collisionTime < 0.0f)
+        return false;
+
+    float3 intersectionPoint = rayPos + rayDir * collisionTime;
+
+    // figure out the surface normal by figuring out which axis we are closest to
+    float closestDist = FLT_MAX;
+    float3 normal = { 0.0f, 0.0f, 0.0f };
+    for (size_t axis = 0; axis < 3; ++axis)
+    {
+        float distFromPos = std::abs(obb.position_w[axis] - intersectionPoint[axis]);
+        float distFromEdge = std::abs(distFromPos - obb.radius_w[axis]);
+
+        if (distFromEdge < closestDist)
+        {
+            closestDist = distFromEdge;
+            normal = { 0.0f, 0.0f, 0.0f };
+            normal[axis] = (intersectionPoint[axis] < obb.position_w[axis]) ? -1.0f : 1.0f;
+        }
+    }
+
+    // make sure normal is facing opposite of ray direction.
+    // this is for if we are hitting the object from the inside / back side.
+    if (Dot(normal, rayDir) > 0.0f)
+        normal = normal * -1.0f;
+
+    rayHitInfo.m_intersectTime = collisionTime;
+    rayHitInfo.m_surfaceNormal = normal;
+    rayHitInfo.m_albedo = XYZ(obb.albedo_w);
+    rayHitInfo.m_emissive = XYZ(obb.emissive_lightIndex);
+    rayHitInfo.m_lightIndex = int(obb.emissive_lightIndex[3]);
+
+    return true;
+}
+
+//----------------------------------------------------------------------------
+inline void RayIntersectsOBB (const float3& rayPos, const float3& rayDir, const ShaderTypes::StructuredBuffers::OBBPrim& obb, SRayHitInfo& rayHitInfo)
+{
+    // put the ray into local space of the obb
+    float3 newRayPos = ChangeBasis(rayPos - XYZ(obb.position_w), XYZ(obb.XAxis_w), XYZ(obb.YAxis_w), XYZ(obb.ZAxis_w)) + XYZ(obb.position_w);
+    float3 newRayDir = ChangeBasis(rayDir, XYZ(obb.XAxis_w), XYZ(obb.YAxis_w), XYZ(obb.ZAxis_w));
+
+    // do ray vs abb intersection
+    if (!RayIntersectsAABB(newRayPos, newRayDir, obb, rayHitInfo))
+        return;
+
+    // convert surface normal back to global space
+    rayHitInfo.m_surfaceNormal = UndoChangeBasis(rayHitInfo.m_surfaceNormal, XYZ(obb.XAxis_w), XYZ(obb.YAxis_w), XYZ(obb.ZAxis_w));
+}
+
+//----------------------------------------------------------------------------
+// true if the ray hits the obb no farther than maxIntersectTime. Skips the normal and material work.
+inline bool RayIntersectsOBBBoolean (const float3& rayPos, const float3& rayDir, const ShaderTypes::StructuredBuffers::OBBPrim& obb, float maxIntersectTime)
+{
+    // put the ray into local space of the obb
+    float3 localRayPos = ChangeBasis(rayPos - XYZ(obb.position_w), XYZ(obb.XAxis_w), XYZ(obb.YAxis_w), XYZ(obb.ZAxis_w)) + XYZ(obb.position_w);
+    float3 localRayDir = ChangeBasis(rayDir, XYZ(obb.XAxis_w), XYZ(obb.YAxis_w), XYZ(obb.ZAxis_w));
+
+    float rayMinTime = 0.0f;
+    float rayMaxTime = FLT_MAX;
+    for (size_t axis = 0; axis < 3; ++axis)
+    {
+        float axisMin = obb.position_w[axis] - obb.radius_w[axis];
+        float axisMax = obb.position_w[axis] + obb.radius_w[axis];
+
+        //if the ray is paralel with this axis
+        if (std::abs(localRayDir[axis]) < 0.0001f)
+        {
+            if (localRayPos[axis] < axisMin || localRayPos[axis] > axisMax)
+                return false;
+        }
+        else
+        {
+            float axisMinTime = (axisMin - localRayPos[axis]) / localRayDir[axis];
+            float axisMaxTime = (axisMax - localRayPos[axis]) / localRayDir[axis];
+            if (axisMinTime > axisMaxTime)
+                std::swap(axisMinTime, axisMaxTime);
+            rayMinTime = (std::max)(rayMinTime, axisMinTime);
+            rayMaxTime = (std::min)(rayMaxTime, axisMaxTime);
+            if (rayMinTime > rayMaxTime)
+                return false;
+        }
+    }
+
+    float collisionTime = (rayMinTime == 0.0f) ? rayMaxTime : rayMinTime;
+    if (maxIntersectTime >= 0.0f && collisionTime > maxIntersectTime)
+        return false;
+    return collisionTime >= 0.0f;
+}
+
+//----------------------------------------------------------------------------
+inline void RayIntersectsQuad (const float3& rayPos, const float3& rayDir, const ShaderTypes::StructuredBuffers::QuadPrim& quad, SRayHitInfo& rayHitInfo)
+{
+    float3 posA = XYZ(quad.positionA_w);
+    float3 posB = XYZ(quad.positionB_w);
+    float3 posC = XYZ(quad.positionC_w);
+    float3 posD = XYZ(quad.positionD_w);
+
+    // If we are viewing the quad from the back, flip the normal and vertex order so we have a two sided surface
+    float3 normal = XYZ(quad.normal_w);
+    if (Dot(normal, rayDir) > 0.0f)
+    {
+        normal = normal * -1.0f;
+        std::swap(posB, posD);
+    }
+
+    // This function adapted from "Real Time Collision Detection" 5.3.5 Intersecting Line Against Quadrilateral
+    // IntersectLineQuad()
+    float3 pa = posA - rayPos;
+    float3 pb = posB - rayPos;
+    float3 pc = posC - rayPos;
+    // Determine which triangle to test against by testing against diagonal first
+    float3 m = Cross(pc, rayDir);
+    float3 r;
+    float v = Dot(pa, m); // ScalarTriple(pq, pa, pc);
+    if (v >= 0.0f) {
+        // Test intersection against triangle abc
+        float u = -Dot(pb, m); // ScalarTriple(pq, pc, pb);
+        if (u < 0.0f) return;
+        float w = ScalarTriple(rayDir, pb, pa);
+        if (w < 0.0f) return;
+        // Compute r, r = u*a + v*b + w*c, from barycentric coordinates (u, v, w)
+        float denom = 1.0f / (u + v + w);
+        u *= denom;
+        v *= denom;
+        w *= denom; // w = 1.0f - u - v;
+        r = posA * u + posB * v + posC * w;
+    }
+    else {
+        // Test intersection against triangle dac
+        float3 pd = posD - rayPos;
+        float u = Dot(pd, m); // ScalarTriple(pq, pd, pc);
+        if (u < 0.0f) return;
+        float w = ScalarTriple(rayDir, pa, pd);
+        if (w < 0.0f) return;
+        v = -v;
+        // Compute r, r = u*a + v*d + w*c, from barycentric coordinates (u, v, w)
+        float denom = 1.0f / (u + v + w);
+        u *= denom;
+        v *= denom;
+        w *= denom; // w = 1.0f - u - v;
+        r = posA * u + posD * v + posC * w;
+    }
+
+    // figure out the time t that we hit the plane (quad)
+    float t = -1.0f;
+    if (std::abs(rayDir[0]) > 0.0f)
+        t = (r[0] - rayPos[0]) / rayDir[0];
+    else if (std::abs(rayDir[1]) > 0.0f)
+        t = (r[1] - rayPos[1]) / rayDir[1];
+    else if (std::abs(rayDir[2]) > 0.0f)
+        t = (r[2] - rayPos[2]) / rayDir[2];
+
+    // only positive time hits allowed!
+    if (t < 0.0f)
+        return;
+
+    //enforce a max distance if we should
+    if (rayHitInfo.m_intersectTime >= 0.0f && t > rayHitInfo.m_intersectTime)
+        return;
+
+    rayHitInfo.m_intersectTime = t;
+    rayHitInfo.m_surfaceNormal = normal;
+    rayHitInfo.m_albedo = XYZ(quad.albedo_w);
+    rayHitInfo.m_emissive = XYZ(quad.emissive_lightIndex);
+    rayHitInfo.m_lightIndex = int(quad.emissive_lightIndex[3]);
+}
+
+//----------------------------------------------------------------------------
+// true if the ray hits the quad no farther than maxIntersectTime. Skips the normal and material work.
+inline bool RayIntersectsQuadBoolean (const float3& rayPos, const float3& rayDir, const ShaderTypes::StructuredBuffers::QuadPrim& quad, float maxIntersectTime)
+{
+    float3 posA = XYZ(quad.positionA_w);
+    float3 posB = XYZ(quad.positionB_w);
+    float3 posC = XYZ(quad.positionC_w);
+    float3 posD = XYZ(quad.positionD_w);
+
+    // two sided, so flip the vertex order when viewed from the back
+    if (Dot(XYZ(quad.normal_w), rayDir) > 0.0f)
+        std::swap(posB, posD);
+
+    // same as RayIntersectsQuad()
+    float3 pa = posA - rayPos;
+    float3 pb = posB - rayPos;
+    float3 pc = posC - rayPos;
+    float3 m = Cross(pc, rayDir);
+    float3 r;
+    float v = Dot(pa, m);
+    if (v >= 0.0f) {
+        float u = -Dot(pb, m);
+        if (u < 0.0f) return false;
+        float w = ScalarTriple(rayDir, pb, pa);
+        if (w < 0.0f) return false;
+        float denom = 1.0f / (u + v + w);
+        r = posA * (u * denom) + posB * (v * denom) + posC * (w * denom);
+    }
+    else {
+        float3 pd = posD - rayPos;
+        float u = Dot(pd, m);
+        if (u < 0.0f) return false;
+        float w = ScalarTriple(rayDir, pa, pd);
+        if (w < 0.0f) return false;
+        v = -v;
+        float denom = 1.0f / (u + v + w);
+        r = posA * (u * denom) + posD * (v * denom) + posC * (w * denom);
+    }
+
+    float t = -1.0f;
+    if (std::abs(rayDir[0]) > 0.0f)
+        t = (r[0] - rayPos[0]) / rayDir[0];
+    else if (std::abs(rayDir[1]) > 0.0f)
+        t = (r[1] - rayPos[1]) / rayDir[1];
+    else if (std::abs(rayDir[2]) > 0.0f)
+        t = (r[2] - rayPos[2]) / rayDir[2];
+
+    if (t < 0.0f)
+        return false;
+    return maxIntersectTime < 0.0f || t <= maxIntersectTime;
+}
+
+//----------------------------------------------------------------------------
+inline void RayIntersectsSphere (const float3& rayPos, const float3& rayDir, const ShaderTypes::StructuredBuffers::SpherePrim& sphere, SRayHitInfo& rayHitInfo)
+{
+    //get the vector from the center of this circle to where the ray begins.
+    float3 m = rayPos - XYZ(sphere.position_Radius);
+
+    //get the dot product of the above vector and the ray's vector
+    float b = Dot(m, rayDir);
+
+    float c = Dot(m, m) - sphere.position_Radius[3] * sphere.position_Radius[3];
+
+    //exit if r's origin outside s (c > 0) and r pointing away from s (b > 0)
+    if (c > 0.0f && b > 0.0f)
+        return;
+
+    //calculate discriminant
+    float discr = b * b - c;
+
+    //a negative discriminant corresponds to ray missing sphere
+    if (discr <= 0.0f)
+        return;
+
+    //ray now found to intersect sphere, compute smallest t value of intersection
+    float collisionTime = -b - std::sqrt(discr);
+
+    //if t is negative, ray started inside sphere so clamp t to zero and remember that we hit from the inside
+    if (collisionTime < 0.0f)
+        collisionTime = -b + std::sqrt(discr);
+
+    //enforce a max distance if we should
+    if (rayHitInfo.m_intersectTime >= 0.0f && collisionTime > rayHitInfo.m_intersectTime)
+        return;
+
+    float3 normal = (rayPos + rayDir * collisionTime) - XYZ(sphere.position_Radius);
+    Normalize(normal);
+
+    // make sure normal is facing opposite of ray direction.
+    // this is for if we are hitting the object from the inside / back side.
+    if (Dot(normal, rayDir) > 0.0f)
+        normal = normal * -1.0f;
+
+    rayHitInfo.m_intersectTime = collisionTime;
+    rayHitInfo.m_surfaceNormal = normal;
+    rayHitInfo.m_albedo = XYZ(sphere.albedo_w);
+    rayHitInfo.m_emissive = XYZ(sphere.emissive_lightIndex);
+    rayHitInfo.m_lightIndex = int(sphere.emissive_lightIndex[3]);
+}
+
+//----------------------------------------------------------------------------
+// TrianglePrim and ModelTrianglePrim have the same fields, so one routine handles both
+template <typename TRIANGLE>
+void RayIntersectsTriangle (const float3& rayPos, const float3& rayDir, const TRIANGLE& trianglePrim, SRayHitInfo& rayHitInfo)
+{
+    // This function adapted from GraphicsCodex.com
+
+    // Edge vectors
+    float3 e_1 = XYZ(trianglePrim.positionB_w) - XYZ(trianglePrim.positionA_w);
+    float3 e_2 = XYZ(trianglePrim.positionC_w) - XYZ(trianglePrim.positionA_w);
+
+    float3 q = Cross(rayDir, e_2);
+    float a = Dot(e_1, q);
+
+    if (std::abs(a) == 0.0f)
+        return;
+
+    float3 s = (rayPos - XYZ(trianglePrim.positionA_w)) * (1.0f / a);
+    float3 r = Cross(s, e_1);
+    float3 b; // b is barycentric coordinates
+    b[0] = Dot(s, q);
+    b[1] = Dot(r, rayDir);
+    b[2] = 1.0f - b[0] - b[1];
+    // Intersected outside triangle?
+    if ((b[0] < 0.0f) || (b[1] < 0.0f) || (b[2] < 0.0f))
+        return;
+    float t = Dot(e_2, r);
+    if (t < 0.0f)
+        return;
+
+    //enforce a max distance if we should
+    if (rayHitInfo.m_intersectTime >= 0.0f && t > rayHitInfo.m_intersectTime)
+        return;
+
+    // make sure normal is facing opposite of ray direction.
+    // this is for if we are hitting the object from the inside / back side.
+    float3 normal = XYZ(trianglePrim.normal_w);
+    if (Dot(normal, rayDir) > 0.0f)
+        normal = normal * -1.0f;
+
+    rayHitInfo.m_intersectTime = t;
+    rayHitInfo.m_surfaceNormal = normal;
+    rayHitInfo.m_albedo = XYZ(trianglePrim.albedo_w);
+    rayHitInfo.m_emissive = XYZ(trianglePrim.emissive_lightIndex);
+    rayHitInfo.m_lightIndex = int(trianglePrim.emissive_lightIndex[3]);
+}
+
+//----------------------------------------------------------------------------
+// Woop test: the precomputed transform takes the ray to triangle space, where the triangle is the unit triangle in
+// the xy plane, so the hit is where the ray crosses z = 0.
+inline void RayIntersectsTriangle (const float3& rayPos, const float3& rayDir, const SModelTriangleWoop& trianglePrim, SRayHitInfo& rayHitInfo)
+{
+    const float4& row2 = trianglePrim.m_woop[2];
+    float oz = Dot(XYZ(row2), rayPos) + row2[3];
+    float dz = Dot(XYZ(row2), rayDir);
+    if (dz == 0.0f)
+        return;
+
+    float t = -oz / dz;
+    if (t < 0.0f)
+        return;
+
+    //enforce a max distance if we should
+    if (rayHitInfo.m_intersectTime >= 0.0f && t > rayHitInfo.m_intersectTime)
+        return;
+
+    // barycentric coordinates of the hit
+    const float4& row0 = trianglePrim.m_woop[0];
+    float u = Dot(XYZ(row0), rayPos) + row0[3] + t * Dot(XYZ(row0), rayDir);
+    if (u < 0.0f)
+        return;
+    const float4& row1 = trianglePrim.m_woop[1];
+    float v = Dot(XYZ(row1), rayPos) + row1[3] + t * Dot(XYZ(row1), rayDir);
+    if (v < 0.0f || u + v > 1.0f)
+        return;
+
+    // make sure normal is facing opposite of ray direction.
+    // this is for if we are hitting the object from the inside / back side.
+    float3 normal = XYZ(trianglePrim.normal_w);
+    if (Dot(normal, rayDir) > 0.0f)
+        normal = normal * -1.0f;
+
+    rayHitInfo.m_intersectTime = t;
+    rayHitInfo.m_surfaceNormal = normal;
+    rayHitInfo.m_albedo = XYZ(trianglePrim.albedo_w);
+    rayHitInfo.m_emissive = XYZ(trianglePrim.emissive_lightIndex);
+    rayHitInfo.m_lightIndex = int(trianglePrim.emissive_lightIndex[3]);
+}
+
+//----------------------------------------------------------------------------
+// true if the ray hits the triangle no farther than maxIntersectTime. Takes positions so it works for TrianglePrim and
+// ModelTrianglePrim, and skips the normal and material work.
+inline bool RayIntersectsTriangleBoolean (const float3& rayPos, const float3& rayDir, const float3& positionA, const float3& positionB, const float3& positionC, float maxIntersectTime)
+{
+    // Edge vectors
+    float3 e_1 = positionB - positionA;
+    float3 e_2 = positionC - positionA;
+
+    float3 q = Cross(rayDir, e_2);
+    float a = Dot(e_1, q);
+    if (std::abs(a) == 0.0f)
+        return false;
+
+    float3 s = (rayPos - positionA) * (1.0f / a);
+    float3 r = Cross(s, e_1);
+    float b0 = Dot(s, q);
+    float b1 = Dot(r, rayDir);
+    float b2 = 1.0f - b0 - b1;
+    if ((b0 < 0.0f) || (b1 < 0.0f) || (b2 < 0.0f))
+        return false;
+    float t = Dot(e_2, r);
+    if (t < 0.0f)
+        return false;
+    return maxIntersectTime < 0.0f || t <= maxIntersectTime;
+}
+
+//----------------------------------------------------------------------------
+// walks a BVH from rootNode, calling lambda(primIndex) on the primitives of each leaf the ray enters.
+// The lambda should update rayHitInfo so that closer hits cull farther nodes.
+template <typename NODES, typename LAMBDA>
+void TraverseBVH (const float3& rayPos, const float3& rayDir, const NODES& nodes, unsigned int rootNode, const SRayHitInfo& rayHitInfo, LAMBDA&& lambda)
+{
+    // visit the nearer child first so closer hits can cull farther nodes
+    float3 rayInvDir = { 1.0f / rayDir[0], 1.0f / rayDir[1], 1.0f / rayDir[2] };
+    unsigned int stack[c_bvhMaxDepth];
+    unsigned int stackCount = 0;
+    unsigned int nodeIndex = rootNode;
+    while (true)
+    {
+        const auto& node = nodes[nodeIndex];
+        if (RayIntersectsBox(rayPos, rayInvDir, node.boundsMin_w, node.boundsMax_w, rayHitInfo.m_intersectTime))
+        {
+            unsigned int firstPrim = node.rightChild_firstPrim_numPrims_splitAxis[1];
+            unsigned int numPrims = node.rightChild_firstPrim_numPrims_splitAxis[2];
+
+            // leaf: test the primitives
+            if (numPrims > 0)
+            {
+                for (unsigned int i = firstPrim; i < firstPrim + numPrims; ++i)
+                    lambda(i);
+            }
+            // interior node: the left child is the next node, the right child is stored
+            else
+            {
+                unsigned int nearChild = nodeIndex + 1;
+                unsigned int farChild = node.rightChild_firstPrim_numPrims_splitAxis[0];
+                if (rayDir[node.rightChild_firstPrim_numPrims_splitAxis[3]] < 0.0f)
+                    std::swap(nearChild, farChild);
+                stack[stackCount] = farChild;
+                ++stackCount;
+                nodeIndex = nearChild;
+                continue;
+            }
+        }
+
+        if (stackCount == 0)
+            break;
+        --stackCount;
+        nodeIndex = stack[stackCount];
+    }
+}
+
+//----------------------------------------------------------------------------
+// walks a BVH from rootNode until lambda(primIndex) returns true, for queries that only need to know if anything
+// was hit. Children are visited in stored order since any hit will do.
+template <typename NODES, typename LAMBDA>
+bool TraverseBVHAny (const float3& rayPos, const float3& rayDir, const NODES& nodes, unsigned int rootNode, float maxIntersectTime, LAMBDA&& lambda)
+{
+    float3 rayInvDir = { 1.0f / rayDir[0], 1.0f / rayDir[1], 1.0f / rayDir[2] };
+    unsigned int stack[c_bvhMaxDepth];
+    unsigned int stackCount = 0;
+    unsigned int nodeIndex = rootNode;
+    while (true)
+    {
+        const auto& node = nodes[nodeIndex];
+        if (RayIntersectsBox(rayPos, rayInvDir, node.boundsMin_w, node.boundsMax_w, maxIntersectTime))
+        {
+            unsigned int firstPrim = node.rightChild_firstPrim_numPrims_splitAxis[1];
+            unsigned int numPrims = node.rightChild_firstPrim_numPrims_splitAxis[2];
+            if (numPrims > 0)
+            {
+                for (unsigned int i = firstPrim; i < firstPrim + numPrims; ++i)
+                {
+                    if (lambda(i))
+                        return true;
+                }
+            }
+            else
+            {
+                stack[stackCount] = node.rightChild_firstPrim_numPrims_splitAxis[0];
+                ++stackCount;
+                nodeIndex = nodeIndex + 1;
+                continue;
+            }
+        }
+
+        if (stackCount == 0)
+            return false;
+        --stackCount;
+        nodeIndex = stack[stackCount];
+    }
+}
+
+//----------------------------------------------------------------------------
+// normals go back to world space by the inverse transpose of worldToObject
+inline float3 ModelNormalToWorld (const ShaderTypes::StructuredBuffers::ModelPrim& modelPrim, const float3& normal)
+{
+    float3 worldNormal = XYZ(modelPrim.worldToObjectX) * normal[0] + XYZ(modelPrim.worldToObjectY) * normal[1] + XYZ(modelPrim.worldToObjectZ) * normal[2];
+    Normalize(worldNormal);
+    return worldNormal;
+}
+
+//----------------------------------------------------------------------------
+// puts the ray into the object space of the model, calls the lambda with the object space ray, and puts any new
+// hit normal back into world space, and the light index of an emissive triangle into the Lights buffer. The ray direction
+// isn't normalized so intersection times are the same in both spaces.
+template <typename LAMBDA>
+void RayIntersectsModelObjectSpace (const float3& rayPos, const float3& rayDir, const ShaderTypes::StructuredBuffers::ModelPrim& modelPrim, SRayHitInfo& rayHitInfo, LAMBDA&& lambda)
+{
+    float3 objectRayPos = TransformPoint(modelPrim.worldToObjectX, modelPrim.worldToObjectY, modelPrim.worldToObjectZ, rayPos);
+    float3 objectRayDir = TransformVector(modelPrim.worldToObjectX, modelPrim.worldToObjectY, modelPrim.worldToObjectZ, rayDir);
+
+    float oldIntersectTime = rayHitInfo.m_intersectTime;
+    lambda(objectRayPos, objectRayDir);
+
+    if (rayHitInfo.m_intersectTime != oldIntersectTime)
+    {
+        rayHitInfo.m_surfaceNormal = ModelNormalToWorld(modelPrim, rayHitInfo.m_surfaceNormal);
+        if (rayHitInfo.m_lightIndex >= 0)
+            rayHitInfo.m_lightIndex += int(modelPrim.firstTriangle_lastTriangle_rootNode_firstLight[3]);
+    }
+}
+
+//----------------------------------------------------------------------------
+// the old linear loop over all the triangles, kept for comparison
+template <typename TRIANGLES>
+void RayIntersectsModelLinear (const float3& rayPos, const float3& rayDir, const ShaderTypes::StructuredBuffers::ModelPrim& modelPrim, const TRIANGLES& triangles, SRayHitInfo& rayHitInfo)
+{
+    RayIntersectsModelObjectSpace(rayPos, rayDir, modelPrim, rayHitInfo,
+        [&] (const float3& objectRayPos, const float3& objectRayDir)
+        {
+            for (unsigned int i = modelPrim.firstTriangle_lastTriangle_rootNode_firstLight[0]; i < modelPrim.firstTriangle_lastTriangle_rootNode_firstLight[1]; ++i)
+                RayIntersectsTriangle(objectRayPos, objectRayDir, triangles[i], rayHitInfo);
+        }
+    );
+}
+
+//----------------------------------------------------------------------------
+// tests the ray against triangle blocks made from triangles [firstTriangle, ...). Only the nearest hit's shading
+// data is read from the triangles.
+template <typename TRIANGLES>
+void RayIntersectsTriangleBlocks (const float3& rayPos, const float3& rayDir, const TTriangleBlocks& blocks, const TRIANGLES& triangles, size_t firstTriangle, SRayHitInfo& rayHitInfo)
+{
+    size_t hitTriangle = 0;
+    bool hit = false;
+    for (size_t blockIndex = 0; blockIndex < blocks.size(); ++blockIndex)
+    {
+        float t;
+        int lane = RayIntersectsTriangleBlock(rayPos, rayDir, blocks[blockIndex], rayHitInfo.m_intersectTime, t);
+        if (lane < 0)
+            continue;
+        rayHitInfo.m_intersectTime = t;
+        hitTriangle = firstTriangle + blockIndex * c_triangleBlockWidth + lane;
+        hit = true;
+    }
+    if (!hit)
+        return;
+
+    // make sure normal is facing opposite of ray direction.
+    const auto& trianglePrim = triangles[hitTriangle];
+    float3 normal = XYZ(trianglePrim.normal_w);
+    if (Dot(normal, rayDir) > 0.0f)
+        normal = normal * -1.0f;
+
+    rayHitInfo.m_surfaceNormal = normal;
+    rayHitInfo.m_albedo = XYZ(trianglePrim.albedo_w);
+    rayHitInfo.m_emissive = XYZ(trianglePrim.emissive_lightIndex);
+    rayHitInfo.m_lightIndex = int(trianglePrim.emissive_lightIndex[3]);
+}
+
+//----------------------------------------------------------------------------
+template <typename TRIANGLES, typename NODES>
+void RayIntersectsModel (const float3& rayPos, const float3& rayDir, const ShaderTypes::StructuredBuffers::ModelPrim& modelPrim, const TRIANGLES& triangles, const NODES& nodes, SRayHitInfo& rayHitInfo)
+{
+    RayIntersectsModelObjectSpace(rayPos, rayDir, modelPrim, rayHitInfo,
+        [&] (const float3& objectRayPos, const float3& objectRayDir)
+        {
+            TraverseBVH(objectRayPos, objectRayDir, nodes, modelPrim.firstTriangle_lastTriangle_rootNode_firstLight[2], rayHitInfo,
+                [&] (unsigned int triangleIndex)
+                {
+                    RayIntersectsTriangle(objectRayPos, objectRayDir, triangles[triangleIndex], rayHitInfo);
+                }
+            );
+        }
+    );
+}
+
+//----------------------------------------------------------------------------
+template <typename TRIANGLES, typename NODES>
+bool RayIntersectsModelBoolean (const float3& rayPos, const float3& rayDir, const ShaderTypes::StructuredBuffers::ModelPrim& modelPrim, const TRIANGLES& triangles, const NODES& nodes, float maxIntersectTime)
+{
+    float3 objectRayPos = TransformPoint(modelPrim.worldToObjectX, modelPrim.worldToObjectY, modelPrim.worldToObjectZ, rayPos);
+    float3 objectRayDir = TransformVector(modelPrim.worldToObjectX, modelPrim.worldToObjectY, modelPrim.worldToObjectZ, rayDir);
+    return TraverseBVHAny(objectRayPos, objectRayDir, nodes, modelPrim.firstTriangle_lastTriangle_rootNode_firstLight[2], maxIntersectTime,
+        [&] (unsigned int triangleIndex)
+        {
+            const auto& triangle = triangles[triangleIndex];
+            return RayIntersectsTriangleBoolean(objectRayPos, objectRayDir, XYZ(triangle.positionA_w), XYZ(triangle.positionB_w), XYZ(triangle.positionC_w), maxIntersectTime);
+        }
+    );
+}
+
+//----------------------------------------------------------------------------
+struct SBVH8StackEntry
+{
+    float m_enterTime;
+    uint32_t m_index;       // node index, or first primitive of a leaf
+    uint32_t m_numPrims;    // 0 for a node
+};
+
+//----------------------------------------------------------------------------
+// Tests the ray against all 8 child boxes of a BVH8 node. Returns a bit mask of which were hit, and the time each was entered.
+// rayNear[axis] is 0 if the ray goes in the positive direction on that axis, else 1, to pick which box planes are entered first.
+inline uint32_t RayIntersectsBVH8Children (const SBVH8Node& node, const float3& rayPos, const float3& rayInvDir, const std::array<size_t, 3>& rayNear, float maxIntersectTime, float enterTimes[c_bvh8Width])
+{
+    // the box planes are at node.m_origin + quantized * 2^exponent, so the time a ray hits them is quantized * a + b
+    float a[3], b[3];
+    for (size_t axis = 0; axis < 3; ++axis)
+    {
+        a[axis] = std::ldexp(rayInvDir[axis], node.m_exponent[axis]);
+        b[axis] = (node.m_origin[axis] - rayPos[axis]) * rayInvDir[axis];
+    }
+
+    const uint8_t (*planes[2])[c_bvh8Width] = { node.m_min, node.m_max };
+
+#ifdef __AVX2__
+    __m256 enter = _mm256_setzero_ps();
+    __m256 exit = _mm256_set1_ps(maxIntersectTime);
+    for (size_t axis = 0; axis < 3; ++axis)
+    {
+        __m256 nearPlanes = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)planes[rayNear[axis]][axis])));
+        __m256 farPlanes = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)planes[1 - rayNear[axis]][axis])));
+        __m256 axisA = _mm256_set1_ps(a[axis]);
+        __m256 axisB = _mm256_set1_ps(b[axis]);
+        enter = _mm256_max_ps(enter, _mm256_add_ps(_mm256_mul_ps(nearPlanes, axisA), axisB));
+        exit = _mm256_min_ps(exit, _mm256_add_ps(_mm256_mul_ps(farPlanes, axisA), axisB));
+    }
+    _mm256_storeu_ps(enterTimes, enter);
+    return (uint32_t)_mm256_movemask_ps(_mm256_cmp_ps(enter, exit, _CMP_LE_OQ));
+#else
+    uint32_t hitMask = 0;
+    for (size_t i = 0; i < c_bvh8Width; ++i)
+    {
+        float enter = 0.0f;
+        float exit = maxIntersectTime;
+        for (size_t axis = 0; axis < 3; ++axis)
+        {
+            enter = (std::max)(enter, float(planes[rayNear[axis]][axis][i]) * a[axis] + b[axis]);
+            exit = (std::min)(exit, float(planes[1 - rayNear[axis]][axis][i]) * a[axis] + b[axis]);
+        }
+        enterTimes[i] = enter;
+        if (enter <= exit)
+            hitMask |= 1 << i;
+    }
+    return hitMask;
+#endif
+}
+
+//----------------------------------------------------------------------------
+// Walks a BVH8, visiting the hit children of each node nearest first, and skipping stack entries that are farther
+// than the closest hit so far. The triangles need to be in the order of bvh8.m_primOrder.
+template <typename TRIANGLES>
+void RayIntersectsModelBVH8 (const float3& rayPos, const float3& rayDir, const ShaderTypes::StructuredBuffers::ModelPrim& modelPrim, const TRIANGLES& triangles, const SBVH8& bvh8, SRayHitInfo& rayHitInfo)
+{
+    if (bvh8.m_nodes.size() == 0)
+        return;
+
+    RayIntersectsModelObjectSpace(rayPos, rayDir, modelPrim, rayHitInfo,
+        [&] (const float3& objectRayPos, const float3& objectRayDir)
+        {
+            // zero direction components would make 0 * infinity in the box test, so clamp them to a tiny value instead
+            float3 rayInvDir;
+            std::array<size_t, 3> rayNear;
+            for (size_t axis = 0; axis < 3; ++axis)
+            {
+                float dir = objectRayDir[axis];
+                if (std::abs(dir) < 1e-20f)
+                    dir = std::signbit(dir) ? -1e-20f : 1e-20f;
+                rayInvDir[axis] = 1.0f / dir;
+                rayNear[axis] = dir < 0.0f ? 1 : 0;
+            }
+
+            SBVH8StackEntry stack[c_bvh8StackSize];
+            size_t stackCount = 1;
+            stack[0] = { 0.0f, 0, 0 };
+            while (stackCount > 0)
+            {
+                --stackCount;
+                SBVH8StackEntry entry = stack[stackCount];
+                float maxIntersectTime = rayHitInfo.m_intersectTime >= 0.0f ? rayHitInfo.m_intersectTime : FLT_MAX;
+                if (entry.m_enterTime > maxIntersectTime)
+                    continue;
+
+                // leaf: test the triangles
+                if (entry.m_numPrims > 0)
+                {
+                    for (uint32_t i = entry.m_index; i < entry.m_index + entry.m_numPrims; ++i)
+                        RayIntersectsTriangle(objectRayPos, objectRayDir, triangles[i], rayHitInfo);
+                    continue;
+                }
+
+                // node: sort the hit children by distance and push them farthest first, so the nearest is popped next
+                const SBVH8Node& node = bvh8.m_nodes[entry.m_index];
+                float enterTimes[c_bvh8Width];
+                uint32_t hitMask = RayIntersectsBVH8Children(node, objectRayPos, rayInvDir, rayNear, maxIntersectTime, enterTimes);
+
+                SBVH8StackEntry hits[c_bvh8Width];
+                size_t hitCount = 0;
+                for (; hitMask; hitMask &= hitMask - 1)
+                {
+                    uint32_t child = 0;
+                    while (((hitMask >> child) & 1) == 0)
+                        ++child;
+
+                    SBVH8StackEntry hit;
+                    hit.m_enterTime = enterTimes[child];
+                    if (node.m_interiorMask & (1 << child))
+                    {
+                        hit.m_index = node.m_firstChild + node.m_childMeta[child];
+                        hit.m_numPrims = 0;
+                    }
+                    else
+                    {
+                        hit.m_index = node.m_firstPrim + (node.m_childMeta[child] & 31);
+                        hit.m_numPrims = node.m_childMeta[child] >> 5;
+                    }
+
+                    size_t insert = hitCount;
+                    while (insert > 0 && hits[insert - 1].m_enterTime < hit.m_enterTime)
+                    {
+                        hits[insert] = hits[insert - 1];
+                        --insert;
+                    }
+                    hits[insert] = hit;
+                    ++hitCount;
+                }
+
+                for (size_t i = 0; i < hitCount; ++i)
+                    stack[stackCount++] = hits[i];
+            }
+        }
+    );
+}
+
+//----------------------------------------------------------------------------
+// closest hit against the scene in ShaderData, using the scene BVH
+inline SRayHitInfo ClosestIntersection (float3 rayPos, const float3& rayDir)
+{
+    SRayHitInfo rayHitInfo;
+
+    rayPos = rayPos + rayDir * c_rayEpsilon;
+
+    const uint4& sceneInfo = ShaderData::ConstantBuffers::ConstantsOnce.Read().numModels_sceneRootNode_numScenePrims_numLights;
+    if (sceneInfo[2] == 0)
+        return rayHitInfo;
+
+    TraverseBVH(rayPos, rayDir, ShaderData::StructuredBuffers::BVHNodes.Read(), sceneInfo[1], rayHitInfo,
+        [&] (unsigned int primIndex)
+        {
+            const uint4& typeIndex = ShaderData::StructuredBuffers::ScenePrimitives.Read()[primIndex].type_index_zw;
+            unsigned int index = typeIndex[1];
+            switch ((EScenePrimitive)typeIndex[0])
+            {
+                case EScenePrimitive::Sphere: RayIntersectsSphere(rayPos, rayDir, ShaderData::StructuredBuffers::Spheres.Read()[index], rayHitInfo); break;
+                case EScenePrimitive::Triangle: RayIntersectsTriangle(rayPos, rayDir, ShaderData::StructuredBuffers::Triangles.Read()[index], rayHitInfo); break;
+                case EScenePrimitive::Quad: RayIntersectsQuad(rayPos, rayDir, ShaderData::StructuredBuffers::Quads.Read()[index], rayHitInfo); break;
+                case EScenePrimitive::OBB: RayIntersectsOBB(rayPos, rayDir, ShaderData::StructuredBuffers::OBBs.Read()[index], rayHitInfo); break;
+                case EScenePrimitive::Model: RayIntersectsModel(rayPos, rayDir, ShaderData::StructuredBuffers::Models.Read()[index], ShaderData::StructuredBuffers::ModelTriangles.Read(), ShaderData::StructuredBuffers::BVHNodes.Read(), rayHitInfo); break;
+            }
+        }
+    );
+
+    return rayHitInfo;
+}
+
+//----------------------------------------------------------------------------
+// which primitive a ray hit. modelTriangle is which of ModelTriangles it was, for models.
+struct SRayHitPrimitive
+{
+    EScenePrimitive m_type = EScenePrimitive::Sphere;
+    unsigned int m_index = 0;
+    unsigned int m_modelTriangle = 0;
+};
+
+//----------------------------------------------------------------------------
+// ClosestIntersection() that also gives the primitive that was hit, to find the lightmap charts the first hits are in.
+// Kept apart so the bounces don't pay for it.
+inline SRayHitInfo ClosestIntersection (float3 rayPos, const float3& rayDir, SRayHitPrimitive& hitPrimitive)
+{
+    SRayHitInfo rayHitInfo;
+
+    rayPos = rayPos + rayDir * c_rayEpsilon;
+
+    const uint4& sceneInfo = ShaderData::ConstantBuffers::ConstantsOnce.Read().numModels_sceneRootNode_numScenePrims_numLights;
+    if (sceneInfo[2] == 0)
+        return rayHitInfo;
+
+    TraverseBVH(rayPos, rayDir, ShaderData::StructuredBuffers::BVHNodes.Read(), sceneInfo[1], rayHitInfo,
+        [&] (unsigned int primIndex)
+        {
+            const uint4& typeIndex = ShaderData::StructuredBuffers::ScenePrimitives.Read()[primIndex].type_index_zw;
+            unsigned int index = typeIndex[1];
+            float oldIntersectTime = rayHitInfo.m_intersectTime;
+            unsigned int modelTriangle = 0;
+            switch ((EScenePrimitive)typeIndex[0])
+            {
+                case EScenePrimitive::Sphere: RayIntersectsSphere(rayPos, rayDir, ShaderData::StructuredBuffers::Spheres.Read()[index], rayHitInfo); break;
+                case EScenePrimitive::Triangle: RayIntersectsTriangle(rayPos, rayDir, ShaderData::StructuredBuffers::Triangles.Read()[index], rayHitInfo); break;
+                case EScenePrimitive::Quad: RayIntersectsQuad(rayPos, rayDir, ShaderData::StructuredBuffers::Quads.Read()[index], rayHitInfo); break;
+                case EScenePrimitive::OBB: RayIntersectsOBB(rayPos, rayDir, ShaderData::StructuredBuffers::OBBs.Read()[index], rayHitInfo); break;
+                case EScenePrimitive::Model:
+                {
+                    const ShaderTypes::StructuredBuffers::ModelPrim& modelPrim = ShaderData::StructuredBuffers::Models.Read()[index];
+                    RayIntersectsModelObjectSpace(rayPos, rayDir, modelPrim, rayHitInfo,
+                        [&] (const float3& objectRayPos, const float3& objectRayDir)
+                        {
+                            TraverseBVH(objectRayPos, objectRayDir, ShaderData::StructuredBuffers::BVHNodes.Read(), modelPrim.firstTriangle_lastTriangle_rootNode_firstLight[2], rayHitInfo,
+                                [&] (unsigned int triangleIndex)
+                                {
+                                    float oldTriangleTime = rayHitInfo.m_intersectTime;
+                                    RayIntersectsTriangle(objectRayPos, objectRayDir, ShaderData::StructuredBuffers::ModelTriangles.Read()[triangleIndex], rayHitInfo);
+                                    if (rayHitInfo.m_intersectTime != oldTriangleTime)
+                                        modelTriangle = triangleIndex;
+                                }
+                            );
+                        }
+                    );
+                    break;
+                }
+            }
+
+            if (rayHitInfo.m_intersectTime != oldIntersectTime)
+            {
+                hitPrimitive.m_type = (EScenePrimitive)typeIndex[0];
+                hitPrimitive.m_index = index;
+                hitPrimitive.m_modelTriangle = modelTriangle;
+            }
+        }
+    );
+
+    return rayHitInfo;
+}
+
+//----------------------------------------------------------------------------
+// true if anything is between a and b. Stops at the first blocker found. Both ends are pulled in by c_rayEpsilon so
+// the surfaces the points are on don't count.
+inline bool OccludedBetween (const float3& a, const float3& b)
+{
+    const uint4& sceneInfo = ShaderData::ConstantBuffers::ConstantsOnce.Read().numModels_sceneRootNode_numScenePrims_numLights;
+    if (sceneInfo[2] == 0)
+        return false;
+
+    float3 rayDir = b - a;
+    float dist = Length(rayDir);
+    float maxIntersectTime = dist - 2.0f * c_rayEpsilon;
+    if (maxIntersectTime <= 0.0f)
+        return false;
+    rayDir = rayDir * (1.0f / dist);
+    float3 rayPos = a + rayDir * c_rayEpsilon;
+
+    return TraverseBVHAny(rayPos, rayDir, ShaderData::StructuredBuffers::BVHNodes.Read(), sceneInfo[1], maxIntersectTime,
+        [&] (unsigned int primIndex)
+        {
+            const uint4& typeIndex = ShaderData::StructuredBuffers::ScenePrimitives.Read()[primIndex].type_index_zw;
+            unsigned int index = typeIndex[1];
+            switch ((EScenePrimitive)typeIndex[0])
+            {
+                case EScenePrimitive::Sphere:
+                {
+                    const auto& sphere = ShaderData::StructuredBuffers::Spheres.Read()[index];
+                    return RayIntersectsSphereBoolean(rayPos, rayDir, XYZ(sphere.position_Radius), sphere.position_Radius[3], maxIntersectTime);
+                }
+                case EScenePrimitive::Triangle:
+                {
+                    const auto& triangle = ShaderData::StructuredBuffers::Triangles.Read()[index];
+                    return RayIntersectsTriangleBoolean(rayPos, rayDir, XYZ(triangle.positionA_w), XYZ(triangle.positionB_w), XYZ(triangle.positionC_w), maxIntersectTime);
+                }
+                case EScenePrimitive::Quad: return RayIntersectsQuadBoolean(rayPos, rayDir, ShaderData::StructuredBuffers::Quads.Read()[index], maxIntersectTime);
+                case EScenePrimitive::OBB: return RayIntersectsOBBBoolean(rayPos, rayDir, ShaderData::StructuredBuffers::OBBs.Read()[index], maxIntersectTime);
+                case EScenePrimitive::Model: return RayIntersectsModelBoolean(rayPos, rayDir, ShaderData::StructuredBuffers::Models.Read()[index], ShaderData::StructuredBuffers::ModelTriangles.Read(), ShaderData::StructuredBuffers::BVHNodes.Read(), maxIntersectTime);
+            }
+            return false;
+        }
+    );
+}
+
+//----------------------------------------------------------------------------
+// the old linear loops over each primitive type, kept for comparison
+inline SRayHitInfo ClosestIntersectionLinear (float3 rayPos, const float3& rayDir)
+{
+    SRayHitInfo rayHitInfo;
+
+    rayPos = rayPos + rayDir * c_rayEpsilon;
+
+    const ShaderTypes::ConstantBuffers::ConstantsOnce& constants = ShaderData::ConstantBuffers::ConstantsOnce.Read();
+    uint4 counts = constants.numSpheres_numTris_numOBBs_numQuads;
+
+    for (unsigned int i = 0; i < counts[0]; ++i)
+        RayIntersectsSphere(rayPos, rayDir, ShaderData::StructuredBuffers::Spheres.Read()[i], rayHitInfo);
+
+    for (unsigned int i = 0; i < counts[1]; ++i)
+        RayIntersectsTriangle(rayPos, rayDir, ShaderData::StructuredBuffers::Triangles.Read()[i], rayHitInfo);
+
+    for (unsigned int i = 0; i < counts[3]; ++i)
+        RayIntersectsQuad(rayPos, rayDir, ShaderData::StructuredBuffers::Quads.Read()[i], rayHitInfo);
+
+    for (unsigned int i = 0; i < counts[2]; ++i)
+        RayIntersectsOBB(rayPos, rayDir, ShaderData::StructuredBuffers::OBBs.Read()[i], rayHitInfo);
+
+    for (unsigned int i = 0; i < constants.numModels_sceneRootNode_numScenePrims_numLights[0]; ++i)
+        RayIntersectsModelLinear(rayPos, rayDir, ShaderData::StructuredBuffers::Models.Read()[i], ShaderData::StructuredBuffers::ModelTriangles.Read(), rayHitInfo);
+
+    return rayHitInfo;
+}
+
+//----------------------------------------------------------------------------
+// the camera vectors CalculateRay() works out, so they can be calculated once per frame instead of once per ray
+struct SCamera
+{
+    float3 m_pos;
+    float3 m_fwd;
+    float3 m_right;
+    float3 m_up;
+    float m_nearPlaneDist;
+    float m_windowRight;
+    float m_windowTop;
+};
+
+inline SCamera MakeCamera ()
+{
+    const ShaderTypes::ConstantBuffers::ConstantsOnce& constants = ShaderData::ConstantBuffers::ConstantsOnce.Read();
+    SCamera camera;
+    camera.m_pos = XYZ(constants.cameraPos_FOVX);
+
+    // calculate camera vectors
+    camera.m_fwd = XYZ(constants.cameraAt_FOVY) - XYZ(constants.cameraPos_FOVX);
+    Normalize(camera.m_fwd);
+    camera.m_right = Cross({ 0.0f, 1.0f, 0.0f }, camera.m_fwd);
+    Normalize(camera.m_right);
+    camera.m_up = Cross(camera.m_fwd, camera.m_right);
+    Normalize(camera.m_up);
+
+    // calculate view window dimensions in world space
+    camera.m_nearPlaneDist = constants.nearPlaneDist_missColor[0];
+    camera.m_windowRight = std::tan(constants.cameraPos_FOVX[3]) * camera.m_nearPlaneDist;
+    camera.m_windowTop = std::tan(constants.cameraAt_FOVY[3]) * camera.m_nearPlaneDist;
+    return camera;
+}
+
+//----------------------------------------------------------------------------
+// C++ version of CalculateRay() in Shaders/PathTrace.h
+inline void CalculateRay (const SCamera& camera, float u, float v, float3& rayPos, float3& rayDir)
+{
+    // calculate coordinate of pixel on the screen in [-1,1]
+    float pixelClipSpaceX = 2.0f * u - 1.0f;
+    float pixelClipSpaceY = 2.0f * v - 1.0f;
+
+    // calculate pixel position in world space, this is the ray's origin
+    rayPos = camera.m_pos + camera.m_fwd * camera.m_nearPlaneDist;
+    rayPos = rayPos + camera.m_right * (pixelClipSpaceX * camera.m_windowRight);
+    rayPos = rayPos + camera.m_up * (pixelClipSpaceY * camera.m_windowTop);
+
+    // calculate the direction
+    rayDir = rayPos - camera.m_pos;
+    Normalize(rayDir);
+}
+
+//----------------------------------------------------------------------------
+// uses the camera in ConstantsOnce
+inline void CalculateRay (float u, float v, float3& rayPos, float3& rayDir)
+{
+    CalculateRay(MakeCamera(), u, v, rayPos, rayDir);
+}
+
+//----------------------------------------------------------------------------
+//                                 Lighting
+//----------------------------------------------------------------------------
+// C++ versions of the path tracing functions at the end of Shaders/PathTrace.h. They give the same results as the
+// shader for the same random number keys, up to floating point differences.
+
+static const unsigned int c_runtimeBounces = ~0u;    // Light_Outgoing<c_runtimeBounces> reads the bounce count from the constants
+static const uint32_t c_goldenRatioFixed = 2654435769u;    // the fractional part of the golden ratio, times 2^32
+static const unsigned int c_sobolDimensions = 2;           // each RandomFloat2() is a 2D Sobol point
+
+//----------------------------------------------------------------------------
+inline float Frac (float f)
+{
+    return f - std::floor(f);
+}
+
+//----------------------------------------------------------------------------
+// the environment texel that light from rayDir comes from
+inline unsigned int EnvironmentTexelIndex (const float3& rayDir)
+{
+    const uint4& environmentWidth_environmentHeight_zw = ShaderData::ConstantBuffers::ConstantsOnce.Read().environmentWidth_environmentHeight_zw;
+    float2 uv = EnvironmentDirectionToUV(rayDir);
+    unsigned int x = (std::min)((unsigned int)(uv[0] * float(environmentWidth_environmentHeight_zw[0])), environmentWidth_environmentHeight_zw[0] - 1);
+    unsigned int y = (std::min)((unsigned int)(uv[1] * float(environmentWidth_environmentHeight_zw[1])), environmentWidth_environmentHeight_zw[1] - 1);
+    return y * environmentWidth_environmentHeight_zw[0] + x;
+}
+
+//----------------------------------------------------------------------------
+// the skybox color, which is the environment map in rayDir if the scene has one, else nearPlaneDist_missColor.yzw
+inline float3 MissColor (const float3& rayDir)
+{
+    const ShaderTypes::ConstantBuffers::ConstantsOnce& constants = ShaderData::ConstantBuffers::ConstantsOnce.Read();
+    if (constants.environmentWidth_environmentHeight_zw[0] > 0)
+        return XYZ(ShaderData::StructuredBuffers::EnvironmentTexels.Read()[EnvironmentTexelIndex(rayDir)].radiance_conditionalCDF);
+    return { constants.nearPlaneDist_missColor[1], constants.nearPlaneDist_missColor[2], constants.nearPlaneDist_missColor[3] };
+}
+
+//----------------------------------------------------------------------------
+// pcg4d from "Hash Functions for GPU Rendering", Jarzynski and Olano: http://jcgt.org/published/0009/03/02/
+inline uint4 pcg4d (uint4 v)
+{
+    for (unsigned int& u : v)
+        u = u * 1664525u + 1013904223u;
+    v[0] += v[1] * v[3];
+    v[1] += v[2] * v[0];
+    v[2] += v[0] * v[1];
+    v[3] += v[1] * v[2];
+    for (unsigned int& u : v)
+        u ^= u >> 16u;
+    v[0] += v[1] * v[3];
+    v[1] += v[2] * v[0];
+    v[2] += v[0] * v[1];
+    v[3] += v[1] * v[2];
+    return v;
+}
+
+//----------------------------------------------------------------------------
+// the top 24 bits as a float in [0, 1)
+inline float UintToFloat01 (uint32_t u)
+{
+    return float(u >> 8) / 16777216.0f;
+}
+
+//----------------------------------------------------------------------------
+// The Sobol direction numbers, built at compile time from the primitive polynomials of Joe and Kuo's new-joe-kuo-6.21201
+// table: https://web.maths.unsw.edu.au/~fkuo/sobol/. Dimension 0 is the van der Corput sequence. c_sobolDirections in
+// Shaders/PathTrace.h has to have the same numbers.
+struct SSobolDirections
+{
+    constexpr SSobolDirections ()
+        : m_directions()
+    {
+        // the degree, the inner coefficients and the initial direction numbers of each dimension's polynomial
+        const unsigned int degrees[c_sobolDimensions] = { 0, 1 };
+        const unsigned int coefficients[c_sobolDimensions] = { 0, 0 };
+        const unsigned int initialNumbers[c_sobolDimensions][1] = { { 0 }, { 1 } };
+
+        for (unsigned int bit = 0; bit < 32; ++bit)
+            m_directions[0][bit] = 1u << (31 - bit);
+
+        for (unsigned int dimension = 1; dimension < c_sobolDimensions; ++dimension)
+        {
+            unsigned int degree = degrees[dimension];
+            for (unsigned int bit = 0; bit < 32; ++bit)
+            {
+                if (bit < degree)
+                {
+                    m_directions[dimension][bit] = initialNumbers[dimension][bit] << (31 - bit);
+                    continue;
+                }
+
+                uint32_t direction = m_directions[dimension][bit - degree] ^ (m_directions[dimension][bit - degree] >> degree);
+                for (unsigned int k = 1; k < degree; ++k)
+                {
+                    if ((coefficients[dimension] >> (degree - 1 - k)) & 1)
+                        direction ^= m_directions[dimension][bit - k];
+                }
+                m_directions[dimension][bit] = direction;
+            }
+        }
+    }
+
+    uint32_t m_directions[c_sobolDimensions][32];
+};
+static constexpr SSobolDirections c_sobolDirections;
+static_assert(c_sobolDirections.m_directions[1][31] == 0xFFFFFFFFu, "Sobol direction numbers of dimension 1 are wrong");
+
+//----------------------------------------------------------------------------
+inline uint32_t ReverseBits (uint32_t x)
+{
+    x = ((x >> 1) & 0x55555555u) | ((x & 0x55555555u) << 1);
+    x = ((x >> 2) & 0x33333333u) | ((x & 0x33333333u) << 2);
+    x = ((x >> 4) & 0x0F0F0F0Fu) | ((x & 0x0F0F0F0Fu) << 4);
+    x = ((x >> 8) & 0x00FF00FFu) | ((x & 0x00FF00FFu) << 8);
+    return (x >> 16) | (x << 16);
+}
+
+//----------------------------------------------------------------------------
+// The Sobol point of index in one dimension, as a 0.32 fixed point number
+inline uint32_t Sobol (uint32_t index, unsigned int dimension)
+{
+    uint32_t ret = 0;
+    for (unsigned int bit = 0; index != 0; ++bit, index >>= 1)
+    {
+        if (index & 1)
+            ret ^= c_sobolDirections.m_directions[dimension][bit];
+    }
+    return ret;
+}
+
+//----------------------------------------------------------------------------
+// Owen scrambling from "Practical Hash-based Owen Scrambling", Burley: http://www.jcgt.org/published/0009/04/01/
+// The Laine Karras permutation flips each bit depending only on the bits below it, so done on the bit reversed value it
+// flips each bit depending on the bits above it, which is a nested uniform scramble.
+inline uint32_t NestedUniformScramble (uint32_t x, uint32_t seed)
+{
+    x = ReverseBits(x);
+    x += seed;
+    x ^= x * 0x6c50b47cu;
+    x ^= x * 0xb82f1e52u;
+    x ^= x * 0xc7afe638u;
+    x ^= x * 0x8d22f6e6u;
+    return ReverseBits(x);
+}
+
+//----------------------------------------------------------------------------
+// The sample's point of a 2D Owen scrambled Sobol sequence. The index is shuffled and each dimension scrambled by the
+// hashes in scramble, so every pixel, bounce and dimension gets its own randomization of the same well stratified points.
+inline float2 ScrambledSobol2 (uint32_t sampleIndex, const uint4& scramble)
+{
+    uint32_t index = NestedUniformScramble(sampleIndex, scramble[0]);
+    return { UintToFloat01(NestedUniformScramble(Sobol(index, 0), scramble[1])), UintToFloat01(NestedUniformScramble(Sobol(index, 1), scramble[2])) };
+}
+
+//----------------------------------------------------------------------------
+// The key of the counter based random numbers of SRNG in Shaders/PathTrace.h. Each random number is a hash of the
+// pixel, sample, bounce and dimension, plus a seed, so they don't depend on the order pixels and samples are run in.
+struct SRNG
+{
+    SRNG (uint32_t pixelIndex, uint32_t sampleIndex, uint32_t seed, float blueNoise, bool sobol)
+        : m_pixelIndex(pixelIndex)
+        , m_sampleIndex(sampleIndex)
+        , m_seed(seed)
+        , m_blueNoise(blueNoise)
+        , m_sobol(sobol)
+    { }
+
+    uint32_t m_pixelIndex;
+    uint32_t m_sampleIndex;     // every sample the pixel has taken since the accumulation started, across frames
+    uint32_t m_bounce = 0;
+    uint32_t m_dimension = 0;
+    uint32_t m_seed;
+    float m_blueNoise;          // the first random number of the sample from blue noise, or negative for white noise
+    bool m_sobol;               // Owen scrambled Sobol points instead of white or blue noise
+};
+
+//----------------------------------------------------------------------------
+// the next two dimensions of the current bounce
+inline float2 RandomFloat2 (SRNG& rng)
+{
+    // the Sobol scrambling can't depend on the sample index, or the samples wouldn't be points of the same sequence
+    if (rng.m_sobol)
+    {
+        float2 ret = ScrambledSobol2(rng.m_sampleIndex, pcg4d({ rng.m_pixelIndex, 0, (rng.m_bounce << 16) | rng.m_dimension, rng.m_seed }));
+        rng.m_dimension += 2;
+        return ret;
+    }
+
+    uint4 hash = pcg4d({ rng.m_pixelIndex, rng.m_sampleIndex, (rng.m_bounce << 16) | rng.m_dimension, rng.m_seed });
+    float2 ret = { UintToFloat01(hash[0]), UintToFloat01(hash[1]) };
+
+    // with blue noise, the first dimension of the first bounce comes from the path trace kernel
+    if (rng.m_bounce == 0 && rng.m_dimension == 0 && rng.m_blueNoise >= 0.0f)
+        ret[0] = rng.m_blueNoise;
+
+    rng.m_dimension += 2;
+    return ret;
+}
+
+//----------------------------------------------------------------------------
+// the next dimension of the current bounce
+inline float RandomFloat (SRNG& rng)
+{
+    if (rng.m_sobol)
+    {
+        uint4 scramble = pcg4d({ rng.m_pixelIndex, 0, (rng.m_bounce << 16) | rng.m_dimension, rng.m_seed });
+        float ret = UintToFloat01(NestedUniformScramble(Sobol(NestedUniformScramble(rng.m_sampleIndex, scramble[0]), 0), scramble[1]));
+        rng.m_dimension += 1;
+        return ret;
+    }
+
+    uint4 hash = pcg4d({ rng.m_pixelIndex, rng.m_sampleIndex, (rng.m_bounce << 16) | rng.m_dimension, rng.m_seed });
+    rng.m_dimension += 1;
+    return UintToFloat01(hash[0]);
+}
+
+//----------------------------------------------------------------------------
+// u and v perpendicular to the unit vector w and each other
+inline void MakeBasis (const float3& w, float3& u, float3& v)
+{
+    if (std::abs(w[0]) > 0.1f)
+        u = Cross({ 0.0f, 1.0f, 0.0f }, w);
+    else
+        u = Cross({ 1.0f, 0.0f, 0.0f }, w);
+
+    Normalize(u);
+    v = Cross(w, u);
+}
+
+//----------------------------------------------------------------------------
+// from smallpt path tracer: http://www.kevinbeason.com/smallpt/
+inline float3 CosineSampleHemisphere (const float3& normal, SRNG& rng)
+{
+    float2 rnd = RandomFloat2(rng);
+
+    float r1 = 2.0f * c_pi * rnd[0];
+    float r2 = rnd[1];
+    float r2s = std::sqrt(r2);
+
+    float3 w = normal;
+    float3 u, v;
+    MakeBasis(w, u, v);
+    float3 d = u * (std::cos(r1) * r2s) + v * (std::sin(r1) * r2s) + w * std::sqrt(1.0f - r2);
+    Normalize(d);
+
+    return d;
+}
+
+//----------------------------------------------------------------------------
+// a point on one of the lights, picked for next event estimation
+struct SLightSample
+{
+    float3 m_position;
+    float3 m_normal;
+    float3 m_emissive;
+    float  m_pdf = 0.0f;    // per unit area, including the chance of picking the light
+};
+
+//----------------------------------------------------------------------------
+// a uniformly distributed point on the triangle abc
+inline float3 SampleTriangle (const float3& a, const float3& b, const float3& c, const float2& rnd)
+{
+    float su = std::sqrt(rnd[0]);
+    return a * (1.0f - su) + b * (su * (1.0f - rnd[1])) + c * (su * rnd[1]);
+}
+
+//----------------------------------------------------------------------------
+// picks a light proportionally to its power with the alias table, in constant time
+inline unsigned int PickLightAlias (float rnd, unsigned int numLights)
+{
+    float slotFloat = rnd * float(numLights);
+    unsigned int slot = (std::min)((unsigned int)slotFloat, numLights - 1);
+    const ShaderTypes::StructuredBuffers::LightPrim& light = ShaderData::StructuredBuffers::Lights.Read()[slot];
+    return (slotFloat - float(slot) < light.selectionPDF_area_aliasThreshold_w[2]) ? slot : light.alias_treeLeaf_zw[0];
+}
+
+//----------------------------------------------------------------------------
+inline float LightTreeNodeImportance (const float3& pos, const float3& normal, const ShaderTypes::StructuredBuffers::LightTreeNode& node)
+{
+    return LightBoundsImportance(pos, normal, XYZ(node.boundsMin_power), XYZ(node.boundsMax_cosTheta), XYZ(node.axis_w), node.boundsMax_cosTheta[3], node.boundsMin_power[3]);
+}
+
+//----------------------------------------------------------------------------
+// Picks a light for the surface at pos facing normal by walking the light tree from the root, choosing a child by its
+// importance and reusing the random number for the next choice. probability is the chance of having picked it, 0 if
+// no light could reach the surface.
+inline unsigned int PickLightTree (const float3& pos, const float3& normal, float rnd, float& probability)
+{
+    const ShaderTypes::StructuredBuffers::TLightTreeNodes& nodes = ShaderData::StructuredBuffers::LightTreeNodes.Read();
+    probability = 1.0f;
+    unsigned int nodeIndex = 0;
+    while (nodes[nodeIndex].rightChild_light_parent_w[1] == c_lightTreeInterior)
+    {
+        unsigned int rightChild = nodes[nodeIndex].rightChild_light_parent_w[0];
+        float leftImportance = LightTreeNodeImportance(pos, normal, nodes[nodeIndex + 1]);
+        float rightImportance = LightTreeNodeImportance(pos, normal, nodes[rightChild]);
+        if (leftImportance + rightImportance <= 0.0f)
+        {
+            probability = 0.0f;
+            return 0;
+        }
+
+        float leftProbability = leftImportance / (leftImportance + rightImportance);
+        if (rnd < leftProbability)
+        {
+            nodeIndex = nodeIndex + 1;
+            rnd = (std::min)(rnd / leftProbability, c_oneMinusEpsilon);
+            probability *= leftProbability;
+        }
+        else
+        {
+            nodeIndex = rightChild;
+            rnd = (std::min)((rnd - leftProbability) / (1.0f - leftProbability), c_oneMinusEpsilon);
+            probability *= 1.0f - leftProbability;
+        }
+    }
+    return nodes[nodeIndex].rightChild_light_parent_w[1];
+}
+
+//----------------------------------------------------------------------------
+// the chance PickLightTree() had of picking the light, found by walking from its leaf up to the root
+inline float LightTreeProbability (const float3& pos, const float3& normal, unsigned int lightIndex)
+{
+    const ShaderTypes::StructuredBuffers::TLightTreeNodes& nodes = ShaderData::StructuredBuffers::LightTreeNodes.Read();
+    float probability = 1.0f;
+    unsigned int nodeIndex = ShaderData::StructuredBuffers::Lights.Read()[lightIndex].alias_treeLeaf_zw[1];
+    while (nodeIndex != 0)
+    {
+        unsigned int parent = nodes[nodeIndex].rightChild_light_parent_w[2];
+        unsigned int rightChild = nodes[parent].rightChild_light_parent_w[0];
+        float leftImportance = LightTreeNodeImportance(pos, normal, nodes[parent + 1]);
+        float rightImportance = LightTreeNodeImportance(pos, normal, nodes[rightChild]);
+        if (leftImportance + rightImportance <= 0.0f)
+            return 0.0f;
+        probability *= ((nodeIndex == rightChild) ? rightImportance : leftImportance) / (leftImportance + rightImportance);
+        nodeIndex = parent;
+    }
+    return probability;
+}
+
+//----------------------------------------------------------------------------
+// picks a light by power, or with the light tree, and a point on it uniformly by area, to light pos with
+inline SLightSample SampleLight (const float3& pos, const float3& normal, SRNG& rng, bool lightTree)
+{
+    SLightSample ret;
+    unsigned int numLights = ShaderData::ConstantBuffers::ConstantsOnce.Read().numModels_sceneRootNode_numScenePrims_numLights[3];
+    if (numLights == 0)
+        return ret;
+
+    float probability;
+    unsigned int lightIndex;
+    if (lightTree)
+    {
+        lightIndex = PickLightTree(pos, normal, RandomFloat(rng), probability);
+        if (probability <= 0.0f)
+            return ret;
+    }
+    else
+    {
+        lightIndex = PickLightAlias(RandomFloat(rng), numLights);
+    }
+
+    const ShaderTypes::StructuredBuffers::LightPrim& light = ShaderData::StructuredBuffers::Lights.Read()[lightIndex];
+    if (!lightTree)
+        probability = light.selectionPDF_area_aliasThreshold_w[0];
+
+    float2 rnd = RandomFloat2(rng);
+    unsigned int index = light.type_index_model_w[1];
+    switch ((EScenePrimitive)light.type_index_model_w[0])
+    {
+        case EScenePrimitive::Sphere:
+        {
+            // uniformly on the hemisphere facing pos, which has every point of the sphere that pos can see
+            const ShaderTypes::StructuredBuffers::SpherePrim& sphere = ShaderData::StructuredBuffers::Spheres.Read()[index];
+            float3 w = pos - XYZ(sphere.position_Radius);
+            Normalize(w);
+            float3 u, v;
+            MakeBasis(w, u, v);
+            float r = std::sqrt((std::max)(1.0f - rnd[0] * rnd[0], 0.0f));
+            float phi = 2.0f * c_pi * rnd[1];
+            ret.m_normal = u * (std::cos(phi) * r) + v * (std::sin(phi) * r) + w * rnd[0];
+            ret.m_position = XYZ(sphere.position_Radius) + ret.m_normal * sphere.position_Radius[3];
+            ret.m_emissive = XYZ(sphere.emissive_lightIndex);
+            break;
+        }
+        case EScenePrimitive::Triangle:
+        {
+            const ShaderTypes::StructuredBuffers::TrianglePrim& triangle = ShaderData::StructuredBuffers::Triangles.Read()[index];
+            ret.m_position = SampleTriangle(XYZ(triangle.positionA_w), XYZ(triangle.positionB_w), XYZ(triangle.positionC_w), rnd);
+            ret.m_normal = XYZ(triangle.normal_w);
+            ret.m_emissive = XYZ(triangle.emissive_lightIndex);
+            break;
+        }
+        case EScenePrimitive::Quad:
+        {
+            // pick triangle abc or acd by area, and stretch the random number used for that back to [0, 1)
+            const ShaderTypes::StructuredBuffers::QuadPrim& quad = ShaderData::StructuredBuffers::Quads.Read()[index];
+            float3 a = XYZ(quad.positionA_w);
+            float3 c = XYZ(quad.positionC_w);
+            float split = 0.5f * Length(Cross(XYZ(quad.positionB_w) - a, c - a)) / light.selectionPDF_area_aliasThreshold_w[1];
+            if (rnd[0] < split)
+                ret.m_position = SampleTriangle(a, XYZ(quad.positionB_w), c, { rnd[0] / split, rnd[1] });
+            else
+                ret.m_position = SampleTriangle(a, c, XYZ(quad.positionD_w), { (std::min)((rnd[0] - split) / (1.0f - split), 1.0f), rnd[1] });
+            ret.m_normal = XYZ(quad.normal_w);
+            ret.m_emissive = XYZ(quad.emissive_lightIndex);
+            break;
+        }
+        case EScenePrimitive::Model:
+        {
+            // uniform in object space is uniform in world space, since the transform is affine
+            const ShaderTypes::StructuredBuffers::ModelPrim& model = ShaderData::StructuredBuffers::Models.Read()[light.type_index_model_w[2]];
+            const ShaderTypes::StructuredBuffers::ModelTrianglePrim& triangle = ShaderData::StructuredBuffers::ModelTriangles.Read()[index];
+            float3 objectPos = SampleTriangle(XYZ(triangle.positionA_w), XYZ(triangle.positionB_w), XYZ(triangle.positionC_w), rnd);
+            ret.m_position = TransformPoint(model.objectToWorldX, model.objectToWorldY, model.objectToWorldZ, objectPos);
+            ret.m_normal = ModelNormalToWorld(model, XYZ(triangle.normal_w));
+            ret.m_emissive = XYZ(triangle.emissive_lightIndex);
+            break;
+        }
+        default: return ret;
+    }
+
+    ret.m_pdf = probability / light.selectionPDF_area_aliasThreshold_w[1];
+    return ret;
+}
+
+//----------------------------------------------------------------------------
+// the power heuristic weight of a sample taken with pdf, that could also have been taken with otherPdf
+inline float MISWeight (float pdf, float otherPdf)
+{
+    return pdf * pdf / (pdf * pdf + otherPdf * otherPdf);
+}
+
+//----------------------------------------------------------------------------
+// The solid angle pdf of a guided bounce, from the cosine weighted pdf and the guide's density over the unit square.
+// Bounces are cosine weighted c_pathGuidingCosineFraction of the time and picked from the guide's quadtree otherwise,
+// and the unit square covers the 4 pi steradians of the sphere.
+inline float BouncePdf (float cosinePdf, float guideSquarePdf)
+{
+    return c_pathGuidingCosineFraction * (std::max)(cosinePdf, 0.0f) + (1.0f - c_pathGuidingCosineFraction) * guideSquarePdf / (4.0f * c_pi);
+}
+
+//----------------------------------------------------------------------------
+// the solid angle pdf of a bounce in dir, which is just the cosine weighted pdf without path guiding
+inline float BouncePdf (float cosinePdf, const float3& dir, const CPathGuidingQuadtree* guide)
+{
+    return guide ? BouncePdf(cosinePdf, guide->Pdf(PathGuidingDirectionToSquare(dir))) : cosinePdf;
+}
+
+//----------------------------------------------------------------------------
+// the solid angle pdf light sampling from the surface at pos facing normal had of picking the point on a light that a
+// ray in rayDir hit
+inline float LightPdf (const float3& pos, const float3& normal, const SRayHitInfo& rayHitInfo, const float3& rayDir, bool lightTree)
+{
+    const float4& selectionPDF_area_aliasThreshold_w = ShaderData::StructuredBuffers::Lights.Read()[rayHitInfo.m_lightIndex].selectionPDF_area_aliasThreshold_w;
+    float cosLight = std::abs(Dot(rayHitInfo.m_surfaceNormal, rayDir));
+    if (cosLight <= 0.0f)
+        return 0.0f;
+    float probability = lightTree ? LightTreeProbability(pos, normal, rayHitInfo.m_lightIndex) : selectionPDF_area_aliasThreshold_w[0];
+    return probability / selectionPDF_area_aliasThreshold_w[1] * rayHitInfo.m_intersectTime * rayHitInfo.m_intersectTime / cosLight;
+}
+
+//----------------------------------------------------------------------------
+// Next event estimation. The light reaching the diffuse surface at pos from a light sample, weighted against the cosine
+// weighted bounce finding the same point, and still to be multiplied by the surface's albedo. guide is the path guiding
+// quadtree the bounce is mixed with, if any.
+inline float3 SampleDirectLight (const float3& pos, const float3& normal, SRNG& rng, bool lightTree, const CPathGuidingQuadtree* guide)
+{
+    float3 ret = { 0.0f, 0.0f, 0.0f };
+    SLightSample lightSample = SampleLight(pos, normal, rng, lightTree);
+    if (lightSample.m_pdf <= 0.0f)
+        return ret;
+
+    float3 toLight = lightSample.m_position - pos;
+    float distSquared = Dot(toLight, toLight);
+    float3 lightDir = toLight * (1.0f / std::sqrt(distSquared));
+    float cosSurface = Dot(normal, lightDir);
+    float cosLight = std::abs(Dot(lightSample.m_normal, lightDir));
+    if (cosSurface <= 0.0f || cosLight <= 0.0f || OccludedBetween(pos, lightSample.m_position))
+        return ret;
+
+    // the lambert BRDF times the cosine term is the cosine weighted pdf, times albedo
+    float lightPdf = lightSample.m_pdf * distSquared / cosLight;
+    float bouncePdf = cosSurface / c_pi;
+    return lightSample.m_emissive * (bouncePdf * MISWeight(lightPdf, BouncePdf(bouncePdf, lightDir, guide)) / lightPdf);
+}
+
+//----------------------------------------------------------------------------
+//                          Environment Sampling
+//----------------------------------------------------------------------------
+// the first index in [first, last] whose CDF value is over rnd, from the CDF values cdf(index)
+template <typename LAMBDA>
+inline unsigned int SearchCDF (float rnd, unsigned int first, unsigned int last, LAMBDA&& cdf)
+{
+    while (first < last)
+    {
+        unsigned int middle = (first + last) / 2;
+        if (cdf(middle) > rnd)
+            last = middle;
+        else
+            first = middle + 1;
+    }
+    return first;
+}
+
+//----------------------------------------------------------------------------
+// The solid angle pdf SampleEnvironment() has of picking rayDir. The texel's probability is spread evenly over its area
+// in uv, and a unit of uv area covers 2 pi^2 sin(theta) steradians.
+inline float EnvironmentPdf (const float3& rayDir)
+{
+    const uint4& environmentWidth_environmentHeight_zw = ShaderData::ConstantBuffers::ConstantsOnce.Read().environmentWidth_environmentHeight_zw;
+    const ShaderTypes::StructuredBuffers::TEnvironmentTexels& texels = ShaderData::StructuredBuffers::EnvironmentTexels.Read();
+    const ShaderTypes::StructuredBuffers::TEnvironmentRows& rows = ShaderData::StructuredBuffers::EnvironmentRows.Read();
+    float sinTheta = std::sqrt((std::max)(1.0f - rayDir[1] * rayDir[1], 0.0f));
+    if (sinTheta <= 0.0f)
+        return 0.0f;
+
+    unsigned int width = environmentWidth_environmentHeight_zw[0];
+    unsigned int texelIndex = EnvironmentTexelIndex(rayDir);
+    unsigned int x = texelIndex % width;
+    unsigned int y = texelIndex / width;
+    float rowProbability = rows[y].marginalCDF_yzw[0] - (y > 0 ? rows[y - 1].marginalCDF_yzw[0] : 0.0f);
+    float texelProbability = texels[texelIndex].radiance_conditionalCDF[3] - (x > 0 ? texels[texelIndex - 1].radiance_conditionalCDF[3] : 0.0f);
+    float uvPdf = rowProbability * float(environmentWidth_environmentHeight_zw[1]) * texelProbability * float(width);
+    return uvPdf / (2.0f * c_pi * c_pi * sinTheta);
+}
+
+//----------------------------------------------------------------------------
+// Picks a direction towards the environment proportionally to luminance times solid angle, by finding the row in the
+// marginal CDF and then the texel in the row's conditional CDF. What's left of each random number after finding the
+// row or texel places the direction within the texel. radiance is the texel's, and pdf is the solid angle pdf.
+inline float3 SampleEnvironment (const float2& rnd, float3& radiance, float& pdf)
+{
+    const uint4& environmentWidth_environmentHeight_zw = ShaderData::ConstantBuffers::ConstantsOnce.Read().environmentWidth_environmentHeight_zw;
+    const ShaderTypes::StructuredBuffers::TEnvironmentTexels& texels = ShaderData::StructuredBuffers::EnvironmentTexels.Read();
+    const ShaderTypes::StructuredBuffers::TEnvironmentRows& rows = ShaderData::StructuredBuffers::EnvironmentRows.Read();
+    unsigned int width = environmentWidth_environmentHeight_zw[0];
+    unsigned int height = environmentWidth_environmentHeight_zw[1];
+
+    unsigned int y = SearchCDF(rnd[1], 0, height - 1, [&] (unsigned int row) { return rows[row].marginalCDF_yzw[0]; });
+    float rowStart = y > 0 ? rows[y - 1].marginalCDF_yzw[0] : 0.0f;
+    float rowProbability = rows[y].marginalCDF_yzw[0] - rowStart;
+
+    unsigned int rowFirstTexel = y * width;
+    unsigned int x = SearchCDF(rnd[0], 0, width - 1, [&] (unsigned int column) { return texels[rowFirstTexel + column].radiance_conditionalCDF[3]; });
+    float texelStart = x > 0 ? texels[rowFirstTexel + x - 1].radiance_conditionalCDF[3] : 0.0f;
+    float texelProbability = texels[rowFirstTexel + x].radiance_conditionalCDF[3] - texelStart;
+
+    float u = (float(x) + (std::min)((rnd[0] - texelStart) / texelProbability, c_oneMinusEpsilon)) / float(width);
+    float v = (float(y) + (std::min)((rnd[1] - rowStart) / rowProbability, c_oneMinusEpsilon)) / float(height);
+    float3 dir = EnvironmentUVToDirection(u, v);
+
+    radiance = XYZ(texels[rowFirstTexel + x].radiance_conditionalCDF);
+    // sin(theta) from the direction like EnvironmentPdf() finds it, so the two agree near the poles
+    float sinTheta = std::sqrt((std::max)(1.0f - dir[1] * dir[1], 0.0f));
+    pdf = (sinTheta > 0.0f) ? rowProbability * float(height) * texelProbability * float(width) / (2.0f * c_pi * c_pi * sinTheta) : 0.0f;
+    return dir;
+}
+
+//----------------------------------------------------------------------------
+// Next event estimation for the environment, like SampleDirectLight(). It's seen from pos if nothing is in the way for
+// c_environmentDistance.
+inline float3 SampleDirectEnvironment (const float3& pos, const float3& normal, SRNG& rng, const CPathGuidingQuadtree* guide)
+{
+    float3 ret = { 0.0f, 0.0f, 0.0f };
+    float3 radiance;
+    float environmentPdf;
+    float3 dir = SampleEnvironment(RandomFloat2(rng), radiance, environmentPdf);
+    float cosSurface = Dot(normal, dir);
+    if (environmentPdf <= 0.0f || cosSurface <= 0.0f || OccludedBetween(pos, pos + dir * c_environmentDistance))
+        return ret;
+
+    float bouncePdf = cosSurface / c_pi;
+    return radiance * (bouncePdf * MISWeight(environmentPdf, BouncePdf(bouncePdf, dir, guide)) / environmentPdf);
+}
+
+//----------------------------------------------------------------------------
+// NUMBOUNCES is maxBounces_rouletteStartBounce_zw.x when it's known at compile time, so the bounce loop has a constant
+// trip count and can be unrolled, or c_runtimeBounces to read it from the constants. pathGuiding is null when path
+// guiding is off. Otherwise bounces are guided by it once it has learned something, and while it's learning, the path
+// records the radiance arriving at each of its vertices into it when it's done. radianceCache is null when the radiance
+// cache is off, else paths end into it once they've spread out enough, and record what their vertices after the first
+// hit reflect into it. reservoirLight is the light from the lights that reservoir resampling found for the first hit,
+// see ShadeReservoir(), or null for light sampling to find it.
+template <unsigned int NUMBOUNCES>
+inline float3 Light_Outgoing (SRayHitInfo rayHitInfo, float3 rayHitPos, SRNG& rng, bool whiteAlbedo, bool lightSampling, bool lightTree, CPathGuiding* pathGuiding, CRadianceCache* radianceCache, const float3* reservoirLight)
+{
+    const uint4& maxBounces_rouletteStartBounce_zw = ShaderData::ConstantBuffers::ConstantsPerFrame.Read().maxBounces_rouletteStartBounce_zw;
+    const unsigned int numBounces = (NUMBOUNCES == c_runtimeBounces) ? maxBounces_rouletteStartBounce_zw[0] : NUMBOUNCES;
+
+    const bool environmentSampling = lightSampling && ShaderData::ConstantBuffers::ConstantsOnce.Read().environmentWidth_environmentHeight_zw[0] > 0;
+    const bool guidingSampling = pathGuiding && pathGuiding->Sampling();
+    const bool guidingTraining = pathGuiding && pathGuiding->Training();
+
+    float3 lightSum = { 0.0f, 0.0f, 0.0f };
+    float3 lightMultiplier = { 1.0f, 1.0f, 1.0f };
+    float emissiveWeight = 1.0f;
+    SPathGuidingPath guidingPath;
+    SRadianceCachePath cachePath;
+
+    // Whether the path trains the radiance cache or looks it up, and the spreads of its footprint heuristic. The
+    // camera's is at the first hit, taking the cosine there to be 1, and the path's grows with each bounce after it.
+    bool cacheTraining = false;
+    if (radianceCache)
+    {
+        rng.m_bounce = c_radianceCacheRandomBounce;
+        rng.m_dimension = 0;
+        cacheTraining = RandomFloat(rng) < c_radianceCacheTrainingFraction;
+    }
+    const float cameraSpread = rayHitInfo.m_intersectTime * rayHitInfo.m_intersectTime / (4.0f * c_pi);
+    float pathSpread = 0.0f;
+
+    // adds light to the sum, and to the radiance arriving at the vertices before it when training the path guiding or
+    // filling the radiance cache
+    auto AddLight = [&] (const float3& light)
+    {
+        lightSum = lightSum + light;
+        if (guidingTraining)
+            guidingPath.AddLight(light);
+        if (cacheTraining)
+            cachePath.AddLight(light);
+    };
+
+    auto Finish = [&] ()
+    {
+        if (guidingTraining)
+            guidingPath.Commit(*pathGuiding);
+        if (cacheTraining)
+            cachePath.Commit(*radianceCache);
+        return lightSum;
+    };
+
+    for (unsigned int i = 0; i <= numBounces; ++i)
+    {
+        rng.m_bounce = i;
+        rng.m_dimension = 0;
+
+        // update our light sum and future light multiplier
+        AddLight(rayHitInfo.m_emissive * lightMultiplier * emissiveWeight);
+
+        // After the first hit, a training path's vertices record what they reflect, except the last, which doesn't sample
+        // lights. Other paths end with the light the cache has for the vertex once they've spread out enough, if it has
+        // enough records.
+        if (radianceCache && i > 0)
+        {
+            float3 cachedRadiance;
+            if (cacheTraining && i < numBounces)
+                cachePath.AddVertex(radianceCache->Key(rayHitPos, rayHitInfo.m_surfaceNormal, i), lightMultiplier);
+            else if (!cacheTraining && pathSpread * pathSpread > c_radianceCacheSpreadThreshold * cameraSpread && radianceCache->Lookup(radianceCache->Key(rayHitPos, rayHitInfo.m_surfaceNormal, i), cachedRadiance))
+            {
+                AddLight(cachedRadiance * lightMultiplier);
+                return Finish();
+            }
+        }
+
+        if (!whiteAlbedo)
+            lightMultiplier = lightMultiplier * rayHitInfo.m_albedo;
+
+        // add a random recursive sample for global illumination. With path guiding, it's picked from the guide or cosine
+        // weighted, and bouncePdf is the pdf of doing either. The last bounce isn't guided, since paths don't record
+        // what it finds, and it only finds light that light sampling didn't take.
+        const CPathGuidingQuadtree* guide = (guidingSampling && i < numBounces) ? &pathGuiding->FindLeaf(rayHitPos).m_sampling : nullptr;
+        float3 newRayDir;
+        float guideSquarePdf = -1.0f;
+        if (guide && RandomFloat(rng) >= c_pathGuidingCosineFraction)
+            newRayDir = PathGuidingSquareToDirection(guide->Sample(RandomFloat2(rng), guideSquarePdf));
+        else
+            newRayDir = CosineSampleHemisphere(rayHitInfo.m_surfaceNormal, rng);
+        float cosinePdf = Dot(rayHitInfo.m_surfaceNormal, newRayDir) / c_pi;
+        float bouncePdf = (guideSquarePdf >= 0.0f) ? BouncePdf(cosinePdf, guideSquarePdf) : BouncePdf(cosinePdf, newRayDir, guide);
+
+        // light sampling, for the lights the bounce could hit before the path ends, and the environment if there is one.
+        // The first hit's reservoir stands in for sampling the lights when there is one.
+        const bool reservoirLit = (i == 0 && reservoirLight);
+        if (lightSampling && i < numBounces)
+            AddLight((reservoirLit ? *reservoirLight : SampleDirectLight(rayHitPos, rayHitInfo.m_surfaceNormal, rng, lightTree, guide)) * lightMultiplier);
+        if (environmentSampling && i < numBounces)
+            AddLight(SampleDirectEnvironment(rayHitPos, rayHitInfo.m_surfaceNormal, rng, guide) * lightMultiplier);
+
+        // the lambert BRDF times the cosine term over the pdf is albedo when the bounce is cosine weighted, else it's
+        // off by the ratio of the pdfs. Guided bounces can go below the surface, which ends the path.
+        if (guide)
+        {
+            if (cosinePdf <= 0.0f || bouncePdf <= 0.0f)
+                return Finish();
+            lightMultiplier = lightMultiplier * (cosinePdf / bouncePdf);
+        }
+
+        // russian roulette
+        if (i >= maxBounces_rouletteStartBounce_zw[1])
+        {
+            float survival = (std::min)((std::max)((std::max)(lightMultiplier[0], lightMultiplier[1]), lightMultiplier[2]), 1.0f);
+            if (RandomFloat(rng) >= survival)
+                return Finish();
+            lightMultiplier = lightMultiplier * (1.0f / survival);
+        }
+
+        // everything the path finds from here on arrives at this vertex from newRayDir
+        if (guidingTraining && i < numBounces)
+            guidingPath.AddVertex(rayHitPos, newRayDir, lightMultiplier, cosinePdf * c_pi, bouncePdf);
+
+        SRayHitInfo newRayHitInfo = ClosestIntersection(rayHitPos, newRayDir);
+
+        // if we hit something new, we continue. Light sampling could have found it too if it's a light. The reservoir's
+        // weight isn't a pdf that MIS could weigh the bounce against, so it takes all of the light from the lights.
+        if (newRayHitInfo.m_intersectTime >= 0.0f)
+        {
+            emissiveWeight = 1.0f;
+            if (lightSampling && newRayHitInfo.m_lightIndex >= 0)
+                emissiveWeight = reservoirLit ? 0.0f : MISWeight(bouncePdf, LightPdf(rayHitPos, rayHitInfo.m_surfaceNormal, newRayHitInfo, newRayDir, lightTree));
+
+            // the bounce spreads the path out by the distance over the square root of its pdf in area measure
+            if (radianceCache && !cacheTraining)
+            {
+                float hitCosine = std::abs(Dot(newRayHitInfo.m_surfaceNormal, newRayDir));
+                if (bouncePdf > 0.0f && hitCosine > 0.0f)
+                    pathSpread += newRayHitInfo.m_intersectTime / std::sqrt(bouncePdf * hitCosine);
+            }
+
+            rayHitInfo = newRayHitInfo;
+            rayHitPos = rayHitPos + newRayDir * newRayHitInfo.m_intersectTime;
+        }
+        // else we missed so light using the miss color (skybox lighting) and return the light we've summed up. Environment
+        // sampling could have found it too, except on the last bounce.
+        else
+        {
+            float missWeight = 1.0f;
+            if (environmentSampling && i < numBounces)
+                missWeight = MISWeight(bouncePdf, EnvironmentPdf(newRayDir));
+            AddLight(MissColor(newRayDir) * lightMultiplier * missWeight);
+            return Finish();
+        }
+    }
+
+    return Finish();
+}
+
+//----------------------------------------------------------------------------
+template <unsigned int NUMBOUNCES>
+inline float3 Light_Incoming (const float3& rayPos, const float3& rayDir, SRNG& rng, bool whiteAlbedo, bool lightSampling, bool lightTree, CPathGuiding* pathGuiding, CRadianceCache* radianceCache, const float3* reservoirLight)
+{
+    // find out what our ray hit first
+    SRayHitInfo rayHitInfo = ClosestIntersection(rayPos, rayDir);
+
+    // if it missed, return the miss color
+    if (rayHitInfo.m_intersectTime < 0.0f)
+        return MissColor(rayDir);
+
+    // else, return the amount of light coming towards us from that point on the object we hit
+    return Light_Outgoing<NUMBOUNCES>(rayHitInfo, rayPos + rayDir * rayHitInfo.m_intersectTime, rng, whiteAlbedo, lightSampling, lightTree, pathGuiding, radianceCache, reservoirLight);
+}
+
+//----------------------------------------------------------------------------
+template <unsigned int NUMBOUNCES>
+inline float3 Light_Incoming (const float3& rayPos, const float3& rayDir, SRNG& rng, const ShaderTypes::StructuredBuffers::FirstRayHit& firstRayHit, bool whiteAlbedo, bool lightSampling, bool lightTree, CPathGuiding* pathGuiding, CRadianceCache* radianceCache, const float3* reservoirLight)
+{
+    // get our first ray hit from the info provided
+    SRayHitInfo rayHitInfo;
+    rayHitInfo.m_surfaceNormal = XYZ(firstRayHit.surfaceNormal_intersectTime);
+    rayHitInfo.m_intersectTime = firstRayHit.surfaceNormal_intersectTime[3];
+    rayHitInfo.m_albedo = XYZ(firstRayHit.albedo_w);
+    rayHitInfo.m_emissive = XYZ(firstRayHit.emissive_w);
+
+    // if it missed, return the miss color
+    if (rayHitInfo.m_intersectTime < 0.0f)
+        return MissColor(rayDir);
+
+    // else, return the amount of light coming towards us from that point on the object we hit
+    return Light_Outgoing<NUMBOUNCES>(rayHitInfo, rayPos + rayDir * rayHitInfo.m_intersectTime, rng, whiteAlbedo, lightSampling, lightTree, pathGuiding, radianceCache, reservoirLight);
+}
+
+//----------------------------------------------------------------------------
+//                            Adaptive Sampling
+//----------------------------------------------------------------------------
+// C++ versions of the adaptive sampling functions at the end of Shaders/PathTrace.h
+
+static const float c_adaptiveLuminanceFloor = 0.05f;
+static const float c_adaptiveMaxPixelError = 1.0f;
+
+//----------------------------------------------------------------------------
+inline float Luminance (const float3& color)
+{
+    return Dot(color, { 0.299f, 0.587f, 0.114f });
+}
+
+//----------------------------------------------------------------------------
+// the relative standard error of a pixel's mean luminance, estimated from the mean and second moment of sampleCount samples
+inline float PixelError (float meanLuminance, float secondMoment, float sampleCount)
+{
+    if (sampleCount < 2.0f)
+        return c_adaptiveMaxPixelError;
+
+    float variance = (std::max)(secondMoment - meanLuminance * meanLuminance, 0.0f) * sampleCount / (sampleCount - 1.0f);
+    return (std::min)(std::sqrt(variance / sampleCount) / (std::max)(meanLuminance, c_adaptiveLuminanceFloor), c_adaptiveMaxPixelError);
+}
+//----------------------------------------------------------------------------
+//                          Reservoir Resampling
+//----------------------------------------------------------------------------
+// ReSTIR direct lighting for the first hit, after Bitterli et al's "Spatiotemporal Reservoir Resampling for Real-Time
+// Ray Tracing with Dynamic Direct Lighting". Each frame, each pixel picks one of c_reservoirCandidates samples from
+// SampleLight() by resampled importance sampling, with the light the sample would give if nothing was in the way as the
+// target pdf. The pixel's reservoir then takes in the one its surface had last frame, and then those of a few of its
+// neighbors, so the sample it ends up with is picked out of many more candidates than it took itself.
+//
+// Unbiased reuse only counts the candidates of the reservoirs whose surfaces can see the sample when weighting it,
+// which takes a shadow ray per reservoir. Biased reuse counts them all, which darkens places that see fewer lights than
+// their neighbors, like the edges of shadows, a little, but takes no extra rays. CPU only, the shaders don't have it.
+
+static const unsigned int c_reservoirCandidates = 4;        // light samples each pixel takes a frame
+static const float c_reservoirMaxHistory = 20.0f;           // last frame's reservoir counts as at most this many frames of candidates
+static const unsigned int c_reservoirNeighbors = 5;         // reservoirs of other pixels each pixel takes in
+static const float c_reservoirNeighborRadius = 30.0f;       // in pixels
+static const float c_reservoirNormalThreshold = 0.906f;     // cos(25 degrees). Reservoirs of surfaces facing further apart aren't reused,
+static const float c_reservoirDepthThreshold = 0.1f;        // and nor are those of surfaces further apart than this fraction of the depth
+static const uint32_t c_reservoirRandomBounce = 0xFFFE;     // the reservoir kernels key their random numbers with this bounce and the next
+
+//----------------------------------------------------------------------------
+// W weights the sample in place of one over its pdf, and m_M is how many candidates it was picked from. m_weightSum is
+// the sum of the resampling weights of the candidates, while taking them in.
+struct SReservoir
+{
+    SReservoir ()
+    {
+        m_sample.m_position = { 0.0f, 0.0f, 0.0f };
+        m_sample.m_normal = { 0.0f, 0.0f, 0.0f };
+        m_sample.m_emissive = { 0.0f, 0.0f, 0.0f };
+    }
+
+    SLightSample m_sample;
+    float m_weightSum = 0.0f;
+    float m_M = 0.0f;
+    float m_W = 0.0f;
+};
+
+//----------------------------------------------------------------------------
+// the first hit a reservoir is for
+struct SReservoirSurface
+{
+    float3 m_position = { 0.0f, 0.0f, 0.0f };
+    float3 m_normal = { 0.0f, 0.0f, 0.0f };
+    float m_depth = -1.0f;      // the intersect time of the camera ray, negative if it missed
+};
+
+//----------------------------------------------------------------------------
+// the surface depth along the camera ray of pixel (x, y)
+inline SReservoirSurface MakeReservoirSurface (const SCamera& camera, size_t x, size_t y, size_t width, size_t height, const float3& normal, float depth)
+{
+    SReservoirSurface surface;
+    surface.m_normal = normal;
+    surface.m_depth = depth;
+    if (depth < 0.0f)
+        return surface;
+
+    float3 rayPos, rayDir;
+    CalculateRay(camera, float(x) / float(width), float(y) / float(height), rayPos, rayDir);
+    surface.m_position = rayPos + rayDir * depth;
+    return surface;
+}
+
+//----------------------------------------------------------------------------
+// whether other is close enough to surface in position and facing for their reservoirs to be reused by each other
+inline bool SimilarSurfaces (const SReservoirSurface& surface, const SReservoirSurface& other)
+{
+    if (surface.m_depth < 0.0f || other.m_depth < 0.0f || Dot(surface.m_normal, other.m_normal) < c_reservoirNormalThreshold)
+        return false;
+    float3 offset = other.m_position - surface.m_position;
+    float maxDistance = c_reservoirDepthThreshold * surface.m_depth;
+    return Dot(offset, offset) <= maxDistance * maxDistance;
+}
+
+//----------------------------------------------------------------------------
+// The pixel the camera sees pos at, the inverse of CalculateRay(). False if it's behind the camera or off screen.
+inline bool CameraPixel (const SCamera& camera, const float3& pos, size_t width, size_t height, size_t& x, size_t& y)
+{
+    float3 toPos = pos - camera.m_pos;
+    float forward = Dot(toPos, camera.m_fwd);
+    if (forward <= 0.0f)
+        return false;
+
+    float scale = camera.m_nearPlaneDist / forward;
+    float u = (Dot(toPos, camera.m_right) * scale / camera.m_windowRight + 1.0f) * 0.5f;
+    float v = (Dot(toPos, camera.m_up) * scale / camera.m_windowTop + 1.0f) * 0.5f;
+    float pixelX = std::floor(u * float(width) + 0.5f);
+    float pixelY = std::floor(v * float(height) + 0.5f);
+    if (!(pixelX >= 0.0f && pixelY >= 0.0f && pixelX < float(width) && pixelY < float(height)))
+        return false;
+
+    x = size_t(pixelX);
+    y = size_t(pixelY);
+    return true;
+}
+
+//----------------------------------------------------------------------------
+// The target pdf the reservoirs resample by, the luminance of the light the sample gives the surface when nothing is in
+// the way. It leaves out the albedo and the BRDF's 1 / pi, which are the same for every sample.
+inline float ReservoirTargetPdf (const SReservoirSurface& surface, const SLightSample& sample)
+{
+    float3 toLight = sample.m_position - surface.m_position;
+    float distSquared = Dot(toLight, toLight);
+    if (distSquared <= 0.0f)
+        return 0.0f;
+
+    float3 lightDir = toLight * (1.0f / std::sqrt(distSquared));
+    float cosSurface = Dot(surface.m_normal, lightDir);
+    if (cosSurface <= 0.0f)
+        return 0.0f;
+    float cosLight = std::abs(Dot(sample.m_normal, lightDir));
+    return Luminance(sample.m_emissive) * cosSurface * cosLight / distSquared;
+}
+
+//----------------------------------------------------------------------------
+// takes in a sample standing for M candidates, which replaces the reservoir's with probability weight over the new sum
+inline void ReservoirAdd (SReservoir& reservoir, const SLightSample& sample, float weight, float M, float rnd)
+{
+    reservoir.m_weightSum += weight;
+    reservoir.m_M += M;
+    if (weight > 0.0f && rnd * reservoir.m_weightSum < weight)
+        reservoir.m_sample = sample;
+}
+
+//----------------------------------------------------------------------------
+// works out W once the reservoir has taken in all of its candidates, numCandidates of which could have been its sample
+inline void ReservoirFinish (SReservoir& reservoir, const SReservoirSurface& surface, float numCandidates)
+{
+    float targetPdf = (reservoir.m_weightSum > 0.0f) ? ReservoirTargetPdf(surface, reservoir.m_sample) : 0.0f;
+    reservoir.m_W = (targetPdf > 0.0f && numCandidates > 0.0f) ? reservoir.m_weightSum / (targetPdf * numCandidates) : 0.0f;
+}
+
+//----------------------------------------------------------------------------
+// A new reservoir for the surface from light samples of its own. The sample it picks is dropped if it's in shadow,
+// which is the paper's visibility reuse, so other pixels don't take in samples that don't light this one.
+inline SReservoir SampleReservoir (const SReservoirSurface& surface, SRNG& rng, bool lightTree)
+{
+    SReservoir reservoir;
+    for (unsigned int i = 0; i < c_reservoirCandidates; ++i)
+    {
+        SLightSample lightSample = SampleLight(surface.m_position, surface.m_normal, rng, lightTree);
+        float weight = (lightSample.m_pdf > 0.0f) ? ReservoirTargetPdf(surface, lightSample) / lightSample.m_pdf : 0.0f;
+        ReservoirAdd(reservoir, lightSample, weight, 1.0f, RandomFloat(rng));
+    }
+    ReservoirFinish(reservoir, surface, reservoir.m_M);
+
+    if (reservoir.m_W > 0.0f && OccludedBetween(surface.m_position, reservoir.m_sample.m_position))
+        reservoir.m_W = 0.0f;
+    return reservoir;
+}
+
+//----------------------------------------------------------------------------
+// Combines the reservoirs of count surfaces like this one into one for it, the first being its own. Each sample is
+// resampled by its target pdf for this surface times its W, and stands for all of the candidates it was picked from.
+inline SReservoir CombineReservoirs (const SReservoirSurface& surface, const SReservoir* reservoirs, const SReservoirSurface* surfaces, size_t count, SRNG& rng, bool unbiased)
+{
+    SReservoir ret;
+    for (size_t i = 0; i < count; ++i)
+    {
+        float weight = (reservoirs[i].m_W > 0.0f) ? ReservoirTargetPdf(surface, reservoirs[i].m_sample) * reservoirs[i].m_W * reservoirs[i].m_M : 0.0f;
+        ReservoirAdd(ret, reservoirs[i].m_sample, weight, reservoirs[i].m_M, RandomFloat(rng));
+    }
+
+    float numCandidates = ret.m_M;
+    if (unbiased && ret.m_weightSum > 0.0f)
+    {
+        numCandidates = 0.0f;
+        for (size_t i = 0; i < count; ++i)
+        {
+            if (ReservoirTargetPdf(surfaces[i], ret.m_sample) > 0.0f && !OccludedBetween(surfaces[i].m_position, ret.m_sample.m_position))
+                numCandidates += reservoirs[i].m_M;
+        }
+    }
+    ReservoirFinish(ret, surface, numCandidates);
+    return ret;
+}
+
+//----------------------------------------------------------------------------
+// the light reaching the surface from the reservoir's sample, still to be multiplied by the albedo like SampleDirectLight()
+inline float3 ShadeReservoir (const SReservoirSurface& surface, const SReservoir& reservoir)
+{
+    float3 ret = { 0.0f, 0.0f, 0.0f };
+    if (reservoir.m_W <= 0.0f)
+        return ret;
+
+    float3 toLight = reservoir.m_sample.m_position - surface.m_position;
+    float distSquared = Dot(toLight, toLight);
+    float3 lightDir = toLight * (1.0f / std::sqrt(distSquared));
+    float cosSurface = Dot(surface.m_normal, lightDir);
+    float cosLight = std::abs(Dot(reservoir.m_sample.m_normal, lightDir));
+    if (cosSurface <= 0.0f || cosLight <= 0.0f || OccludedBetween(surface.m_position, reservoir.m_sample.m_position))
+        return ret;
+
+    // the lambert BRDF without the albedo, times the cosine and the geometry term
+    return reservoir.m_sample.m_emissive * (cosSurface * cosLight / (c_pi * distSquared) * reservoir.m_W);
+}
+
+//----------------------------------------------------------------------------
+// A reservoir kept from one kernel to the next, with the normal and depth of the surface it was made for. The surface's
+// position is found again from its pixel and depth.
+struct SStoredReservoir
+{
+    SReservoir m_reservoir;
+    float3 m_surfaceNormal = { 0.0f, 0.0f, 0.0f };
+    float m_surfaceDepth = -1.0f;
+};
+
+//----------------------------------------------------------------------------
+// The reservoirs of the pixels of the image, made by PathTraceResetReservoirs(). m_final are the ones the pixels ended
+// the last frame with, and m_temporal the ones after temporal reuse, which spatial reuse reads. They live with the CPU
+// renderer rather than in ShaderData, since the shaders don't have ReSTIR.
+struct SPixelReservoirs
+{
+    std::vector<SStoredReservoir> m_final;
+    std::vector<SStoredReservoir> m_temporal;
+};
+
+//----------------------------------------------------------------------------
+inline void WriteReservoir (const SReservoir& reservoir, const SReservoirSurface& surface, SStoredReservoir& stored)
+{
+    stored.m_reservoir = reservoir;
+    stored.m_surfaceNormal = surface.m_normal;
+    stored.m_surfaceDepth = surface.m_depth;
+}
@@ -0,0 +1,684 @@
+#pragma once
+
+// C++ version of Shaders/PathTraceFirstHit.fx. Camera rays are coherent, so the CPU traces them in packets of 8x8
+// pixels. A packet walks the BVHs together, testing a node against one ray at a time until one hits it, and uses
+// the frustum around the packet to throw out nodes and primitives that no ray of the packet can hit. When only a
+// few rays are left in a subtree, they finish it one ray at a time. With AVX2, boxes and triangles are tested
+// against a row of 8 rays at once.
+
+#include <stdint.h>
+#include "PathTraceCPU.h"
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+static const size_t c_packetTileSize = 8;
+static const size_t c_packetSize = c_packetTileSize * c_packetTileSize;
+static const size_t c_packetMinActiveRays = 4;          // subtrees with fewer active rays than this are traced one ray at a time
+static const float c_packetFrustumEpsilon = 0.001f;     // frustum planes are pushed out by this much to cover rounding in the rays
+
+typedef uint64_t TRayMask;  // bit i is set if ray i of the packet is active
+
+static_assert(c_packetSize <= sizeof(TRayMask) * 8, "Ray packets need a bit per ray in TRayMask");
+
+typedef ShaderTypes::StructuredBuffers::FirstRayHit TFirstRayHit;
+
+//----------------------------------------------------------------------------
+inline size_t FirstRay (TRayMask mask)
+{
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward64(&index, mask);
+    return index;
+#else
+    return (size_t)__builtin_ctzll(mask);
+#endif
+}
+
+//----------------------------------------------------------------------------
+inline size_t CountRays (TRayMask mask)
+{
+#ifdef _MSC_VER
+    return (size_t)__popcnt64(mask);
+#else
+    return (size_t)__builtin_popcountll(mask);
+#endif
+}
+
+//----------------------------------------------------------------------------
+// calls lambda(rayIndex) for each ray in the mask
+template <typename LAMBDA>
+void ForEachRay (TRayMask mask, LAMBDA&& lambda)
+{
+    while (mask != 0)
+    {
+        lambda(FirstRay(mask));
+        mask &= mask - 1;
+    }
+}
+
+//----------------------------------------------------------------------------
+// the pyramid that contains the rays of a packet. All camera rays start on the line from the camera position
+// through their pixel, so the sides are the planes through the camera position and each pair of corner rays.
+struct SPacketFrustum
+{
+    float3 m_normals[4];
+    float m_dists[4];   // a point p is inside plane i if Dot(m_normals[i], p) >= m_dists[i]
+};
+
+inline void MakePacketFrustum (const float3& origin, const float3 cornerDirs[4], SPacketFrustum& frustum)
+{
+    float3 center = cornerDirs[0] + cornerDirs[1] + cornerDirs[2] + cornerDirs[3];
+    for (size_t i = 0; i < 4; ++i)
+    {
+        float3 normal = Cross(cornerDirs[i], cornerDirs[(i + 1) % 4]);
+
+        // a tile one pixel wide or tall has matching corners, so that side can't cull anything
+        if (LengthSq(normal) < 1e-20f)
+        {
+            frustum.m_normals[i] = { 0.0f, 0.0f, 0.0f };
+            frustum.m_dists[i] = -1.0f;
+            continue;
+        }
+
+        Normalize(normal);
+        if (Dot(normal, center) < 0.0f)
+            normal = normal * -1.0f;
+        frustum.m_normals[i] = normal;
+        frustum.m_dists[i] = Dot(normal, origin) - c_packetFrustumEpsilon;
+    }
+}
+
+//----------------------------------------------------------------------------
+inline bool FrustumCullsBox (const SPacketFrustum& frustum, const float4& boxMin, const float4& boxMax)
+{
+    // if the corner of the box farthest along a plane's normal is outside, the whole box is
+    for (size_t i = 0; i < 4; ++i)
+    {
+        const float3& normal = frustum.m_normals[i];
+        float3 corner = {
+            normal[0] > 0.0f ? boxMax[0] : boxMin[0],
+            normal[1] > 0.0f ? boxMax[1] : boxMin[1],
+            normal[2] > 0.0f ? boxMax[2] : boxMin[2]
+        };
+        if (Dot(normal, corner) < frustum.m_dists[i])
+            return true;
+    }
+    return false;
+}
+
+//----------------------------------------------------------------------------
+template <size_t NUMPOINTS>
+bool FrustumCullsPoints (const SPacketFrustum& frustum, const std::array<float3, NUMPOINTS>& points)
+{
+    for (size_t i = 0; i < 4; ++i)
+    {
+        bool allOutside = true;
+        for (const float3& point : points)
+            allOutside = allOutside && Dot(frustum.m_normals[i], point) < frustum.m_dists[i];
+        if (allOutside)
+            return true;
+    }
+    return false;
+}
+
+//----------------------------------------------------------------------------
+inline bool FrustumCullsSphere (const SPacketFrustum& frustum, const float3& center, float radius)
+{
+    for (size_t i = 0; i < 4; ++i)
+    {
+        if (Dot(frustum.m_normals[i], center) + radius < frustum.m_dists[i])
+            return true;
+    }
+    return false;
+}
+
+//----------------------------------------------------------------------------
+// rays are stored per axis, row by row of the tile, so a row of 8 rays is one AVX register per axis
+struct alignas(32) SRayPacket
+{
+    float m_pos[3][c_packetSize];
+    float m_dir[3][c_packetSize];
+    float m_invDir[3][c_packetSize];
+
+    // the frustum, and what it was made from so it can be remade in a model's object space
+    float3 m_origin;
+    float3 m_cornerDirs[4];
+    SPacketFrustum m_frustum;
+
+    float3 Pos (size_t ray) const { return { m_pos[0][ray], m_pos[1][ray], m_pos[2][ray] }; }
+    float3 Dir (size_t ray) const { return { m_dir[0][ray], m_dir[1][ray], m_dir[2][ray] }; }
+    float3 InvDir (size_t ray) const { return { m_invDir[0][ray], m_invDir[1][ray], m_invDir[2][ray] }; }
+
+    void SetRay (size_t ray, const float3& pos, const float3& dir)
+    {
+        for (size_t axis = 0; axis < 3; ++axis)
+        {
+            m_pos[axis][ray] = pos[axis];
+            m_dir[axis][ray] = dir[axis];
+            m_invDir[axis][ray] = 1.0f / dir[axis];
+        }
+    }
+};
+
+#ifdef __AVX2__
+
+//----------------------------------------------------------------------------
+// the current hit times of a row of rays. Rays that haven't hit anything yet can hit anything.
+inline __m256 LoadRowMaxIntersectTimes (const SRayHitInfo* rayHitInfos)
+{
+    __m256 times = _mm256_set_ps(rayHitInfos[7].m_intersectTime, rayHitInfos[6].m_intersectTime, rayHitInfos[5].m_intersectTime, rayHitInfos[4].m_intersectTime,
+        rayHitInfos[3].m_intersectTime, rayHitInfos[2].m_intersectTime, rayHitInfos[1].m_intersectTime, rayHitInfos[0].m_intersectTime);
+    return _mm256_blendv_ps(times, _mm256_set1_ps(FLT_MAX), _mm256_cmp_ps(times, _mm256_setzero_ps(), _CMP_LT_OQ));
+}
+
+//----------------------------------------------------------------------------
+// RayIntersectsBox() for a row of rays. Returns a bit per ray that hits. The min/max operand order matches
+// std::min/std::max so NaNs from axis aligned rays come out the same way.
+inline int PacketRowIntersectsBox (const SRayPacket& packet, size_t firstRay, const SRayHitInfo* rayHitInfos, const float4& boxMin, const float4& boxMax)
+{
+    __m256 enter = _mm256_setzero_ps();
+    __m256 exit = _mm256_set1_ps(FLT_MAX);
+    for (size_t axis = 0; axis < 3; ++axis)
+    {
+        __m256 pos = _mm256_load_ps(&packet.m_pos[axis][firstRay]);
+        __m256 invDir = _mm256_load_ps(&packet.m_invDir[axis][firstRay]);
+        __m256 t0 = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(boxMin[axis]), pos), invDir);
+        __m256 t1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(boxMax[axis]), pos), invDir);
+        enter = _mm256_max_ps(_mm256_min_ps(t1, t0), enter);
+        exit = _mm256_min_ps(_mm256_max_ps(t1, t0), exit);
+    }
+    __m256 hit = _mm256_and_ps(_mm256_cmp_ps(enter, exit, _CMP_LE_OQ), _mm256_cmp_ps(enter, LoadRowMaxIntersectTimes(&rayHitInfos[firstRay]), _CMP_LE_OQ));
+    return _mm256_movemask_ps(hit);
+}
+
+//----------------------------------------------------------------------------
+// RayIntersectsTriangle() for a row of rays, with the same math in the same order
+template <typename TRIANGLE>
+void PacketRowIntersectsTriangle (const SRayPacket& packet, size_t firstRay, int rowMask, const TRIANGLE& trianglePrim, SRayHitInfo* rayHitInfos)
+{
+    float3 positionA = XYZ(trianglePrim.positionA_w);
+    float3 e_1 = XYZ(trianglePrim.positionB_w) - positionA;
+    float3 e_2 = XYZ(trianglePrim.positionC_w) - positionA;
+
+    __m256 dirX = _mm256_load_ps(&packet.m_dir[0][firstRay]);
+    __m256 dirY = _mm256_load_ps(&packet.m_dir[1][firstRay]);
+    __m256 dirZ = _mm256_load_ps(&packet.m_dir[2][firstRay]);
+    __m256 e1X = _mm256_set1_ps(e_1[0]);
+    __m256 e1Y = _mm256_set1_ps(e_1[1]);
+    __m256 e1Z = _mm256_set1_ps(e_1[2]);
+    __m256 e2X = _mm256_set1_ps(e_2[0]);
+    __m256 e2Y = _mm256_set1_ps(e_2[1]);
+    __m256 e2Z = _mm256_set1_ps(e_2[2]);
+
+    // q = cross(rayDir, e_2), a = dot(e_1, q)
+    __m256 qX = _mm256_sub_ps(_mm256_mul_ps(dirY, e2Z), _mm256_mul_ps(dirZ, e2Y));
+    __m256 qY = _mm256_sub_ps(_mm256_mul_ps(dirZ, e2X), _mm256_mul_ps(dirX, e2Z));
+    __m256 qZ = _mm256_sub_ps(_mm256_mul_ps(dirX, e2Y), _mm256_mul_ps(dirY, e2X));
+    __m256 a = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e1X, qX), _mm256_mul_ps(e1Y, qY)), _mm256_mul_ps(e1Z, qZ));
+    __m256 zero = _mm256_setzero_ps();
+    __m256 valid = _mm256_cmp_ps(a, zero, _CMP_NEQ_OQ);
+
+    // s = (rayPos - positionA) / a, r = cross(s, e_1)
+    __m256 invA = _mm256_div_ps(_mm256_set1_ps(1.0f), a);
+    __m256 sX = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(&packet.m_pos[0][firstRay]), _mm256_set1_ps(positionA[0])), invA);
+    __m256 sY = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(&packet.m_pos[1][firstRay]), _mm256_set1_ps(positionA[1])), invA);
+    __m256 sZ = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(&packet.m_pos[2][firstRay]), _mm256_set1_ps(positionA[2])), invA);
+    __m256 rX = _mm256_sub_ps(_mm256_mul_ps(sY, e1Z), _mm256_mul_ps(sZ, e1Y));
+    __m256 rY = _mm256_sub_ps(_mm256_mul_ps(sZ, e1X), _mm256_mul_ps(sX, e1Z));
+    __m256 rZ = _mm256_sub_ps(_mm256_mul_ps(sX, e1Y), _mm256_mul_ps(sY, e1X));
+
+    // barycentric coordinates and hit time
+    __m256 b0 = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(sX, qX), _mm256_mul_ps(sY, qY)), _mm256_mul_ps(sZ, qZ));
+    __m256 b1 = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(rX, dirX), _mm256_mul_ps(rY, dirY)), _mm256_mul_ps(rZ, dirZ));
+    __m256 b2 = _mm256_sub_ps(_mm256_sub_ps(_mm256_set1_ps(1.0f), b0), b1);
+    __m256 t = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e2X, rX), _mm256_mul_ps(e2Y, rY)), _mm256_mul_ps(e2Z, rZ));
+
+    valid = _mm256_and_ps(valid, _mm256_cmp_ps(b0, zero, _CMP_GE_OQ));
+    valid = _mm256_and_ps(valid, _mm256_cmp_ps(b1, zero, _CMP_GE_OQ));
+    valid = _mm256_and_ps(valid, _mm256_cmp_ps(b2, zero, _CMP_GE_OQ));
+    valid = _mm256_and_ps(valid, _mm256_cmp_ps(t, zero, _CMP_GE_OQ));
+    valid = _mm256_and_ps(valid, _mm256_cmp_ps(t, LoadRowMaxIntersectTimes(&rayHitInfos[firstRay]), _CMP_LE_OQ));
+    int hitMask = _mm256_movemask_ps(valid) & rowMask;
+    if (hitMask == 0)
+        return;
+
+    // hits are rare compared to tests, so they are written out one at a time
+    alignas(32) float times[8];
+    _mm256_store_ps(times, t);
+    ForEachRay(TRayMask(hitMask),
+        [&] (size_t lane)
+        {
+            SRayHitInfo& rayHitInfo = rayHitInfos[firstRay + lane];
+            float3 normal = XYZ(trianglePrim.normal_w);
+            if (Dot(normal, packet.Dir(firstRay + lane)) > 0.0f)
+                normal = normal * -1.0f;
+
+            rayHitInfo.m_intersectTime = times[lane];
+            rayHitInfo.m_surfaceNormal = normal;
+            rayHitInfo.m_albedo = XYZ(trianglePrim.albedo_w);
+            rayHitInfo.m_emissive = XYZ(trianglePrim.emissive_lightIndex);
+            rayHitInfo.m_lightIndex = int(trianglePrim.emissive_lightIndex[3]);
+        }
+    );
+}
+
+//----------------------------------------------------------------------------
+// RayIntersectsSphere() for a row of rays
+inline void PacketRowIntersectsSphere (const SRayPacket& packet, size_t firstRay, int rowMask, const ShaderTypes::StructuredBuffers::SpherePrim& sphere, SRayHitInfo* rayHitInfos)
+{
+    __m256 mX = _mm256_sub_ps(_mm256_load_ps(&packet.m_pos[0][firstRay]), _mm256_set1_ps(sphere.position_Radius[0]));
+    __m256 mY = _mm256_sub_ps(_mm256_load_ps(&packet.m_pos[1][firstRay]), _mm256_set1_ps(sphere.position_Radius[1]));
+    __m256 mZ = _mm256_sub_ps(_mm256_load_ps(&packet.m_pos[2][firstRay]), _mm256_set1_ps(sphere.position_Radius[2]));
+    __m256 b = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(mX, _mm256_load_ps(&packet.m_dir[0][firstRay])), _mm256_mul_ps(mY, _mm256_load_ps(&packet.m_dir[1][firstRay]))),
+        _mm256_mul_ps(mZ, _mm256_load_ps(&packet.m_dir[2][firstRay])));
+    __m256 c = _mm256_sub_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(mX, mX), _mm256_mul_ps(mY, mY)), _mm256_mul_ps(mZ, mZ)),
+        _mm256_set1_ps(sphere.position_Radius[3] * sphere.position_Radius[3]));
+
+    // miss if the ray starts outside and points away, or the discriminant isn't positive
+    __m256 zero = _mm256_setzero_ps();
+    __m256 discr = _mm256_sub_ps(_mm256_mul_ps(b, b), c);
+    __m256 valid = _mm256_andnot_ps(_mm256_and_ps(_mm256_cmp_ps(c, zero, _CMP_GT_OQ), _mm256_cmp_ps(b, zero, _CMP_GT_OQ)), _mm256_cmp_ps(discr, zero, _CMP_GT_OQ));
+
+    // the far hit is used when the ray starts inside
+    __m256 root = _mm256_sqrt_ps(discr);
+    __m256 negB = _mm256_sub_ps(zero, b);
+    __m256 t = _mm256_sub_ps(negB, root);
+    t = _mm256_blendv_ps(t, _mm256_add_ps(negB, root), _mm256_cmp_ps(t, zero, _CMP_LT_OQ));
+    valid = _mm256_and_ps(valid, _mm256_cmp_ps(t, LoadRowMaxIntersectTimes(&rayHitInfos[firstRay]), _CMP_LE_OQ));
+    int hitMask = _mm256_movemask_ps(valid) & rowMask;
+    if (hitMask == 0)
+        return;
+
+    alignas(32) float times[8];
+    _mm256_store_ps(times, t);
+    ForEachRay(TRayMask(hitMask),
+        [&] (size_t lane)
+        {
+            size_t ray = firstRay + lane;
+            SRayHitInfo& rayHitInfo = rayHitInfos[ray];
+            float3 rayDir = packet.Dir(ray);
+            float3 normal = (packet.Pos(ray) + rayDir * times[lane]) - XYZ(sphere.position_Radius);
+            Normalize(normal);
+            if (Dot(normal, rayDir) > 0.0f)
+                normal = normal * -1.0f;
+
+            rayHitInfo.m_intersectTime = times[lane];
+            rayHitInfo.m_surfaceNormal = normal;
+            rayHitInfo.m_albedo = XYZ(sphere.albedo_w);
+            rayHitInfo.m_emissive = XYZ(sphere.emissive_lightIndex);
+            rayHitInfo.m_lightIndex = int(sphere.emissive_lightIndex[3]);
+        }
+    );
+}
+
+//----------------------------------------------------------------------------
+// CalculateRay() for a row of 8 pixels starting at x, y, pushed off their start by c_rayEpsilon like ClosestIntersection() does
+inline void PacketRowCalculateRays (const SCamera& camera, size_t x, size_t y, size_t width, size_t height, size_t firstRay, SRayPacket& packet)
+{
+    __m256 u = _mm256_div_ps(_mm256_cvtepi32_ps(_mm256_add_epi32(_mm256_set1_epi32(int(x)), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7))), _mm256_set1_ps(float(width)));
+    __m256 pixelClipSpaceX = _mm256_sub_ps(_mm256_mul_ps(_mm256_set1_ps(2.0f), u), _mm256_set1_ps(1.0f));
+    float pixelClipSpaceY = 2.0f * (float(y) / float(height)) - 1.0f;
+
+    float3 nearPlaneCenter = camera.m_pos + camera.m_fwd * camera.m_nearPlaneDist;
+    float3 rowStart = camera.m_up * (pixelClipSpaceY * camera.m_windowTop);
+    __m256 right = _mm256_mul_ps(pixelClipSpaceX, _mm256_set1_ps(camera.m_windowRight));
+
+    __m256 pos[3];
+    __m256 dir[3];
+    for (size_t axis = 0; axis < 3; ++axis)
+    {
+        pos[axis] = _mm256_add_ps(_mm256_set1_ps(nearPlaneCenter[axis]), _mm256_mul_ps(_mm256_set1_ps(camera.m_right[axis]), right));
+        pos[axis] = _mm256_add_ps(pos[axis], _mm256_set1_ps(rowStart[axis]));
+        dir[axis] = _mm256_sub_ps(pos[axis], _mm256_set1_ps(camera.m_pos[axis]));
+    }
+    __m256 len = _mm256_sqrt_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dir[0], dir[0]), _mm256_mul_ps(dir[1], dir[1])), _mm256_mul_ps(dir[2], dir[2])));
+    for (size_t axis = 0; axis < 3; ++axis)
+    {
+        dir[axis] = _mm256_div_ps(dir[axis], len);
+        _mm256_store_ps(&packet.m_pos[axis][firstRay], _mm256_add_ps(pos[axis], _mm256_mul_ps(dir[axis], _mm256_set1_ps(c_rayEpsilon))));
+        _mm256_store_ps(&packet.m_dir[axis][firstRay], dir[axis]);
+        _mm256_store_ps(&packet.m_invDir[axis][firstRay], _mm256_div_ps(_mm256_set1_ps(1.0f), dir[axis]));
+    }
+}
+
+#endif
+
+//----------------------------------------------------------------------------
+// returns exactly the rays that hit the box
+inline TRayMask PacketIntersectsBoxExact (const SRayPacket& packet, TRayMask rayMask, const SRayHitInfo* rayHitInfos, const float4& boxMin, const float4& boxMax)
+{
+    TRayMask ret = 0;
+#ifdef __AVX2__
+    for (size_t firstRay = 0; firstRay < c_packetSize; firstRay += c_packetTileSize)
+    {
+        TRayMask rowMask = (rayMask >> firstRay) & 0xFF;
+        if (rowMask != 0)
+            ret |= (TRayMask(PacketRowIntersectsBox(packet, firstRay, rayHitInfos, boxMin, boxMax)) & rowMask) << firstRay;
+    }
+#else
+    ForEachRay(rayMask,
+        [&] (size_t ray)
+        {
+            if (RayIntersectsBox(packet.Pos(ray), packet.InvDir(ray), boxMin, boxMax, rayHitInfos[ray].m_intersectTime))
+                ret |= TRayMask(1) << ray;
+        }
+    );
+#endif
+    return ret;
+}
+
+//----------------------------------------------------------------------------
+// returns the rays that need to visit the box. If the first active ray hits it, every ray goes in without being
+// tested. Otherwise the frustum gets a chance to cull the box before more rays are tested. The rays from the first
+// one that hits onwards go in.
+inline TRayMask PacketIntersectsBox (const SRayPacket& packet, TRayMask rayMask, const SRayHitInfo* rayHitInfos, const float4& boxMin, const float4& boxMax)
+{
+    size_t first = FirstRay(rayMask);
+    if (RayIntersectsBox(packet.Pos(first), packet.InvDir(first), boxMin, boxMax, rayHitInfos[first].m_intersectTime))
+        return rayMask;
+
+    if (FrustumCullsBox(packet.m_frustum, boxMin, boxMax))
+        return 0;
+
+    rayMask &= rayMask - 1;
+#ifdef __AVX2__
+    for (size_t firstRay = first - first % c_packetTileSize; firstRay < c_packetSize; firstRay += c_packetTileSize)
+    {
+        TRayMask rowMask = (rayMask >> firstRay) & 0xFF;
+        if (rowMask == 0)
+            continue;
+        TRayMask hitMask = TRayMask(PacketRowIntersectsBox(packet, firstRay, rayHitInfos, boxMin, boxMax)) & rowMask;
+        if (hitMask != 0)
+            return rayMask & ~((TRayMask(1) << (firstRay + FirstRay(hitMask))) - 1);
+    }
+#else
+    while (rayMask != 0)
+    {
+        size_t ray = FirstRay(rayMask);
+        if (RayIntersectsBox(packet.Pos(ray), packet.InvDir(ray), boxMin, boxMax, rayHitInfos[ray].m_intersectTime))
+            return rayMask;
+        rayMask &= rayMask - 1;
+    }
+#endif
+    return 0;
+}
+
+//----------------------------------------------------------------------------
+template <typename TRIANGLE>
+void PacketIntersectsTriangle (const SRayPacket& packet, TRayMask rayMask, const TRIANGLE& trianglePrim, SRayHitInfo* rayHitInfos)
+{
+    if (FrustumCullsPoints<3>(packet.m_frustum, { XYZ(trianglePrim.positionA_w), XYZ(trianglePrim.positionB_w), XYZ(trianglePrim.positionC_w) }))
+        return;
+
+#ifdef __AVX2__
+    for (size_t firstRay = 0; firstRay < c_packetSize; firstRay += c_packetTileSize)
+    {
+        int rowMask = int((rayMask >> firstRay) & 0xFF);
+        if (rowMask != 0)
+            PacketRowIntersectsTriangle(packet, firstRay, rowMask, trianglePrim, rayHitInfos);
+    }
+#else
+    ForEachRay(rayMask, [&] (size_t ray) { RayIntersectsTriangle(packet.Pos(ray), packet.Dir(ray), trianglePrim, rayHitInfos[ray]); });
+#endif
+}
+
+//----------------------------------------------------------------------------
+// packet version of TraverseBVH(). Calls lambda(primIndex, rayMask) for the rays of the packet that enter each leaf.
+template <typename NODES, typename LAMBDA>
+void TraverseBVHPacket (const SRayPacket& packet, TRayMask rayMask, const SRayHitInfo* rayHitInfos, const NODES& nodes, unsigned int rootNode, LAMBDA&& lambda)
+{
+    struct SStackEntry
+    {
+        unsigned int m_nodeIndex;
+        TRayMask m_rayMask;
+    };
+    SStackEntry stack[c_bvhMaxDepth];
+    unsigned int stackCount = 0;
+    unsigned int nodeIndex = rootNode;
+    while (true)
+    {
+        const auto& node = nodes[nodeIndex];
+        rayMask = PacketIntersectsBox(packet, rayMask, rayHitInfos, node.boundsMin_w, node.boundsMax_w);
+        if (rayMask != 0)
+        {
+            unsigned int firstPrim = node.rightChild_firstPrim_numPrims_splitAxis[1];
+            unsigned int numPrims = node.rightChild_firstPrim_numPrims_splitAxis[2];
+
+            // the packet has diverged: the remaining rays finish this subtree on their own
+            if (CountRays(rayMask) < c_packetMinActiveRays)
+            {
+                ForEachRay(rayMask,
+                    [&] (size_t ray)
+                    {
+                        TraverseBVH(packet.Pos(ray), packet.Dir(ray), nodes, nodeIndex, rayHitInfos[ray],
+                            [&] (unsigned int primIndex)
+                            {
+                                lambda(primIndex, TRayMask(1) << ray);
+                            }
+                        );
+                    }
+                );
+            }
+            // leaf: only the rays that really hit the box test the primitives
+            else if (numPrims > 0)
+            {
+                rayMask = PacketIntersectsBoxExact(packet, rayMask, rayHitInfos, node.boundsMin_w, node.boundsMax_w);
+                if (rayMask != 0)
+                {
+                    for (unsigned int i = firstPrim; i < firstPrim + numPrims; ++i)
+                        lambda(i, rayMask);
+                }
+            }
+            // interior node: the first active ray decides which child is nearer
+            else
+            {
+                unsigned int nearChild = nodeIndex + 1;
+                unsigned int farChild = node.rightChild_firstPrim_numPrims_splitAxis[0];
+                if (packet.m_dir[node.rightChild_firstPrim_numPrims_splitAxis[3]][FirstRay(rayMask)] < 0.0f)
+                    std::swap(nearChild, farChild);
+                stack[stackCount].m_nodeIndex = farChild;
+                stack[stackCount].m_rayMask = rayMask;
+                ++stackCount;
+                nodeIndex = nearChild;
+                continue;
+            }
+        }
+
+        if (stackCount == 0)
+            break;
+        --stackCount;
+        nodeIndex = stack[stackCount].m_nodeIndex;
+        rayMask = stack[stackCount].m_rayMask;
+    }
+}
+
+//----------------------------------------------------------------------------
+// packet version of RayIntersectsModel(). The rays and the frustum are moved into the model's object space.
+template <typename TRIANGLES, typename NODES>
+void PacketIntersectsModel (const SRayPacket& packet, TRayMask rayMask, SRayHitInfo* rayHitInfos, const ShaderTypes::StructuredBuffers::ModelPrim& modelPrim, const TRIANGLES& triangles, const NODES& nodes)
+{
+    SRayPacket objectPacket;
+    float oldIntersectTimes[c_packetSize];
+    ForEachRay(rayMask,
+        [&] (size_t ray)
+        {
+            objectPacket.SetRay(ray,
+                TransformPoint(modelPrim.worldToObjectX, modelPrim.worldToObjectY, modelPrim.worldToObjectZ, packet.Pos(ray)),
+                TransformVector(modelPrim.worldToObjectX, modelPrim.worldToObjectY, modelPrim.worldToObjectZ, packet.Dir(ray)));
+            oldIntersectTimes[ray] = rayHitInfos[ray].m_intersectTime;
+        }
+    );
+
+    objectPacket.m_origin = TransformPoint(modelPrim.worldToObjectX, modelPrim.worldToObjectY, modelPrim.worldToObjectZ, packet.m_origin);
+    for (size_t i = 0; i < 4; ++i)
+        objectPacket.m_cornerDirs[i] = TransformVector(modelPrim.worldToObjectX, modelPrim.worldToObjectY, modelPrim.worldToObjectZ, packet.m_cornerDirs[i]);
+    MakePacketFrustum(objectPacket.m_origin, objectPacket.m_cornerDirs, objectPacket.m_frustum);
+
+    TraverseBVHPacket(objectPacket, rayMask, rayHitInfos, nodes, modelPrim.firstTriangle_lastTriangle_rootNode_firstLight[2],
+        [&] (unsigned int triangleIndex, TRayMask triangleRayMask)
+        {
+            PacketIntersectsTriangle(objectPacket, triangleRayMask, triangles[triangleIndex], rayHitInfos);
+        }
+    );
+
+    ForEachRay(rayMask,
+        [&] (size_t ray)
+        {
+            if (rayHitInfos[ray].m_intersectTime != oldIntersectTimes[ray])
+                rayHitInfos[ray].m_surfaceNormal = ModelNormalToWorld(modelPrim, rayHitInfos[ray].m_surfaceNormal);
+        }
+    );
+}
+
+//----------------------------------------------------------------------------
+// packet version of ClosestIntersection(). The packet's rays should already be pushed off their start by c_rayEpsilon.
+inline void ClosestIntersectionPacket (const SRayPacket& packet, TRayMask rayMask, SRayHitInfo* rayHitInfos)
+{
+    const uint4& sceneInfo = ShaderData::ConstantBuffers::ConstantsOnce.Read().numModels_sceneRootNode_numScenePrims_numLights;
+    if (sceneInfo[2] == 0 || rayMask == 0)
+        return;
+
+    TraverseBVHPacket(packet, rayMask, rayHitInfos, ShaderData::StructuredBuffers::BVHNodes.Read(), sceneInfo[1],
+        [&] (unsigned int primIndex, TRayMask primRayMask)
+        {
+            const uint4& typeIndex = ShaderData::StructuredBuffers::ScenePrimitives.Read()[primIndex].type_index_zw;
+            unsigned int index = typeIndex[1];
+            switch ((EScenePrimitive)typeIndex[0])
+            {
+                case EScenePrimitive::Sphere:
+                {
+                    const auto& sphere = ShaderData::StructuredBuffers::Spheres.Read()[index];
+                    if (FrustumCullsSphere(packet.m_frustum, XYZ(sphere.position_Radius), sphere.position_Radius[3]))
+                        return;
+#ifdef __AVX2__
+                    for (size_t firstRay = 0; firstRay < c_packetSize; firstRay += c_packetTileSize)
+                    {
+                        int rowMask = int((primRayMask >> firstRay) & 0xFF);
+                        if (rowMask != 0)
+                            PacketRowIntersectsSphere(packet, firstRay, rowMask, sphere, rayHitInfos);
+                    }
+#else
+                    ForEachRay(primRayMask, [&] (size_t ray) { RayIntersectsSphere(packet.Pos(ray), packet.Dir(ray), sphere, rayHitInfos[ray]); });
+#endif
+                    break;
+                }
+                case EScenePrimitive::Triangle:
+                {
+                    PacketIntersectsTriangle(packet, primRayMask, ShaderData::StructuredBuffers::Triangles.Read()[index], rayHitInfos);
+                    break;
+                }
+                case EScenePrimitive::Quad:
+                {
+                    const auto& quad = ShaderData::StructuredBuffers::Quads.Read()[index];
+                    if (FrustumCullsPoints<4>(packet.m_frustum, { XYZ(quad.positionA_w), XYZ(quad.positionB_w), XYZ(quad.positionC_w), XYZ(quad.positionD_w) }))
+                        return;
+                    ForEachRay(primRayMask, [&] (size_t ray) { RayIntersectsQuad(packet.Pos(ray), packet.Dir(ray), quad, rayHitInfos[ray]); });
+                    break;
+                }
+                case EScenePrimitive::OBB:
+                {
+                    // culled by the sphere around the box
+                    const auto& obb = ShaderData::StructuredBuffers::OBBs.Read()[index];
+                    if (FrustumCullsSphere(packet.m_frustum, XYZ(obb.position_w), std::sqrt(LengthSq(XYZ(obb.radius_w)))))
+                        return;
+                    ForEachRay(primRayMask, [&] (size_t ray) { RayIntersectsOBB(packet.Pos(ray), packet.Dir(ray), obb, rayHitInfos[ray]); });
+                    break;
+                }
+                case EScenePrimitive::Model:
+                {
+                    PacketIntersectsModel(packet, primRayMask, rayHitInfos, ShaderData::StructuredBuffers::Models.Read()[index],
+                        ShaderData::StructuredBuffers::ModelTriangles.Read(), ShaderData::StructuredBuffers::BVHNodes.Read());
+                    break;
+                }
+            }
+        }
+    );
+}
+
+//----------------------------------------------------------------------------
+inline void WriteFirstRayHit (const SRayHitInfo& rayHitInfo, TFirstRayHit& firstRayHit)
+{
+    const float3& normal = rayHitInfo.m_surfaceNormal;
+    firstRayHit.surfaceNormal_intersectTime = { normal[0], normal[1], normal[2], rayHitInfo.m_intersectTime };
+    firstRayHit.albedo_w = { rayHitInfo.m_albedo[0], rayHitInfo.m_albedo[1], rayHitInfo.m_albedo[2], 0.0f };
+    firstRayHit.emissive_w = { rayHitInfo.m_emissive[0], rayHitInfo.m_emissive[1], rayHitInfo.m_emissive[2], 0.0f };
+}
+
+//----------------------------------------------------------------------------
+// one ray, the same as the shader does it
+inline void TraceFirstHit (const SCamera& camera, size_t x, size_t y, size_t width, size_t height, TFirstRayHit* firstRayHits)
+{
+    float3 rayPos, rayDir;
+    CalculateRay(camera, float(x) / float(width), float(y) / float(height), rayPos, rayDir);
+    WriteFirstRayHit(ClosestIntersection(rayPos, rayDir), firstRayHits[y * width + x]);
+}
+
+//----------------------------------------------------------------------------
+// the 8x8 pixel tile starting at tileX, tileY as one packet. Tiles at the edges of the image can be smaller.
+inline void TraceFirstHitTile (const SCamera& camera, size_t tileX, size_t tileY, size_t width, size_t height, TFirstRayHit* firstRayHits)
+{
+    size_t tileWidth = (std::min)(c_packetTileSize, width - tileX);
+    size_t tileHeight = (std::min)(c_packetTileSize, height - tileY);
+
+    SRayPacket packet;
+    TRayMask rayMask = 0;
+    for (size_t y = 0; y < tileHeight; ++y)
+    {
+#ifdef __AVX2__
+        PacketRowCalculateRays(camera, tileX, tileY + y, width, height, y * c_packetTileSize, packet);
+#endif
+        for (size_t x = 0; x < tileWidth; ++x)
+        {
+            size_t ray = y * c_packetTileSize + x;
+#ifndef __AVX2__
+            float3 rayPos, rayDir;
+            CalculateRay(camera, float(tileX + x) / float(width), float(tileY + y) / float(height), rayPos, rayDir);
+            packet.SetRay(ray, rayPos + rayDir * c_rayEpsilon, rayDir);
+#endif
+            rayMask |= TRayMask(1) << ray;
+        }
+    }
+
+    // corners go around the tile so neighboring corners make the sides of the frustum
+    packet.m_origin = camera.m_pos;
+    packet.m_cornerDirs[0] = packet.Dir(0);
+    packet.m_cornerDirs[1] = packet.Dir(tileWidth - 1);
+    packet.m_cornerDirs[2] = packet.Dir((tileHeight - 1) * c_packetTileSize + tileWidth - 1);
+    packet.m_cornerDirs[3] = packet.Dir((tileHeight - 1) * c_packetTileSize);
+    MakePacketFrustum(packet.m_origin, packet.m_cornerDirs, packet.m_frustum);
+
+    SRayHitInfo rayHitInfos[c_packetSize];
+    ClosestIntersectionPacket(packet, rayMask, rayHitInfos);
+
+    for (size_t y = 0; y < tileHeight; ++y)
+    {
+        for (size_t x = 0; x < tileWidth; ++x)
+            WriteFirstRayHit(rayHitInfos[y * c_packetTileSize + x], firstRayHits[(tileY + y) * width + tileX + x]);
+    }
+}
+
+//----------------------------------------------------------------------------
+// the whole first hit pass, into width * height FirstRayHit records
+inline void TraceFirstHits (size_t width, size_t height, TFirstRayHit* firstRayHits, bool usePackets)
+{
+    SCamera camera = MakeCamera();
+    if (!usePackets)
+    {
+        for (size_t y = 0; y < height; ++y)
+        {
+            for (size_t x = 0; x < width; ++x)
+                TraceFirstHit(camera, x, y, width, height, firstRayHits);
+        }
+        return;
+    }
+
+    for (size_t tileY = 0; tileY < height; tileY += c_packetTileSize)
+    {
+        for (size_t tileX = 0; tileX < width; tileX += c_packetTileSize)
+            TraceFirstHitTile(camera, tileX, tileY, width, height, firstRayHits);
+    }
+}
\ No newline at end of file
@@ -0,0 +1,575 @@
+#pragma once
+
+// C++ versions of the cs_main kernels of Shaders/PathTraceFirstHit.fx and Shaders/PathTrace.fx, to run with
+// CComputeDispatcherCPU::Dispatch<c_pathTraceNumThreadsX, c_pathTraceNumThreadsY, 1>(). Like the shaders, they read
+// the constant buffers, write FirstRayHits, and read and write the pathTraceOutput texture, which sets the image size.
+// They only use dispatchThreadID, so they can also be dispatched in square tiles of any size, or on a list of tiles
+// for adaptive sampling. Needs CPU_ONLY for the textures.
+
+#include <type_traits>
+#include "PathTraceCPU.h"
+#include "ComputeDispatchCPU.h"
+#include "Lightmap.h"
+
+static const unsigned int c_pathTraceNumThreadsX = 32;  // [numthreads(32, 32, 1)]
+static const unsigned int c_pathTraceNumThreadsY = 32;
+static const unsigned int c_maxUnrolledBounces = 8;     // DispatchBounceCount() has a specialization per bounce count up to this
+
+//----------------------------------------------------------------------------
+// the groups to dispatch to cover the pathTraceOutput texture
+inline void PathTraceDispatchSize (size_t& dispatchX, size_t& dispatchY)
+{
+    dispatchX = (ShaderData::Textures::pathTraceOutput.Width() + c_pathTraceNumThreadsX - 1) / c_pathTraceNumThreadsX;
+    dispatchY = (ShaderData::Textures::pathTraceOutput.Height() + c_pathTraceNumThreadsY - 1) / c_pathTraceNumThreadsY;
+}
+
+//----------------------------------------------------------------------------
+// the groups to dispatch to cover the pathTraceOutput texture with tileSize x tileSize tiles
+inline void PathTraceDispatchSize (unsigned int tileSize, size_t& dispatchX, size_t& dispatchY)
+{
+    dispatchX = (ShaderData::Textures::pathTraceOutput.Width() + tileSize - 1) / tileSize;
+    dispatchY = (ShaderData::Textures::pathTraceOutput.Height() + tileSize - 1) / tileSize;
+}
+
+//----------------------------------------------------------------------------
+// The shaders skip threads past the edge with > rather than >=. Writes past the edge of a UAV are dropped on the GPU,
+// but would write past the end of the storage here, so these use >=.
+inline bool PathTraceThreadInImage (const SComputeThreadIDs& ids)
+{
+    return ids.dispatchThreadID[0] < ShaderData::Textures::pathTraceOutput.Width() && ids.dispatchThreadID[1] < ShaderData::Textures::pathTraceOutput.Height();
+}
+
+//----------------------------------------------------------------------------
+inline void PathTraceFirstHitKernel (const SComputeThreadIDs& ids, const SCamera& camera)
+{
+    // Don't write out of bounds pixels
+    if (!PathTraceThreadInImage(ids))
+        return;
+    size_t dimsX = ShaderData::Textures::pathTraceOutput.Width();
+    size_t dimsY = ShaderData::Textures::pathTraceOutput.Height();
+
+    // calculate screen uv
+    float u = float(ids.dispatchThreadID[0]) / float(dimsX);
+    float v = float(ids.dispatchThreadID[1]) / float(dimsY);
+
+    // calculate the ray for this pixel and get the time of the first ray hit
+    float3 rayPos, rayDir;
+    CalculateRay(camera, u, v, rayPos, rayDir);
+    SRayHitInfo rayHitInfo = ClosestIntersection(rayPos, rayDir);
+
+    // write the results
+    size_t pixelIndex = ids.dispatchThreadID[1] * dimsX + ids.dispatchThreadID[0];
+    ShaderTypes::StructuredBuffers::FirstRayHit& firstRayHit = ShaderData::StructuredBuffers::FirstRayHits.GetUAV()[pixelIndex];
+    firstRayHit.surfaceNormal_intersectTime = { rayHitInfo.m_surfaceNormal[0], rayHitInfo.m_surfaceNormal[1], rayHitInfo.m_surfaceNormal[2], rayHitInfo.m_intersectTime };
+    firstRayHit.albedo_w = { rayHitInfo.m_albedo[0], rayHitInfo.m_albedo[1], rayHitInfo.m_albedo[2], 0.0f };
+    firstRayHit.emissive_w = { rayHitInfo.m_emissive[0], rayHitInfo.m_emissive[1], rayHitInfo.m_emissive[2], 0.0f };
+}
+
+//----------------------------------------------------------------------------
+// how PathTraceKernel() and PathTraceLightmapKernel() trace their paths. m_whiteAlbedo is the SBWhiteAlbedo static branch
+// of the pathTrace shader, the sampler and light picker are its sampler_lightPicker_zw constants, and the pointers are
+// CPU only.
+struct SPathTraceSettings
+{
+    bool m_whiteAlbedo = false;
+    ESampler m_sampler = ESampler::WhiteNoise;
+    ELightPicker m_lightPicker = ELightPicker::AliasTable;
+    CPathGuiding* m_pathGuiding = nullptr;      // guides the paths if not null, see Light_Outgoing()
+    CRadianceCache* m_radianceCache = nullptr;  // caches radiance if not null, see Light_Outgoing()
+    const SPixelReservoirs* m_reservoirs = nullptr;     // lights the first hit with the pixel's reservoir if not null, see PathTraceReservoirKernel()
+};
+
+//----------------------------------------------------------------------------
+// calls lambda(std::integral_constant<unsigned int, NUMBOUNCES>()) with the bounce count in the constants, so kernels
+// can unroll their bounce loop for the common counts, and only longer paths go through the runtime loop
+template <typename LAMBDA>
+inline void DispatchBounceCount (LAMBDA&& lambda)
+{
+    static_assert(c_maxUnrolledBounces == 8, "DispatchBounceCount() needs a case per unrolled bounce count");
+    switch (ShaderData::ConstantBuffers::ConstantsPerFrame.Read().maxBounces_rouletteStartBounce_zw[0])
+    {
+        case 0: lambda(std::integral_constant<unsigned int, 0>()); break;
+        case 1: lambda(std::integral_constant<unsigned int, 1>()); break;
+        case 2: lambda(std::integral_constant<unsigned int, 2>()); break;
+        case 3: lambda(std::integral_constant<unsigned int, 3>()); break;
+        case 4: lambda(std::integral_constant<unsigned int, 4>()); break;
+        case 5: lambda(std::integral_constant<unsigned int, 5>()); break;
+        case 6: lambda(std::integral_constant<unsigned int, 6>()); break;
+        case 7: lambda(std::integral_constant<unsigned int, 7>()); break;
+        case 8: lambda(std::integral_constant<unsigned int, 8>()); break;
+        default: lambda(std::integral_constant<unsigned int, c_runtimeBounces>()); break;
+    }
+}
+
+//----------------------------------------------------------------------------
+// NUMBOUNCES is passed on to Light_Outgoing(), and has to be the bounce count in the constants unless it's
+// c_runtimeBounces
+template <unsigned int NUMBOUNCES>
+inline void PathTraceKernel (const SComputeThreadIDs& ids, const SCamera& camera, const SPathTraceSettings& settings)
+{
+    // Don't write out of bounds pixels
+    if (!PathTraceThreadInImage(ids))
+        return;
+    size_t dimsX = ShaderData::Textures::pathTraceOutput.Width();
+    size_t dimsY = ShaderData::Textures::pathTraceOutput.Height();
+
+    const ShaderTypes::ConstantBuffers::ConstantsPerFrame& constantsPerFrame = ShaderData::ConstantBuffers::ConstantsPerFrame.Read();
+    const uint4& sampleCount_samplesPerFrame_zw = constantsPerFrame.sampleCount_samplesPerFrame_zw;
+
+    // calculate screen uv
+    float u = float(ids.dispatchThreadID[0]) / float(dimsX);
+    float v = float(ids.dispatchThreadID[1]) / float(dimsY);
+
+    bool blueNoise = settings.m_sampler == ESampler::BlueNoise || settings.m_sampler == ESampler::SpatiotemporalBlueNoise;
+    bool spatiotemporalBlueNoise = settings.m_sampler == ESampler::SpatiotemporalBlueNoise;
+    bool sobol = settings.m_sampler == ESampler::Sobol;
+    bool lightSampling = settings.m_lightPicker != ELightPicker::None;
+    bool lightTree = settings.m_lightPicker == ELightPicker::LightTree;
+
+    // Sample a blue noise texture for this pixel if we should. It starts a low discrepancy sequence for the first random
+    // number of each sample, which makes the noise less harsh on the eyes. With spatiotemporal blue noise, the texture
+    // is read for each sample instead, below. Otherwise everything is white noise, unless the Sobol sampler makes every
+    // random number an Owen scrambled Sobol point.
+    float blueNoiseValue = -1.0f;
+    if (blueNoise && !spatiotemporalBlueNoise)
+    {
+        float blueNoiseU = u * float(dimsX) / 256.0f;
+        float blueNoiseV = v * float(dimsY) / 256.0f;
+        blueNoiseValue = ShaderData::Textures::blueNoise256.SampleNearestWrap(blueNoiseU, blueNoiseV)[0];
+    }
+
+    // calculate the ray for this pixel
+    float3 rayPos, rayDir;
+    CalculateRay(camera, u, v, rayPos, rayDir);
+
+    // path trace
+    size_t pixelIndex = ids.dispatchThreadID[1] * dimsX + ids.dispatchThreadID[0];
+    const ShaderTypes::StructuredBuffers::FirstRayHit& firstRayHit = ShaderData::StructuredBuffers::FirstRayHits.Read()[pixelIndex];
+    float3 light = { 0.0f, 0.0f, 0.0f };
+
+    // the reservoir's light is the same for all of the frame's samples
+    float3 reservoirLight = { 0.0f, 0.0f, 0.0f };
+    if (settings.m_reservoirs)
+    {
+        SReservoirSurface surface = MakeReservoirSurface(camera, ids.dispatchThreadID[0], ids.dispatchThreadID[1], dimsX, dimsY, XYZ(firstRayHit.surfaceNormal_intersectTime), firstRayHit.surfaceNormal_intersectTime[3]);
+        if (surface.m_depth >= 0.0f)
+            reservoirLight = ShadeReservoir(surface, settings.m_reservoirs->m_final[pixelIndex].m_reservoir);
+    }
+
+    // average N samples together to make our sample for this frame. The random numbers are keyed by the sample's index
+    // counting from the start of the accumulation.
+    for (unsigned int i = 0; i < sampleCount_samplesPerFrame_zw[1]; ++i)
+    {
+        uint32_t sampleIndex = (sampleCount_samplesPerFrame_zw[0] - 1) * sampleCount_samplesPerFrame_zw[1] + i;
+
+        // The first random number of the sample is the blue noise value plus the golden ratio times the sample index.
+        // Spatiotemporal blue noise reads slice sampleIndex mod depth, whose values over the slices are already well
+        // spread out, so the golden ratio only steps each time through the slices.
+        float sampleBlueNoise = -1.0f;
+        if (blueNoise)
+        {
+            uint32_t goldenRatioStep = sampleIndex;
+            if (spatiotemporalBlueNoise)
+            {
+                const CTextureCPU& blueNoiseTexture = ShaderData::Textures::blueNoiseSpatiotemporal;
+                uint32_t depth = (uint32_t)blueNoiseTexture.NumSlices();
+                float blueNoiseU = u * float(dimsX) / float(blueNoiseTexture.Width());
+                float blueNoiseV = v * float(dimsY) / float(blueNoiseTexture.Height());
+                blueNoiseValue = blueNoiseTexture.SampleNearestWrap(blueNoiseU, blueNoiseV, sampleIndex % depth)[0];
+                goldenRatioStep = sampleIndex / depth;
+            }
+            sampleBlueNoise = Frac(blueNoiseValue + UintToFloat01(goldenRatioStep * c_goldenRatioFixed));
+        }
+
+        SRNG rng((uint32_t)pixelIndex, sampleIndex, constantsPerFrame.rngSeed_yzw[0], sampleBlueNoise, sobol);
+        light = light + Light_Incoming<NUMBOUNCES>(rayPos, rayDir, rng, firstRayHit, settings.m_whiteAlbedo, lightSampling, lightTree, settings.m_pathGuiding, settings.m_radianceCache, settings.m_reservoirs ? &reservoirLight : nullptr);
+    }
+    light = light * (1.0f / float(sampleCount_samplesPerFrame_zw[1]));
+
+    // each pixel counts its own samples, since adaptive sampling skips tiles on some frames
+    float4& moments = ShaderData::Textures::pathTraceMoments.Texel(ids.dispatchThreadID[0], ids.dispatchThreadID[1]);
+    float pixelSampleCount = (sampleCount_samplesPerFrame_zw[0] == 1) ? 1.0f : moments[1] + 1.0f;
+
+    // use lerping for incremental averageing:  https://blog.demofox.org/2016/08/23/incremental-averaging/
+    // lerp from the old value to the current and write it back out, along with the luminance second moment
+    float4& output = ShaderData::Textures::pathTraceOutput.Texel(ids.dispatchThreadID[0], ids.dispatchThreadID[1]);
+    float t = 1.0f / pixelSampleCount;
+    output = { output[0] + (light[0] - output[0]) * t, output[1] + (light[1] - output[1]) * t, output[2] + (light[2] - output[2]) * t, 1.0f };
+    float luminance = Luminance(light);
+    moments = { moments[0] + (luminance * luminance - moments[0]) * t, pixelSampleCount, 0.0f, 0.0f };
+}
+
+//----------------------------------------------------------------------------
+// runs the specialization of the kernel for the bounce count in the constants
+inline void PathTraceKernel (const SComputeThreadIDs& ids, const SCamera& camera, const SPathTraceSettings& settings)
+{
+    DispatchBounceCount(
+        [&] (auto numBounces)
+        {
+            PathTraceKernel<decltype(numBounces)::value>(ids, camera, settings);
+        }
+    );
+}
+
+//----------------------------------------------------------------------------
+// starts path guiding over from nothing, in the bounds of the scene's BVH, for when the scene changes
+inline void PathTraceResetGuiding (CPathGuiding& pathGuiding)
+{
+    const ShaderTypes::StructuredBuffers::BVHNode& root = ShaderData::StructuredBuffers::BVHNodes.Read()[ShaderData::ConstantBuffers::ConstantsOnce.Read().numModels_sceneRootNode_numScenePrims_numLights[1]];
+    pathGuiding.Reset(XYZ(root.boundsMin_w), XYZ(root.boundsMax_w));
+}
+
+//----------------------------------------------------------------------------
+// empties the radiance cache, in the bounds of the scene's BVH, for when the scene changes
+inline void PathTraceResetRadianceCache (CRadianceCache& radianceCache)
+{
+    const ShaderTypes::StructuredBuffers::BVHNode& root = ShaderData::StructuredBuffers::BVHNodes.Read()[ShaderData::ConstantBuffers::ConstantsOnce.Read().numModels_sceneRootNode_numScenePrims_numLights[1]];
+    radianceCache.Reset(XYZ(root.boundsMin_w), XYZ(root.boundsMax_w));
+}
+
+//----------------------------------------------------------------------------
+//                          Reservoir Resampling
+//----------------------------------------------------------------------------
+// ReSTIR for the light the first hits get from the lights, see the end of PathTraceCPU.h. Each frame, after the first
+// hits and before PathTraceKernel(), PathTraceReservoirKernel() and then PathTraceSpatialReuseKernel() are dispatched
+// over the whole image, even with adaptive sampling, since pixels reuse the reservoirs of others.
+
+//----------------------------------------------------------------------------
+// makes empty reservoirs for each pixel of pathTraceOutput, so there's nothing for temporal reuse to take from, for
+// when the scene or the image size changes
+inline void PathTraceResetReservoirs (SPixelReservoirs& reservoirs)
+{
+    size_t numPixels = ShaderData::Textures::pathTraceOutput.Width() * ShaderData::Textures::pathTraceOutput.Height();
+    reservoirs.m_final.assign(numPixels, SStoredReservoir());
+    reservoirs.m_temporal.assign(numPixels, SStoredReservoir());
+}
+
+//----------------------------------------------------------------------------
+// The random numbers of the frame's first sample, for the given one of the two reservoir kernels. The Sobol points and
+// blue noise are for the paths.
+inline SRNG ReservoirRNG (size_t pixelIndex, uint32_t kernel)
+{
+    const ShaderTypes::ConstantBuffers::ConstantsPerFrame& constantsPerFrame = ShaderData::ConstantBuffers::ConstantsPerFrame.Read();
+    const uint4& sampleCount_samplesPerFrame_zw = constantsPerFrame.sampleCount_samplesPerFrame_zw;
+    SRNG rng((uint32_t)pixelIndex, (sampleCount_samplesPerFrame_zw[0] - 1) * sampleCount_samplesPerFrame_zw[1], constantsPerFrame.rngSeed_yzw[0], -1.0f, false);
+    rng.m_bounce = c_reservoirRandomBounce + kernel;
+    return rng;
+}
+
+//----------------------------------------------------------------------------
+// Makes the pixel a new reservoir, and combines it with the one its surface had at the end of the last frame, found by
+// projecting the surface into previousCamera. That one counts as at most c_reservoirMaxHistory frames of candidates.
+// Writes the temporal reservoirs.
+inline void PathTraceReservoirKernel (const SComputeThreadIDs& ids, const SCamera& camera, const SCamera& previousCamera, SPixelReservoirs& storedReservoirs, bool lightTree, bool unbiased)
+{
+    if (!PathTraceThreadInImage(ids))
+        return;
+    size_t dimsX = ShaderData::Textures::pathTraceOutput.Width();
+    size_t dimsY = ShaderData::Textures::pathTraceOutput.Height();
+    size_t x = ids.dispatchThreadID[0];
+    size_t y = ids.dispatchThreadID[1];
+    size_t pixelIndex = y * dimsX + x;
+
+    const ShaderTypes::StructuredBuffers::FirstRayHit& firstRayHit = ShaderData::StructuredBuffers::FirstRayHits.Read()[pixelIndex];
+    SReservoirSurface surfaces[2];
+    surfaces[0] = MakeReservoirSurface(camera, x, y, dimsX, dimsY, XYZ(firstRayHit.surfaceNormal_intersectTime), firstRayHit.surfaceNormal_intersectTime[3]);
+    if (surfaces[0].m_depth < 0.0f)
+    {
+        WriteReservoir(SReservoir(), surfaces[0], storedReservoirs.m_temporal[pixelIndex]);
+        return;
+    }
+
+    SRNG rng = ReservoirRNG(pixelIndex, 0);
+    SReservoir reservoirs[2];
+    reservoirs[0] = SampleReservoir(surfaces[0], rng, lightTree);
+
+    size_t count = 1;
+    size_t previousX, previousY;
+    if (CameraPixel(previousCamera, surfaces[0].m_position, dimsX, dimsY, previousX, previousY))
+    {
+        const SStoredReservoir& previous = storedReservoirs.m_final[previousY * dimsX + previousX];
+        surfaces[1] = MakeReservoirSurface(previousCamera, previousX, previousY, dimsX, dimsY, previous.m_surfaceNormal, previous.m_surfaceDepth);
+        if (SimilarSurfaces(surfaces[0], surfaces[1]))
+        {
+            reservoirs[1] = previous.m_reservoir;
+            reservoirs[1].m_M = (std::min)(reservoirs[1].m_M, c_reservoirMaxHistory * float(c_reservoirCandidates));
+            count = 2;
+        }
+    }
+
+    SReservoir reservoir = (count > 1) ? CombineReservoirs(surfaces[0], reservoirs, surfaces, count, rng, unbiased) : reservoirs[0];
+    WriteReservoir(reservoir, surfaces[0], storedReservoirs.m_temporal[pixelIndex]);
+}
+
+//----------------------------------------------------------------------------
+// Combines the pixel's temporal reservoir with those of up to c_reservoirNeighbors random pixels within
+// c_reservoirNeighborRadius whose surfaces are like its own, into the reservoir it ends the frame with
+inline void PathTraceSpatialReuseKernel (const SComputeThreadIDs& ids, const SCamera& camera, SPixelReservoirs& storedReservoirs, bool unbiased)
+{
+    if (!PathTraceThreadInImage(ids))
+        return;
+    size_t dimsX = ShaderData::Textures::pathTraceOutput.Width();
+    size_t dimsY = ShaderData::Textures::pathTraceOutput.Height();
+    size_t x = ids.dispatchThreadID[0];
+    size_t y = ids.dispatchThreadID[1];
+    size_t pixelIndex = y * dimsX + x;
+
+    const SStoredReservoir& own = storedReservoirs.m_temporal[pixelIndex];
+    SReservoirSurface surfaces[c_reservoirNeighbors + 1];
+    SReservoir reservoirs[c_reservoirNeighbors + 1];
+    surfaces[0] = MakeReservoirSurface(camera, x, y, dimsX, dimsY, own.m_surfaceNormal, own.m_surfaceDepth);
+    reservoirs[0] = own.m_reservoir;
+    if (surfaces[0].m_depth < 0.0f)
+    {
+        storedReservoirs.m_final[pixelIndex] = own;
+        return;
+    }
+
+    SRNG rng = ReservoirRNG(pixelIndex, 1);
+    size_t count = 1;
+    for (unsigned int i = 0; i < c_reservoirNeighbors; ++i)
+    {
+        // uniformly in the disk around the pixel
+        float2 rnd = RandomFloat2(rng);
+        float radius = c_reservoirNeighborRadius * std::sqrt(rnd[0]);
+        float angle = 2.0f * c_pi * rnd[1];
+        float neighborX = std::floor(float(x) + 0.5f + radius * std::cos(angle));
+        float neighborY = std::floor(float(y) + 0.5f + radius * std::sin(angle));
+        if (!(neighborX >= 0.0f && neighborY >= 0.0f && neighborX < float(dimsX) && neighborY < float(dimsY)))
+            continue;
+        size_t neighborIndex = size_t(neighborY) * dimsX + size_t(neighborX);
+        if (neighborIndex == pixelIndex)
+            continue;
+
+        const SStoredReservoir& neighbor = storedReservoirs.m_temporal[neighborIndex];
+        surfaces[count] = MakeReservoirSurface(camera, size_t(neighborX), size_t(neighborY), dimsX, dimsY, neighbor.m_surfaceNormal, neighbor.m_surfaceDepth);
+        if (!SimilarSurfaces(surfaces[0], surfaces[count]))
+            continue;
+        reservoirs[count] = neighbor.m_reservoir;
+        ++count;
+    }
+
+    SReservoir reservoir = (count > 1) ? CombineReservoirs(surfaces[0], reservoirs, surfaces, count, rng, unbiased) : reservoirs[0];
+    WriteReservoir(reservoir, surfaces[0], storedReservoirs.m_final[pixelIndex]);
+}
+
+//----------------------------------------------------------------------------
+//                                 Lightmap
+//----------------------------------------------------------------------------
+// Object space path tracing into the charts of a CLightmap, see Lightmap.h. PathTraceLightmapFirstHitKernel() takes the
+// place of PathTraceFirstHitKernel(), and runs again whenever the camera moves, while the lightmap keeps what it has.
+// Each frame, PathTraceLightmapKernel() is dispatched over CLightmap::SeenBlocks() to add a sample to each texel of the
+// charts seen so far, and then PathTraceLightmapViewKernel() fills pathTraceOutput from them.
+
+//----------------------------------------------------------------------------
+// PathTraceFirstHitKernel() that also gives the lightmap which of its charts the pixel sees and where, and marks the
+// chart as seen
+inline void PathTraceLightmapFirstHitKernel (const SComputeThreadIDs& ids, const SCamera& camera, CLightmap& lightmap)
+{
+    // Don't write out of bounds pixels
+    if (!PathTraceThreadInImage(ids))
+        return;
+    size_t dimsX = ShaderData::Textures::pathTraceOutput.Width();
+    size_t dimsY = ShaderData::Textures::pathTraceOutput.Height();
+
+    // calculate screen uv
+    float u = float(ids.dispatchThreadID[0]) / float(dimsX);
+    float v = float(ids.dispatchThreadID[1]) / float(dimsY);
+
+    // calculate the ray for this pixel and get the first ray hit, and what it hit
+    float3 rayPos, rayDir;
+    CalculateRay(camera, u, v, rayPos, rayDir);
+    SRayHitPrimitive hitPrimitive;
+    SRayHitInfo rayHitInfo = ClosestIntersection(rayPos, rayDir, hitPrimitive);
+
+    // write the results
+    size_t pixelIndex = ids.dispatchThreadID[1] * dimsX + ids.dispatchThreadID[0];
+    ShaderTypes::StructuredBuffers::FirstRayHit& firstRayHit = ShaderData::StructuredBuffers::FirstRayHits.GetUAV()[pixelIndex];
+    firstRayHit.surfaceNormal_intersectTime = { rayHitInfo.m_surfaceNormal[0], rayHitInfo.m_surfaceNormal[1], rayHitInfo.m_surfaceNormal[2], rayHitInfo.m_intersectTime };
+    firstRayHit.albedo_w = { rayHitInfo.m_albedo[0], rayHitInfo.m_albedo[1], rayHitInfo.m_albedo[2], 0.0f };
+    firstRayHit.emissive_w = { rayHitInfo.m_emissive[0], rayHitInfo.m_emissive[1], rayHitInfo.m_emissive[2], 0.0f };
+
+    // the intersect time is from the ray start pushed out by c_rayEpsilon
+    SLightmapPixel& lightmapPixel = lightmap.Pixel(pixelIndex);
+    lightmapPixel = SLightmapPixel();
+    if (rayHitInfo.m_intersectTime >= 0.0f)
+    {
+        float3 hitPos = rayPos + rayDir * (rayHitInfo.m_intersectTime + c_rayEpsilon);
+        lightmapPixel.m_chart = lightmap.ChartUV(hitPrimitive.m_type, hitPrimitive.m_index, hitPrimitive.m_modelTriangle, hitPos, rayHitInfo.m_surfaceNormal, lightmapPixel.m_uv);
+        lightmap.MarkSeen(lightmapPixel.m_chart);
+    }
+}
+
+//----------------------------------------------------------------------------
+// Adds a sample to a texel of one of the blocks from CLightmap::SeenBlocks(), dispatched with a group of
+// c_lightmapBlockSize x 1 x 1 per block. The path starts from a random point in the texel and leaves out the texel's own
+// emission, which the pixels add. The random numbers are keyed by the texel and how many samples it has, in place of the
+// pixel and sample index. Blue noise, path guiding, the radiance cache and reservoirs are for pixels, so the settings
+// for them are ignored, and the blue noise samplers are white noise.
+template <unsigned int NUMBOUNCES>
+inline void PathTraceLightmapKernel (const SComputeThreadIDs& ids, CLightmap& lightmap, const std::vector<uint2>& blocks, const SPathTraceSettings& settings)
+{
+    const uint2& block = blocks[ids.groupID[0]];
+    const SLightmapChart& chart = lightmap.Chart(block[0]);
+    uint32_t texel = block[1] + ids.groupThreadID[0];
+    uint32_t chartTexel = texel - chart.m_firstTexel;
+    if (chartTexel >= chart.m_width * chart.m_height)
+        return;
+
+    // with more than one sample per frame, the block list can have texels that just got to c_lightmapMaxSamples
+    float4& value = lightmap.Texel(texel);
+    if (value[3] >= float(c_lightmapMaxSamples))
+        return;
+    SRNG rng(texel, uint32_t(value[3]), ShaderData::ConstantBuffers::ConstantsPerFrame.Read().rngSeed_yzw[0], -1.0f, settings.m_sampler == ESampler::Sobol);
+    rng.m_bounce = c_lightmapRandomBounce;
+    float2 jitter = RandomFloat2(rng);
+    float2 uv = { (float(chartTexel % chart.m_width) + jitter[0]) / float(chart.m_width), (float(chartTexel / chart.m_width) + jitter[1]) / float(chart.m_height) };
+    SLightmapSurface surface = lightmap.Surface(block[0], uv);
+
+    SRayHitInfo rayHitInfo;
+    rayHitInfo.m_intersectTime = 0.0f;
+    rayHitInfo.m_surfaceNormal = surface.m_normal;
+    rayHitInfo.m_albedo = surface.m_albedo;
+    float3 light = Light_Outgoing<NUMBOUNCES>(rayHitInfo, surface.m_position, rng, settings.m_whiteAlbedo, settings.m_lightPicker != ELightPicker::None, settings.m_lightPicker == ELightPicker::LightTree, nullptr, nullptr, nullptr);
+
+    // incremental averaging, like the pixels of PathTraceKernel()
+    float t = 1.0f / (value[3] + 1.0f);
+    value = { value[0] + (light[0] - value[0]) * t, value[1] + (light[1] - value[1]) * t, value[2] + (light[2] - value[2]) * t, value[3] + 1.0f };
+}
+
+//----------------------------------------------------------------------------
+// runs the specialization of the kernel for the bounce count in the constants, like PathTraceKernel()
+inline void PathTraceLightmapKernel (const SComputeThreadIDs& ids, CLightmap& lightmap, const std::vector<uint2>& blocks, const SPathTraceSettings& settings)
+{
+    DispatchBounceCount(
+        [&] (auto numBounces)
+        {
+            PathTraceLightmapKernel<decltype(numBounces)::value>(ids, lightmap, blocks, settings);
+        }
+    );
+}
+
+//----------------------------------------------------------------------------
+// Each pixel is the emission of its first hit plus the light the lightmap has for it, or the miss color. There is no
+// accumulation in the pixels, it all happens in the texels, so the pixels only see through their centers and edges
+// aren't antialiased.
+inline void PathTraceLightmapViewKernel (const SComputeThreadIDs& ids, const SCamera& camera, const CLightmap& lightmap)
+{
+    // Don't write out of bounds pixels
+    if (!PathTraceThreadInImage(ids))
+        return;
+    size_t dimsX = ShaderData::Textures::pathTraceOutput.Width();
+    size_t dimsY = ShaderData::Textures::pathTraceOutput.Height();
+    size_t pixelIndex = ids.dispatchThreadID[1] * dimsX + ids.dispatchThreadID[0];
+
+    const SLightmapPixel& lightmapPixel = lightmap.Pixel(pixelIndex);
+    float3 light;
+    if (lightmapPixel.m_chart == c_lightmapNoChart)
+    {
+        float3 rayPos, rayDir;
+        CalculateRay(camera, float(ids.dispatchThreadID[0]) / float(dimsX), float(ids.dispatchThreadID[1]) / float(dimsY), rayPos, rayDir);
+        light = MissColor(rayDir);
+    }
+    else
+    {
+        const ShaderTypes::StructuredBuffers::FirstRayHit& firstRayHit = ShaderData::StructuredBuffers::FirstRayHits.Read()[pixelIndex];
+        light = XYZ(firstRayHit.emissive_w) + lightmap.Lookup(lightmapPixel.m_chart, lightmapPixel.m_uv);
+    }
+
+    float luminance = Luminance(light);
+    ShaderData::Textures::pathTraceOutput.Texel(ids.dispatchThreadID[0], ids.dispatchThreadID[1]) = { light[0], light[1], light[2], 1.0f };
+    ShaderData::Textures::pathTraceMoments.Texel(ids.dispatchThreadID[0], ids.dispatchThreadID[1]) = { luminance * luminance, 1.0f, 0.0f, 0.0f };
+}
+
+//----------------------------------------------------------------------------
+//                            Adaptive Sampling
+//----------------------------------------------------------------------------
+// The SBAdaptive shader branch has each 32x32 group work out its tile's error and return early if it's low enough.
+// On the CPU the tiles are found before the frame instead, and only the ones that need samples are dispatched, so
+// finished tiles cost nothing and tiles can be any size.
+
+//----------------------------------------------------------------------------
+// how many pixels of the tile are in the image
+inline size_t PathTraceTilePixels (const uint2& tile, unsigned int tileSize)
+{
+    size_t width = ShaderData::Textures::pathTraceOutput.Width();
+    size_t height = ShaderData::Textures::pathTraceOutput.Height();
+    return (std::min)(size_t(tileSize), width - tile[0] * tileSize) * (std::min)(size_t(tileSize), height - tile[1] * tileSize);
+}
+
+//----------------------------------------------------------------------------
+// the average PixelError() over the pixels of the tile
+inline float PathTraceTileError (const uint2& tile, unsigned int tileSize)
+{
+    size_t width = ShaderData::Textures::pathTraceOutput.Width();
+    size_t height = ShaderData::Textures::pathTraceOutput.Height();
+    size_t endX = (std::min)(size_t(tile[0] + 1) * tileSize, width);
+    size_t endY = (std::min)(size_t(tile[1] + 1) * tileSize, height);
+
+    float errorSum = 0.0f;
+    for (size_t y = size_t(tile[1]) * tileSize; y < endY; ++y)
+    {
+        for (size_t x = size_t(tile[0]) * tileSize; x < endX; ++x)
+        {
+            const float4& moments = ShaderData::Textures::pathTraceMoments.Texel(x, y);
+            errorSum += PixelError(Luminance(XYZ(ShaderData::Textures::pathTraceOutput.Texel(x, y))), moments[0], moments[1]);
+        }
+    }
+    return errorSum / float(PathTraceTilePixels(tile, tileSize));
+}
+
+//----------------------------------------------------------------------------
+// Fills tiles with the tiles that need samples this frame, using adaptiveError_adaptiveMinSamples_zw from
+// ConstantsPerFrame like the shader. Every tile needs samples until the adaptive min samples. The errors are found
+// with a dispatch of one tile per group.
+inline void PathTraceAdaptiveTiles (CComputeDispatcherCPU& dispatcher, unsigned int tileSize, std::vector<uint2>& tiles)
+{
+    const ShaderTypes::ConstantBuffers::ConstantsPerFrame& constantsPerFrame = ShaderData::ConstantBuffers::ConstantsPerFrame.Read();
+    size_t dispatchX, dispatchY;
+    PathTraceDispatchSize(tileSize, dispatchX, dispatchY);
+
+    tiles.clear();
+    if (float(constantsPerFrame.sampleCount_samplesPerFrame_zw[0]) <= constantsPerFrame.adaptiveError_adaptiveMinSamples_zw[1])
+    {
+        for (unsigned int y = 0; y < dispatchY; ++y)
+        {
+            for (unsigned int x = 0; x < dispatchX; ++x)
+                tiles.push_back({ x, y });
+        }
+        return;
+    }
+
+    std::vector<float> tileErrors(dispatchX * dispatchY);
+    dispatcher.Dispatch<1, 1, 1>(dispatchX, dispatchY, 1,
+        [&] (const SComputeThreadIDs& ids)
+        {
+            tileErrors[ids.groupID[1] * dispatchX + ids.groupID[0]] = PathTraceTileError({ ids.groupID[0], ids.groupID[1] }, tileSize);
+        }
+    );
+
+    for (unsigned int y = 0; y < dispatchY; ++y)
+    {
+        for (unsigned int x = 0; x < dispatchX; ++x)
+        {
+            if (tileErrors[y * dispatchX + x] >= constantsPerFrame.adaptiveError_adaptiveMinSamples_zw[0])
+                tiles.push_back({ x, y });
+        }
+    }
+}
+
+//----------------------------------------------------------------------------
+// runs kernel on just the given tiles, with the thread IDs they would get in a dispatch of every tile
+template <typename KERNEL>
+inline void PathTraceDispatchTiles (CComputeDispatcherCPU& dispatcher, unsigned int tileSize, const std::vector<uint2>& tiles, KERNEL&& kernel)
+{
+    dispatcher.Dispatch({ tileSize, tileSize, 1 }, tiles.size(), 1, 1,
+        [&] (const SComputeThreadIDs& ids)
+        {
+            const uint2& tile = tiles[ids.groupID[0]];
+            SComputeThreadIDs tileIDs = ids;
+            tileIDs.groupID = { tile[0], tile[1], 0 };
+            tileIDs.dispatchThreadID = { tile[0] * tileSize + ids.groupThreadID[0], tile[1] * tileSize + ids.groupThreadID[1], 0 };
+            kernel(tileIDs);
+        }
+    );
+}
\ No newline at end of file
@@ -0,0 +1,252 @@
+#include "RadianceCache.h"
+
+static const uint64_t c_radianceCacheMask = (uint64_t(1) << c_radianceCacheLog2Capacity) - 1;
+
+// an entry being taken over holds this while it's cleared. Real keys have the top bit set so are never this.
+static const uint64_t c_radianceCacheBusyKey = 1;
+
+//----------------------------------------------------------------------------
+static void AtomicAdd (std::atomic<float>& sum, float value)
+{
+    float old = sum.load(std::memory_order_relaxed);
+    while (!sum.compare_exchange_weak(old, old + value, std::memory_order_relaxed));
+}
+
+//----------------------------------------------------------------------------
+// the finalizer of MurmurHash3, which mixes every bit of the key into every bit of the hash
+static uint64_t HashKey (uint64_t key)
+{
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdull;
+    key ^= key >> 33;
+    key *= 0xc4ceb9fe1a85ec53ull;
+    key ^= key >> 33;
+    return key;
+}
+
+//----------------------------------------------------------------------------
+// the octahedral bin of a unit normal, mapping the sphere to the unit square by folding the bottom half of the
+// octahedron over the top
+static uint32_t NormalBin (const float3& normal)
+{
+    float sum = std::abs(normal[0]) + std::abs(normal[1]) + std::abs(normal[2]);
+    if (sum <= 0.0f)
+        return 0;
+
+    float u = normal[0] / sum;
+    float v = normal[1] / sum;
+    if (normal[2] < 0.0f)
+    {
+        float foldedU = (1.0f - std::abs(v)) * (u >= 0.0f ? 1.0f : -1.0f);
+        float foldedV = (1.0f - std::abs(u)) * (v >= 0.0f ? 1.0f : -1.0f);
+        u = foldedU;
+        v = foldedV;
+    }
+
+    uint32_t binU = (std::min)(uint32_t((std::max)((u + 1.0f) * 0.5f, 0.0f) * float(c_radianceCacheNormalBins)), c_radianceCacheNormalBins - 1);
+    uint32_t binV = (std::min)(uint32_t((std::max)((v + 1.0f) * 0.5f, 0.0f) * float(c_radianceCacheNormalBins)), c_radianceCacheNormalBins - 1);
+    return binV * c_radianceCacheNormalBins + binU;
+}
+
+//----------------------------------------------------------------------------
+static void ClearEntry (SRadianceCacheEntry& entry)
+{
+    for (size_t channel = 0; channel < 3; ++channel)
+        entry.m_radiance[channel].store(0.0f, std::memory_order_relaxed);
+    entry.m_samples.store(0, std::memory_order_relaxed);
+}
+
+//----------------------------------------------------------------------------
+void CRadianceCache::Reset (const float3& boundsMin, const float3& boundsMax)
+{
+    // cubify the bounds, a little bigger so the points on the far sides are inside
+    m_boundsMin = boundsMin;
+    float boundsSize = (std::max)((std::max)(boundsMax[0] - boundsMin[0], boundsMax[1] - boundsMin[1]), boundsMax[2] - boundsMin[2]) * 1.001f;
+    if (!(boundsSize > 0.0f))
+        boundsSize = 1.0f;
+    m_cellSize = boundsSize / float(c_radianceCacheResolution);
+
+    for (SRadianceCacheEntry& entry : m_entries)
+    {
+        entry.m_key.store(0, std::memory_order_relaxed);
+        entry.m_lastUsed.store(0, std::memory_order_relaxed);
+        ClearEntry(entry);
+    }
+    m_frame = 1;
+    ResetStats();
+}
+
+//----------------------------------------------------------------------------
+// 16 bits for each of the cell's coordinates, then 4 for the normal bin and 8 for the bounce, and the top bit set so no
+// key is 0
+uint64_t CRadianceCache::Key (const float3& pos, const float3& normal, uint32_t bounce) const
+{
+    static_assert(c_radianceCacheResolution <= 0x10000 && c_radianceCacheNormalBins * c_radianceCacheNormalBins <= 16, "the cell or the normal bin doesn't fit in its bits of the key");
+    uint64_t key = uint64_t(1) << 63;
+    for (size_t axis = 0; axis < 3; ++axis)
+    {
+        float cell = (std::min)((std::max)((pos[axis] - m_boundsMin[axis]) / m_cellSize, 0.0f), float(c_radianceCacheResolution - 1));
+        key |= uint64_t(cell) << (16 * axis);
+    }
+    return key | (uint64_t(NormalBin(normal)) << 48) | (uint64_t((std::min)(bounce, 255u)) << 52);
+}
+
+//----------------------------------------------------------------------------
+// An entry being taken over holds c_radianceCacheBusyKey, which matches no key, so it's a miss
+SRadianceCacheEntry* CRadianceCache::Find (uint64_t key)
+{
+    uint64_t slot = HashKey(key);
+    for (size_t probe = 0; probe < c_radianceCacheProbes; ++probe)
+    {
+        SRadianceCacheEntry& entry = m_entries[(slot + probe) & c_radianceCacheMask];
+        if (entry.m_key.load(std::memory_order_relaxed) == key)
+            return &entry;
+    }
+    return nullptr;
+}
+
+//----------------------------------------------------------------------------
+// Finds the key's entry, or claims a free one in its probe window, or takes over the least recently used one there.
+// Entries other threads are taking over are skipped.
+SRadianceCacheEntry* CRadianceCache::Insert (uint64_t key)
+{
+    uint64_t slot = HashKey(key);
+    SRadianceCacheEntry* oldest = nullptr;
+    uint32_t oldestUsed = 0;
+    for (size_t probe = 0; probe < c_radianceCacheProbes; ++probe)
+    {
+        SRadianceCacheEntry& entry = m_entries[(slot + probe) & c_radianceCacheMask];
+        uint64_t entryKey = entry.m_key.load(std::memory_order_relaxed);
+        if (entryKey == key)
+            return &entry;
+
+        // another thread can claim the entry first, and it could be for this key
+        if (entryKey == 0)
+        {
+            if (entry.m_key.compare_exchange_strong(entryKey, key, std::memory_order_relaxed))
+            {
+                m_inserts.fetch_add(1, std::memory_order_relaxed);
+                return &entry;
+            }
+            if (entryKey == key)
+                return &entry;
+        }
+        if (entryKey == c_radianceCacheBusyKey)
+            continue;
+
+        uint32_t lastUsed = entry.m_lastUsed.load(std::memory_order_relaxed);
+        if (!oldest || lastUsed < oldestUsed)
+        {
+            oldest = &entry;
+            oldestUsed = lastUsed;
+        }
+    }
+
+    if (!oldest)
+        return nullptr;
+
+    // hold the entry busy while it's cleared, so nobody finds the new key with the old sums
+    uint64_t oldestKey = oldest->m_key.load(std::memory_order_relaxed);
+    if (oldestKey == c_radianceCacheBusyKey || !oldest->m_key.compare_exchange_strong(oldestKey, c_radianceCacheBusyKey, std::memory_order_acquire))
+        return (oldestKey == key) ? oldest : nullptr;
+    ClearEntry(*oldest);
+    oldest->m_lastUsed.store(m_frame.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    oldest->m_key.store(key, std::memory_order_release);
+    m_inserts.fetch_add(1, std::memory_order_relaxed);
+    m_evictions.fetch_add(1, std::memory_order_relaxed);
+    return oldest;
+}
+
+//----------------------------------------------------------------------------
+bool CRadianceCache::Lookup (uint64_t key, float3& radiance)
+{
+    m_lookups.fetch_add(1, std::memory_order_relaxed);
+    SRadianceCacheEntry* entry = Find(key);
+    if (!entry)
+        return false;
+
+    uint32_t frame = m_frame.load(std::memory_order_relaxed);
+    entry->m_lastUsed.store(frame, std::memory_order_relaxed);
+
+    // the sums and the count are read apart, so records landing in between can make the average a little off
+    uint32_t samples = entry->m_samples.load(std::memory_order_relaxed);
+    if (samples < c_radianceCacheMinSamples)
+        return false;
+    for (size_t channel = 0; channel < 3; ++channel)
+        radiance[channel] = entry->m_radiance[channel].load(std::memory_order_relaxed) / float(samples);
+    m_hits.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+//----------------------------------------------------------------------------
+void CRadianceCache::Record (uint64_t key, const float3& radiance)
+{
+    if (!std::isfinite(radiance[0]) || !std::isfinite(radiance[1]) || !std::isfinite(radiance[2]))
+        return;
+
+    SRadianceCacheEntry* entry = Insert(key);
+    if (!entry)
+        return;
+
+    for (size_t channel = 0; channel < 3; ++channel)
+        AtomicAdd(entry->m_radiance[channel], radiance[channel]);
+    entry->m_samples.fetch_add(1, std::memory_order_relaxed);
+    entry->m_lastUsed.store(m_frame.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    m_records.fetch_add(1, std::memory_order_relaxed);
+}
+
+//----------------------------------------------------------------------------
+// No threads are rendering, so the entries can change without racing anything
+void CRadianceCache::FrameDone ()
+{
+    uint32_t frame = m_frame.fetch_add(1, std::memory_order_relaxed);
+    for (SRadianceCacheEntry& entry : m_entries)
+    {
+        if (entry.m_key.load(std::memory_order_relaxed) == 0)
+            continue;
+
+        if (frame - entry.m_lastUsed.load(std::memory_order_relaxed) > c_radianceCacheMaxAge)
+        {
+            entry.m_key.store(0, std::memory_order_relaxed);
+            ClearEntry(entry);
+            m_evictions.fetch_add(1, std::memory_order_relaxed);
+            continue;
+        }
+
+        uint32_t samples = entry.m_samples.load(std::memory_order_relaxed);
+        if (samples > c_radianceCacheMaxSamples)
+        {
+            float scale = float(samples / 2) / float(samples);
+            for (size_t channel = 0; channel < 3; ++channel)
+                entry.m_radiance[channel].store(entry.m_radiance[channel].load(std::memory_order_relaxed) * scale, std::memory_order_relaxed);
+            entry.m_samples.store(samples / 2, std::memory_order_relaxed);
+        }
+    }
+}
+
+//----------------------------------------------------------------------------
+SRadianceCacheStats CRadianceCache::Stats () const
+{
+    SRadianceCacheStats stats;
+    stats.m_lookups = m_lookups.load(std::memory_order_relaxed);
+    stats.m_hits = m_hits.load(std::memory_order_relaxed);
+    stats.m_records = m_records.load(std::memory_order_relaxed);
+    stats.m_inserts = m_inserts.load(std::memory_order_relaxed);
+    stats.m_evictions = m_evictions.load(std::memory_order_relaxed);
+    for (const SRadianceCacheEntry& entry : m_entries)
+    {
+        if (entry.m_key.load(std::memory_order_relaxed) != 0)
+            ++stats.m_entries;
+    }
+    return stats;
+}
+
+//----------------------------------------------------------------------------
+void CRadianceCache::ResetStats ()
+{
+    m_lookups = 0;
+    m_hits = 0;
+    m_records = 0;
+    m_inserts = 0;
+    m_evictions = 0;
+}
@@ -0,0 +1,155 @@
+#pragma once
+
+#include <vector>
+#include <atomic>
+#include <algorithm>
+#include <cmath>
+#include <stdint.h>
+#include "ShaderTypes.h"
+
+// A world space radiance cache for the CPU path tracer, like the hash grids of Binder et al's "Massively Parallel Path
+// Space Filtering" and of spatially hashed radiance caches in real time renderers. The scenes are static and diffuse,
+// so the light a point reflects doesn't depend on where it's seen from, and paths that have bounced enough that the
+// cache's blur won't show can end by looking up what the paths before them found there, instead of tracing on.
+//
+// The scene's bounds are cubified and split into a grid of c_radianceCacheResolution cells along each side. A cell, the
+// octahedral bin of the surface normal and the bounce make a 64 bit key, which is hashed into a fixed size table with
+// open addressing. Each entry holds the sum of the reflected radiance recorded into it and how many records that was.
+// Paths have a bounce limit, so a vertex reflects less light the later it's reached, and the cache keeps the bounces
+// apart so paths end with the light they would have found. The cache is still biased, since it blurs the light over a
+// cell, and the throughput of a path reaching part of a cell goes with the light there.
+//
+// A random c_radianceCacheTrainingFraction of the paths are training paths, which are traced as if there was no cache,
+// and record the radiance each of their vertices after the first hit reflects towards the vertex before it, not
+// counting its own emission. The rest end into the cache with the footprint heuristic of Muller et al's "Real-time
+// Neural Radiance Caching for Path Tracing": once the spread of the path from its second vertex on is larger than a
+// fraction of the spread of the camera ray at the first hit. They don't record anything, since the vertices they reach
+// without ending are the ones the cache doesn't have yet or that are close to the vertex before, like in corners, and
+// would make the cache darker than the places that look it up.
+//
+// Memory is bounded by the table size. Entries not used for c_radianceCacheMaxAge frames are freed at the end of each
+// frame, and when an insert finds no free entry in its probe window, it takes over the least recently used one.
+// Rendering threads look up, record and insert at the same time with atomics, and no locks. A record racing an
+// eviction can land in the new entry, which only blurs the cache a little more.
+
+static const size_t c_radianceCacheLog2Capacity = 18;           // 2^18 entries of 32 bytes, 8MB
+static const size_t c_radianceCacheProbes = 8;                  // entries an insert or lookup looks at, starting from the hashed one
+static const uint32_t c_radianceCacheResolution = 32;          // cells along each side of the cubified scene bounds
+static const uint32_t c_radianceCacheNormalBins = 4;            // octahedral normal bins along each side, 16 in all
+static const uint32_t c_radianceCacheMinSamples = 4;            // records an entry needs before paths can end in it
+static const uint32_t c_radianceCacheMaxSamples = 1024;         // entries with more records are halved at the end of a frame, so early records fade
+static const uint32_t c_radianceCacheMaxAge = 64;               // frames an entry can go unused before it's evicted
+static const float c_radianceCacheSpreadThreshold = 0.01f;      // c in the footprint heuristic, paths end once spread^2 > c * the camera's spread
+static const size_t c_radianceCacheMaxVertices = 32;            // path vertices past this many aren't recorded
+static const float c_radianceCacheTrainingFraction = 0.125f;
+static const uint32_t c_radianceCacheRandomBounce = 0xFFFD;     // Light_Outgoing() keys the random number picking training paths with this bounce
+
+struct SRadianceCacheEntry
+{
+    SRadianceCacheEntry ()
+    {
+        m_key = 0;
+        for (size_t i = 0; i < 3; ++i)
+            m_radiance[i] = 0.0f;
+        m_samples = 0;
+        m_lastUsed = 0;
+    }
+
+    std::atomic<uint64_t> m_key;    // 0 when the entry is free, 1 while it is being taken over
+    std::atomic<float> m_radiance[3];
+    std::atomic<uint32_t> m_samples;
+    std::atomic<uint32_t> m_lastUsed;
+};
+
+// counts since the last ResetStats(), and how many entries are in use
+struct SRadianceCacheStats
+{
+    uint64_t m_lookups = 0;
+    uint64_t m_hits = 0;
+    uint64_t m_records = 0;
+    uint64_t m_inserts = 0;
+    uint64_t m_evictions = 0;
+    size_t m_entries = 0;
+};
+
+class CRadianceCache
+{
+public:
+    CRadianceCache () : m_entries(size_t(1) << c_radianceCacheLog2Capacity) { }
+
+    // empties the cache, for a scene inside the box from boundsMin to boundsMax
+    void Reset (const float3& boundsMin, const float3& boundsMax);
+
+    // the key of the entry for a surface point reached after the given number of bounces, never 0
+    uint64_t Key (const float3& pos, const float3& normal, uint32_t bounce) const;
+
+    // gives the average reflected radiance of the key's entry if it has at least c_radianceCacheMinSamples records
+    bool Lookup (uint64_t key, float3& radiance);
+
+    void Record (uint64_t key, const float3& radiance);
+
+    // call when a frame is done rendering, to age and evict entries
+    void FrameDone ();
+
+    SRadianceCacheStats Stats () const;
+    void ResetStats ();
+
+private:
+    SRadianceCacheEntry* Find (uint64_t key);
+    SRadianceCacheEntry* Insert (uint64_t key);
+
+    std::vector<SRadianceCacheEntry> m_entries;
+    float3 m_boundsMin = { 0.0f, 0.0f, 0.0f };
+    float m_cellSize = 1.0f;
+    std::atomic<uint32_t> m_frame{ 1 };
+
+    std::atomic<uint64_t> m_lookups{ 0 };
+    std::atomic<uint64_t> m_hits{ 0 };
+    std::atomic<uint64_t> m_records{ 0 };
+    std::atomic<uint64_t> m_inserts{ 0 };
+    std::atomic<uint64_t> m_evictions{ 0 };
+};
+
+// The vertices of a path being traced, so that the radiance each one reflects can be recorded when the path is done.
+// m_throughput is what light leaving the vertex is multiplied by on its way to the camera, like SPathGuidingVertex.
+struct SRadianceCacheVertex
+{
+    uint64_t m_key;
+    float3 m_throughput;
+    float3 m_radiance;
+};
+
+struct SRadianceCachePath
+{
+    void AddVertex (uint64_t key, const float3& throughput)
+    {
+        if (m_numVertices >= c_radianceCacheMaxVertices)
+            return;
+        SRadianceCacheVertex& vertex = m_vertices[m_numVertices++];
+        vertex.m_key = key;
+        vertex.m_throughput = throughput;
+        vertex.m_radiance = { 0.0f, 0.0f, 0.0f };
+    }
+
+    void AddLight (const float3& light)
+    {
+        for (size_t i = 0; i < m_numVertices; ++i)
+        {
+            SRadianceCacheVertex& vertex = m_vertices[i];
+            for (size_t channel = 0; channel < 3; ++channel)
+            {
+                if (vertex.m_throughput[channel] > 0.0f)
+                    vertex.m_radiance[channel] += light[channel] / vertex.m_throughput[channel];
+            }
+        }
+    }
+
+    void Commit (CRadianceCache& radianceCache) const
+    {
+        for (size_t i = 0; i < m_numVertices; ++i)
+            radianceCache.Record(m_vertices[i].m_key, m_vertices[i].m_radiance);
+    }
+
+    SRadianceCacheVertex m_vertices[c_radianceCacheMaxVertices];
+    size_t m_numVertices = 0;
+};
@@ -0,0 +1,638 @@
+#define _CRT_SECURE_NO_WARNINGS
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <vector>
+#include <array>
+#include <string>
+#include <chrono>
+#ifdef _WIN32
+#include <direct.h>
+#define chdir _chdir
+#define getcwd _getcwd
+#else
+#include <unistd.h>
+#endif
+#include "../PathTraceKernelsCPU.h"
+#include "../ShowPathTraceCPU.h"
+#include "../Scenes.h"
+
+// Headless CPU renderer. Runs the C++ versions of the PathTraceFirstHit.fx, PathTrace.fx and ShowPathTrace.fx shaders
+// with CComputeDispatcherCPU, one dispatch per frame like the app, and writes the HDR result and the tonemapped image
+// shown on screen. Each dispatch is split into square screen tiles that the workers share by work stealing, and how
+// busy each worker was and how much it stole is printed, to see how well it scales. With -adaptive, tiles stop getting
+// samples once their error is low enough, and the samples each pixel got are written out too. Builds with CPU_ONLY defined, so
+// runs anywhere, not just windows. Run it from the Renderer directory, like the Benchmark; it loads the art from "..".
+
+static const size_t c_defaultSamples = 64;
+
+static const char* c_sceneNames[] =
+{
+    "SphereOnPlane_LowLight",
+    "SphereOnPlane_RegularLight",
+    "CornellBox_SmallLight",
+    "CornellBox_BigLight",
+    "FurnaceTest",
+    "CornellObj",
+    "ObjTest",
+    "Spheres",
+    "GlowingJets",
+    "SunSky",
+};
+
+static_assert(sizeof(c_sceneNames) / sizeof(c_sceneNames[0]) == (size_t)EScene::COUNT, "c_sceneNames needs a name for each EScene");
+
+//======================================================================================
+struct SRenderSettings
+{
+    EScene m_scene = EScene::CornellBox_SmallLight;
+    size_t m_width = c_width;
+    size_t m_height = c_height;
+    size_t m_samples = c_defaultSamples;
+    size_t m_samplesPerFrame = 1;
+    size_t m_numThreads = 0;    // 0 for one per core
+    unsigned int m_tileSize = c_pathTraceNumThreadsX;
+    unsigned int m_seed = 0;
+    float m_adaptiveError = 0.0f;   // 0 for no adaptive sampling
+    size_t m_adaptiveMinSamples = 32;
+    unsigned int m_maxBounces = c_maxBounces;
+    unsigned int m_rouletteStartBounce = c_rouletteStartBounce;
+    std::string m_outFileName;  // without extension. The scene name if empty.
+    std::string m_environmentFileName;  // a Radiance .hdr to light the scene with instead of its own sky, if not empty
+    bool m_pathGuiding = false;     // CPU only, so not a static branch
+    bool m_restir = false;          // also CPU only
+    bool m_restirUnbiased = true;
+    bool m_radianceCache = false;
+    bool m_lightmap = false;        // also CPU only
+    size_t m_lightmapTexels = c_lightmapDefaultTexels;
+
+    // the shader static branches and constants
+    bool m_whiteAlbedo = false;
+    ESampler m_sampler = ESampler::BlueNoise;
+    ELightPicker m_lightPicker = ELightPicker::AliasTable;
+    bool m_grey = false;
+    bool m_crossHatch = false;
+    bool m_smoothStep = false;
+    bool m_explicitCrossHatch = false;
+};
+
+//======================================================================================
+//                                     STimer
+//======================================================================================
+// measures time since construction
+struct STimer
+{
+    STimer()
+    {
+        m_start = std::chrono::high_resolution_clock::now();
+    }
+
+    float Seconds() const
+    {
+        std::chrono::duration<float> seconds = std::chrono::high_resolution_clock::now() - m_start;
+        return seconds.count();
+    }
+
+    std::chrono::high_resolution_clock::time_point m_start;
+};
+
+//======================================================================================
+// Radiance RGBE, uncompressed. Rows are stored top down, and row 0 of the image is the bottom of the screen.
+bool WriteHDR (const char* fileName, size_t width, size_t height, const std::vector<float3>& pixels)
+{
+    FILE* file = fopen(fileName, "wb");
+    if (!file)
+        return false;
+
+    fprintf(file, "#?RADIANCE\nFORMAT=32-bit_rle_rgbe\n\n-Y %zu +X %zu\n", height, width);
+
+    std::vector<uint8_t> row(width * 4);
+    for (size_t y = height; y-- > 0; )
+    {
+        for (size_t x = 0; x < width; ++x)
+        {
+            const float3& pixel = pixels[y * width + x];
+            float maxChannel = (std::max)((std::max)(pixel[0], pixel[1]), pixel[2]);
+            uint8_t* rgbe = &row[x * 4];
+            if (!(maxChannel > 1e-32f))
+            {
+                rgbe[0] = rgbe[1] = rgbe[2] = rgbe[3] = 0;
+                continue;
+            }
+
+            int exponent;
+            float scale = std::frexp(maxChannel, &exponent) * 256.0f / maxChannel;
+            for (size_t channel = 0; channel < 3; ++channel)
+                rgbe[channel] = (uint8_t)(std::max)(pixel[channel] * scale, 0.0f);
+            rgbe[3] = (uint8_t)(exponent + 128);
+        }
+        fwrite(row.data(), 1, row.size(), file);
+    }
+
+    return fclose(file) == 0;
+}
+
+//======================================================================================
+// 24 bit uncompressed targa, which LoadTarga() can read back. Targa rows are bottom up, like the image rows.
+bool WriteTGA (const char* fileName, size_t width, size_t height, const std::vector<float3>& pixels)
+{
+    FILE* file = fopen(fileName, "wb");
+    if (!file)
+        return false;
+
+    uint8_t header[18] = {};
+    header[2] = 2;  // uncompressed true color
+    header[12] = uint8_t(width & 0xFF);
+    header[13] = uint8_t(width >> 8);
+    header[14] = uint8_t(height & 0xFF);
+    header[15] = uint8_t(height >> 8);
+    header[16] = 24;
+    fwrite(header, 1, sizeof(header), file);
+
+    std::vector<uint8_t> bgr(width * height * 3);
+    for (size_t i = 0; i < width * height; ++i)
+    {
+        for (size_t channel = 0; channel < 3; ++channel)
+        {
+            float value = (std::min)((std::max)(pixels[i][channel], 0.0f), 1.0f);
+            bgr[i * 3 + 2 - channel] = uint8_t(value * 255.0f + 0.5f);
+        }
+    }
+    fwrite(bgr.data(), 1, bgr.size(), file);
+
+    return fclose(file) == 0;
+}
+
+//======================================================================================
+void PrintUsage ()
+{
+    printf(
+        "Usage: Renderer <scene> [options]\n"
+        "  scene is a name or an index:\n");
+    for (size_t i = 0; i < (size_t)EScene::COUNT; ++i)
+        printf("    %zu: %s\n", i, c_sceneNames[i]);
+    printf(
+        "options:\n"
+        "  -samples N          frames to accumulate. default %zu\n"
+        "  -samplesperframe N  samples averaged per frame. default 1\n"
+        "  -size W H           image size. default %i %i\n"
+        "  -threads N          default is one per core\n"
+        "  -tile N             the size of the square tiles that threads take and steal. default %u\n"
+        "  -out name           writes name.hdr and name.tga. default is the scene name\n"
+        "  -envmap file        lights the scene with a lat-long Radiance .hdr environment map, relative to the repo root\n"
+        "  -adaptive E         stop sampling tiles when their average relative error is under E\n"
+        "  -minsamples N       frames before adaptive sampling starts skipping tiles. default 32\n"
+        "  -seed N             seed for the random numbers. the same seed and settings give the same image. default 0\n"
+        "  -bounces N          the most bounces a path can take after the first hit. default %u\n"
+        "  -roulette N         the first bounce russian roulette can end a path on. more than -bounces turns it off. default %u\n"
+        "  -nolightsampling    only find lights by bouncing into them\n"
+        "  -lighttree          pick lights to sample with the light tree instead of by power\n"
+        "  -sobol              Owen scrambled Sobol points for every random number, instead of blue or white noise\n"
+        "  -stbn               spatiotemporal blue noise, where sample N reads a different blue noise texture\n"
+        "  -guiding            guide bounces with the radiance learned from the paths of the frames before\n"
+        "  -restir             light the first hits with spatiotemporal reservoir resampling instead of light sampling\n"
+        "  -restirbiased       the same, with the faster biased reuse\n"
+        "  -radiancecache      end paths into a world space cache of the light that the paths before them found\n"
+        "  -lightmap           path trace into object space lightmap charts of the surfaces seen, and look them up\n"
+        "  -lightmaptexels N   about how many texels the lightmap charts have in all. default %zu\n"
+        "  -whitealbedo -whitenoise -grey -crosshatch -smoothstep -explicitcrosshatch\n"
+        "                      the same as the options in the app\n",
+        c_defaultSamples, c_width, c_height, c_pathTraceNumThreadsX, c_maxBounces, c_rouletteStartBounce, c_lightmapDefaultTexels
+    );
+}
+
+//======================================================================================
+bool ParseSettings (int argc, char** argv, SRenderSettings& settings)
+{
+    if (argc < 2)
+        return false;
+
+    // the scene, by index or name
+    char* end = nullptr;
+    unsigned long sceneIndex = strtoul(argv[1], &end, 10);
+    if (end == argv[1] || *end != 0)
+    {
+        for (sceneIndex = 0; sceneIndex < (unsigned long)EScene::COUNT; ++sceneIndex)
+        {
+            if (!strcmp(argv[1], c_sceneNames[sceneIndex]))
+                break;
+        }
+    }
+    if (sceneIndex >= (unsigned long)EScene::COUNT)
+    {
+        printf("Unknown scene: %s\n", argv[1]);
+        return false;
+    }
+    settings.m_scene = (EScene)sceneIndex;
+
+    for (int i = 2; i < argc; ++i)
+    {
+        bool hasValue = i + 1 < argc;
+        if (!strcmp(argv[i], "-samples") && hasValue)
+            settings.m_samples = (size_t)strtoul(argv[++i], nullptr, 10);
+        else if (!strcmp(argv[i], "-samplesperframe") && hasValue)
+            settings.m_samplesPerFrame = (size_t)strtoul(argv[++i], nullptr, 10);
+        else if (!strcmp(argv[i], "-size") && i + 2 < argc)
+        {
+            settings.m_width = (size_t)strtoul(argv[++i], nullptr, 10);
+            settings.m_height = (size_t)strtoul(argv[++i], nullptr, 10);
+        }
+        else if (!strcmp(argv[i], "-threads") && hasValue)
+            settings.m_numThreads = (size_t)strtoul(argv[++i], nullptr, 10);
+        else if (!strcmp(argv[i], "-tile") && hasValue)
+            settings.m_tileSize = (unsigned int)strtoul(argv[++i], nullptr, 10);
+        else if (!strcmp(argv[i], "-adaptive") && hasValue)
+            settings.m_adaptiveError = (float)atof(argv[++i]);
+        else if (!strcmp(argv[i], "-minsamples") && hasValue)
+            settings.m_adaptiveMinSamples = (size_t)strtoul(argv[++i], nullptr, 10);
+        else if (!strcmp(argv[i], "-seed") && hasValue)
+            settings.m_seed = (unsigned int)strtoul(argv[++i], nullptr, 10);
+        else if (!strcmp(argv[i], "-bounces") && hasValue)
+            settings.m_maxBounces = (unsigned int)strtoul(argv[++i], nullptr, 10);
+        else if (!strcmp(argv[i], "-roulette") && hasValue)
+            settings.m_rouletteStartBounce = (unsigned int)strtoul(argv[++i], nullptr, 10);
+        else if (!strcmp(argv[i], "-out") && hasValue)
+            settings.m_outFileName = argv[++i];
+        else if (!strcmp(argv[i], "-envmap") && hasValue)
+            settings.m_environmentFileName = argv[++i];
+        else if (!strcmp(argv[i], "-whitealbedo"))
+            settings.m_whiteAlbedo = true;
+        else if (!strcmp(argv[i], "-whitenoise"))
+            settings.m_sampler = ESampler::WhiteNoise;
+        else if (!strcmp(argv[i], "-sobol"))
+            settings.m_sampler = ESampler::Sobol;
+        else if (!strcmp(argv[i], "-stbn"))
+            settings.m_sampler = ESampler::SpatiotemporalBlueNoise;
+        else if (!strcmp(argv[i], "-nolightsampling"))
+            settings.m_lightPicker = ELightPicker::None;
+        else if (!strcmp(argv[i], "-lighttree"))
+            settings.m_lightPicker = ELightPicker::LightTree;
+        else if (!strcmp(argv[i], "-guiding"))
+            settings.m_pathGuiding = true;
+        else if (!strcmp(argv[i], "-restir") || !strcmp(argv[i], "-restirbiased"))
+        {
+            settings.m_restir = true;
+            settings.m_restirUnbiased = !strcmp(argv[i], "-restir");
+        }
+        else if (!strcmp(argv[i], "-radiancecache"))
+            settings.m_radianceCache = true;
+        else if (!strcmp(argv[i], "-lightmap"))
+            settings.m_lightmap = true;
+        else if (!strcmp(argv[i], "-lightmaptexels") && hasValue)
+            settings.m_lightmapTexels = (size_t)strtoul(argv[++i], nullptr, 10);
+        else if (!strcmp(argv[i], "-grey"))
+            settings.m_grey = true;
+        else if (!strcmp(argv[i], "-crosshatch"))
+            settings.m_crossHatch = true;
+        else if (!strcmp(argv[i], "-smoothstep"))
+            settings.m_smoothStep = true;
+        else if (!strcmp(argv[i], "-explicitcrosshatch"))
+            settings.m_explicitCrossHatch = true;
+        else
+        {
+            printf("Unknown option: %s\n", argv[i]);
+            return false;
+        }
+    }
+
+    if (settings.m_samples == 0 || settings.m_samplesPerFrame == 0 || settings.m_width == 0 || settings.m_height == 0 || settings.m_tileSize == 0)
+    {
+        printf("samples, size and tile need to be more than 0\n");
+        return false;
+    }
+    if (settings.m_restir && settings.m_lightPicker == ELightPicker::None)
+    {
+        printf("-restir and -restirbiased replace light sampling, so can't be used with -nolightsampling\n");
+        return false;
+    }
+    if (settings.m_lightmap && (settings.m_adaptiveError > 0.0f || settings.m_pathGuiding || settings.m_restir || settings.m_radianceCache))
+    {
+        printf("-lightmap doesn't path trace the pixels, so can't be used with -adaptive, -guiding, -restir, -restirbiased or -radiancecache\n");
+        return false;
+    }
+    if (settings.m_lightmap && settings.m_lightmapTexels == 0)
+    {
+        printf("lightmaptexels needs to be more than 0\n");
+        return false;
+    }
+    if (settings.m_width * settings.m_height > ShaderData::StructuredBuffers::FirstRayHits.Read().size())
+    {
+        printf("size can't have more pixels than the FirstRayHits buffer, which is %i x %i\n", c_width, c_height);
+        return false;
+    }
+
+    if (settings.m_outFileName.empty())
+        settings.m_outFileName = c_sceneNames[sceneIndex];
+    return true;
+}
+
+//======================================================================================
+bool LoadScene (const SRenderSettings& settings)
+{
+    // the same defaults as the app
+    ShaderData::ConstantBuffers::ConstantsOnce.Write(
+        nullptr,
+        [&] (ShaderTypes::ConstantBuffers::ConstantsOnce& data)
+        {
+            data.width_height_zw = { float(settings.m_width), float(settings.m_height), 0.0f, 0.0f };
+            data.cameraPos_FOVX = { 0.0f, 0.0f, 0.0f, c_fovX };
+            data.cameraAt_FOVY = { 0.0f, 0.0f, 0.0f, c_fovX * float(settings.m_height) / float(settings.m_width) };
+            data.nearPlaneDist_missColor = { 0.0f, 0.0f, 0.0f, 0.0f };
+            data.numSpheres_numTris_numOBBs_numQuads = { 0, 0, 0, 0 };
+            data.numModels_sceneRootNode_numScenePrims_numLights = { 0, 0, 0, 0 };
+            data.environmentWidth_environmentHeight_zw = { 0, 0, 0, 0 };
+            data.uvmultiplier_blackPoint_whitePoint_triplanarPow = { 0.25f, 0.0f, 1.0f, 4.0f };
+            data.overlayOpacity_yzw = { 1.0f, 0.0f, 0.0f, 0.0f };
+        }
+    );
+
+    if (!ShaderTypesInitTexturesCPU())
+        return false;
+    ShaderData::Textures::pathTraceOutput.Create(settings.m_width, settings.m_height, 1);
+    ShaderData::Textures::pathTraceMoments.Create(settings.m_width, settings.m_height, 1);
+
+    if (!FillSceneData(settings.m_scene, nullptr))
+    {
+        printf("Could not fill scene data\n");
+        return false;
+    }
+    if (!settings.m_environmentFileName.empty() && !SetSceneEnvironment(settings.m_environmentFileName.c_str(), nullptr))
+    {
+        printf("Could not load environment map %s\n", settings.m_environmentFileName.c_str());
+        return false;
+    }
+    return true;
+}
+
+//======================================================================================
+int main (int argc, char** argv)
+{
+    SRenderSettings settings;
+    if (!ParseSettings(argc, argv, settings))
+    {
+        PrintUsage();
+        return 1;
+    }
+
+    // the art is loaded relative to the repo root, and the images are written relative to where we were run from
+    char workingDirectory[4096];
+    if (!getcwd(workingDirectory, sizeof(workingDirectory)) || chdir("..") != 0)
+    {
+        printf("Could not change to the parent directory\n");
+        return 1;
+    }
+    bool loaded = LoadScene(settings);
+    if (chdir(workingDirectory) != 0 || !loaded)
+        return 1;
+
+    size_t width = settings.m_width;
+    size_t height = settings.m_height;
+    CComputeDispatcherCPU dispatcher(settings.m_numThreads);
+    printf("Rendering %s at %zu x %zu, %zu samples (%zu per frame) on %zu threads\n", c_sceneNames[(size_t)settings.m_scene], width, height, settings.m_samples, settings.m_samplesPerFrame, dispatcher.NumWorkers());
+    if (settings.m_rouletteStartBounce <= settings.m_maxBounces)
+        printf("  up to %u bounces, russian roulette from bounce %u\n", settings.m_maxBounces, settings.m_rouletteStartBounce);
+    else
+        printf("  %u bounces\n", settings.m_maxBounces);
+    printf("  %u lights sampled%s\n", settings.m_lightPicker != ELightPicker::None ? ShaderData::ConstantBuffers::ConstantsOnce.Read().numModels_sceneRootNode_numScenePrims_numLights[3] : 0, settings.m_lightPicker == ELightPicker::LightTree ? " with the light tree" : "");
+    if (settings.m_restir)
+        printf("  first hits lit by %s spatiotemporal reservoir resampling, %u candidates and %u neighbors\n", settings.m_restirUnbiased ? "unbiased" : "biased", c_reservoirCandidates, c_reservoirNeighbors);
+    if (settings.m_lightmap)
+        printf("  object space lightmap of about %zu texels\n", settings.m_lightmapTexels);
+    const char* samplerNames[] = { "white noise", "blue noise & golden ratio", "spatiotemporal blue noise & golden ratio", "Owen scrambled Sobol" };
+    static_assert(sizeof(samplerNames) / sizeof(samplerNames[0]) == (size_t)ESampler::COUNT, "samplerNames needs a name for each ESampler");
+    printf("  %s random numbers\n", samplerNames[(size_t)settings.m_sampler]);
+    const uint4& environmentWidth_environmentHeight_zw = ShaderData::ConstantBuffers::ConstantsOnce.Read().environmentWidth_environmentHeight_zw;
+    if (environmentWidth_environmentHeight_zw[0] > 0)
+        printf("  %ux%u environment map%s\n", environmentWidth_environmentHeight_zw[0], environmentWidth_environmentHeight_zw[1], settings.m_lightPicker != ELightPicker::None ? ", importance sampled" : "");
+
+    // path guiding learns for the first frames, guiding each frame with what the ones before it learned
+    CPathGuiding pathGuiding;
+    PathTraceResetGuiding(pathGuiding);
+    CPathGuiding* guiding = settings.m_pathGuiding ? &pathGuiding : nullptr;
+
+    // the radiance cache fills up from the paths of each frame, and later paths end into it
+    CRadianceCache radianceCache;
+    PathTraceResetRadianceCache(radianceCache);
+    CRadianceCache* cache = settings.m_radianceCache ? &radianceCache : nullptr;
+
+    // the reservoirs ReSTIR keeps from frame to frame
+    SPixelReservoirs reservoirs;
+    PathTraceResetReservoirs(reservoirs);
+
+    // the lightmap's charts are made up front, and the ones the first hits see are traced each frame
+    CLightmap lightmap;
+    if (settings.m_lightmap)
+        lightmap.Build(settings.m_lightmapTexels, width * height);
+
+    SPathTraceSettings pathTraceSettings;
+    pathTraceSettings.m_whiteAlbedo = settings.m_whiteAlbedo;
+    pathTraceSettings.m_sampler = settings.m_sampler;
+    pathTraceSettings.m_lightPicker = settings.m_lightPicker;
+    pathTraceSettings.m_pathGuiding = guiding;
+    pathTraceSettings.m_radianceCache = cache;
+    pathTraceSettings.m_reservoirs = settings.m_restir ? &reservoirs : nullptr;
+
+    SCamera camera = MakeCamera();
+    uint3 tileSize = { settings.m_tileSize, settings.m_tileSize, 1 };
+    size_t dispatchX, dispatchY;
+    PathTraceDispatchSize(settings.m_tileSize, dispatchX, dispatchY);
+
+    // first hits
+    STimer firstHitTimer;
+    dispatcher.Dispatch(tileSize, dispatchX, dispatchY, 1,
+        [&] (const SComputeThreadIDs& ids)
+        {
+            if (settings.m_lightmap)
+                PathTraceLightmapFirstHitKernel(ids, camera, lightmap);
+            else
+                PathTraceFirstHitKernel(ids, camera);
+        }
+    );
+    float firstHitSeconds = firstHitTimer.Seconds();
+
+    // Path trace a frame at a time, with the sample count the app would give each frame. With adaptive sampling, only
+    // the tiles that need samples are dispatched, and it stops early if none do. The reservoirs are made for the whole
+    // image first, with the same camera as last frame since it doesn't move. With the lightmap, each frame adds the
+    // samples to the texels of the charts seen instead, and the pixels look them up.
+    bool adaptive = settings.m_adaptiveError > 0.0f;
+    std::vector<uint2> tiles;
+    std::vector<uint2> lightmapBlocks;
+    size_t numFrames = 0;
+    double numPaths = 0.0;
+    dispatcher.ResetStats();
+    STimer pathTraceTimer;
+    for (; numFrames < settings.m_samples; ++numFrames)
+    {
+        ShaderData::ConstantBuffers::ConstantsPerFrame.Write(
+            nullptr,
+            [&] (ShaderTypes::ConstantBuffers::ConstantsPerFrame& data)
+            {
+                data.rngSeed_yzw = { settings.m_seed, 0, 0, 0 };
+                data.sampleCount_samplesPerFrame_zw = { (unsigned int)numFrames + 1, (unsigned int)settings.m_samplesPerFrame, 0, 0 };
+                data.adaptiveError_adaptiveMinSamples_zw = { settings.m_adaptiveError, float(settings.m_adaptiveMinSamples), 0.0f, 0.0f };
+                data.maxBounces_rouletteStartBounce_zw = { settings.m_maxBounces, settings.m_rouletteStartBounce, 0, 0 };
+            }
+        );
+
+        if (settings.m_lightmap)
+        {
+            numPaths += double(lightmap.SeenBlocks(lightmapBlocks)) * double(settings.m_samplesPerFrame);
+            for (size_t sample = 0; sample < settings.m_samplesPerFrame; ++sample)
+            {
+                dispatcher.Dispatch({ c_lightmapBlockSize, 1, 1 }, lightmapBlocks.size(), 1, 1,
+                    [&] (const SComputeThreadIDs& ids)
+                    {
+                        PathTraceLightmapKernel(ids, lightmap, lightmapBlocks, pathTraceSettings);
+                    }
+                );
+            }
+            dispatcher.Dispatch(tileSize, dispatchX, dispatchY, 1,
+                [&] (const SComputeThreadIDs& ids)
+                {
+                    PathTraceLightmapViewKernel(ids, camera, lightmap);
+                }
+            );
+            continue;
+        }
+
+        if (settings.m_restir)
+        {
+            dispatcher.Dispatch(tileSize, dispatchX, dispatchY, 1,
+                [&] (const SComputeThreadIDs& ids)
+                {
+                    PathTraceReservoirKernel(ids, camera, camera, reservoirs, settings.m_lightPicker == ELightPicker::LightTree, settings.m_restirUnbiased);
+                }
+            );
+            dispatcher.Dispatch(tileSize, dispatchX, dispatchY, 1,
+                [&] (const SComputeThreadIDs& ids)
+                {
+                    PathTraceSpatialReuseKernel(ids, camera, reservoirs, settings.m_restirUnbiased);
+                }
+            );
+        }
+
+        if (!adaptive)
+        {
+            dispatcher.Dispatch(tileSize, dispatchX, dispatchY, 1,
+                [&] (const SComputeThreadIDs& ids)
+                {
+                    PathTraceKernel(ids, camera, pathTraceSettings);
+                }
+            );
+            numPaths += double(width) * double(height) * double(settings.m_samplesPerFrame);
+            if (guiding)
+                guiding->FrameDone();
+            if (cache)
+                cache->FrameDone();
+            continue;
+        }
+
+        PathTraceAdaptiveTiles(dispatcher, settings.m_tileSize, tiles);
+        if (tiles.empty())
+            break;
+        PathTraceDispatchTiles(dispatcher, settings.m_tileSize, tiles,
+            [&] (const SComputeThreadIDs& ids)
+            {
+                PathTraceKernel(ids, camera, pathTraceSettings);
+            }
+        );
+        for (const uint2& tile : tiles)
+            numPaths += double(PathTraceTilePixels(tile, settings.m_tileSize)) * double(settings.m_samplesPerFrame);
+        if (guiding)
+            guiding->FrameDone();
+        if (cache)
+            cache->FrameDone();
+    }
+    float pathTraceSeconds = pathTraceTimer.Seconds();
+    std::vector<SComputeWorkerStats> workerStats = dispatcher.WorkerStats();
+    double dispatchSeconds = dispatcher.DispatchSeconds();
+
+    // tonemap, sampling at pixel centers like the pixel shader
+    std::vector<float3> hdr(width * height);
+    std::vector<float3> ldr(width * height);
+    dispatcher.Dispatch(tileSize, dispatchX, dispatchY, 1,
+        [&] (const SComputeThreadIDs& ids)
+        {
+            size_t x = ids.dispatchThreadID[0];
+            size_t y = ids.dispatchThreadID[1];
+            if (x >= width || y >= height)
+                return;
+
+            size_t pixelIndex = y * width + x;
+            hdr[pixelIndex] = XYZ(ShaderData::Textures::pathTraceOutput.Texel(x, y));
+            float u = (float(x) + 0.5f) / float(width);
+            float v = (float(y) + 0.5f) / float(height);
+            ldr[pixelIndex] = GetPixelColor(camera, u, v, hdr[pixelIndex], ShaderData::StructuredBuffers::FirstRayHits.Read()[pixelIndex], settings.m_grey, settings.m_crossHatch, settings.m_smoothStep, settings.m_explicitCrossHatch);
+        }
+    );
+
+    printf("  first hits: %0.2f ms\n", firstHitSeconds * 1000.0f);
+    if (adaptive)
+        printf("  adaptive: %zu frames, %0.1f samples per pixel on average\n", numFrames, numPaths / double(width * height));
+    if (settings.m_pathGuiding)
+        printf("  path guiding: %zu training iterations done, %zu spatial leaves\n", pathGuiding.Iteration(), pathGuiding.NumLeaves());
+    if (settings.m_radianceCache)
+    {
+        SRadianceCacheStats stats = radianceCache.Stats();
+        printf("  radiance cache: %0.1f%% of %llu lookups hit, %llu records, %llu inserts, %llu evictions, %zu of %zu entries in use\n",
+            stats.m_lookups ? 100.0 * double(stats.m_hits) / double(stats.m_lookups) : 0.0, (unsigned long long)stats.m_lookups, (unsigned long long)stats.m_records,
+            (unsigned long long)stats.m_inserts, (unsigned long long)stats.m_evictions, stats.m_entries, size_t(1) << c_radianceCacheLog2Capacity);
+    }
+    if (settings.m_lightmap)
+    {
+        printf("  lightmap: %zu of %zu charts seen, %zu of %zu texels still being traced, texel size %0.4f\n",
+            lightmap.NumSeenCharts(), lightmap.NumCharts(), lightmap.SeenBlocks(lightmapBlocks), lightmap.NumTexels(), lightmap.TexelSize());
+    }
+    printf("  path trace: %0.2f s, %0.3f Mpaths/s, %0.3f Mpaths/s per thread\n", pathTraceSeconds, numPaths / double(pathTraceSeconds) / 1000000.0, numPaths / double(pathTraceSeconds) / 1000000.0 / double(dispatcher.NumWorkers()));
+
+    // Utilization is the time a thread spent running tiles over the time the dispatches took. Idle time is time spent
+    // looking for tiles to steal, or waiting at the end of a frame for the last tiles to finish.
+    size_t totalSteals = 0;
+    double minUtilization = 1.0;
+    double totalUtilization = 0.0;
+    printf("  %u x %u tiles, %zu per frame:\n", settings.m_tileSize, settings.m_tileSize, dispatchX * dispatchY);
+    for (size_t i = 0; i < workerStats.size(); ++i)
+    {
+        const SComputeWorkerStats& stats = workerStats[i];
+        double utilization = dispatchSeconds > 0.0 ? stats.m_busySeconds / dispatchSeconds : 0.0;
+        printf("    thread %2zu: %5.1f%% utilization, %7zu tiles, %5zu steals of %6zu tiles\n", i, 100.0 * utilization, stats.m_groupsRun, stats.m_steals, stats.m_groupsStolen);
+        totalSteals += stats.m_steals;
+        minUtilization = (std::min)(minUtilization, utilization);
+        totalUtilization += utilization;
+    }
+    printf("  utilization: %0.1f%% average, %0.1f%% lowest. %zu steals, %0.2f per frame\n", 100.0 * totalUtilization / double(workerStats.size()), 100.0 * minUtilization, totalSteals, double(totalSteals) / double((std::max)(numFrames, size_t(1))));
+
+    std::string hdrFileName = settings.m_outFileName + ".hdr";
+    std::string tgaFileName = settings.m_outFileName + ".tga";
+    if (!WriteHDR(hdrFileName.c_str(), width, height, hdr) || !WriteTGA(tgaFileName.c_str(), width, height, ldr))
+    {
+        printf("Could not write %s and %s\n", hdrFileName.c_str(), tgaFileName.c_str());
+        return 1;
+    }
+    printf("  wrote %s and %s\n", hdrFileName.c_str(), tgaFileName.c_str());
+
+    // the samples each pixel got, as a fraction of the most any pixel got
+    if (adaptive)
+    {
+        std::vector<float3> samples(width * height);
+        for (size_t y = 0; y < height; ++y)
+        {
+            for (size_t x = 0; x < width; ++x)
+            {
+                float fraction = ShaderData::Textures::pathTraceMoments.Texel(x, y)[1] / float(numFrames);
+                samples[y * width + x] = { fraction, fraction, fraction };
+            }
+        }
+
+        std::string samplesFileName = settings.m_outFileName + "_samples.tga";
+        if (!WriteTGA(samplesFileName.c_str(), width, height, samples))
+        {
+            printf("Could not write %s\n", samplesFileName.c_str());
+            return 1;
+        }
+        printf("  wrote %s\n", samplesFileName.c_str());
+    }
+    return 0;
+}
\ No newline at end of file
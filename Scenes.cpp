@@ -1,213 +1,649 @@
 #include "Scenes.h"
 #include "ShaderTypes.h"
-#include "tiny_obj_loader.h"
+#include "MeshLoader.h"
+#include "BVH.h"
+#include "LightTree.h"
+#include "Environment.h"
+#include <string>
+#include <vector>
+#include <algorithm>
+#ifndef CPU_ONLY
 #include <d3d11.h>
+#endif
 
-template<typename T>
-void AddMeshToTriangleSoup (const char* fileName, const char* basePath, T& triangles, size_t& triangleIndex)
+// a mesh loaded into ModelTriangles, in its normalized object space
+struct SSceneMesh
 {
-    tinyobj::attrib_t attrib;
-    std::vector<tinyobj::shape_t> shapes;
-    std::vector<tinyobj::material_t> materials;
+    std::string m_fileName;
+    size_t m_firstTriangle;
+    size_t m_lastTriangle;
+};
+
+// keeps track of where things go in the model buffers while a scene is being made.
+// Each mesh file is only loaded once, and is shared by all models that use it.
+struct SSceneModels
+{
+    size_t m_modelIndex = 0;
+    size_t m_modelTriangleIndex = 0;
+    std::vector<SSceneMesh> m_meshes;
+};
 
-    // load the object if we can
-    std::string err;
-    if (!tinyobj::LoadObj(&attrib, &shapes, &materials, &err, fileName, basePath, true))
+// where a model goes in a scene. rotationAngle is in degrees.
+struct SSceneModelPlacement
+{
+    const char* m_fileName;
+    float3 m_position;
+    float3 m_scale;
+    float3 m_rotationAxis;
+    float m_rotationAngle;
+};
+
+// the jets of EScene::ObjTest. AnimateScene() spins them about their rotation axis and bobs them up and down.
+static const SSceneModelPlacement c_objTestJets[] =
+{
+    { "Art/Models/jet0-0.obj", { -2.0f, -1.0f, 2.0f }, { 1.0f, 1.0f, 1.0f }, { 0.0f, 1.0f, 1.0f }, 0.0f },
+    { "Art/Models/jet0-0.obj", { -1.0f, -0.8f, 2.0f }, { 1.0f, 1.0f, 1.0f }, { 0.0f, 1.0f, 1.0f }, 20.0f },
+    { "Art/Models/jet0-0.obj", {  0.0f, -0.6f, 2.0f }, { 1.0f, 1.0f, 1.0f }, { 0.0f, 1.0f, 1.0f }, 40.0f },
+    { "Art/Models/jet0-0.obj", {  1.0f, -0.4f, 2.0f }, { 1.0f, 1.0f, 1.0f }, { 0.0f, 1.0f, 1.0f }, 60.0f },
+    { "Art/Models/jet0-0.obj", {  2.0f, -0.2f, 2.0f }, { 1.0f, 1.0f, 1.0f }, { 0.0f, 1.0f, 1.0f }, 80.0f },
+};
+// the jets of EScene::GlowingJets. Every triangle of the jet mesh glows, so the scene is lit by hundreds of small lights.
+static const SSceneModelPlacement c_glowingJets[] =
+{
+    { "Art/Models/jet0-0.obj", { -1.8f, -2.0f, 2.5f }, { 0.8f, 0.8f, 0.8f }, { 0.0f, 1.0f, 0.0f }, 30.0f },
+    { "Art/Models/jet0-0.obj", {  1.8f, -2.0f, 2.0f }, { 0.8f, 0.8f, 0.8f }, { 0.0f, 1.0f, 0.0f }, -60.0f },
+    { "Art/Models/jet0-0.obj", { -1.5f,  1.8f, 3.5f }, { 0.8f, 0.8f, 0.8f }, { 1.0f, 0.0f, 0.0f }, 90.0f },
+    { "Art/Models/jet0-0.obj", {  1.5f,  0.5f, 4.0f }, { 0.8f, 0.8f, 0.8f }, { 0.0f, 0.0f, 1.0f }, 45.0f },
+    { "Art/Models/jet0-0.obj", {  0.0f, -0.5f, 1.5f }, { 0.6f, 0.6f, 0.6f }, { 0.0f, 1.0f, 0.0f }, 180.0f },
+};
+static const float c_glowingJetBrightness = 3.0f;
+
+// the sky of EScene::SunSky. The sun is a few hundred times brighter than the sky, but a tiny part of it, so it's about
+// half the light.
+static const float3 c_sunSkySunDirection = { 0.6f, 0.5f, -0.4f };
+static const float3 c_sunSkySunColor = { 1000.0f, 900.0f, 750.0f };
+static const float3 c_sunSkySkyColor = { 0.3f, 0.45f, 0.8f };
+static const float3 c_sunSkyGroundColor = { 0.2f, 0.18f, 0.15f };
+
+static const float c_objTestJetSpinSpeed = 90.0f;   // degrees per second
+static const float c_objTestJetBobHeight = 0.5f;
+static const float c_objTestJetBobSpeed = 2.0f;     // radians per second
+
+// inverts a 3x4 affine transform given as rows
+void InvertTransform (const float4& X, const float4& Y, const float4& Z, float4& invX, float4& invY, float4& invZ)
+{
+    // the rows of the inverse of a 3x3 matrix are the cross products of its columns, divided by the determinant
+    float3 a = { X[0], Y[0], Z[0] };
+    float3 b = { X[1], Y[1], Z[1] };
+    float3 c = { X[2], Y[2], Z[2] };
+    float3 bc = Cross(b, c);
+    float invDet = 1.0f / Dot(a, bc);
+    float3 rowX = bc * invDet;
+    float3 rowY = Cross(c, a) * invDet;
+    float3 rowZ = Cross(a, b) * invDet;
+
+    // the translation is undone after the rotation / scale is
+    float3 translation = { X[3], Y[3], Z[3] };
+    invX = { rowX[0], rowX[1], rowX[2], -Dot(rowX, translation) };
+    invY = { rowY[0], rowY[1], rowY[2], -Dot(rowY, translation) };
+    invZ = { rowZ[0], rowZ[1], rowZ[2], -Dot(rowZ, translation) };
+}
+
+const SSceneMesh* LoadSceneMesh (const char* fileName, SSceneModels& sceneModels)
+{
+    for (const SSceneMesh& mesh : sceneModels.m_meshes)
     {
-        printf("[LOAD OBJ ERROR] %s - %s\n", fileName, err.c_str());
-        return;
+        if (mesh.m_fileName == fileName)
+            return &mesh;
     }
 
-    // write the triangles
-    for (const tinyobj::shape_t& shape : shapes)
-    {
-        for (size_t srcIndex = 0; srcIndex < shape.mesh.indices.size(); srcIndex += 3)
-        {
-            float3 a, b, c;
-            float3 albedo, emissive;
+    SSceneMesh mesh;
+    mesh.m_fileName = fileName;
+    mesh.m_firstTriangle = sceneModels.m_modelTriangleIndex;
 
-            int indexA = shape.mesh.indices[srcIndex + 0].vertex_index;
-            int indexB = shape.mesh.indices[srcIndex + 1].vertex_index;
-            int indexC = shape.mesh.indices[srcIndex + 2].vertex_index;
+    bool success = true;
+    ShaderData::StructuredBuffers::ModelTriangles.WriteNoFlush(
+        [&] (ShaderTypes::StructuredBuffers::TModelTriangles& triangles)
+        {
+            AddMeshToTriangleSoup(fileName, "./Art/Models/", triangles, sceneModels.m_modelTriangleIndex);
+            mesh.m_lastTriangle = sceneModels.m_modelTriangleIndex;
+            if (mesh.m_firstTriangle == mesh.m_lastTriangle)
+            {
+                success = false;
+                return;
+            }
 
-            a[0] = attrib.vertices[indexA * 3 + 0];
-            a[1] = attrib.vertices[indexA * 3 + 1];
-            a[2] = attrib.vertices[indexA * 3 + 2];
+            // put the mesh into a normalized object space
+            NormalizeMesh(triangles, mesh.m_firstTriangle, mesh.m_lastTriangle);
+        }
+    );
 
-            b[0] = attrib.vertices[indexB * 3 + 0];
-            b[1] = attrib.vertices[indexB * 3 + 1];
-            b[2] = attrib.vertices[indexB * 3 + 2];
+    if (!success)
+        return nullptr;
 
-            c[0] = attrib.vertices[indexC * 3 + 0];
-            c[1] = attrib.vertices[indexC * 3 + 1];
-            c[2] = attrib.vertices[indexC * 3 + 2];
+    sceneModels.m_meshes.push_back(mesh);
+    return &sceneModels.m_meshes.back();
+}
 
-            int materialID = shape.mesh.material_ids[srcIndex / 3];
-            if (materialID >= 0)
-            {
-                albedo[0] = materials[materialID].diffuse[0];
-                albedo[1] = materials[materialID].diffuse[1];
-                albedo[2] = materials[materialID].diffuse[2];
+// sets the object to world transform of a model that is already in the scene. Its mesh and BVH don't change.
+static void SetModelTransform (size_t modelIndex, float3 position, float3 scale, float3 rotationAxis, float rotationAngle)
+{
+    // the object to world transform scales, then rotates, then translates
+    float3 xAxis, yAxis, zAxis;
+    RotationBasis(rotationAxis, rotationAngle, xAxis, yAxis, zAxis);
+    float4 objectToWorldX = { xAxis[0] * scale[0], yAxis[0] * scale[1], zAxis[0] * scale[2], position[0] };
+    float4 objectToWorldY = { xAxis[1] * scale[0], yAxis[1] * scale[1], zAxis[1] * scale[2], position[1] };
+    float4 objectToWorldZ = { xAxis[2] * scale[0], yAxis[2] * scale[1], zAxis[2] * scale[2], position[2] };
 
-                emissive[0] = materials[materialID].ambient[0];
-                emissive[1] = materials[materialID].ambient[1];
-                emissive[2] = materials[materialID].ambient[2];
-            }
-            else
-            {
-                albedo = { 1.0f, 1.0f, 1.0f };
-                emissive = { 0.0f, 0.0f, 0.0f };
-            }
+    ShaderData::StructuredBuffers::Models.WriteNoFlush(
+        [&] (ShaderTypes::StructuredBuffers::TModels& models)
+        {
+            ShaderTypes::StructuredBuffers::ModelPrim& model = models[modelIndex];
+            model.objectToWorldX = objectToWorldX;
+            model.objectToWorldY = objectToWorldY;
+            model.objectToWorldZ = objectToWorldZ;
+            InvertTransform(objectToWorldX, objectToWorldY, objectToWorldZ, model.worldToObjectX, model.worldToObjectY, model.worldToObjectZ);
+        }
+    );
+}
 
-            MakeTriangle(triangles[triangleIndex], a, b, c, albedo, emissive);
-            ++triangleIndex;
+void AddMeshToScene (const char* fileName, SSceneModels& sceneModels, float3 position, float3 scale, float3 rotationAxis, float rotationAngle)
+{
+    const SSceneMesh* mesh = LoadSceneMesh(fileName, sceneModels);
+    if (!mesh)
+        return;
 
-            if (triangleIndex >= triangles.size())
-            {
-                printf("[LOAD OBJ ERROR] %s - ran out of scene triangles!\n", fileName);
-                return;
-            }
+    ShaderData::StructuredBuffers::Models.WriteNoFlush(
+        [&] (ShaderTypes::StructuredBuffers::TModels& models)
+        {
+            // the root node is filled in when the BVHs are built
+            models[sceneModels.m_modelIndex].firstTriangle_lastTriangle_rootNode_firstLight = { (unsigned int)mesh->m_firstTriangle, (unsigned int)mesh->m_lastTriangle, 0, 0 };
         }
-    }
+    );
+    SetModelTransform(sceneModels.m_modelIndex, position, scale, rotationAxis, rotationAngle);
+
+    ++sceneModels.m_modelIndex;
 }
 
-template<typename T>
-float AddMeshToTriangleSoup (const char* fileName, const char* basePath, T& triangles, size_t& triangleIndex, float3 position, float3 scale, float3 rotationAxis, float rotationAngle)
+// the scene BVH as it was last built or refit, so RefitSceneBVH() can refit it again
+static SBVH s_sceneBVH;
+static float s_sceneBVHBuiltCost = 0.0f;
+
+// the bounds of each sphere, triangle, quad, OBB and model in the scene, which the scene BVH is made from
+static void MakeScenePrimitives (std::vector<SBVHPrimitive>& primitives, std::vector<uint4>& primitiveTypeIndex)
 {
-    // remember where the first triangle of the model is going to go
-    size_t startingTriangleIndex = triangleIndex;
+    const ShaderTypes::ConstantBuffers::ConstantsOnce& constants = ShaderData::ConstantBuffers::ConstantsOnce.Read();
+    uint4 counts = constants.numSpheres_numTris_numOBBs_numQuads;
+    unsigned int numModels = constants.numModels_sceneRootNode_numScenePrims_numLights[0];
+
+    primitives.clear();
+    primitiveTypeIndex.clear();
+    auto AddPrimitive = [&] (EScenePrimitive type, size_t index, const float3& boundsMin, const float3& boundsMax)
+    {
+        primitives.emplace_back();
+        MakeBVHPrimitive(primitives.back(), boundsMin, boundsMax);
+        primitiveTypeIndex.push_back({ (unsigned int)type, (unsigned int)index, 0, 0 });
+    };
 
-    // call function above to add the triangles
-    AddMeshToTriangleSoup(fileName, basePath, triangles, triangleIndex);
+    for (size_t i = 0; i < counts[0]; ++i)
+    {
+        const ShaderTypes::StructuredBuffers::SpherePrim& sphere = ShaderData::StructuredBuffers::Spheres.Read()[i];
+        float3 radius = { sphere.position_Radius[3], sphere.position_Radius[3], sphere.position_Radius[3] };
+        AddPrimitive(EScenePrimitive::Sphere, i, XYZ(sphere.position_Radius) - radius, XYZ(sphere.position_Radius) + radius);
+    }
 
-    // bail out if no triangles added for this mesh
-    if (startingTriangleIndex == triangleIndex)
-        return 0.0f;
+    for (size_t i = 0; i < counts[1]; ++i)
+    {
+        primitives.emplace_back();
+        MakeBVHPrimitive(primitives.back(), ShaderData::StructuredBuffers::Triangles.Read()[i]);
+        primitiveTypeIndex.push_back({ (unsigned int)EScenePrimitive::Triangle, (unsigned int)i, 0, 0 });
+    }
 
-    // get the largest absolute valued position vector component so we can scale the mesh to fit within a normalized cube
-    float Max = 0.0f;
-    for (size_t i = startingTriangleIndex; i < triangleIndex; ++i)
+    for (size_t i = 0; i < counts[3]; ++i)
     {
+        const ShaderTypes::StructuredBuffers::QuadPrim& quad = ShaderData::StructuredBuffers::Quads.Read()[i];
+        float3 boundsMin, boundsMax;
         for (size_t j = 0; j < 3; ++j)
         {
-            Max = max(Max, abs(triangles[i].positionA_w[j]));
-            Max = max(Max, abs(triangles[i].positionB_w[j]));
-            Max = max(Max, abs(triangles[i].positionC_w[j]));
+            boundsMin[j] = (std::min)((std::min)(quad.positionA_w[j], quad.positionB_w[j]), (std::min)(quad.positionC_w[j], quad.positionD_w[j]));
+            boundsMax[j] = (std::max)((std::max)(quad.positionA_w[j], quad.positionB_w[j]), (std::max)(quad.positionC_w[j], quad.positionD_w[j]));
         }
+        AddPrimitive(EScenePrimitive::Quad, i, boundsMin, boundsMax);
     }
 
-    // combine the scale passed in with the normalization scale.
-    float normalizationScale = 1.0f / (2.0f * Max);
-    scale[0] *= normalizationScale;
-    scale[1] *= normalizationScale;
-    scale[2] *= normalizationScale;
-
-    // calculate basis axes for rotation
-    float cosTheta = cos(rotationAngle);
-    float sinTheta = sin(rotationAngle);
-    float3 xAxis =
+    for (size_t i = 0; i < counts[2]; ++i)
     {
-        cosTheta + rotationAxis[0] * rotationAxis[0] * (1.0f - cosTheta),
-        rotationAxis[0] * rotationAxis[1] * (1.0f - cosTheta) - rotationAxis[2] * sinTheta,
-        rotationAxis[0] * rotationAxis[2] * (1.0f - cosTheta) + rotationAxis[1] * sinTheta
-    };
+        // UndoChangeBasis() puts the obb axes into world space, so the world space extents are the box radius dotted
+        // against the absolute value of each axis.
+        const ShaderTypes::StructuredBuffers::OBBPrim& obb = ShaderData::StructuredBuffers::OBBs.Read()[i];
+        float3 radius = XYZ(obb.radius_w);
+        float3 extents =
+        {
+            Dot(radius, { std::abs(obb.XAxis_w[0]), std::abs(obb.XAxis_w[1]), std::abs(obb.XAxis_w[2]) }),
+            Dot(radius, { std::abs(obb.YAxis_w[0]), std::abs(obb.YAxis_w[1]), std::abs(obb.YAxis_w[2]) }),
+            Dot(radius, { std::abs(obb.ZAxis_w[0]), std::abs(obb.ZAxis_w[1]), std::abs(obb.ZAxis_w[2]) })
+        };
+        AddPrimitive(EScenePrimitive::OBB, i, XYZ(obb.position_w) - extents, XYZ(obb.position_w) + extents);
+    }
 
-    float3 yAxis =
+    for (size_t i = 0; i < numModels; ++i)
     {
-        rotationAxis[1] * rotationAxis[0] * (1.0f - cosTheta) + rotationAxis[2] * sinTheta,
-        cosTheta + rotationAxis[1] * rotationAxis[1] * (1.0f - cosTheta),
-        rotationAxis[1] * rotationAxis[2] * (1.0f - cosTheta) - rotationAxis[0] * sinTheta
-    };
+        // put the corners of the root node of the model's BVH into world space
+        const ShaderTypes::StructuredBuffers::ModelPrim& model = ShaderData::StructuredBuffers::Models.Read()[i];
+        const ShaderTypes::StructuredBuffers::BVHNode& root = ShaderData::StructuredBuffers::BVHNodes.Read()[model.firstTriangle_lastTriangle_rootNode_firstLight[2]];
+        float4 objectToWorldX, objectToWorldY, objectToWorldZ;
+        InvertTransform(model.worldToObjectX, model.worldToObjectY, model.worldToObjectZ, objectToWorldX, objectToWorldY, objectToWorldZ);
+
+        float3 boundsMin = { FLT_MAX, FLT_MAX, FLT_MAX };
+        float3 boundsMax = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+        for (size_t corner = 0; corner < 8; ++corner)
+        {
+            float3 objectPos =
+            {
+                (corner & 1) ? root.boundsMax_w[0] : root.boundsMin_w[0],
+                (corner & 2) ? root.boundsMax_w[1] : root.boundsMin_w[1],
+                (corner & 4) ? root.boundsMax_w[2] : root.boundsMin_w[2]
+            };
+            float3 worldPos = TransformPoint(objectToWorldX, objectToWorldY, objectToWorldZ, objectPos);
+            for (size_t j = 0; j < 3; ++j)
+            {
+                boundsMin[j] = (std::min)(boundsMin[j], worldPos[j]);
+                boundsMax[j] = (std::max)(boundsMax[j], worldPos[j]);
+            }
+        }
+        AddPrimitive(EScenePrimitive::Model, i, boundsMin, boundsMax);
+    }
+}
 
-    float3 zAxis =
-    {
-        rotationAxis[2] * rotationAxis[0] * (1.0f - cosTheta) - rotationAxis[1] * sinTheta,
-        rotationAxis[2] * rotationAxis[1] * (1.0f - cosTheta) + rotationAxis[0] * sinTheta,
-        cosTheta + rotationAxis[2] * rotationAxis[2] * (1.0f - cosTheta)
-    };
+// builds the scene BVH over all spheres, triangles, quads, OBBs and models, and writes its nodes from firstNode on,
+// which is after the mesh nodes
+static bool BuildTopLevelBVH (ID3D11DeviceContext* context, EBVHBuilder builder, size_t firstNode, const std::vector<SBVHPrimitive>& primitives, const std::vector<uint4>& primitiveTypeIndex)
+{
+    BuildBVH(primitives, s_sceneBVH, builder);
+    s_sceneBVHBuiltCost = BVHSAHCost(s_sceneBVH);
 
-    // transform the vertices
-    for (size_t i = startingTriangleIndex; i < triangleIndex; ++i)
+    // leave the scene root and primitive count alone if the tree doesn't fit
+    if (firstNode + s_sceneBVH.m_nodes.size() > ShaderData::StructuredBuffers::BVHNodes.Read().size() ||
+        primitives.size() > ShaderData::StructuredBuffers::ScenePrimitives.Read().size())
     {
-        // scale the vertices
-        for (size_t j = 0; j < 3; ++j)
+        printf("[BVH ERROR] ran out of room for the scene BVH!\n");
+        return false;
+    }
+
+    size_t bvhNodeIndex = firstNode;
+    bool ret =
+        ShaderData::StructuredBuffers::ModelTriangles.FlushWrites(context) &&
+        ShaderData::StructuredBuffers::Models.FlushWrites(context);
+    ret &= ShaderData::StructuredBuffers::BVHNodes.Write(
+        context,
+        [&] (ShaderTypes::StructuredBuffers::TBVHNodes& nodes)
         {
-            triangles[i].positionA_w[j] *= scale[j];
-            triangles[i].positionB_w[j] *= scale[j];
-            triangles[i].positionC_w[j] *= scale[j];
+            WriteBVHNodes(s_sceneBVH, nodes, bvhNodeIndex, 0);
         }
+    );
 
-        // rotate the vertices
-        float3 a = ChangeBasis(XYZ(triangles[i].positionA_w), xAxis, yAxis, zAxis);
-        float3 b = ChangeBasis(XYZ(triangles[i].positionB_w), xAxis, yAxis, zAxis);
-        float3 c = ChangeBasis(XYZ(triangles[i].positionC_w), xAxis, yAxis, zAxis);
-        for (size_t j = 0; j < 3; ++j)
+    ret &= ShaderData::StructuredBuffers::ScenePrimitives.Write(
+        context,
+        [&] (ShaderTypes::StructuredBuffers::TScenePrimitives& scenePrimitives)
         {
-            triangles[i].positionA_w[j] = a[j];
-            triangles[i].positionB_w[j] = b[j];
-            triangles[i].positionC_w[j] = c[j];
+            for (size_t i = 0; i < primitives.size(); ++i)
+                scenePrimitives[i].type_index_zw = primitiveTypeIndex[s_sceneBVH.m_primOrder[i]];
         }
+    );
 
-        // translate the vertices
-        for (size_t j = 0; j < 3; ++j)
+    ret &= ShaderData::ConstantBuffers::ConstantsOnce.Write(
+        context,
+        [&] (ShaderTypes::ConstantBuffers::ConstantsOnce& data)
         {
-            triangles[i].positionA_w[j] += position[j];
-            triangles[i].positionB_w[j] += position[j];
-            triangles[i].positionC_w[j] += position[j];
+            data.numModels_sceneRootNode_numScenePrims_numLights[1] = (unsigned int)firstNode;
+            data.numModels_sceneRootNode_numScenePrims_numLights[2] = (unsigned int)primitives.size();
         }
+    );
 
-        // recalculate the normal
-        float3 norm = Normal(XYZ(triangles[i].positionA_w), XYZ(triangles[i].positionB_w), XYZ(triangles[i].positionC_w));
-        triangles[i].normal_w[0] = norm[0];
-        triangles[i].normal_w[1] = norm[1];
-        triangles[i].normal_w[2] = norm[2];
-    }
+    return ret;
+}
+
+bool BuildSceneBVHs (ID3D11DeviceContext* context, EBVHBuilder builder)
+{
+    const ShaderTypes::ConstantBuffers::ConstantsOnce& constants = ShaderData::ConstantBuffers::ConstantsOnce.Read();
+    unsigned int numModels = constants.numModels_sceneRootNode_numScenePrims_numLights[0];
+
+    // build a BVH for each mesh, shared by all the models that use it. This re-orders the mesh triangles to match the BVH leaves.
+    size_t bvhNodeIndex = 0;
+    bool success = true;
+    ShaderData::StructuredBuffers::Models.WriteNoFlush(
+        [&] (ShaderTypes::StructuredBuffers::TModels& models)
+        {
+            for (size_t i = 0; i < numModels && success; ++i)
+            {
+                uint4& info = models[i].firstTriangle_lastTriangle_rootNode_firstLight;
+                size_t sameMesh = 0;
+                while (sameMesh < i && models[sameMesh].firstTriangle_lastTriangle_rootNode_firstLight[0] != info[0])
+                    ++sameMesh;
+                if (sameMesh < i)
+                {
+                    info[2] = models[sameMesh].firstTriangle_lastTriangle_rootNode_firstLight[2];
+                    continue;
+                }
 
-    // return the radius of the mesh: the distance to the farthest point, from position.
-    float radiusSq = 0.0f;
-    for (size_t i = startingTriangleIndex; i < triangleIndex; ++i)
+                info[2] = (unsigned int)bvhNodeIndex;
+                ShaderData::StructuredBuffers::ModelTriangles.WriteNoFlush(
+                    [&] (ShaderTypes::StructuredBuffers::TModelTriangles& triangles)
+                    {
+                        ShaderData::StructuredBuffers::BVHNodes.WriteNoFlush(
+                            [&] (ShaderTypes::StructuredBuffers::TBVHNodes& nodes)
+                            {
+                                success = BuildModelBVH(triangles, info[0], info[1], nodes, bvhNodeIndex, builder);
+                            }
+                        );
+                    }
+                );
+            }
+        }
+    );
+
+    if (!success)
     {
-        float lengthSq = LengthSq(XYZ(triangles[i].positionA_w) - position);
-        radiusSq = max(radiusSq, lengthSq);
+        printf("[BVH ERROR] ran out of BVH nodes for the models!\n");
+        return false;
+    }
+
+    std::vector<SBVHPrimitive> primitives;
+    std::vector<uint4> primitiveTypeIndex;
+    MakeScenePrimitives(primitives, primitiveTypeIndex);
+    return BuildTopLevelBVH(context, builder, bvhNodeIndex, primitives, primitiveTypeIndex);
+}
 
-        lengthSq = LengthSq(XYZ(triangles[i].positionB_w) - position);
-        radiusSq = max(radiusSq, lengthSq);
+bool RefitSceneBVH (ID3D11DeviceContext* context, EBVHBuilder builder, bool& rebuilt, float& costRatio)
+{
+    std::vector<SBVHPrimitive> primitives;
+    std::vector<uint4> primitiveTypeIndex;
+    MakeScenePrimitives(primitives, primitiveTypeIndex);
+
+    // refit unless primitives were added or removed, then rebuild if the tree got too much worse
+    const ShaderTypes::ConstantBuffers::ConstantsOnce& constants = ShaderData::ConstantBuffers::ConstantsOnce.Read();
+    size_t rootNode = constants.numModels_sceneRootNode_numScenePrims_numLights[1];
+    rebuilt = primitives.size() != constants.numModels_sceneRootNode_numScenePrims_numLights[2] || primitives.size() != s_sceneBVH.m_primOrder.size();
+    if (!rebuilt)
+    {
+        RefitBVH(primitives, s_sceneBVH);
+        costRatio = s_sceneBVHBuiltCost > 0.0f ? BVHSAHCost(s_sceneBVH) / s_sceneBVHBuiltCost : 1.0f;
+        rebuilt = costRatio > c_bvhRefitRebuildRatio;
+    }
 
-        lengthSq = LengthSq(XYZ(triangles[i].positionC_w) - position);
-        radiusSq = max(radiusSq, lengthSq);
+    if (rebuilt)
+    {
+        costRatio = 1.0f;
+        return BuildTopLevelBVH(context, builder, rootNode, primitives, primitiveTypeIndex);
     }
 
-    return std::sqrt(radiusSq);
+    bool ret = ShaderData::StructuredBuffers::Models.FlushWrites(context);
+    ret &= ShaderData::StructuredBuffers::BVHNodes.Write(
+        context,
+        [&] (ShaderTypes::StructuredBuffers::TBVHNodes& nodes)
+        {
+            WriteBVHNodes(s_sceneBVH, nodes, rootNode, 0);
+        }
+    );
+    return ret;
 }
 
-void AddMeshToScene (const char* fileName, size_t& modelIndex, size_t& modelTriangleIndex, float3 position, float3 scale, float3 rotationAxis, float rotationAngle)
+// Makes the Lights buffer from the emissive spheres, triangles, quads and model triangles, gives each of them its index
+// in it, and builds the alias table and light tree for picking them. A light's power is its luminance times the area
+// its points are sampled from: its whole area for triangles and quads, and for spheres the hemisphere facing the point
+// being lit. Picking lights proportionally to that makes the probability density of a light sample independent of a
+// light's area, and low for dim lights.
+// Model triangles are in world space here, so this has to be called again when models move, and after the mesh BVHs are
+// built, since building them reorders the triangles.
+static bool FillLightList (ID3D11DeviceContext* context)
 {
-    size_t firstTriangle = modelTriangleIndex;
+    const ShaderTypes::ConstantBuffers::ConstantsOnce& constants = ShaderData::ConstantBuffers::ConstantsOnce.Read();
+    uint4 counts = constants.numSpheres_numTris_numOBBs_numQuads;
+    unsigned int numModels = constants.numModels_sceneRootNode_numScenePrims_numLights[0];
+
+    std::vector<ShaderTypes::StructuredBuffers::LightPrim> lights;
+    std::vector<SLightEmitter> emitters;
+    std::vector<float> powers;
+    auto AddLight = [&] (EScenePrimitive type, size_t index, size_t model, const float3& emissive, float area, const float3& boundsMin, const float3& boundsMax, const float3& normal, float cosTheta)
+    {
+        float power = Dot(emissive, { 0.299f, 0.587f, 0.114f }) * area;
+        lights.emplace_back();
+        lights.back().type_index_model_w = { (unsigned int)type, (unsigned int)index, (unsigned int)model, 0 };
+        lights.back().selectionPDF_area_aliasThreshold_w = { power, area, 1.0f, 0.0f };
+        emitters.push_back({ boundsMin, boundsMax, normal, cosTheta, power });
+        powers.push_back(power);
+    };
+    auto IsEmissive = [] (const float4& emissive_lightIndex)
+    {
+        return Dot(XYZ(emissive_lightIndex), { 0.299f, 0.587f, 0.114f }) > 0.0f;
+    };
 
-    float meshRadius = 0.0f;
-    ShaderData::StructuredBuffers::ModelTriangles.WriteNoFlush(
+    bool ret = ShaderData::StructuredBuffers::Spheres.Write(
+        context,
+        [&] (ShaderTypes::StructuredBuffers::TSpheres& spheres)
+        {
+            for (size_t i = 0; i < counts[0]; ++i)
+            {
+                ShaderTypes::StructuredBuffers::SpherePrim& sphere = spheres[i];
+                sphere.emissive_lightIndex[3] = IsEmissive(sphere.emissive_lightIndex) ? float(lights.size()) : -1.0f;
+                if (sphere.emissive_lightIndex[3] < 0.0f)
+                    continue;
+
+                float3 center = XYZ(sphere.position_Radius);
+                float radius = sphere.position_Radius[3];
+                float3 extent = { radius, radius, radius };
+                AddLight(EScenePrimitive::Sphere, i, 0, XYZ(sphere.emissive_lightIndex), 2.0f * c_pi * radius * radius, center - extent, center + extent, { 0.0f, 0.0f, 1.0f }, -1.0f);
+            }
+        }
+    );
+
+    ret &= ShaderData::StructuredBuffers::Triangles.Write(
+        context,
+        [&] (ShaderTypes::StructuredBuffers::TTriangles& triangles)
+        {
+            for (size_t i = 0; i < counts[1]; ++i)
+            {
+                ShaderTypes::StructuredBuffers::TrianglePrim& triangle = triangles[i];
+                triangle.emissive_lightIndex[3] = IsEmissive(triangle.emissive_lightIndex) ? float(lights.size()) : -1.0f;
+                if (triangle.emissive_lightIndex[3] < 0.0f)
+                    continue;
+
+                float3 a = XYZ(triangle.positionA_w);
+                float3 b = XYZ(triangle.positionB_w);
+                float3 c = XYZ(triangle.positionC_w);
+                float3 boundsMin = a, boundsMax = a;
+                GrowBounds(boundsMin, boundsMax, b, b);
+                GrowBounds(boundsMin, boundsMax, c, c);
+                AddLight(EScenePrimitive::Triangle, i, 0, XYZ(triangle.emissive_lightIndex), 0.5f * Length(Cross(b - a, c - a)), boundsMin, boundsMax, XYZ(triangle.normal_w), 1.0f);
+            }
+        }
+    );
+
+    ret &= ShaderData::StructuredBuffers::Quads.Write(
+        context,
+        [&] (ShaderTypes::StructuredBuffers::TQuads& quads)
+        {
+            // sampled as the triangles abc and acd, the same split the ray test uses
+            for (size_t i = 0; i < counts[3]; ++i)
+            {
+                ShaderTypes::StructuredBuffers::QuadPrim& quad = quads[i];
+                quad.emissive_lightIndex[3] = IsEmissive(quad.emissive_lightIndex) ? float(lights.size()) : -1.0f;
+                if (quad.emissive_lightIndex[3] < 0.0f)
+                    continue;
+
+                float3 a = XYZ(quad.positionA_w);
+                float3 c = XYZ(quad.positionC_w);
+                float3 boundsMin = a, boundsMax = a;
+                GrowBounds(boundsMin, boundsMax, XYZ(quad.positionB_w), XYZ(quad.positionB_w));
+                GrowBounds(boundsMin, boundsMax, c, c);
+                GrowBounds(boundsMin, boundsMax, XYZ(quad.positionD_w), XYZ(quad.positionD_w));
+                float area = 0.5f * (Length(Cross(XYZ(quad.positionB_w) - a, c - a)) + Length(Cross(c - a, XYZ(quad.positionD_w) - a)));
+                AddLight(EScenePrimitive::Quad, i, 0, XYZ(quad.emissive_lightIndex), area, boundsMin, boundsMax, XYZ(quad.normal_w), 1.0f);
+            }
+        }
+    );
+
+    // Number the emissive triangles of each mesh, then give each model a light per emissive triangle of its mesh, in
+    // that order, so a hit's light is the model's first light plus the triangle's number.
+    ret &= ShaderData::StructuredBuffers::ModelTriangles.Write(
+        context,
         [&] (ShaderTypes::StructuredBuffers::TModelTriangles& triangles)
         {
-            meshRadius = AddMeshToTriangleSoup(fileName, "./Art/Models/", triangles, modelTriangleIndex, position, scale, rotationAxis, rotationAngle);
+            const ShaderTypes::StructuredBuffers::TModels& models = ShaderData::StructuredBuffers::Models.Read();
+            for (size_t modelIndex = 0; modelIndex < numModels; ++modelIndex)
+            {
+                const uint4& info = models[modelIndex].firstTriangle_lastTriangle_rootNode_firstLight;
+                float meshEmitters = 0.0f;
+                for (size_t i = info[0]; i < info[1]; ++i)
+                {
+                    float4& emissive_lightIndex = triangles[i].emissive_lightIndex;
+                    emissive_lightIndex[3] = IsEmissive(emissive_lightIndex) ? meshEmitters : -1.0f;
+                    meshEmitters += emissive_lightIndex[3] >= 0.0f ? 1.0f : 0.0f;
+                }
+            }
         }
     );
 
-    ShaderData::StructuredBuffers::Models.WriteNoFlush(
+    ret &= ShaderData::StructuredBuffers::Models.Write(
+        context,
         [&] (ShaderTypes::StructuredBuffers::TModels& models)
         {
-            models[modelIndex].position_Radius = { position[0], position[1], position[2], meshRadius};
-            models[modelIndex].firstTriangle_lastTriangle_zw = { (unsigned int)firstTriangle, (unsigned int)modelTriangleIndex, 0, 0 };
+            const ShaderTypes::StructuredBuffers::TModelTriangles& triangles = ShaderData::StructuredBuffers::ModelTriangles.Read();
+            for (size_t modelIndex = 0; modelIndex < numModels; ++modelIndex)
+            {
+                ShaderTypes::StructuredBuffers::ModelPrim& model = models[modelIndex];
+                uint4& info = model.firstTriangle_lastTriangle_rootNode_firstLight;
+                info[3] = (unsigned int)lights.size();
+                for (size_t i = info[0]; i < info[1]; ++i)
+                {
+                    const ShaderTypes::StructuredBuffers::ModelTrianglePrim& triangle = triangles[i];
+                    if (triangle.emissive_lightIndex[3] < 0.0f)
+                        continue;
+
+                    float3 a = TransformPoint(model.objectToWorldX, model.objectToWorldY, model.objectToWorldZ, XYZ(triangle.positionA_w));
+                    float3 b = TransformPoint(model.objectToWorldX, model.objectToWorldY, model.objectToWorldZ, XYZ(triangle.positionB_w));
+                    float3 c = TransformPoint(model.objectToWorldX, model.objectToWorldY, model.objectToWorldZ, XYZ(triangle.positionC_w));
+                    float3 normal = Cross(b - a, c - a);
+                    float area = 0.5f * Length(normal);
+                    if (area > 0.0f)
+                        Normalize(normal);
+                    float3 boundsMin = a, boundsMax = a;
+                    GrowBounds(boundsMin, boundsMax, b, b);
+                    GrowBounds(boundsMin, boundsMax, c, c);
+                    AddLight(EScenePrimitive::Model, i, modelIndex, XYZ(triangle.emissive_lightIndex), area, boundsMin, boundsMax, normal, 1.0f);
+                }
+            }
+        }
+    );
+
+    if (lights.size() > ShaderData::StructuredBuffers::Lights.Read().size())
+    {
+        printf("[LIGHT ERROR] ran out of lights!\n");
+        return false;
+    }
+
+    // normalize the powers into the selection pdf, and make the alias table and light tree
+    std::vector<float> aliasThresholds;
+    std::vector<uint32_t> aliases;
+    BuildLightAliasTable(powers, aliasThresholds, aliases);
+    SLightTree tree;
+    BuildLightTree(emitters, tree);
+
+    float totalPower = 0.0f;
+    for (float power : powers)
+        totalPower += power;
+    for (size_t i = 0; i < lights.size(); ++i)
+    {
+        float4& selectionPDF_area_aliasThreshold_w = lights[i].selectionPDF_area_aliasThreshold_w;
+        selectionPDF_area_aliasThreshold_w[0] /= totalPower;
+        selectionPDF_area_aliasThreshold_w[2] = aliasThresholds[i];
+        lights[i].alias_treeLeaf_zw = { aliases[i], tree.m_lightLeaves[i], 0, 0 };
+    }
+
+    ret &= ShaderData::StructuredBuffers::Lights.Write(
+        context,
+        [&] (ShaderTypes::StructuredBuffers::TLights& lightBuffer)
+        {
+            std::copy(lights.begin(), lights.end(), lightBuffer.begin());
+        }
+    );
+
+    ret &= ShaderData::StructuredBuffers::LightTreeNodes.Write(
+        context,
+        [&] (ShaderTypes::StructuredBuffers::TLightTreeNodes& nodes)
+        {
+            for (size_t i = 0; i < tree.m_nodes.size(); ++i)
+            {
+                const SLightTreeNode& node = tree.m_nodes[i];
+                const SLightEmitter& bounds = node.m_bounds;
+                nodes[i].boundsMin_power = { bounds.m_min[0], bounds.m_min[1], bounds.m_min[2], bounds.m_power };
+                nodes[i].boundsMax_cosTheta = { bounds.m_max[0], bounds.m_max[1], bounds.m_max[2], bounds.m_cosTheta };
+                nodes[i].axis_w = { bounds.m_axis[0], bounds.m_axis[1], bounds.m_axis[2], 0.0f };
+                nodes[i].rightChild_light_parent_w = { node.m_rightChild, node.m_light, node.m_parent, 0 };
+            }
         }
     );
 
-    ++modelIndex;
+    ret &= ShaderData::ConstantBuffers::ConstantsOnce.Write(
+        context,
+        [&] (ShaderTypes::ConstantBuffers::ConstantsOnce& data)
+        {
+            data.numModels_sceneRootNode_numScenePrims_numLights[3] = (unsigned int)lights.size();
+        }
+    );
+
+    return ret;
 }
 
-bool FinalizeSceneMeshes (ID3D11DeviceContext* context)
+// Writes the environment map and its CDFs for importance sampling it, or goes back to the flat miss color if there
+// are no texels.
+static bool FillEnvironment (ID3D11DeviceContext* context, const std::vector<float3>& texels)
 {
-    return
-        ShaderData::StructuredBuffers::ModelTriangles.FlushWrites(context) &&
-        ShaderData::StructuredBuffers::Models.FlushWrites(context);
+    bool ret = true;
+    if (!texels.empty())
+    {
+        std::vector<float> conditionalCDF, marginalCDF;
+        BuildEnvironmentCDFs(texels, conditionalCDF, marginalCDF);
+
+        ret &= ShaderData::StructuredBuffers::EnvironmentTexels.Write(
+            context,
+            [&] (ShaderTypes::StructuredBuffers::TEnvironmentTexels& environmentTexels)
+            {
+                for (size_t i = 0; i < texels.size(); ++i)
+                    environmentTexels[i].radiance_conditionalCDF = { texels[i][0], texels[i][1], texels[i][2], conditionalCDF[i] };
+            }
+        );
+
+        ret &= ShaderData::StructuredBuffers::EnvironmentRows.Write(
+            context,
+            [&] (ShaderTypes::StructuredBuffers::TEnvironmentRows& environmentRows)
+            {
+                for (size_t i = 0; i < marginalCDF.size(); ++i)
+                    environmentRows[i].marginalCDF_yzw = { marginalCDF[i], 0.0f, 0.0f, 0.0f };
+            }
+        );
+    }
+
+    ret &= ShaderData::ConstantBuffers::ConstantsOnce.Write(
+        context,
+        [&] (ShaderTypes::ConstantBuffers::ConstantsOnce& data)
+        {
+            if (texels.empty())
+                data.environmentWidth_environmentHeight_zw = { 0, 0, 0, 0 };
+            else
+                data.environmentWidth_environmentHeight_zw = { c_environmentWidth, c_environmentHeight, 0, 0 };
+        }
+    );
+
+    return ret;
+}
+
+bool SetSceneEnvironment (const char* fileName, ID3D11DeviceContext* context)
+{
+    std::vector<float3> texels;
+    if (!LoadEnvironmentHDR(fileName, texels))
+        return false;
+    return FillEnvironment(context, texels);
 }
 
 bool FillSceneData (EScene scene, ID3D11DeviceContext* context)
@@ -223,6 +659,8 @@ bool FillSceneData (EScene scene, ID3D11DeviceContext* context)
         }
     );
 
+    SSceneModels sceneModels;
+    std::vector<float3> environment;
     switch (scene)
     {
         case EScene::SphereOnPlane_LowLight:
@@ -242,7 +680,7 @@ bool FillSceneData (EScene scene, ID3D11DeviceContext* context)
                     scene.nearPlaneDist_missColor = { 0.1f, 0.0f, 0.0f, 0.0f };
 
                     scene.numSpheres_numTris_numOBBs_numQuads = { 2, 0, 0, 2 };
-                    scene.numModels_yzw = { 0, 0, 0, 0 };
+                    scene.numModels_sceneRootNode_numScenePrims_numLights = { 0, 0, 0, 0 };
                 }
             );
 
@@ -282,7 +720,7 @@ bool FillSceneData (EScene scene, ID3D11DeviceContext* context)
                     scene.nearPlaneDist_missColor = { 0.1f, 0.1f, 0.4f, 1.0f };
 
                     scene.numSpheres_numTris_numOBBs_numQuads = { 2, 0, 0, 2 };
-                    scene.numModels_yzw = { 0, 0, 0, 0 };
+                    scene.numModels_sceneRootNode_numScenePrims_numLights = { 0, 0, 0, 0 };
                 }
             );
 
@@ -323,7 +761,7 @@ bool FillSceneData (EScene scene, ID3D11DeviceContext* context)
                     scene.nearPlaneDist_missColor = { 0.1f, 0.0f, 0.0f, 0.0f };
 
                     scene.numSpheres_numTris_numOBBs_numQuads = { 0, 0, 2, 6 };
-                    scene.numModels_yzw = { 0, 0, 0, 0 };
+                    scene.numModels_sceneRootNode_numScenePrims_numLights = { 0, 0, 0, 0 };
                 }
             );
 
@@ -380,7 +818,7 @@ bool FillSceneData (EScene scene, ID3D11DeviceContext* context)
                     scene.nearPlaneDist_missColor = { 0.1f, 0.0f, 0.0f, 0.0f };
 
                     scene.numSpheres_numTris_numOBBs_numQuads = { 0, 0, 2, 5 };
-                    scene.numModels_yzw = { 0, 0, 0, 0 };
+                    scene.numModels_sceneRootNode_numScenePrims_numLights = { 0, 0, 0, 0 };
                 }
             );
 
@@ -433,7 +871,7 @@ bool FillSceneData (EScene scene, ID3D11DeviceContext* context)
                     scene.nearPlaneDist_missColor = { 0.1f, 0.5f, 0.5f, 0.5f };
 
                     scene.numSpheres_numTris_numOBBs_numQuads = { 1, 0, 0, 0 };
-                    scene.numModels_yzw = { 0, 0, 0, 0 };
+                    scene.numModels_sceneRootNode_numScenePrims_numLights = { 0, 0, 0, 0 };
                 }
             );
 
@@ -472,7 +910,7 @@ bool FillSceneData (EScene scene, ID3D11DeviceContext* context)
                     scene.nearPlaneDist_missColor = { 0.1f, 0.0f, 0.0f, 0.0f };
 
                     scene.numSpheres_numTris_numOBBs_numQuads = { 0, (unsigned int)triangleIndex, 0, 0 };
-                    scene.numModels_yzw = { 0, 0, 0, 0 };
+                    scene.numModels_sceneRootNode_numScenePrims_numLights = { 0, 0, 0, 0 };
                 }
             );
 
@@ -481,8 +919,6 @@ bool FillSceneData (EScene scene, ID3D11DeviceContext* context)
         case EScene::ObjTest:
         {
             size_t triangleIndex = 0;
-            size_t modelTriangleIndex = 0;
-            size_t modelIndex = 0;
 
             ret &= ShaderData::StructuredBuffers::Triangles.Write(
                 context,
@@ -492,12 +928,65 @@ bool FillSceneData (EScene scene, ID3D11DeviceContext* context)
                 }
             );
 
-            AddMeshToScene("Art/Models/jet0-0.obj", modelIndex, modelTriangleIndex, { -2.0f, -1.0f, 2.0f }, { 1.0f, 1.0f, 1.0f }, { 0.0f, 1.0f, 1.0f }, DegreesToRadians(0.0f));
-            AddMeshToScene("Art/Models/jet0-0.obj", modelIndex, modelTriangleIndex, { -1.0f, -0.8f, 2.0f }, { 1.0f, 1.0f, 1.0f }, { 0.0f, 1.0f, 1.0f }, DegreesToRadians(20.0f));
-            AddMeshToScene("Art/Models/jet0-0.obj", modelIndex, modelTriangleIndex, {  0.0f, -0.6f, 2.0f }, { 1.0f, 1.0f, 1.0f }, { 0.0f, 1.0f, 1.0f }, DegreesToRadians(40.0f));
-            AddMeshToScene("Art/Models/jet0-0.obj", modelIndex, modelTriangleIndex, {  1.0f, -0.4f, 2.0f }, { 1.0f, 1.0f, 1.0f }, { 0.0f, 1.0f, 1.0f }, DegreesToRadians(60.0f));
-            AddMeshToScene("Art/Models/jet0-0.obj", modelIndex, modelTriangleIndex, {  2.0f, -0.2f, 2.0f }, { 1.0f, 1.0f, 1.0f }, { 0.0f, 1.0f, 1.0f }, DegreesToRadians(80.0f));
-            ret &= FinalizeSceneMeshes(context);
+            for (const SSceneModelPlacement& jet : c_objTestJets)
+                AddMeshToScene(jet.m_fileName, sceneModels, jet.m_position, jet.m_scale, jet.m_rotationAxis, DegreesToRadians(jet.m_rotationAngle));
+
+            ret &= ShaderData::ConstantBuffers::ConstantsOnce.Write(
+                context,
+                [&](ShaderTypes::ConstantBuffers::ConstantsOnce& scene)
+                {
+                    scene.cameraPos_FOVX[0] = 0.0f;
+                    scene.cameraPos_FOVX[1] = 0.0f;
+                    scene.cameraPos_FOVX[2] = -3.0f;
+
+                    scene.cameraAt_FOVY[0] = 0.0f;
+                    scene.cameraAt_FOVY[1] = 0.0f;
+                    scene.cameraAt_FOVY[2] = 0.0f;
+
+                    scene.nearPlaneDist_missColor = { 0.1f, 0.0f, 0.0f, 0.0f };
+
+                    scene.numSpheres_numTris_numOBBs_numQuads = { 0, (unsigned int)triangleIndex, 0, 0 };
+                    scene.numModels_sceneRootNode_numScenePrims_numLights = { (unsigned int)sceneModels.m_modelIndex, 0, 0, 0 };
+                }
+            );
+
+            break;
+        }
+        case EScene::GlowingJets:
+        {
+            // the cornell box with its ceiling light turned off
+            size_t triangleIndex = 0;
+            ret &= ShaderData::StructuredBuffers::Triangles.Write(
+                context,
+                [&] (ShaderTypes::StructuredBuffers::TTriangles& triangles)
+                {
+                    AddMeshToTriangleSoup("Art/Models/cornell_box.obj", "./Art/Models/", triangles, triangleIndex, { -2.5f, -2.5f, 1.0f }, { 10.0f, 10.0f, 10.0f }, { 0.0f, 1.0f, 0.0f }, 0.0f);
+                    for (size_t i = 0; i < triangleIndex; ++i)
+                        triangles[i].emissive_lightIndex = { 0.0f, 0.0f, 0.0f, -1.0f };
+                }
+            );
+
+            for (const SSceneModelPlacement& jet : c_glowingJets)
+                AddMeshToScene(jet.m_fileName, sceneModels, jet.m_position, jet.m_scale, jet.m_rotationAxis, DegreesToRadians(jet.m_rotationAngle));
+
+            // give each triangle of the jet mesh its own color
+            ret &= ShaderData::StructuredBuffers::ModelTriangles.Write(
+                context,
+                [&] (ShaderTypes::StructuredBuffers::TModelTriangles& triangles)
+                {
+                    for (size_t i = 0; i < sceneModels.m_modelTriangleIndex; ++i)
+                    {
+                        float hue = float(i) * 0.7f;
+                        triangles[i].emissive_lightIndex =
+                        {
+                            (0.5f + 0.5f * std::cos(hue)) * c_glowingJetBrightness,
+                            (0.5f + 0.5f * std::cos(hue + 2.1f)) * c_glowingJetBrightness,
+                            (0.5f + 0.5f * std::cos(hue + 4.2f)) * c_glowingJetBrightness,
+                            -1.0f
+                        };
+                    }
+                }
+            );
 
             ret &= ShaderData::ConstantBuffers::ConstantsOnce.Write(
                 context,
@@ -514,7 +1003,7 @@ bool FillSceneData (EScene scene, ID3D11DeviceContext* context)
                     scene.nearPlaneDist_missColor = { 0.1f, 0.0f, 0.0f, 0.0f };
 
                     scene.numSpheres_numTris_numOBBs_numQuads = { 0, (unsigned int)triangleIndex, 0, 0 };
-                    scene.numModels_yzw = { (unsigned int)modelIndex, 0, 0, 0 };
+                    scene.numModels_sceneRootNode_numScenePrims_numLights = { (unsigned int)sceneModels.m_modelIndex, 0, 0, 0 };
                 }
             );
 
@@ -537,7 +1026,7 @@ bool FillSceneData (EScene scene, ID3D11DeviceContext* context)
                     scene.nearPlaneDist_missColor = { 0.1f, 0.01f, 0.01f, 0.01f };
 
                     scene.numSpheres_numTris_numOBBs_numQuads = { 9, 0, 3, 2 };
-                    scene.numModels_yzw = { 0, 0, 0, 0 };
+                    scene.numModels_sceneRootNode_numScenePrims_numLights = { 0, 0, 0, 0 };
                 }
             );
 
@@ -579,11 +1068,96 @@ bool FillSceneData (EScene scene, ID3D11DeviceContext* context)
             );
             break;
         }
+        case EScene::SunSky:
+        {
+            // the spheres and boxes of EScene::Spheres, outside and lit only by the sky
+            MakeSkyEnvironment(c_sunSkySunDirection, c_sunSkySunColor, c_sunSkySkyColor, c_sunSkyGroundColor, environment);
+
+            ret &= ShaderData::ConstantBuffers::ConstantsOnce.Write(
+                context,
+                [](ShaderTypes::ConstantBuffers::ConstantsOnce& scene)
+                {
+                    scene.cameraPos_FOVX[0] = 0.0f;
+                    scene.cameraPos_FOVX[1] = 0.0f;
+                    scene.cameraPos_FOVX[2] = -10.0f;
+
+                    scene.cameraAt_FOVY[0] = 0.0f;
+                    scene.cameraAt_FOVY[1] = 0.0f;
+                    scene.cameraAt_FOVY[2] = 0.0f;
+
+                    scene.nearPlaneDist_missColor = { 0.1f, 0.0f, 0.0f, 0.0f };
+
+                    scene.numSpheres_numTris_numOBBs_numQuads = { 3, 0, 3, 2 };
+                    scene.numModels_sceneRootNode_numScenePrims_numLights = { 0, 0, 0, 0 };
+                }
+            );
+
+            ret &= ShaderData::StructuredBuffers::Spheres.Write(
+                context,
+                [] (ShaderTypes::StructuredBuffers::TSpheres& spheres)
+                {
+                    MakeSphere(spheres[0], { 0.0f, 0.0f, 4.0f }, 2.0f, { 1.0f, 0.1f, 0.1f }, { 0.0f, 0.0f, 0.0f });
+                    MakeSphere(spheres[1], { 3.0f, -1.0f, 5.0f }, 1.0f, { 0.1f, 1.0f, 0.1f }, { 0.0f, 0.0f, 0.0f });
+                    MakeSphere(spheres[2], { 5.5f, -1.0f, 4.0f }, 1.0f, { 0.1f, 0.1f, 1.0f }, { 0.0f, 0.0f, 0.0f });
+                }
+            );
+
+            ret &= ShaderData::StructuredBuffers::OBBs.Write(
+                context,
+                [] (ShaderTypes::StructuredBuffers::TOBBs& quads)
+                {
+                    MakeOBB(quads[0], { 0.0f, -1.0f, -2.0f }, { 1.0f, 1.0f, 1.0f }, { 1.0f, 1.0f, 1.0f }, DegreesToRadians(45.0f), { 0.1f, 1.0f, 1.0f }, { 0.0f, 0.0f, 0.0f });
+                    MakeOBB(quads[1], { 3.0f, -1.0f, -3.0f }, { 1.0f, 1.0f, 1.0f }, { 1.0f, 1.0f, 1.0f }, DegreesToRadians(80.0f), { 1.0f, 0.1f, 1.0f }, { 0.0f, 0.0f, 0.0f });
+                    MakeOBB(quads[2], { 5.5f, -1.0f, -2.0f }, { 1.0f, 1.0f, 1.0f }, { 1.0f, 1.0f, 1.0f }, DegreesToRadians(22.0f), { 1.0f, 1.0f, 0.1f }, { 0.0f, 0.0f, 0.0f });
+                }
+            );
+
+            ret &= ShaderData::StructuredBuffers::Quads.Write(
+                context,
+                [] (ShaderTypes::StructuredBuffers::TQuads& Quads)
+                {
+                    MakeQuad(Quads[0], { -4.0f, -3.0f, -4.0f }, { -4.0f, 2.0f, -4.0f }, { -4.0f, 2.0f, 12.0f }, { -4.0f, -3.0f, 12.0f }, { 0.8f, 0.9f, 0.8f }, { 0.0f, 0.0f, 0.0f });
+                    MakeQuad(Quads[1], { -15.0f, -2.0f, 15.0f }, { 15.0f, -2.0f, 15.0f }, { 15.0f, -2.0f, -15.0f }, { -15.0f, -2.0f, -15.0f }, { 0.9f, 0.8f, 0.8f }, { 0.0f, 0.0f, 0.0f });
+                }
+            );
+            break;
+        }
         default:
         {
             ret = false;
         }
     }
 
+    ret &= BuildSceneBVHs(context, c_bvhBuilder);
+    ret &= FillLightList(context);
+    ret &= FillEnvironment(context, environment);
+
+    return ret;
+}
+
+bool SceneIsAnimated (EScene scene)
+{
+    return scene == EScene::ObjTest;
+}
+
+bool AnimateScene (EScene scene, float timeSeconds, ID3D11DeviceContext* context, bool& rebuiltBVH, float& bvhCostRatio)
+{
+    rebuiltBVH = false;
+    bvhCostRatio = 1.0f;
+    if (!SceneIsAnimated(scene))
+        return true;
+
+    for (size_t i = 0; i < sizeof(c_objTestJets) / sizeof(c_objTestJets[0]); ++i)
+    {
+        const SSceneModelPlacement& jet = c_objTestJets[i];
+        float3 position = jet.m_position;
+        position[1] += c_objTestJetBobHeight * std::sin(timeSeconds * c_objTestJetBobSpeed + float(i));
+        float rotationAngle = jet.m_rotationAngle + timeSeconds * c_objTestJetSpinSpeed;
+        SetModelTransform(i, position, jet.m_scale, jet.m_rotationAxis, DegreesToRadians(rotationAngle));
+    }
+
+    // the lights on the models moved with them
+    bool ret = RefitSceneBVH(context, c_bvhBuilder, rebuiltBVH, bvhCostRatio);
+    ret &= FillLightList(context);
     return ret;
 }
\ No newline at end of file
@@ -1,6 +1,7 @@
 #pragma once
 
 struct ID3D11DeviceContext;
+enum class EBVHBuilder;
 
 enum class EScene
 {
@@ -12,7 +13,27 @@ enum class EScene
     CornellObj,
     ObjTest,
     Spheres,
+    GlowingJets,
+    SunSky,
     COUNT
 };
 
-bool FillSceneData (EScene scene, ID3D11DeviceContext* context);
\ No newline at end of file
+bool FillSceneData (EScene scene, ID3D11DeviceContext* context);
+
+// Lights the scene FillSceneData() made with the environment map in a Radiance .hdr file, instead of what it came with.
+bool SetSceneEnvironment (const char* fileName, ID3D11DeviceContext* context);
+
+// Builds the BVH of each mesh and the scene BVH over all the primitives and models, from what is in the scene buffers.
+// FillSceneData() calls this with c_bvhBuilder, it can be called again to rebuild after editing the scene.
+bool BuildSceneBVHs (ID3D11DeviceContext* context, EBVHBuilder builder);
+
+// Refits the scene BVH to where the primitives and models are now, without touching the mesh BVHs. Rebuilds it
+// instead if its SAH cost grows past c_bvhRefitRebuildRatio times the cost it had when built. costRatio is that ratio.
+bool RefitSceneBVH (ID3D11DeviceContext* context, EBVHBuilder builder, bool& rebuilt, float& costRatio);
+
+// true if AnimateScene() moves anything in the scene
+bool SceneIsAnimated (EScene scene);
+
+// Moves the models of an animated scene to where they are at timeSeconds, then refits the scene BVH.
+// Models are instances of their meshes, so only their transforms change.
+bool AnimateScene (EScene scene, float timeSeconds, ID3D11DeviceContext* context, bool& rebuiltBVH, float& bvhCostRatio);
\ No newline at end of file
@@ -13,4 +13,12 @@
 #define c_fovY (c_fovX * float(c_height) / float(c_width))
 
 #define c_mouseLookSpeed 2.0f
-#define c_walkSpeed 5.0f
\ No newline at end of file
+#define c_walkSpeed 5.0f
+
+#define c_maxBounces 3              // bounces after the first hit, until changed in the UI
+#define c_rouletteStartBounce 1     // the first bounce russian roulette can end a path on. More than c_maxBounces turns it off.
+
+#define c_bvhBuilder EBVHBuilder::SAH // which BVH builder FillSceneData() uses. See EBVHBuilder in BVH.h
+
+#define c_environmentWidth 256     // environment maps are resampled to this size, see Environment.h
+#define c_environmentHeight 128
\ No newline at end of file
@@ -1,18 +1,54 @@
 #pragma once
 
 #include <array>
+#include <cmath>
+#include <stdint.h>
+#include "Settings.h"
 #include "ConstantBuffer.h"
 #include "StructuredBuffer.h"
+
+#ifndef CPU_ONLY
 #include "Texture.h"
 #include "Shader.h"
+#else
+#include "TextureCPU.h"
+#endif
 
 typedef std::array<float, 2> float2;
 typedef std::array<float, 3> float3;
 typedef std::array<float, 4> float4;
 
+typedef std::array<unsigned int, 2> uint2;
+typedef std::array<unsigned int, 3> uint3;
 typedef std::array<unsigned int, 4> uint4;
 
+// how the pathTrace shader makes its random numbers, in ConstantsPerFrame::sampler_lightPicker_zw[0]. It's a constant
+// and not static branches, so it doesn't multiply the shader permutations. Must match c_sampler* in Shaders/PathTrace.h
+enum class ESampler : unsigned int
+{
+    WhiteNoise,
+    BlueNoise,                  // the first random number of each sample is blue noise plus the golden ratio times the sample index
+    SpatiotemporalBlueNoise,    // the same, but the blue noise changes each sample
+    Sobol,                      // Owen scrambled Sobol points
+    COUNT
+};
+
+// how the pathTrace shader picks a light for next event estimation, in ConstantsPerFrame::sampler_lightPicker_zw[1].
+// Must match c_lightPicker* in Shaders/PathTrace.h
+enum class ELightPicker : unsigned int
+{
+    None,           // no next event estimation, paths only find lights by bouncing into them
+    AliasTable,     // by power
+    LightTree,      // by importance to the shading point
+    COUNT
+};
+
+#ifndef CPU_ONLY
 bool ShaderTypesInit (void);
+#else
+// loads the texture images and makes the texture arrays and buffers. Textures are empty until this is called.
+bool ShaderTypesInitTexturesCPU (void);
+#endif
 
 namespace ShaderTypes
 {
@@ -34,7 +70,7 @@ namespace ShaderTypes
         #define STRUCTURED_BUFFER_END };
         #include "ShaderTypesList.h"
 
-        #define STRUCTURED_BUFFER_BEGIN(NAME, TYPENAME, COUNT, CPUWRITES) typedef std::array<ShaderTypes::StructuredBuffers::##TYPENAME, COUNT> T##NAME;
+        #define STRUCTURED_BUFFER_BEGIN(NAME, TYPENAME, COUNT, CPUWRITES) typedef std::array<ShaderTypes::StructuredBuffers::TYPENAME, COUNT> T##NAME;
         #include "ShaderTypesList.h"
     };
 
@@ -49,20 +85,31 @@ namespace ShaderTypes
 #pragma pack()
 };
 
+// CPU_ONLY builds only get the constant buffers, structured buffers and textures, which are defined in ShaderTypesCPU.cpp
 namespace ShaderData
 {
     namespace ConstantBuffers
     {
-        #define CONSTANT_BUFFER_BEGIN(NAME) extern CConstantBuffer<ShaderTypes::ConstantBuffers::##NAME> NAME;
+        #define CONSTANT_BUFFER_BEGIN(NAME) extern CConstantBuffer<ShaderTypes::ConstantBuffers::NAME> NAME;
         #include "ShaderTypesList.h"
     };
 
     namespace StructuredBuffers
     {
-        #define STRUCTURED_BUFFER_BEGIN(NAME, TYPENAME, COUNT, CPUWRITES) extern CStructuredBuffer<ShaderTypes::StructuredBuffers::##TYPENAME, COUNT> NAME;
+        #define STRUCTURED_BUFFER_BEGIN(NAME, TYPENAME, COUNT, CPUWRITES) extern CStructuredBuffer<ShaderTypes::StructuredBuffers::TYPENAME, COUNT> NAME;
         #include "ShaderTypesList.h"
     };
 
+#ifdef CPU_ONLY
+    namespace Textures
+    {
+        #define TEXTURE_IMAGE(NAME, FILENAME) extern CTextureCPU NAME;
+        #define TEXTURE_BUFFER(NAME, SHADERTYPE, FORMAT) extern CTextureCPU NAME;
+        #define TEXTURE_VOLUME_BEGIN(NAME) extern CTextureCPU NAME;
+        #define TEXTURE_ARRAY_BEGIN(NAME) extern CTextureCPU NAME;
+        #include "ShaderTypesList.h"
+    };
+#else
     namespace Textures
     {
         #define TEXTURE_IMAGE(NAME, FILENAME) extern CTexture NAME;
@@ -124,6 +171,7 @@ namespace ShaderData
     #define SHADER_VSPS_BEGIN(NAME, FILENAME, VSENTRY, PSENTRY, VERTEXFORMAT) \
         bool WriteStaticBranches_VSPS_##NAME (uint64_t permutation);
     #include "ShaderTypesList.h"
+#endif
 };
 
 inline float Dot (const float3& a, const float3& b)
@@ -176,8 +224,18 @@ std::array<float, N> operator* (const std::array<float, N>& A, float B)
     return result;
 }
 
+// component wise, like * on HLSL vectors
 template <size_t N>
-inline float LengthSq (std::array<float, N>& v)
+std::array<float, N> operator* (const std::array<float, N>& A, const std::array<float, N>& B)
+{
+    std::array<float, N> result;
+    for (size_t i = 0; i < N; ++i)
+        result[i] = A[i] * B[i];
+    return result;
+}
+
+template <size_t N>
+inline float LengthSq (const std::array<float, N>& v)
 {
     float lensq = 0.0f;
     for (float f : v)
@@ -186,9 +244,9 @@ inline float LengthSq (std::array<float, N>& v)
 }
 
 template <size_t N>
-inline float Length (std::array<float, N>& v)
+inline float Length (const std::array<float, N>& v)
 {
-    return std::sqrtf(LengthSq(v));
+    return std::sqrt(LengthSq(v));
 }
 
 template <size_t N>
@@ -220,6 +278,96 @@ inline float3 ChangeBasis (const std::array<float, 3>& v, const std::array<float
     };
 }
 
+// transforms a point / vector by a 3x4 affine transform given as rows
+inline float3 TransformPoint (const float4& X, const float4& Y, const float4& Z, const float3& p)
+{
+    return
+    {
+        X[0] * p[0] + X[1] * p[1] + X[2] * p[2] + X[3],
+        Y[0] * p[0] + Y[1] * p[1] + Y[2] * p[2] + Y[3],
+        Z[0] * p[0] + Z[1] * p[1] + Z[2] * p[2] + Z[3]
+    };
+}
+
+inline float3 TransformVector (const float4& X, const float4& Y, const float4& Z, const float3& v)
+{
+    return
+    {
+        X[0] * v[0] + X[1] * v[1] + X[2] * v[2],
+        Y[0] * v[0] + Y[1] * v[1] + Y[2] * v[2],
+        Z[0] * v[0] + Z[1] * v[1] + Z[2] * v[2]
+    };
+}
+
+// calculates the basis axes of a rotation of rotationAngle radians around rotationAxis.
+// ChangeBasis() with these axes applies the rotation.
+inline void RotationBasis (const float3& rotationAxis, float rotationAngle, float3& xAxis, float3& yAxis, float3& zAxis)
+{
+    float cosTheta = cos(rotationAngle);
+    float sinTheta = sin(rotationAngle);
+    xAxis =
+    {
+        cosTheta + rotationAxis[0] * rotationAxis[0] * (1.0f - cosTheta),
+        rotationAxis[0] * rotationAxis[1] * (1.0f - cosTheta) - rotationAxis[2] * sinTheta,
+        rotationAxis[0] * rotationAxis[2] * (1.0f - cosTheta) + rotationAxis[1] * sinTheta
+    };
+
+    yAxis =
+    {
+        rotationAxis[1] * rotationAxis[0] * (1.0f - cosTheta) + rotationAxis[2] * sinTheta,
+        cosTheta + rotationAxis[1] * rotationAxis[1] * (1.0f - cosTheta),
+        rotationAxis[1] * rotationAxis[2] * (1.0f - cosTheta) - rotationAxis[0] * sinTheta
+    };
+
+    zAxis =
+    {
+        rotationAxis[2] * rotationAxis[0] * (1.0f - cosTheta) - rotationAxis[1] * sinTheta,
+        rotationAxis[2] * rotationAxis[1] * (1.0f - cosTheta) + rotationAxis[0] * sinTheta,
+        cosTheta + rotationAxis[2] * rotationAxis[2] * (1.0f - cosTheta)
+    };
+}
+
+// CPU only model triangle that also carries a precomputed Woop transform: the affine transform that takes the triangle
+// to the unit triangle in the xy plane, with its normal along z. Ray tests against it skip the edge vectors and cross
+// products. Use it in place of ModelTrianglePrim to have MakeTriangle and AddMeshToTriangleSoup emit the data.
+struct SModelTriangleWoop : public ShaderTypes::StructuredBuffers::ModelTrianglePrim
+{
+    float4 m_woop[3];   // rows of the transform. xyz multiplies a position, w is the translation.
+};
+
+// triangles without precomputed data have nothing to do
+template <typename T>
+inline void PrecomputeTriangleIntersection (T&)
+{
+}
+
+inline void PrecomputeTriangleIntersection (SModelTriangleWoop& triangle)
+{
+    // the triangle space basis is e1, e2 and n = cross(e1, e2). The rows of its inverse are
+    // cross(e2, n), cross(n, e1) and n, divided by the determinant, which is dot(n, n).
+    float3 a = XYZ(triangle.positionA_w);
+    float3 e1 = XYZ(triangle.positionB_w) - a;
+    float3 e2 = XYZ(triangle.positionC_w) - a;
+    float3 n = Cross(e1, e2);
+    float det = Dot(n, n);
+
+    // degenerate triangles put every point at z = 1, so no ray ever crosses them
+    if (det == 0.0f)
+    {
+        triangle.m_woop[0] = { 0.0f, 0.0f, 0.0f, 0.0f };
+        triangle.m_woop[1] = { 0.0f, 0.0f, 0.0f, 0.0f };
+        triangle.m_woop[2] = { 0.0f, 0.0f, 0.0f, 1.0f };
+        return;
+    }
+
+    float3 rows[3] = { Cross(e2, n), Cross(n, e1), n };
+    for (size_t i = 0; i < 3; ++i)
+    {
+        float3 row = rows[i] * (1.0f / det);
+        triangle.m_woop[i] = { row[0], row[1], row[2], -Dot(row, a) };
+    }
+}
+
 template <typename T>
 inline void MakeTriangle (
     T& triangle,
@@ -250,10 +398,10 @@ inline void MakeTriangle (
     triangle.albedo_w[2] = albedo[2];
     triangle.albedo_w[3] = 0.0f;
 
-    triangle.emissive_w[0] = emissive[0];
-    triangle.emissive_w[1] = emissive[1];
-    triangle.emissive_w[2] = emissive[2];
-    triangle.emissive_w[3] = 0.0f;
+    triangle.emissive_lightIndex[0] = emissive[0];
+    triangle.emissive_lightIndex[1] = emissive[1];
+    triangle.emissive_lightIndex[2] = emissive[2];
+    triangle.emissive_lightIndex[3] = -1.0f;
 
     // calculate normal
     float3 norm = Normal(a, b, c);
@@ -261,6 +409,8 @@ inline void MakeTriangle (
     triangle.normal_w[1] = norm[1];
     triangle.normal_w[2] = norm[2];
     triangle.normal_w[3] = 0.0f;
+
+    PrecomputeTriangleIntersection(triangle);
 }
 
 inline void MakeQuad(
@@ -298,10 +448,10 @@ inline void MakeQuad(
     quad.albedo_w[2] = albedo[2];
     quad.albedo_w[3] = 0.0f;
 
-    quad.emissive_w[0] = emissive[0];
-    quad.emissive_w[1] = emissive[1];
-    quad.emissive_w[2] = emissive[2];
-    quad.emissive_w[3] = 0.0f;
+    quad.emissive_lightIndex[0] = emissive[0];
+    quad.emissive_lightIndex[1] = emissive[1];
+    quad.emissive_lightIndex[2] = emissive[2];
+    quad.emissive_lightIndex[3] = -1.0f;
 
     // calculate normal
     float3 norm = Normal(a, b, c);
@@ -328,10 +478,10 @@ inline void MakeSphere(
     sphere.albedo_w[2] = albedo[2];
     sphere.albedo_w[3] = 0.0f;
 
-    sphere.emissive_w[0] = emissive[0];
-    sphere.emissive_w[1] = emissive[1];
-    sphere.emissive_w[2] = emissive[2];
-    sphere.emissive_w[3] = 0.0f;
+    sphere.emissive_lightIndex[0] = emissive[0];
+    sphere.emissive_lightIndex[1] = emissive[1];
+    sphere.emissive_lightIndex[2] = emissive[2];
+    sphere.emissive_lightIndex[3] = -1.0f;
 }
 
 inline void MakeOBB (
@@ -359,10 +509,10 @@ inline void MakeOBB (
     obb.albedo_w[2] = albedo[2];
     obb.albedo_w[3] = 0.0f;
 
-    obb.emissive_w[0] = emissive[0];
-    obb.emissive_w[1] = emissive[1];
-    obb.emissive_w[2] = emissive[2];
-    obb.emissive_w[3] = 0.0f;
+    obb.emissive_lightIndex[0] = emissive[0];
+    obb.emissive_lightIndex[1] = emissive[1];
+    obb.emissive_lightIndex[2] = emissive[2];
+    obb.emissive_lightIndex[3] = -1.0f;
 
     // make sure the axis we get is normalized
     Normalize(rotAxis);
@@ -396,6 +546,7 @@ inline void MakeOBB (
     };
 }
 
+#ifndef CPU_ONLY
 template <EShaderType SHADER_TYPE>
 void UnbindShaderTextures (ID3D11DeviceContext* deviceContext, ID3D11ShaderReflection* reflector)
 {
@@ -626,4 +777,5 @@ void FillShaderParams (ID3D11DeviceContext* deviceContext, ID3D11ShaderReflectio
         else
             deviceContext->CSSetSamplers(desc.BindPoint, 1, &sampler);
     }
-}
\ No newline at end of file
+}
+#endif
\ No newline at end of file
@@ -0,0 +1,53 @@
+#include "ShaderTypes.h"
+
+// CPU_ONLY projects don't link ShaderTypes.cpp, so the constant buffers, structured buffers and textures are defined here.
+// They are just storage, there are no d3d objects behind them.
+namespace ShaderData
+{
+    namespace ConstantBuffers
+    {
+        #define CONSTANT_BUFFER_BEGIN(NAME) CConstantBuffer<ShaderTypes::ConstantBuffers::NAME> NAME;
+        #include "ShaderTypesList.h"
+    };
+
+    namespace StructuredBuffers
+    {
+        #define STRUCTURED_BUFFER_BEGIN(NAME, TYPENAME, COUNT, CPUWRITES) CStructuredBuffer<ShaderTypes::StructuredBuffers::TYPENAME, COUNT> NAME;
+        #include "ShaderTypesList.h"
+    };
+
+    namespace Textures
+    {
+        #define TEXTURE_IMAGE(NAME, FILENAME) CTextureCPU NAME;
+        #define TEXTURE_BUFFER(NAME, SHADERTYPE, FORMAT) CTextureCPU NAME;
+        #define TEXTURE_VOLUME_BEGIN(NAME) CTextureCPU NAME;
+        #define TEXTURE_ARRAY_BEGIN(NAME) CTextureCPU NAME;
+        #include "ShaderTypesList.h"
+    };
+};
+
+bool ShaderTypesInitTexturesCPU (void)
+{
+    // load images and create texture buffers
+    #define TEXTURE_IMAGE(NAME, FILENAME) \
+        if(!ShaderData::Textures::NAME.LoadTGA(FILENAME)) { ReportError("Could not load texture: " #NAME "\n"); return false; }
+    #define TEXTURE_BUFFER(NAME, SHADERTYPE, FORMAT) ShaderData::Textures::NAME.Create(c_width, c_height, 1);
+    #include "ShaderTypesList.h"
+
+    // create volume textures and texture arrays
+    #define TEXTURE_VOLUME_BEGIN(NAME) CTextureCPU* slices##NAME [] = {
+    #define TEXTURE_VOLUME_SLICE(TEXTURE) &ShaderData::Textures::TEXTURE,
+    #define TEXTURE_VOLUME_END };
+    #define TEXTURE_ARRAY_BEGIN(NAME) CTextureCPU* slices##NAME [] = {
+    #define TEXTURE_ARRAY_SLICE(TEXTURE) &ShaderData::Textures::TEXTURE,
+    #define TEXTURE_ARRAY_END };
+    #include "ShaderTypesList.h"
+
+    #define TEXTURE_VOLUME_BEGIN(NAME) \
+        if (!ShaderData::Textures::NAME.CreateArray(slices##NAME, sizeof(slices##NAME) / sizeof(slices##NAME[0]))) { ReportError("Could not create volume texture: " #NAME "\n"); return false; }
+    #define TEXTURE_ARRAY_BEGIN(NAME) \
+        if (!ShaderData::Textures::NAME.CreateArray(slices##NAME, sizeof(slices##NAME) / sizeof(slices##NAME[0]))) { ReportError("Could not create texture array: " #NAME "\n"); return false; }
+    #include "ShaderTypesList.h"
+
+    return true;
+}
\ No newline at end of file
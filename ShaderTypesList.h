@@ -215,12 +215,16 @@ CONSTANT_BUFFER_BEGIN(ConstantsOnce)
     CONSTANT_BUFFER_FIELD(uvmultiplier_blackPoint_whitePoint_triplanarPow, float4)
     CONSTANT_BUFFER_FIELD(overlayOpacity_yzw, float4)
     CONSTANT_BUFFER_FIELD(numSpheres_numTris_numOBBs_numQuads, uint4)
-    CONSTANT_BUFFER_FIELD(numModels_yzw, uint4)
+    CONSTANT_BUFFER_FIELD(numModels_sceneRootNode_numScenePrims_numLights, uint4)
+    CONSTANT_BUFFER_FIELD(environmentWidth_environmentHeight_zw, uint4)     // 0 wide if misses get the flat miss color
 CONSTANT_BUFFER_END
 
 CONSTANT_BUFFER_BEGIN(ConstantsPerFrame)
-    CONSTANT_BUFFER_FIELD(frameRnd_w, float4)
+    CONSTANT_BUFFER_FIELD(rngSeed_yzw, uint4)
+    CONSTANT_BUFFER_FIELD(adaptiveError_adaptiveMinSamples_zw, float4)
     CONSTANT_BUFFER_FIELD(sampleCount_samplesPerFrame_zw, uint4)
+    CONSTANT_BUFFER_FIELD(maxBounces_rouletteStartBounce_zw, uint4)
+    CONSTANT_BUFFER_FIELD(sampler_lightPicker_zw, uint4)
 CONSTANT_BUFFER_END
 
 //=================================================================
@@ -230,7 +234,7 @@ CONSTANT_BUFFER_END
 STRUCTURED_BUFFER_BEGIN(Spheres, SpherePrim, 10, true)
     STRUCTURED_BUFFER_FIELD(position_Radius, float4)
     STRUCTURED_BUFFER_FIELD(albedo_w, float4)
-    STRUCTURED_BUFFER_FIELD(emissive_w, float4)
+    STRUCTURED_BUFFER_FIELD(emissive_lightIndex, float4)
 STRUCTURED_BUFFER_END
 
 STRUCTURED_BUFFER_BEGIN(Triangles, TrianglePrim, 1000, true)
@@ -239,7 +243,7 @@ STRUCTURED_BUFFER_BEGIN(Triangles, TrianglePrim, 1000, true)
     STRUCTURED_BUFFER_FIELD(positionC_w, float4)
     STRUCTURED_BUFFER_FIELD(normal_w, float4)
     STRUCTURED_BUFFER_FIELD(albedo_w, float4)
-    STRUCTURED_BUFFER_FIELD(emissive_w, float4)
+    STRUCTURED_BUFFER_FIELD(emissive_lightIndex, float4)
 STRUCTURED_BUFFER_END
 
 STRUCTURED_BUFFER_BEGIN(Quads, QuadPrim, 10, true)
@@ -249,7 +253,7 @@ STRUCTURED_BUFFER_BEGIN(Quads, QuadPrim, 10, true)
     STRUCTURED_BUFFER_FIELD(positionD_w, float4)
     STRUCTURED_BUFFER_FIELD(normal_w, float4)
     STRUCTURED_BUFFER_FIELD(albedo_w, float4)
-    STRUCTURED_BUFFER_FIELD(emissive_w, float4)
+    STRUCTURED_BUFFER_FIELD(emissive_lightIndex, float4)
 STRUCTURED_BUFFER_END
 
 STRUCTURED_BUFFER_BEGIN(OBBs, OBBPrim, 10, true)
@@ -259,21 +263,74 @@ STRUCTURED_BUFFER_BEGIN(OBBs, OBBPrim, 10, true)
     STRUCTURED_BUFFER_FIELD(YAxis_w, float4)
     STRUCTURED_BUFFER_FIELD(ZAxis_w, float4)
     STRUCTURED_BUFFER_FIELD(albedo_w, float4)
-    STRUCTURED_BUFFER_FIELD(emissive_w, float4)
+    STRUCTURED_BUFFER_FIELD(emissive_lightIndex, float4)
 STRUCTURED_BUFFER_END
 
+// Models are instances of meshes. The triangles and BVH of a mesh are shared by all instances of it.
+// worldToObject X,Y,Z are the rows of a 3x4 matrix that puts world space positions into the mesh's object space, and
+// objectToWorld X,Y,Z are the rows of its inverse, for putting light samples on emissive triangles into world space.
+// Each model has its own lights for its mesh's emissive triangles, starting at firstLight.
 STRUCTURED_BUFFER_BEGIN(Models, ModelPrim, 10, true)
-    STRUCTURED_BUFFER_FIELD(position_Radius, float4)
-    STRUCTURED_BUFFER_FIELD(firstTriangle_lastTriangle_zw, uint4)
+    STRUCTURED_BUFFER_FIELD(worldToObjectX, float4)
+    STRUCTURED_BUFFER_FIELD(worldToObjectY, float4)
+    STRUCTURED_BUFFER_FIELD(worldToObjectZ, float4)
+    STRUCTURED_BUFFER_FIELD(objectToWorldX, float4)
+    STRUCTURED_BUFFER_FIELD(objectToWorldY, float4)
+    STRUCTURED_BUFFER_FIELD(objectToWorldZ, float4)
+    STRUCTURED_BUFFER_FIELD(firstTriangle_lastTriangle_rootNode_firstLight, uint4)
 STRUCTURED_BUFFER_END
 
+// The light index in the w of emissive is which of its mesh's emissive triangles it is, for the model's firstLight to
+// be added to.
 STRUCTURED_BUFFER_BEGIN(ModelTriangles, ModelTrianglePrim, 1000, true)
     STRUCTURED_BUFFER_FIELD(positionA_w, float4)
     STRUCTURED_BUFFER_FIELD(positionB_w, float4)
     STRUCTURED_BUFFER_FIELD(positionC_w, float4)
     STRUCTURED_BUFFER_FIELD(normal_w, float4)
     STRUCTURED_BUFFER_FIELD(albedo_w, float4)
-    STRUCTURED_BUFFER_FIELD(emissive_w, float4)
+    STRUCTURED_BUFFER_FIELD(emissive_lightIndex, float4)
+STRUCTURED_BUFFER_END
+
+// BVH nodes are depth first, so the left child of an interior node is the next node. numPrims is 0 for interior nodes.
+STRUCTURED_BUFFER_BEGIN(BVHNodes, BVHNode, 4096, true)
+    STRUCTURED_BUFFER_FIELD(boundsMin_w, float4)
+    STRUCTURED_BUFFER_FIELD(boundsMax_w, float4)
+    STRUCTURED_BUFFER_FIELD(rightChild_firstPrim_numPrims_splitAxis, uint4)
+STRUCTURED_BUFFER_END
+
+// The leaves of the scene BVH index into this list of primitives, which can be of any type.
+STRUCTURED_BUFFER_BEGIN(ScenePrimitives, ScenePrimitive, 1040, true)
+    STRUCTURED_BUFFER_FIELD(type_index_zw, uint4)
+STRUCTURED_BUFFER_END
+
+// The emissive spheres, triangles, quads and model triangles, for light sampling. FillSceneData() makes the list, and
+// puts each light's index in the w of its primitive's emissive_lightIndex, which is -1 for primitives that aren't in
+// the list. Model triangles are one light per model, see ModelTriangles. There is room for every primitive to be a light.
+// A light is picked either with probability selectionPDF, proportional to its power, using the alias table, or by
+// walking the light tree from the root. Then a point on it is picked uniformly by area.
+STRUCTURED_BUFFER_BEGIN(Lights, LightPrim, 11020, true)
+    STRUCTURED_BUFFER_FIELD(type_index_model_w, uint4)
+    STRUCTURED_BUFFER_FIELD(alias_treeLeaf_zw, uint4)
+    STRUCTURED_BUFFER_FIELD(selectionPDF_area_aliasThreshold_w, float4)
+STRUCTURED_BUFFER_END
+
+// Light tree nodes are depth first like BVHNodes, with one light per leaf. light is 0xFFFFFFFF for interior nodes.
+// The bounds hold the lights' positions, the normal cone (axis and cosine of its half angle) their facing directions.
+STRUCTURED_BUFFER_BEGIN(LightTreeNodes, LightTreeNode, 22040, true)
+    STRUCTURED_BUFFER_FIELD(boundsMin_power, float4)
+    STRUCTURED_BUFFER_FIELD(boundsMax_cosTheta, float4)
+    STRUCTURED_BUFFER_FIELD(axis_w, float4)
+    STRUCTURED_BUFFER_FIELD(rightChild_light_parent_w, uint4)
+STRUCTURED_BUFFER_END
+
+// The environment map the scene is lit by, if environmentWidth isn't 0. Each texel has its radiance and its value of
+// its row's conditional CDF, and each row its value of the marginal CDF. See Environment.h.
+STRUCTURED_BUFFER_BEGIN(EnvironmentTexels, EnvironmentTexel, c_environmentWidth * c_environmentHeight, true)
+    STRUCTURED_BUFFER_FIELD(radiance_conditionalCDF, float4)
+STRUCTURED_BUFFER_END
+
+STRUCTURED_BUFFER_BEGIN(EnvironmentRows, EnvironmentRow, c_environmentHeight, true)
+    STRUCTURED_BUFFER_FIELD(marginalCDF_yzw, float4)
 STRUCTURED_BUFFER_END
 
 STRUCTURED_BUFFER_BEGIN(FirstRayHits, FirstRayHit, c_width * c_height, false)
@@ -300,9 +357,79 @@ VERTEX_FORMAT_END
 //=================================================================
 
 TEXTURE_BUFFER(pathTraceOutput, float4, DXGI_FORMAT_R32G32B32A32_FLOAT)
+TEXTURE_BUFFER(pathTraceMoments, float4, DXGI_FORMAT_R32G32B32A32_FLOAT)    // x: luminance second moment, y: sample count
 
 TEXTURE_IMAGE(blueNoise256, "Art/BlueNoise256.tga")
 
+// spatiotemporal blue noise from TAMGenerator, sample N of a pixel reads slice N mod 32
+TEXTURE_IMAGE(blueNoiseSpatiotemporal0, "Art/BlueNoiseSpatiotemporal_0.tga")
+TEXTURE_IMAGE(blueNoiseSpatiotemporal1, "Art/BlueNoiseSpatiotemporal_1.tga")
+TEXTURE_IMAGE(blueNoiseSpatiotemporal2, "Art/BlueNoiseSpatiotemporal_2.tga")
+TEXTURE_IMAGE(blueNoiseSpatiotemporal3, "Art/BlueNoiseSpatiotemporal_3.tga")
+TEXTURE_IMAGE(blueNoiseSpatiotemporal4, "Art/BlueNoiseSpatiotemporal_4.tga")
+TEXTURE_IMAGE(blueNoiseSpatiotemporal5, "Art/BlueNoiseSpatiotemporal_5.tga")
+TEXTURE_IMAGE(blueNoiseSpatiotemporal6, "Art/BlueNoiseSpatiotemporal_6.tga")
+TEXTURE_IMAGE(blueNoiseSpatiotemporal7, "Art/BlueNoiseSpatiotemporal_7.tga")
+TEXTURE_IMAGE(blueNoiseSpatiotemporal8, "Art/BlueNoiseSpatiotemporal_8.tga")
+TEXTURE_IMAGE(blueNoiseSpatiotemporal9, "Art/BlueNoiseSpatiotemporal_9.tga")
+TEXTURE_IMAGE(blueNoiseSpatiotemporal10, "Art/BlueNoiseSpatiotemporal_10.tga")
+TEXTURE_IMAGE(blueNoiseSpatiotemporal11, "Art/BlueNoiseSpatiotemporal_11.tga")
+TEXTURE_IMAGE(blueNoiseSpatiotemporal12, "Art/BlueNoiseSpatiotemporal_12.tga")
+TEXTURE_IMAGE(blueNoiseSpatiotemporal13, "Art/BlueNoiseSpatiotemporal_13.tga")
+TEXTURE_IMAGE(blueNoiseSpatiotemporal14, "Art/BlueNoiseSpatiotemporal_14.tga")
+TEXTURE_IMAGE(blueNoiseSpatiotemporal15, "Art/BlueNoiseSpatiotemporal_15.tga")
+TEXTURE_IMAGE(blueNoiseSpatiotemporal16, "Art/BlueNoiseSpatiotemporal_16.tga")
+TEXTURE_IMAGE(blueNoiseSpatiotemporal17, "Art/BlueNoiseSpatiotemporal_17.tga")
+TEXTURE_IMAGE(blueNoiseSpatiotemporal18, "Art/BlueNoiseSpatiotemporal_18.tga")
+TEXTURE_IMAGE(blueNoiseSpatiotemporal19, "Art/BlueNoiseSpatiotemporal_19.tga")
+TEXTURE_IMAGE(blueNoiseSpatiotemporal20, "Art/BlueNoiseSpatiotemporal_20.tga")
+TEXTURE_IMAGE(blueNoiseSpatiotemporal21, "Art/BlueNoiseSpatiotemporal_21.tga")
+TEXTURE_IMAGE(blueNoiseSpatiotemporal22, "Art/BlueNoiseSpatiotemporal_22.tga")
+TEXTURE_IMAGE(blueNoiseSpatiotemporal23, "Art/BlueNoiseSpatiotemporal_23.tga")
+TEXTURE_IMAGE(blueNoiseSpatiotemporal24, "Art/BlueNoiseSpatiotemporal_24.tga")
+TEXTURE_IMAGE(blueNoiseSpatiotemporal25, "Art/BlueNoiseSpatiotemporal_25.tga")
+TEXTURE_IMAGE(blueNoiseSpatiotemporal26, "Art/BlueNoiseSpatiotemporal_26.tga")
+TEXTURE_IMAGE(blueNoiseSpatiotemporal27, "Art/BlueNoiseSpatiotemporal_27.tga")
+TEXTURE_IMAGE(blueNoiseSpatiotemporal28, "Art/BlueNoiseSpatiotemporal_28.tga")
+TEXTURE_IMAGE(blueNoiseSpatiotemporal29, "Art/BlueNoiseSpatiotemporal_29.tga")
+TEXTURE_IMAGE(blueNoiseSpatiotemporal30, "Art/BlueNoiseSpatiotemporal_30.tga")
+TEXTURE_IMAGE(blueNoiseSpatiotemporal31, "Art/BlueNoiseSpatiotemporal_31.tga")
+
+TEXTURE_ARRAY_BEGIN(blueNoiseSpatiotemporal)
+    TEXTURE_ARRAY_SLICE(blueNoiseSpatiotemporal0)
+    TEXTURE_ARRAY_SLICE(blueNoiseSpatiotemporal1)
+    TEXTURE_ARRAY_SLICE(blueNoiseSpatiotemporal2)
+    TEXTURE_ARRAY_SLICE(blueNoiseSpatiotemporal3)
+    TEXTURE_ARRAY_SLICE(blueNoiseSpatiotemporal4)
+    TEXTURE_ARRAY_SLICE(blueNoiseSpatiotemporal5)
+    TEXTURE_ARRAY_SLICE(blueNoiseSpatiotemporal6)
+    TEXTURE_ARRAY_SLICE(blueNoiseSpatiotemporal7)
+    TEXTURE_ARRAY_SLICE(blueNoiseSpatiotemporal8)
+    TEXTURE_ARRAY_SLICE(blueNoiseSpatiotemporal9)
+    TEXTURE_ARRAY_SLICE(blueNoiseSpatiotemporal10)
+    TEXTURE_ARRAY_SLICE(blueNoiseSpatiotemporal11)
+    TEXTURE_ARRAY_SLICE(blueNoiseSpatiotemporal12)
+    TEXTURE_ARRAY_SLICE(blueNoiseSpatiotemporal13)
+    TEXTURE_ARRAY_SLICE(blueNoiseSpatiotemporal14)
+    TEXTURE_ARRAY_SLICE(blueNoiseSpatiotemporal15)
+    TEXTURE_ARRAY_SLICE(blueNoiseSpatiotemporal16)
+    TEXTURE_ARRAY_SLICE(blueNoiseSpatiotemporal17)
+    TEXTURE_ARRAY_SLICE(blueNoiseSpatiotemporal18)
+    TEXTURE_ARRAY_SLICE(blueNoiseSpatiotemporal19)
+    TEXTURE_ARRAY_SLICE(blueNoiseSpatiotemporal20)
+    TEXTURE_ARRAY_SLICE(blueNoiseSpatiotemporal21)
+    TEXTURE_ARRAY_SLICE(blueNoiseSpatiotemporal22)
+    TEXTURE_ARRAY_SLICE(blueNoiseSpatiotemporal23)
+    TEXTURE_ARRAY_SLICE(blueNoiseSpatiotemporal24)
+    TEXTURE_ARRAY_SLICE(blueNoiseSpatiotemporal25)
+    TEXTURE_ARRAY_SLICE(blueNoiseSpatiotemporal26)
+    TEXTURE_ARRAY_SLICE(blueNoiseSpatiotemporal27)
+    TEXTURE_ARRAY_SLICE(blueNoiseSpatiotemporal28)
+    TEXTURE_ARRAY_SLICE(blueNoiseSpatiotemporal29)
+    TEXTURE_ARRAY_SLICE(blueNoiseSpatiotemporal30)
+    TEXTURE_ARRAY_SLICE(blueNoiseSpatiotemporal31)
+TEXTURE_ARRAY_END
+
 TEXTURE_IMAGE(circleneg4, "Art/circlesneg4.tga")
 TEXTURE_IMAGE(circleneg3, "Art/circlesneg3.tga")
 TEXTURE_IMAGE(circleneg2, "Art/circlesneg2.tga")
@@ -355,7 +482,7 @@ SHADER_VSPS_END
 
 SHADER_CS_BEGIN(pathTrace, L"Shaders/PathTrace.fx", "cs_main")
     SHADER_CS_STATICBRANCH(SBWhiteAlbedo)
-    SHADER_CS_STATICBRANCH(SBBlueNoise)
+    SHADER_CS_STATICBRANCH(SBAdaptive)
 SHADER_CS_END
 
 SHADER_CS_BEGIN(pathTraceFirstHit, L"Shaders/PathTraceFirstHit.fx", "cs_main")
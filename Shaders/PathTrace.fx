@@ -1,5 +1,9 @@
 #include "PathTrace.h"
 
+// the tile's summed pixel errors, in fixed point so they can be added atomically
+groupshared uint g_tileError;
+static const float c_tileErrorScale = 65536.0f;
+
 //----------------------------------------------------------------------------
 [numthreads(32, 32, 1)]
 void cs_main (
@@ -8,30 +12,58 @@ void cs_main (
     uint groupIndex : SV_GroupIndex,
     uint3 dispatchThreadID : SV_DispatchThreadID)
 {
-    // Don't write out of bounds pixels
     uint dimsX, dimsY;
     pathTraceOutput_rw.GetDimensions(dimsX, dimsY);
+
+    // With adaptive sampling, the group skips this frame if the average error of its tile is under the threshold. This
+    // comes before the out of bounds test so the whole group gets to the barriers.
+    if (SBAdaptive)
+    {
+        if (groupIndex == 0)
+            g_tileError = 0;
+        GroupMemoryBarrierWithGroupSync();
+
+        if (dispatchThreadID.x < dimsX && dispatchThreadID.y < dimsY)
+        {
+            float4 moments = pathTraceMoments_rw[dispatchThreadID.xy];
+            float pixelError = PixelError(Luminance(pathTraceOutput_rw[dispatchThreadID.xy].xyz), moments.x, moments.y);
+            InterlockedAdd(g_tileError, uint(pixelError * c_tileErrorScale));
+        }
+        GroupMemoryBarrierWithGroupSync();
+
+        uint2 tilePixels = min(uint2(32, 32), uint2(dimsX, dimsY) - groupID.xy * 32);
+        float tileError = float(g_tileError) / c_tileErrorScale / float(tilePixels.x * tilePixels.y);
+        if (float(sampleCount_samplesPerFrame_zw.x) > adaptiveError_adaptiveMinSamples_zw.y && tileError < adaptiveError_adaptiveMinSamples_zw.x)
+            return;
+    }
+
+    // Don't write out of bounds pixels
     if (dispatchThreadID.x > dimsX || dispatchThreadID.y > dimsY)
         return;
 
     // calculate screen uv
     float2 uv = float2(dispatchThreadID.xy) / float2(dimsX, dimsY);
 
-    // calculate a random seed, basing it either on blue noise (from a texture) or white noise
-    float rngSeed = 0.0f;
-    if (SBBlueNoise)
+    // The sampler and light picker are the same for the whole dispatch, so branching on them is cheap, and they don't
+    // need a shader permutation each
+    uint samplerType = sampler_lightPicker_zw.x;
+    bool useBlueNoise = samplerType == c_samplerBlueNoise || samplerType == c_samplerSpatiotemporalBlueNoise;
+    bool spatiotemporalBlueNoise = samplerType == c_samplerSpatiotemporalBlueNoise;
+    bool sobol = samplerType == c_samplerSobol;
+    bool lightSampling = sampler_lightPicker_zw.y != c_lightPickerNone;
+    bool lightTree = sampler_lightPicker_zw.y == c_lightPickerLightTree;
+
+    // Sample a blue noise texture for this pixel if we should. It starts a low discrepancy sequence for the first random
+    // number of each sample, which makes the noise less harsh on the eyes. With spatiotemporal blue noise, the texture
+    // is read for each sample instead, below. Otherwise everything is white noise, unless the Sobol sampler makes every
+    // random number an Owen scrambled Sobol point.
+    float blueNoise = -1.0f;
+    if (useBlueNoise && !spatiotemporalBlueNoise)
     {
-        // calculate a rngSeed by sampling a blue noise texture for this pixel and adding frame number * golden ratio.
-        // The blue noise starting seed makes the noise less harsh on the eyes.
-        // The golden ratio addition makes a sort of low discrepancy sequence, even though we aren't keeping it in 0-1 range
         float2 blueNoiseUV = uv;
         blueNoiseUV.x *= float(dimsX) / 256.0f;
         blueNoiseUV.y *= float(dimsY) / 256.0f;
-        rngSeed = blueNoise256.SampleLevel(SamplerNearestWrap, blueNoiseUV, 0).r + GOLDEN_RATIO * float(sampleCount_samplesPerFrame_zw.x);
-    }
-    else
-    {
-        rngSeed = frameRnd_w.z + 10000.0f * dot(frameRnd_w.xy, uv);
+        blueNoise = blueNoise256.SampleLevel(SamplerNearestWrap, blueNoiseUV, 0).r;
     }
 
     // calculate the ray for this pixel
@@ -42,13 +74,47 @@ void cs_main (
     uint pixelIndex = dispatchThreadID.y * dimsX + dispatchThreadID.x;
     float3 light = float3(0.0f, 0.0f, 0.0f);
     
-    // average N samples together to make our sample for this frame
-    for (int i = 0; i < sampleCount_samplesPerFrame_zw.y; ++i)
-        light += Light_Incoming(rayPos, rayDir, rngSeed, FirstRayHits[pixelIndex], SBWhiteAlbedo);
+    // average N samples together to make our sample for this frame. The random numbers are keyed by the sample's index
+    // counting from the start of the accumulation.
+    for (uint i = 0; i < sampleCount_samplesPerFrame_zw.y; ++i)
+    {
+        uint sampleIndex = (sampleCount_samplesPerFrame_zw.x - 1) * sampleCount_samplesPerFrame_zw.y + i;
+
+        // The first random number of the sample is the blue noise value plus the golden ratio times the sample index.
+        // Spatiotemporal blue noise reads slice sampleIndex mod depth, whose values over the slices are already well
+        // spread out, so the golden ratio only steps each time through the slices. The golden ratio multiply is in
+        // fixed point so it doesn't lose precision as the sample index grows.
+        float sampleBlueNoise = -1.0f;
+        if (useBlueNoise)
+        {
+            uint goldenRatioStep = sampleIndex;
+            if (spatiotemporalBlueNoise)
+            {
+                uint blueNoiseWidth, blueNoiseHeight, depth;
+                blueNoiseSpatiotemporal.GetDimensions(blueNoiseWidth, blueNoiseHeight, depth);
+                float2 blueNoiseUV = uv * float2(dimsX, dimsY) / float2(blueNoiseWidth, blueNoiseHeight);
+                blueNoise = blueNoiseSpatiotemporal.SampleLevel(SamplerNearestWrap, float3(blueNoiseUV, float(sampleIndex % depth)), 0).r;
+                goldenRatioStep = sampleIndex / depth;
+            }
+            sampleBlueNoise = frac(blueNoise + UintToFloat01(goldenRatioStep * GOLDEN_RATIO_FIXED));
+        }
+
+        SRNG rng = RNGInit(pixelIndex, sampleIndex, rngSeed_yzw.x, sampleBlueNoise, sobol);
+        light += Light_Incoming(rayPos, rayDir, rng, FirstRayHits[pixelIndex], SBWhiteAlbedo, lightSampling, lightTree);
+    }
     light /= float(sampleCount_samplesPerFrame_zw.y);
 
+    // Each pixel counts its own samples, since adaptive sampling skips tiles on some frames. The first frame of an
+    // accumulation starts every pixel over.
+    float4 moments = pathTraceMoments_rw[dispatchThreadID.xy];
+    float pixelSampleCount = (sampleCount_samplesPerFrame_zw.x == 1) ? 1.0f : moments.y + 1.0f;
+
     // use lerping for incremental averageing:  https://blog.demofox.org/2016/08/23/incremental-averaging/
-    // lerp from the old value to the current and write it back out
-    float3 integration = lerp(pathTraceOutput_rw[dispatchThreadID.xy].xyz, light, 1.0f / float(sampleCount_samplesPerFrame_zw.x));
+    // lerp from the old value to the current and write it back out. The second moment of the luminance is averaged
+    // the same way, for the adaptive sampling error estimate.
+    float t = 1.0f / pixelSampleCount;
+    float3 integration = lerp(pathTraceOutput_rw[dispatchThreadID.xy].xyz, light, t);
     pathTraceOutput_rw[dispatchThreadID.xy] = float4(integration, 1.0f);
+    float luminance = Luminance(light);
+    pathTraceMoments_rw[dispatchThreadID.xy] = float4(lerp(moments.x, luminance * luminance, t), pixelSampleCount, 0.0f, 0.0f);
 }
\ No newline at end of file
@@ -3,8 +3,29 @@
 static const float c_pi = 3.14159265359f;
 static const float c_rayEpsilon = 0.001f;
 static const float FLT_MAX = 3.402823466e+38F;
-static const float GOLDEN_RATIO = 1.61803398875f;
-static const int c_numBounces = 3;
+static const uint GOLDEN_RATIO_FIXED = 2654435769u;    // the fractional part of the golden ratio, times 2^32
+static const uint c_bvhStackSize = 32; // must match c_bvhMaxDepth in BVH.h
+static const float c_oneMinusEpsilon = 0.99999994f;    // the largest float under 1
+static const float c_environmentDistance = 10000.0f;   // how far shadow rays towards the environment go
+static const uint c_lightTreeInterior = 0xFFFFFFFF;     // must match c_lightTreeInterior in LightTree.h
+
+// random number samplers, must match ESampler in ShaderTypes.h
+static const uint c_samplerWhiteNoise = 0;
+static const uint c_samplerBlueNoise = 1;
+static const uint c_samplerSpatiotemporalBlueNoise = 2;
+static const uint c_samplerSobol = 3;
+
+// next event estimation light pickers, must match ELightPicker in ShaderTypes.h
+static const uint c_lightPickerNone = 0;
+static const uint c_lightPickerAliasTable = 1;
+static const uint c_lightPickerLightTree = 2;
+
+// scene primitive types, must match EScenePrimitive in BVH.h
+static const uint c_scenePrimitiveSphere = 0;
+static const uint c_scenePrimitiveTriangle = 1;
+static const uint c_scenePrimitiveQuad = 2;
+static const uint c_scenePrimitiveOBB = 3;
+static const uint c_scenePrimitiveModel = 4;
 
 //----------------------------------------------------------------------------
 struct SRayHitInfo
@@ -13,6 +34,7 @@ struct SRayHitInfo
     float3 m_surfaceNormal;
     float3 m_albedo;
     float3 m_emissive;
+    int    m_lightIndex;    // where the emitter is in the Lights buffer, or -1 if light sampling doesn't know about it
 };
 
 //----------------------------------------------------------------------------
@@ -163,7 +185,8 @@ bool RayIntersectsAABB (in float3 rayPos, in float3 rayDir, in OBBPrim obb, inou
     rayHitInfo.m_intersectTime = collisionTime;
     rayHitInfo.m_surfaceNormal = normal;
     rayHitInfo.m_albedo = obb.albedo_w.xyz;
-    rayHitInfo.m_emissive = obb.emissive_w.xyz;
+    rayHitInfo.m_emissive = obb.emissive_lightIndex.xyz;
+    rayHitInfo.m_lightIndex = int(obb.emissive_lightIndex.w);
 
     return true;
 }
@@ -183,6 +206,44 @@ void RayIntersectsOBB (in float3 rayPos, in float3 rayDir, in OBBPrim obb, inout
     rayHitInfo.m_surfaceNormal = UndoChangeBasis(rayHitInfo.m_surfaceNormal, obb.XAxis_w.xyz, obb.YAxis_w.xyz, obb.ZAxis_w.xyz);
 }
 
+//----------------------------------------------------------------------------
+// true if the ray hits the obb no farther than maxIntersectTime. Skips the normal and material work.
+bool RayIntersectsOBBBoolean (in float3 rayPos, in float3 rayDir, in OBBPrim obb, float maxIntersectTime)
+{
+    // put the ray into local space of the obb
+    float3 localRayPos = ChangeBasis(rayPos - obb.position_w.xyz, obb.XAxis_w.xyz, obb.YAxis_w.xyz, obb.ZAxis_w.xyz) + obb.position_w.xyz;
+    float3 localRayDir = ChangeBasis(rayDir, obb.XAxis_w.xyz, obb.YAxis_w.xyz, obb.ZAxis_w.xyz);
+
+    float rayMinTime = 0.0;
+    float rayMaxTime = FLT_MAX;
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        float axisMin = obb.position_w[axis] - obb.radius_w[axis];
+        float axisMax = obb.position_w[axis] + obb.radius_w[axis];
+
+        //if the ray is paralel with this axis
+        if (abs(localRayDir[axis]) < 0.0001f)
+        {
+            if (localRayPos[axis] < axisMin || localRayPos[axis] > axisMax)
+                return false;
+        }
+        else
+        {
+            float axisMinTime = (axisMin - localRayPos[axis]) / localRayDir[axis];
+            float axisMaxTime = (axisMax - localRayPos[axis]) / localRayDir[axis];
+            rayMinTime = max(rayMinTime, min(axisMinTime, axisMaxTime));
+            rayMaxTime = min(rayMaxTime, max(axisMinTime, axisMaxTime));
+            if (rayMinTime > rayMaxTime)
+                return false;
+        }
+    }
+
+    float collisionTime = (rayMinTime == 0.0f) ? rayMaxTime : rayMinTime;
+    if (maxIntersectTime >= 0.0 && collisionTime > maxIntersectTime)
+        return false;
+    return collisionTime >= 0.0f;
+}
+
 //----------------------------------------------------------------------------
 void RayIntersectsQuad (in float3 rayPos, in float3 rayDir, in QuadPrim quad, inout SRayHitInfo rayHitInfo)
 {
@@ -258,7 +319,63 @@ void RayIntersectsQuad (in float3 rayPos, in float3 rayDir, in QuadPrim quad, in
     rayHitInfo.m_intersectTime = t;
     rayHitInfo.m_surfaceNormal = normal;
     rayHitInfo.m_albedo = quad.albedo_w.xyz;
-    rayHitInfo.m_emissive = quad.emissive_w.xyz;
+    rayHitInfo.m_emissive = quad.emissive_lightIndex.xyz;
+    rayHitInfo.m_lightIndex = int(quad.emissive_lightIndex.w);
+}
+
+//----------------------------------------------------------------------------
+// true if the ray hits the quad no farther than maxIntersectTime. Skips the normal and material work.
+bool RayIntersectsQuadBoolean (in float3 rayPos, in float3 rayDir, in QuadPrim quad, float maxIntersectTime)
+{
+    float3 posA = quad.positionA_w.xyz;
+    float3 posB = quad.positionB_w.xyz;
+    float3 posC = quad.positionC_w.xyz;
+    float3 posD = quad.positionD_w.xyz;
+
+    // two sided, so flip the vertex order when viewed from the back
+    if (dot(quad.normal_w.xyz, rayDir) > 0.0f)
+    {
+        posB = quad.positionD_w.xyz;
+        posD = quad.positionB_w.xyz;
+    }
+
+    // same as RayIntersectsQuad()
+    float3 pa = posA - rayPos;
+    float3 pb = posB - rayPos;
+    float3 pc = posC - rayPos;
+    float3 m = cross(pc, rayDir);
+    float3 r;
+    float v = dot(pa, m);
+    if (v >= 0.0f) {
+        float u = -dot(pb, m);
+        if (u < 0.0f) return false;
+        float w = ScalarTriple(rayDir, pb, pa);
+        if (w < 0.0f) return false;
+        float denom = 1.0f / (u + v + w);
+        r = (u*denom)*posA + (v*denom)*posB + (w*denom)*posC;
+    }
+    else {
+        float3 pd = posD - rayPos;
+        float u = dot(pd, m);
+        if (u < 0.0f) return false;
+        float w = ScalarTriple(rayDir, pa, pd);
+        if (w < 0.0f) return false;
+        v = -v;
+        float denom = 1.0f / (u + v + w);
+        r = (u*denom)*posA + (v*denom)*posD + (w*denom)*posC;
+    }
+
+    float t = -1.0f;
+    if (abs(rayDir[0]) > 0.0f)
+        t = (r[0] - rayPos[0]) / rayDir[0];
+    else if (abs(rayDir[1]) > 0.0f)
+        t = (r[1] - rayPos[1]) / rayDir[1];
+    else if (abs(rayDir[2]) > 0.0f)
+        t = (r[2] - rayPos[2]) / rayDir[2];
+
+    if (t < 0.0f)
+        return false;
+    return maxIntersectTime < 0.0 || t <= maxIntersectTime;
 }
 
 //----------------------------------------------------------------------------
@@ -340,7 +457,8 @@ void RayIntersectsSphere (in float3 rayPos, in float3 rayDir, in SpherePrim sphe
     rayHitInfo.m_intersectTime = collisionTime;
     rayHitInfo.m_surfaceNormal = normal;
     rayHitInfo.m_albedo = sphere.albedo_w.xyz;
-    rayHitInfo.m_emissive = sphere.emissive_w.xyz;
+    rayHitInfo.m_emissive = sphere.emissive_lightIndex.xyz;
+    rayHitInfo.m_lightIndex = int(sphere.emissive_lightIndex.w);
 }
 
 //----------------------------------------------------------------------------
@@ -388,7 +506,8 @@ void RayIntersectsTriangle (in float3 rayPos, in float3 rayDir, in TrianglePrim
     rayHitInfo.m_intersectTime = t;
     rayHitInfo.m_surfaceNormal = normal;
     rayHitInfo.m_albedo = trianglePrim.albedo_w.xyz;
-    rayHitInfo.m_emissive = trianglePrim.emissive_w.xyz;
+    rayHitInfo.m_emissive = trianglePrim.emissive_lightIndex.xyz;
+    rayHitInfo.m_lightIndex = int(trianglePrim.emissive_lightIndex.w);
 }
 
 //----------------------------------------------------------------------------
@@ -436,19 +555,211 @@ void RayIntersectsModelTriangle (in float3 rayPos, in float3 rayDir, in ModelTri
     rayHitInfo.m_intersectTime = t;
     rayHitInfo.m_surfaceNormal = normal;
     rayHitInfo.m_albedo = trianglePrim.albedo_w.xyz;
-    rayHitInfo.m_emissive = trianglePrim.emissive_w.xyz;
+    rayHitInfo.m_emissive = trianglePrim.emissive_lightIndex.xyz;
+    rayHitInfo.m_lightIndex = int(trianglePrim.emissive_lightIndex.w);
+}
+
+//----------------------------------------------------------------------------
+// true if the ray hits the triangle no farther than maxIntersectTime. Takes positions so it works for TrianglePrim and
+// ModelTrianglePrim, and skips the normal and material work.
+bool RayIntersectsTriangleBoolean (in float3 rayPos, in float3 rayDir, in float3 positionA, in float3 positionB, in float3 positionC, float maxIntersectTime)
+{
+    // Edge vectors
+    float3 e_1 = positionB - positionA;
+    float3 e_2 = positionC - positionA;
+
+    float3 q = cross(rayDir, e_2);
+    float a = dot(e_1, q);
+    if (abs(a) == 0.0f)
+        return false;
+
+    float3 s = (rayPos - positionA) / a;
+    float3 r = cross(s, e_1);
+    float3 b;
+    b[0] = dot(s, q);
+    b[1] = dot(r, rayDir);
+    b[2] = 1.0f - b[0] - b[1];
+    if ((b[0] < 0.0f) || (b[1] < 0.0f) || (b[2] < 0.0f))
+        return false;
+    float t = dot(e_2, r);
+    if (t < 0.0f)
+        return false;
+    return maxIntersectTime < 0.0 || t <= maxIntersectTime;
+}
+
+//----------------------------------------------------------------------------
+bool RayIntersectsBox (in float3 rayPos, in float3 rayInvDir, in float3 boxMin, in float3 boxMax, float maxIntersectTime)
+{
+    // slab test. infinities from axis aligned rays work out correctly.
+    float3 t0 = (boxMin - rayPos) * rayInvDir;
+    float3 t1 = (boxMax - rayPos) * rayInvDir;
+    float3 tmin = min(t0, t1);
+    float3 tmax = max(t0, t1);
+
+    float enter = max(max(tmin.x, tmin.y), max(tmin.z, 0.0f));
+    float exit = min(min(tmax.x, tmax.y), tmax.z);
+
+    //enforce a max distance if we should
+    if (maxIntersectTime >= 0.0 && enter > maxIntersectTime)
+        return false;
+
+    return enter <= exit;
 }
 
 //----------------------------------------------------------------------------
 void RayIntersectsModel (in float3 rayPos, in float3 rayDir, in ModelPrim modelPrim, inout SRayHitInfo rayHitInfo)
 {
-    // if the ray misses the bounding sphere of the mesh, it's a total miss
-    if (!RayIntersectsSphereBoolean(rayPos, rayDir, modelPrim.position_Radius.xyz, modelPrim.position_Radius.w, rayHitInfo.m_intersectTime))
-        return;
+    // put the ray into the object space of the model's mesh. The direction isn't normalized, so intersection times
+    // are the same in both spaces.
+    float3 objectRayPos = float3
+    (
+        dot(modelPrim.worldToObjectX, float4(rayPos, 1.0f)),
+        dot(modelPrim.worldToObjectY, float4(rayPos, 1.0f)),
+        dot(modelPrim.worldToObjectZ, float4(rayPos, 1.0f))
+    );
+    float3 objectRayDir = float3
+    (
+        dot(modelPrim.worldToObjectX.xyz, rayDir),
+        dot(modelPrim.worldToObjectY.xyz, rayDir),
+        dot(modelPrim.worldToObjectZ.xyz, rayDir)
+    );
+
+    // walk the BVH of the mesh, visiting the nearer child first so closer hits can cull farther nodes
+    float oldIntersectTime = rayHitInfo.m_intersectTime;
+    float3 rayInvDir = 1.0f / objectRayDir;
+    uint stack[c_bvhStackSize];
+    uint stackCount = 0;
+    uint nodeIndex = modelPrim.firstTriangle_lastTriangle_rootNode_firstLight.z;
+    while (true)
+    {
+        BVHNode node = BVHNodes[nodeIndex];
+        if (RayIntersectsBox(objectRayPos, rayInvDir, node.boundsMin_w.xyz, node.boundsMax_w.xyz, rayHitInfo.m_intersectTime))
+        {
+            uint firstPrim = node.rightChild_firstPrim_numPrims_splitAxis.y;
+            uint numPrims = node.rightChild_firstPrim_numPrims_splitAxis.z;
+
+            // leaf: test the triangles
+            if (numPrims > 0)
+            {
+                for (uint i = firstPrim; i < firstPrim + numPrims; ++i)
+                    RayIntersectsModelTriangle(objectRayPos, objectRayDir, ModelTriangles[i], rayHitInfo);
+            }
+            // interior node: the left child is the next node, the right child is stored
+            else
+            {
+                uint nearChild = nodeIndex + 1;
+                uint farChild = node.rightChild_firstPrim_numPrims_splitAxis.x;
+                if (objectRayDir[node.rightChild_firstPrim_numPrims_splitAxis.w] < 0.0f)
+                {
+                    nearChild = farChild;
+                    farChild = nodeIndex + 1;
+                }
+                stack[stackCount] = farChild;
+                ++stackCount;
+                nodeIndex = nearChild;
+                continue;
+            }
+        }
+
+        if (stackCount == 0)
+            break;
+        --stackCount;
+        nodeIndex = stack[stackCount];
+    }
+
+    // if this model was hit, normals go back to world space by the inverse transpose of worldToObject, and the light
+    // index of an emissive triangle goes into the Lights buffer
+    if (rayHitInfo.m_intersectTime != oldIntersectTime)
+    {
+        float3 normal = rayHitInfo.m_surfaceNormal;
+        rayHitInfo.m_surfaceNormal = normalize(normal.x * modelPrim.worldToObjectX.xyz + normal.y * modelPrim.worldToObjectY.xyz + normal.z * modelPrim.worldToObjectZ.xyz);
+        if (rayHitInfo.m_lightIndex >= 0)
+            rayHitInfo.m_lightIndex += int(modelPrim.firstTriangle_lastTriangle_rootNode_firstLight.w);
+    }
+}
+
+//----------------------------------------------------------------------------
+// true if the ray hits any triangle of the model no farther than maxIntersectTime. Stops at the first hit.
+bool RayIntersectsModelBoolean (in float3 rayPos, in float3 rayDir, in ModelPrim modelPrim, float maxIntersectTime)
+{
+    float3 objectRayPos = float3
+    (
+        dot(modelPrim.worldToObjectX, float4(rayPos, 1.0f)),
+        dot(modelPrim.worldToObjectY, float4(rayPos, 1.0f)),
+        dot(modelPrim.worldToObjectZ, float4(rayPos, 1.0f))
+    );
+    float3 objectRayDir = float3
+    (
+        dot(modelPrim.worldToObjectX.xyz, rayDir),
+        dot(modelPrim.worldToObjectY.xyz, rayDir),
+        dot(modelPrim.worldToObjectZ.xyz, rayDir)
+    );
 
-    // else test each triangle in the mesh
-    for (uint i = modelPrim.firstTriangle_lastTriangle_zw.x; i < modelPrim.firstTriangle_lastTriangle_zw.y; ++i)
-        RayIntersectsModelTriangle(rayPos, rayDir, ModelTriangles[i], rayHitInfo);
+    // any hit will do, so children are visited in stored order
+    float3 rayInvDir = 1.0f / objectRayDir;
+    uint stack[c_bvhStackSize];
+    uint stackCount = 0;
+    uint nodeIndex = modelPrim.firstTriangle_lastTriangle_rootNode_firstLight.z;
+    while (true)
+    {
+        BVHNode node = BVHNodes[nodeIndex];
+        if (RayIntersectsBox(objectRayPos, rayInvDir, node.boundsMin_w.xyz, node.boundsMax_w.xyz, maxIntersectTime))
+        {
+            uint firstPrim = node.rightChild_firstPrim_numPrims_splitAxis.y;
+            uint numPrims = node.rightChild_firstPrim_numPrims_splitAxis.z;
+            if (numPrims > 0)
+            {
+                for (uint i = firstPrim; i < firstPrim + numPrims; ++i)
+                {
+                    ModelTrianglePrim triangle = ModelTriangles[i];
+                    if (RayIntersectsTriangleBoolean(objectRayPos, objectRayDir, triangle.positionA_w.xyz, triangle.positionB_w.xyz, triangle.positionC_w.xyz, maxIntersectTime))
+                        return true;
+                }
+            }
+            else
+            {
+                stack[stackCount] = node.rightChild_firstPrim_numPrims_splitAxis.x;
+                ++stackCount;
+                nodeIndex = nodeIndex + 1;
+                continue;
+            }
+        }
+
+        if (stackCount == 0)
+            return false;
+        --stackCount;
+        nodeIndex = stack[stackCount];
+    }
+    return false;
+}
+
+//----------------------------------------------------------------------------
+void RayIntersectsScenePrimitive (in float3 rayPos, in float3 rayDir, in ScenePrimitive scenePrimitive, inout SRayHitInfo rayHitInfo)
+{
+    uint index = scenePrimitive.type_index_zw.y;
+    switch (scenePrimitive.type_index_zw.x)
+    {
+        case c_scenePrimitiveSphere: RayIntersectsSphere(rayPos, rayDir, Spheres[index], rayHitInfo); break;
+        case c_scenePrimitiveTriangle: RayIntersectsTriangle(rayPos, rayDir, Triangles[index], rayHitInfo); break;
+        case c_scenePrimitiveQuad: RayIntersectsQuad(rayPos, rayDir, Quads[index], rayHitInfo); break;
+        case c_scenePrimitiveOBB: RayIntersectsOBB(rayPos, rayDir, OBBs[index], rayHitInfo); break;
+        case c_scenePrimitiveModel: RayIntersectsModel(rayPos, rayDir, Models[index], rayHitInfo); break;
+    }
+}
+
+//----------------------------------------------------------------------------
+bool RayIntersectsScenePrimitiveBoolean (in float3 rayPos, in float3 rayDir, in ScenePrimitive scenePrimitive, float maxIntersectTime)
+{
+    uint index = scenePrimitive.type_index_zw.y;
+    switch (scenePrimitive.type_index_zw.x)
+    {
+        case c_scenePrimitiveSphere: return RayIntersectsSphereBoolean(rayPos, rayDir, Spheres[index].position_Radius.xyz, Spheres[index].position_Radius.w, maxIntersectTime);
+        case c_scenePrimitiveTriangle: return RayIntersectsTriangleBoolean(rayPos, rayDir, Triangles[index].positionA_w.xyz, Triangles[index].positionB_w.xyz, Triangles[index].positionC_w.xyz, maxIntersectTime);
+        case c_scenePrimitiveQuad: return RayIntersectsQuadBoolean(rayPos, rayDir, Quads[index], maxIntersectTime);
+        case c_scenePrimitiveOBB: return RayIntersectsOBBBoolean(rayPos, rayDir, OBBs[index], maxIntersectTime);
+        case c_scenePrimitiveModel: return RayIntersectsModelBoolean(rayPos, rayDir, Models[index], maxIntersectTime);
+    }
+    return false;
 }
 
 //----------------------------------------------------------------------------
@@ -456,116 +767,745 @@ SRayHitInfo ClosestIntersection (in float3 rayPos, in float3 rayDir)
 {
     SRayHitInfo rayHitInfo;
     rayHitInfo.m_intersectTime = -1.0f;
+    rayHitInfo.m_lightIndex = -1;
 
     rayPos += rayDir * c_rayEpsilon;
 
-    // spheres
-    {
-        int numSpheres = numSpheres_numTris_numOBBs_numQuads.x;
-        for (int i = 0; i < numSpheres; ++i)
-            RayIntersectsSphere(rayPos, rayDir, Spheres[i], rayHitInfo);
-    }
+    if (numModels_sceneRootNode_numScenePrims_numLights.z == 0)
+        return rayHitInfo;
 
-    // triangles
+    // walk the scene BVH, which holds the spheres, triangles, quads, obbs and models all together
+    float3 rayInvDir = 1.0f / rayDir;
+    uint stack[c_bvhStackSize];
+    uint stackCount = 0;
+    uint nodeIndex = numModels_sceneRootNode_numScenePrims_numLights.y;
+    while (true)
     {
-        int numTris = numSpheres_numTris_numOBBs_numQuads.y;
-        for (int i = 0; i < numTris; ++i)
-            RayIntersectsTriangle(rayPos, rayDir, Triangles[i], rayHitInfo);
+        BVHNode node = BVHNodes[nodeIndex];
+        if (RayIntersectsBox(rayPos, rayInvDir, node.boundsMin_w.xyz, node.boundsMax_w.xyz, rayHitInfo.m_intersectTime))
+        {
+            uint firstPrim = node.rightChild_firstPrim_numPrims_splitAxis.y;
+            uint numPrims = node.rightChild_firstPrim_numPrims_splitAxis.z;
+
+            // leaf: test the primitives
+            if (numPrims > 0)
+            {
+                for (uint i = firstPrim; i < firstPrim + numPrims; ++i)
+                    RayIntersectsScenePrimitive(rayPos, rayDir, ScenePrimitives[i], rayHitInfo);
+            }
+            // interior node: the left child is the next node, the right child is stored
+            else
+            {
+                uint nearChild = nodeIndex + 1;
+                uint farChild = node.rightChild_firstPrim_numPrims_splitAxis.x;
+                if (rayDir[node.rightChild_firstPrim_numPrims_splitAxis.w] < 0.0f)
+                {
+                    nearChild = farChild;
+                    farChild = nodeIndex + 1;
+                }
+                stack[stackCount] = farChild;
+                ++stackCount;
+                nodeIndex = nearChild;
+                continue;
+            }
+        }
+
+        if (stackCount == 0)
+            break;
+        --stackCount;
+        nodeIndex = stack[stackCount];
     }
 
-    // quads
+    return rayHitInfo;
+}
+
+//----------------------------------------------------------------------------
+// true if anything is between a and b. Stops at the first blocker found. Both ends are pulled in by c_rayEpsilon so
+// the surfaces the points are on don't count.
+bool OccludedBetween (in float3 a, in float3 b)
+{
+    if (numModels_sceneRootNode_numScenePrims_numLights.z == 0)
+        return false;
+
+    float dist = length(b - a);
+    float maxIntersectTime = dist - 2.0f * c_rayEpsilon;
+    if (maxIntersectTime <= 0.0f)
+        return false;
+    float3 rayDir = (b - a) / dist;
+    float3 rayPos = a + rayDir * c_rayEpsilon;
+
+    float3 rayInvDir = 1.0f / rayDir;
+    uint stack[c_bvhStackSize];
+    uint stackCount = 0;
+    uint nodeIndex = numModels_sceneRootNode_numScenePrims_numLights.y;
+    while (true)
     {
-        int numQuads = numSpheres_numTris_numOBBs_numQuads.w;
-        for (int i = 0; i < numQuads; ++i)
-            RayIntersectsQuad(rayPos, rayDir, Quads[i], rayHitInfo);
+        BVHNode node = BVHNodes[nodeIndex];
+        if (RayIntersectsBox(rayPos, rayInvDir, node.boundsMin_w.xyz, node.boundsMax_w.xyz, maxIntersectTime))
+        {
+            uint firstPrim = node.rightChild_firstPrim_numPrims_splitAxis.y;
+            uint numPrims = node.rightChild_firstPrim_numPrims_splitAxis.z;
+            if (numPrims > 0)
+            {
+                for (uint i = firstPrim; i < firstPrim + numPrims; ++i)
+                {
+                    if (RayIntersectsScenePrimitiveBoolean(rayPos, rayDir, ScenePrimitives[i], maxIntersectTime))
+                        return true;
+                }
+            }
+            else
+            {
+                stack[stackCount] = node.rightChild_firstPrim_numPrims_splitAxis.x;
+                ++stackCount;
+                nodeIndex = nodeIndex + 1;
+                continue;
+            }
+        }
+
+        if (stackCount == 0)
+            return false;
+        --stackCount;
+        nodeIndex = stack[stackCount];
     }
+    return false;
+}
+
+//----------------------------------------------------------------------------
+// Counter based random numbers. Each random number is a hash of the pixel, sample, bounce and dimension it's for, plus
+// a seed, instead of coming from a seed that gets advanced. Nothing depends on what ran before, so the C++ port gives
+// the same numbers, and a render comes out the same however it is split up between threads or frames.
+//----------------------------------------------------------------------------
+// pcg4d from "Hash Functions for GPU Rendering", Jarzynski and Olano: http://jcgt.org/published/0009/03/02/
+uint4 pcg4d (uint4 v)
+{
+    v = v * 1664525u + 1013904223u;
+    v.x += v.y * v.w;
+    v.y += v.z * v.x;
+    v.z += v.x * v.y;
+    v.w += v.y * v.z;
+    v ^= v >> 16u;
+    v.x += v.y * v.w;
+    v.y += v.z * v.x;
+    v.z += v.x * v.y;
+    v.w += v.y * v.z;
+    return v;
+}
 
-    // obbs
+//----------------------------------------------------------------------------
+// the top 24 bits as a float in [0, 1)
+float UintToFloat01 (uint u)
+{
+    return float(u >> 8) / 16777216.0f;
+}
+
+//----------------------------------------------------------------------------
+// The Sobol direction numbers of the two dimensions of a 2D Sobol point. Dimension 0 is the van der Corput sequence and
+// dimension 1 comes from the polynomial x + 1. Has to match c_sobolDirections in PathTraceCPU.h, which builds them.
+static const uint c_sobolDirections[2][32] =
+{
+    {
+        0x80000000, 0x40000000, 0x20000000, 0x10000000, 0x08000000, 0x04000000, 0x02000000, 0x01000000,
+        0x00800000, 0x00400000, 0x00200000, 0x00100000, 0x00080000, 0x00040000, 0x00020000, 0x00010000,
+        0x00008000, 0x00004000, 0x00002000, 0x00001000, 0x00000800, 0x00000400, 0x00000200, 0x00000100,
+        0x00000080, 0x00000040, 0x00000020, 0x00000010, 0x00000008, 0x00000004, 0x00000002, 0x00000001
+    },
     {
-        int numOBBs = numSpheres_numTris_numOBBs_numQuads.z;
-        for (int i = 0; i < numOBBs; ++i)
-            RayIntersectsOBB(rayPos, rayDir, OBBs[i], rayHitInfo);
+        0x80000000, 0xc0000000, 0xa0000000, 0xf0000000, 0x88000000, 0xcc000000, 0xaa000000, 0xff000000,
+        0x80800000, 0xc0c00000, 0xa0a00000, 0xf0f00000, 0x88880000, 0xcccc0000, 0xaaaa0000, 0xffff0000,
+        0x80008000, 0xc000c000, 0xa000a000, 0xf000f000, 0x88008800, 0xcc00cc00, 0xaa00aa00, 0xff00ff00,
+        0x80808080, 0xc0c0c0c0, 0xa0a0a0a0, 0xf0f0f0f0, 0x88888888, 0xcccccccc, 0xaaaaaaaa, 0xffffffff
     }
+};
 
-    // Models
+//----------------------------------------------------------------------------
+// The Sobol point of index in one dimension, as a 0.32 fixed point number
+uint Sobol (uint index, uint dimension)
+{
+    uint ret = 0;
+    for (uint bit = 0; index != 0; ++bit, index >>= 1)
     {
-        int numModels = numModels_yzw.x;
-        for (int i = 0; i < numModels; ++i)
-            RayIntersectsModel(rayPos, rayDir, Models[i], rayHitInfo);
+        if (index & 1)
+            ret ^= c_sobolDirections[dimension][bit];
     }
+    return ret;
+}
 
-    return rayHitInfo;
+//----------------------------------------------------------------------------
+// Owen scrambling from "Practical Hash-based Owen Scrambling", Burley: http://www.jcgt.org/published/0009/04/01/
+// The Laine Karras permutation flips each bit depending only on the bits below it, so done on the bit reversed value it
+// flips each bit depending on the bits above it, which is a nested uniform scramble.
+uint NestedUniformScramble (uint x, uint seed)
+{
+    x = reversebits(x);
+    x += seed;
+    x ^= x * 0x6c50b47cu;
+    x ^= x * 0xb82f1e52u;
+    x ^= x * 0xc7afe638u;
+    x ^= x * 0x8d22f6e6u;
+    return reversebits(x);
 }
 
 //----------------------------------------------------------------------------
-// Links to some shader friendly prngs:
-// https://www.shadertoy.com/view/4djSRW "Hash Without Sine" by Dave_Hoskins
-// https://www.shadertoy.com/view/MsV3z3 2d Weyl Hash by MBR
-// https://github.com/gheshu/gputracer/blob/master/src/depth.glsl#L43 From Lauren @lh0xfb
-// https://www.shadertoy.com/view/4tl3z4
+// The sample's point of a 2D Owen scrambled Sobol sequence. The index is shuffled and each dimension scrambled by the
+// hashes in scramble, so every pixel, bounce and dimension gets its own randomization of the same well stratified points.
+float2 ScrambledSobol2 (uint sampleIndex, uint4 scramble)
+{
+    uint index = NestedUniformScramble(sampleIndex, scramble.x);
+    return float2(UintToFloat01(NestedUniformScramble(Sobol(index, 0), scramble.y)), UintToFloat01(NestedUniformScramble(Sobol(index, 1), scramble.z)));
+}
+
+//----------------------------------------------------------------------------
+struct SRNG
+{
+    uint m_pixelIndex;
+    uint m_sampleIndex;
+    uint m_bounce;
+    uint m_dimension;
+    uint m_seed;
+    float m_blueNoise;  // the first random number of the sample from blue noise, or negative for white noise
+    bool m_sobol;       // Owen scrambled Sobol points instead of white or blue noise
+};
+
 //----------------------------------------------------------------------------
-// from "hash without sine" https://www.shadertoy.com/view/4djSRW
-//  2 out, 1 in...
-float2 hash21(inout float p)
+// sampleIndex counts every sample the pixel has taken since the accumulation started, across frames
+SRNG RNGInit (uint pixelIndex, uint sampleIndex, uint seed, float blueNoise, bool sobol)
 {
-    float3 p3 = frac(float3(p,p,p) * float3(0.1031f, 0.1030f, 0.0973f));
-    p3 += dot(p3, p3.yzx + 19.19);
-    float2 ret = frac((p3.xx + p3.yz)*p3.zy);
-    p += 0.3514;
+    SRNG rng;
+    rng.m_pixelIndex = pixelIndex;
+    rng.m_sampleIndex = sampleIndex;
+    rng.m_bounce = 0;
+    rng.m_dimension = 0;
+    rng.m_seed = seed;
+    rng.m_blueNoise = blueNoise;
+    rng.m_sobol = sobol;
+    return rng;
+}
+
+//----------------------------------------------------------------------------
+// the next two dimensions of the current bounce
+float2 RandomFloat2 (inout SRNG rng)
+{
+    // the Sobol scrambling can't depend on the sample index, or the samples wouldn't be points of the same sequence
+    if (rng.m_sobol)
+    {
+        float2 sobol = ScrambledSobol2(rng.m_sampleIndex, pcg4d(uint4(rng.m_pixelIndex, 0, (rng.m_bounce << 16) | rng.m_dimension, rng.m_seed)));
+        rng.m_dimension += 2;
+        return sobol;
+    }
+
+    uint4 hash = pcg4d(uint4(rng.m_pixelIndex, rng.m_sampleIndex, (rng.m_bounce << 16) | rng.m_dimension, rng.m_seed));
+    float2 ret = float2(UintToFloat01(hash.x), UintToFloat01(hash.y));
+
+    // With blue noise, the first dimension of the first bounce comes from cs_main in PathTrace.fx. It's the pixel's blue
+    // noise value plus sample index * golden ratio, which is a low discrepancy sequence over time that's blue over space.
+    if (rng.m_bounce == 0 && rng.m_dimension == 0 && rng.m_blueNoise >= 0.0f)
+        ret.x = rng.m_blueNoise;
+
+    rng.m_dimension += 2;
     return ret;
 }
 
 //----------------------------------------------------------------------------
-// from smallpt path tracer: http://www.kevinbeason.com/smallpt/
-float3 CosineSampleHemisphere (in float3 normal, inout float rngSeed)
+// the next dimension of the current bounce
+float RandomFloat (inout SRNG rng)
 {
-    float2 rnd = hash21(rngSeed);
+    if (rng.m_sobol)
+    {
+        uint4 scramble = pcg4d(uint4(rng.m_pixelIndex, 0, (rng.m_bounce << 16) | rng.m_dimension, rng.m_seed));
+        rng.m_dimension += 1;
+        return UintToFloat01(NestedUniformScramble(Sobol(NestedUniformScramble(rng.m_sampleIndex, scramble.x), 0), scramble.y));
+    }
 
-    float r1 = 2.0f * c_pi * rnd.x;
-    float r2 = rnd.y;
-    float r2s = sqrt(r2);
+    uint4 hash = pcg4d(uint4(rng.m_pixelIndex, rng.m_sampleIndex, (rng.m_bounce << 16) | rng.m_dimension, rng.m_seed));
+    rng.m_dimension += 1;
+    return UintToFloat01(hash.x);
+}
 
-    float3 w = normal;
-    float3 u;
+//----------------------------------------------------------------------------
+// u and v perpendicular to the unit vector w and each other
+void MakeBasis (in float3 w, out float3 u, out float3 v)
+{
     if (abs(w[0]) > 0.1f)
         u = cross(float3(0.0f, 1.0f, 0.0f), w);
     else
         u = cross(float3(1.0f, 0.0f, 0.0f), w);
 
     u = normalize(u);
-    float3 v = cross(w, u);
+    v = cross(w, u);
+}
+
+//----------------------------------------------------------------------------
+// from smallpt path tracer: http://www.kevinbeason.com/smallpt/
+float3 CosineSampleHemisphere (in float3 normal, inout SRNG rng)
+{
+    float2 rnd = RandomFloat2(rng);
+
+    float r1 = 2.0f * c_pi * rnd.x;
+    float r2 = rnd.y;
+    float r2s = sqrt(r2);
+
+    float3 w = normal;
+    float3 u, v;
+    MakeBasis(w, u, v);
     float3 d = (u*cos(r1)*r2s + v*sin(r1)*r2s + w*sqrt(1.0f - r2));
     d = normalize(d);
 
     return d;
 }
+
+//----------------------------------------------------------------------------
+//                              Light Sampling
+//----------------------------------------------------------------------------
+// a point on one of the lights, picked for next event estimation
+struct SLightSample
+{
+    float3 m_position;
+    float3 m_normal;
+    float3 m_emissive;
+    float  m_pdf;       // per unit area, including the chance of picking the light
+};
+
+//----------------------------------------------------------------------------
+// a uniformly distributed point on the triangle abc
+float3 SampleTriangle (in float3 a, in float3 b, in float3 c, in float2 rnd)
+{
+    float su = sqrt(rnd.x);
+    return a * (1.0f - su) + b * (su * (1.0f - rnd.y)) + c * (su * rnd.y);
+}
+
+//----------------------------------------------------------------------------
+// picks a light proportionally to its power with the alias table, in constant time
+uint PickLightAlias (float rnd)
+{
+    uint numLights = numModels_sceneRootNode_numScenePrims_numLights.w;
+    float slotFloat = rnd * float(numLights);
+    uint slot = min(uint(slotFloat), numLights - 1);
+    LightPrim light = Lights[slot];
+    return (slotFloat - float(slot) < light.selectionPDF_area_aliasThreshold_w.z) ? slot : light.alias_treeLeaf_zw.x;
+}
+
+//----------------------------------------------------------------------------
+// cos(a - b) for angles given as sines and cosines, which is 1 if a is smaller than b
+float CosSubClamped (float sinA, float cosA, float sinB, float cosB)
+{
+    if (cosA > cosB)
+        return 1.0f;
+    return cosA * cosB + sinA * sinB;
+}
+
+//----------------------------------------------------------------------------
+// sin(a - b), which is 0 if a is smaller than b
+float SinSubClamped (float sinA, float cosA, float sinB, float cosB)
+{
+    if (cosA > cosB)
+        return 0.0f;
+    return sinA * cosB - cosA * sinB;
+}
+
+//----------------------------------------------------------------------------
+// An upper bound on the light the emitters under the node could send to a surface at pos facing normal, up to a
+// constant. Same as LightBoundsImportance() in LightTree.h.
+float LightTreeNodeImportance (in float3 pos, in float3 normal, in LightTreeNode node)
+{
+    float power = node.boundsMin_power.w;
+    if (power <= 0.0f)
+        return 0.0f;
+
+    // distance to the center, but not less than the size of the bounds, so points inside or near them don't blow up
+    float3 boundsMin = node.boundsMin_power.xyz;
+    float3 boundsMax = node.boundsMax_cosTheta.xyz;
+    float3 center = (boundsMin + boundsMax) * 0.5f;
+    float3 toPos = pos - center;
+    float toPosLengthSq = dot(toPos, toPos);
+    float distSquared = max(toPosLengthSq, length(boundsMax - boundsMin) * 0.5f);
+
+    // the cone of directions from pos that the bounds subtend
+    float radiusSquared = dot(boundsMax - center, boundsMax - center);
+    float cosThetaB = -1.0f;
+    if (toPosLengthSq > radiusSquared)
+        cosThetaB = sqrt(max(1.0f - radiusSquared / toPosLengthSq, 0.0f));
+    float sinThetaB = sqrt(max(1.0f - cosThetaB * cosThetaB, 0.0f));
+
+    // the smallest angle between the normal cone and the direction to pos, over all points in the bounds
+    float cosTheta = node.boundsMax_cosTheta.w;
+    float3 dir = toPos / max(sqrt(toPosLengthSq), 1e-12f);
+    float cosThetaW = abs(dot(node.axis_w.xyz, dir));
+    float sinThetaW = sqrt(max(1.0f - cosThetaW * cosThetaW, 0.0f));
+    float sinThetaO = sqrt(max(1.0f - cosTheta * cosTheta, 0.0f));
+    float cosThetaX = CosSubClamped(sinThetaW, cosThetaW, sinThetaO, cosTheta);
+    float sinThetaX = SinSubClamped(sinThetaW, cosThetaW, sinThetaO, cosTheta);
+    float cosThetaP = CosSubClamped(sinThetaX, cosThetaX, sinThetaB, cosThetaB);
+    if (cosThetaP <= 0.0f)
+        return 0.0f;
+
+    // and the smallest angle between the surface normal and a direction into the bounds
+    float cosThetaI = abs(dot(dir, normal));
+    float sinThetaI = sqrt(max(1.0f - cosThetaI * cosThetaI, 0.0f));
+    float cosThetaPI = CosSubClamped(sinThetaI, cosThetaI, sinThetaB, cosThetaB);
+
+    return max(power * cosThetaP * cosThetaPI / distSquared, 0.0f);
+}
+
+//----------------------------------------------------------------------------
+// Picks a light for the surface at pos facing normal by walking the light tree from the root, choosing a child by its
+// importance and reusing the random number for the next choice. probability is the chance of having picked it, 0 if
+// no light could reach the surface.
+uint PickLightTree (in float3 pos, in float3 normal, float rnd, out float probability)
+{
+    probability = 1.0f;
+    uint nodeIndex = 0;
+    while (LightTreeNodes[nodeIndex].rightChild_light_parent_w.y == c_lightTreeInterior)
+    {
+        uint rightChild = LightTreeNodes[nodeIndex].rightChild_light_parent_w.x;
+        float leftImportance = LightTreeNodeImportance(pos, normal, LightTreeNodes[nodeIndex + 1]);
+        float rightImportance = LightTreeNodeImportance(pos, normal, LightTreeNodes[rightChild]);
+        if (leftImportance + rightImportance <= 0.0f)
+        {
+            probability = 0.0f;
+            return 0;
+        }
+
+        float leftProbability = leftImportance / (leftImportance + rightImportance);
+        if (rnd < leftProbability)
+        {
+            nodeIndex = nodeIndex + 1;
+            rnd = min(rnd / leftProbability, c_oneMinusEpsilon);
+            probability *= leftProbability;
+        }
+        else
+        {
+            nodeIndex = rightChild;
+            rnd = min((rnd - leftProbability) / (1.0f - leftProbability), c_oneMinusEpsilon);
+            probability *= 1.0f - leftProbability;
+        }
+    }
+    return LightTreeNodes[nodeIndex].rightChild_light_parent_w.y;
+}
+
+//----------------------------------------------------------------------------
+// the chance PickLightTree() had of picking the light, found by walking from its leaf up to the root
+float LightTreeProbability (in float3 pos, in float3 normal, uint lightIndex)
+{
+    float probability = 1.0f;
+    uint nodeIndex = Lights[lightIndex].alias_treeLeaf_zw.y;
+    while (nodeIndex != 0)
+    {
+        uint parent = LightTreeNodes[nodeIndex].rightChild_light_parent_w.z;
+        uint rightChild = LightTreeNodes[parent].rightChild_light_parent_w.x;
+        float leftImportance = LightTreeNodeImportance(pos, normal, LightTreeNodes[parent + 1]);
+        float rightImportance = LightTreeNodeImportance(pos, normal, LightTreeNodes[rightChild]);
+        if (leftImportance + rightImportance <= 0.0f)
+            return 0.0f;
+        probability *= ((nodeIndex == rightChild) ? rightImportance : leftImportance) / (leftImportance + rightImportance);
+        nodeIndex = parent;
+    }
+    return probability;
+}
+
+//----------------------------------------------------------------------------
+// picks a light by power, or with the light tree, and a point on it uniformly by area, to light pos with
+SLightSample SampleLight (in float3 pos, in float3 normal, inout SRNG rng, bool lightTree)
+{
+    SLightSample ret;
+    ret.m_position = float3(0.0f, 0.0f, 0.0f);
+    ret.m_normal = float3(0.0f, 0.0f, 0.0f);
+    ret.m_emissive = float3(0.0f, 0.0f, 0.0f);
+    ret.m_pdf = 0.0f;
+    if (numModels_sceneRootNode_numScenePrims_numLights.w == 0)
+        return ret;
+
+    float probability = 0.0f;
+    uint lightIndex;
+    if (lightTree)
+    {
+        lightIndex = PickLightTree(pos, normal, RandomFloat(rng), probability);
+        if (probability <= 0.0f)
+            return ret;
+    }
+    else
+    {
+        lightIndex = PickLightAlias(RandomFloat(rng));
+    }
+
+    LightPrim light = Lights[lightIndex];
+    if (!lightTree)
+        probability = light.selectionPDF_area_aliasThreshold_w.x;
+
+    float2 rnd = RandomFloat2(rng);
+    uint index = light.type_index_model_w.y;
+    if (light.type_index_model_w.x == c_scenePrimitiveSphere)
+    {
+        // uniformly on the hemisphere facing pos, which has every point of the sphere that pos can see
+        SpherePrim sphere = Spheres[index];
+        float3 w = normalize(pos - sphere.position_Radius.xyz);
+        float3 u, v;
+        MakeBasis(w, u, v);
+        float r = sqrt(max(1.0f - rnd.x * rnd.x, 0.0f));
+        float phi = 2.0f * c_pi * rnd.y;
+        ret.m_normal = u * (cos(phi) * r) + v * (sin(phi) * r) + w * rnd.x;
+        ret.m_position = sphere.position_Radius.xyz + ret.m_normal * sphere.position_Radius.w;
+        ret.m_emissive = sphere.emissive_lightIndex.xyz;
+    }
+    else if (light.type_index_model_w.x == c_scenePrimitiveTriangle)
+    {
+        TrianglePrim trianglePrim = Triangles[index];
+        ret.m_position = SampleTriangle(trianglePrim.positionA_w.xyz, trianglePrim.positionB_w.xyz, trianglePrim.positionC_w.xyz, rnd);
+        ret.m_normal = trianglePrim.normal_w.xyz;
+        ret.m_emissive = trianglePrim.emissive_lightIndex.xyz;
+    }
+    else if (light.type_index_model_w.x == c_scenePrimitiveQuad)
+    {
+        // pick triangle abc or acd by area, and stretch the random number used for that back to [0, 1)
+        QuadPrim quad = Quads[index];
+        float3 a = quad.positionA_w.xyz;
+        float3 c = quad.positionC_w.xyz;
+        float split = 0.5f * length(cross(quad.positionB_w.xyz - a, c - a)) / light.selectionPDF_area_aliasThreshold_w.y;
+        if (rnd.x < split)
+            ret.m_position = SampleTriangle(a, quad.positionB_w.xyz, c, float2(rnd.x / split, rnd.y));
+        else
+            ret.m_position = SampleTriangle(a, c, quad.positionD_w.xyz, float2(min((rnd.x - split) / (1.0f - split), 1.0f), rnd.y));
+        ret.m_normal = quad.normal_w.xyz;
+        ret.m_emissive = quad.emissive_lightIndex.xyz;
+    }
+    else if (light.type_index_model_w.x == c_scenePrimitiveModel)
+    {
+        // uniform in object space is uniform in world space, since the transform is affine
+        ModelPrim model = Models[light.type_index_model_w.z];
+        ModelTrianglePrim trianglePrim = ModelTriangles[index];
+        float4 objectPos = float4(SampleTriangle(trianglePrim.positionA_w.xyz, trianglePrim.positionB_w.xyz, trianglePrim.positionC_w.xyz, rnd), 1.0f);
+        ret.m_position = float3(dot(model.objectToWorldX, objectPos), dot(model.objectToWorldY, objectPos), dot(model.objectToWorldZ, objectPos));
+        float3 objectNormal = trianglePrim.normal_w.xyz;
+        ret.m_normal = normalize(objectNormal.x * model.worldToObjectX.xyz + objectNormal.y * model.worldToObjectY.xyz + objectNormal.z * model.worldToObjectZ.xyz);
+        ret.m_emissive = trianglePrim.emissive_lightIndex.xyz;
+    }
+    else
+        return ret;
+
+    ret.m_pdf = probability / light.selectionPDF_area_aliasThreshold_w.y;
+    return ret;
+}
+
+//----------------------------------------------------------------------------
+// the power heuristic weight of a sample taken with pdf, that could also have been taken with otherPdf
+float MISWeight (float pdf, float otherPdf)
+{
+    return pdf * pdf / (pdf * pdf + otherPdf * otherPdf);
+}
+
+//----------------------------------------------------------------------------
+// the solid angle pdf light sampling from the surface at pos facing normal had of picking the point on a light that a
+// ray in rayDir hit
+float LightPdf (in float3 pos, in float3 normal, in SRayHitInfo rayHitInfo, in float3 rayDir, bool lightTree)
+{
+    float4 selectionPDF_area_aliasThreshold_w = Lights[rayHitInfo.m_lightIndex].selectionPDF_area_aliasThreshold_w;
+    float cosLight = abs(dot(rayHitInfo.m_surfaceNormal, rayDir));
+    if (cosLight <= 0.0f)
+        return 0.0f;
+    float probability = lightTree ? LightTreeProbability(pos, normal, rayHitInfo.m_lightIndex) : selectionPDF_area_aliasThreshold_w.x;
+    return probability / selectionPDF_area_aliasThreshold_w.y * rayHitInfo.m_intersectTime * rayHitInfo.m_intersectTime / cosLight;
+}
+
 //----------------------------------------------------------------------------
-float3 Light_Outgoing (in SRayHitInfo rayHitInfo, in float3 rayHitPos, inout float rngSeed, bool whiteAlbedo)
+// Next event estimation. The light reaching the diffuse surface at pos from a light sample, weighted against the cosine
+// weighted bounce finding the same point, and still to be multiplied by the surface's albedo.
+float3 SampleDirectLight (in float3 pos, in float3 normal, inout SRNG rng, bool lightTree)
 {
+    SLightSample lightSample = SampleLight(pos, normal, rng, lightTree);
+    if (lightSample.m_pdf <= 0.0f)
+        return float3(0.0f, 0.0f, 0.0f);
+
+    float3 toLight = lightSample.m_position - pos;
+    float distSquared = dot(toLight, toLight);
+    float3 lightDir = toLight * rsqrt(distSquared);
+    float cosSurface = dot(normal, lightDir);
+    float cosLight = abs(dot(lightSample.m_normal, lightDir));
+    if (cosSurface <= 0.0f || cosLight <= 0.0f || OccludedBetween(pos, lightSample.m_position))
+        return float3(0.0f, 0.0f, 0.0f);
+
+    // the lambert BRDF times the cosine term is the cosine weighted pdf, times albedo
+    float lightPdf = lightSample.m_pdf * distSquared / cosLight;
+    float bouncePdf = cosSurface / c_pi;
+    return lightSample.m_emissive * (bouncePdf * MISWeight(lightPdf, bouncePdf) / lightPdf);
+}
+
+//----------------------------------------------------------------------------
+//                          Environment Sampling
+//----------------------------------------------------------------------------
+// see Environment.h for how the environment map and its CDFs are laid out
+float3 EnvironmentUVToDirection (float u, float v)
+{
+    float phi = 2.0f * c_pi * u;
+    float theta = c_pi * v;
+    float sinTheta = sin(theta);
+    return float3(sinTheta * cos(phi), cos(theta), sinTheta * sin(phi));
+}
+
+//----------------------------------------------------------------------------
+// the environment texel that light from rayDir comes from
+uint EnvironmentTexelIndex (in float3 rayDir)
+{
+    float u = atan2(rayDir.z, rayDir.x) / (2.0f * c_pi);
+    if (u < 0.0f)
+        u += 1.0f;
+    float v = acos(clamp(rayDir.y, -1.0f, 1.0f)) / c_pi;
+    uint x = min(uint(u * float(environmentWidth_environmentHeight_zw.x)), environmentWidth_environmentHeight_zw.x - 1);
+    uint y = min(uint(v * float(environmentWidth_environmentHeight_zw.y)), environmentWidth_environmentHeight_zw.y - 1);
+    return y * environmentWidth_environmentHeight_zw.x + x;
+}
+
+//----------------------------------------------------------------------------
+// the skybox color, which is the environment map in rayDir if the scene has one, else nearPlaneDist_missColor.yzw
+float3 MissColor (in float3 rayDir)
+{
+    if (environmentWidth_environmentHeight_zw.x > 0)
+        return EnvironmentTexels[EnvironmentTexelIndex(rayDir)].radiance_conditionalCDF.xyz;
+    return nearPlaneDist_missColor.yzw;
+}
+
+//----------------------------------------------------------------------------
+// The solid angle pdf SampleEnvironment() has of picking rayDir. The texel's probability is spread evenly over its area
+// in uv, and a unit of uv area covers 2 pi^2 sin(theta) steradians.
+float EnvironmentPdf (in float3 rayDir)
+{
+    float sinTheta = sqrt(max(1.0f - rayDir.y * rayDir.y, 0.0f));
+    if (sinTheta <= 0.0f)
+        return 0.0f;
+
+    uint width = environmentWidth_environmentHeight_zw.x;
+    uint texelIndex = EnvironmentTexelIndex(rayDir);
+    uint x = texelIndex % width;
+    uint y = texelIndex / width;
+    float rowProbability = EnvironmentRows[y].marginalCDF_yzw.x - (y > 0 ? EnvironmentRows[y - 1].marginalCDF_yzw.x : 0.0f);
+    float texelProbability = EnvironmentTexels[texelIndex].radiance_conditionalCDF.w - (x > 0 ? EnvironmentTexels[texelIndex - 1].radiance_conditionalCDF.w : 0.0f);
+    float uvPdf = rowProbability * float(environmentWidth_environmentHeight_zw.y) * texelProbability * float(width);
+    return uvPdf / (2.0f * c_pi * c_pi * sinTheta);
+}
+
+//----------------------------------------------------------------------------
+// Picks a direction towards the environment proportionally to luminance times solid angle, by finding the row in the
+// marginal CDF and then the texel in the row's conditional CDF. What's left of each random number after finding the
+// row or texel places the direction within the texel. radiance is the texel's, and pdf is the solid angle pdf.
+float3 SampleEnvironment (in float2 rnd, out float3 radiance, out float pdf)
+{
+    uint width = environmentWidth_environmentHeight_zw.x;
+    uint height = environmentWidth_environmentHeight_zw.y;
+
+    uint first = 0;
+    uint last = height - 1;
+    while (first < last)
+    {
+        uint middle = (first + last) / 2;
+        if (EnvironmentRows[middle].marginalCDF_yzw.x > rnd.y)
+            last = middle;
+        else
+            first = middle + 1;
+    }
+    uint y = first;
+    float rowStart = y > 0 ? EnvironmentRows[y - 1].marginalCDF_yzw.x : 0.0f;
+    float rowProbability = EnvironmentRows[y].marginalCDF_yzw.x - rowStart;
+
+    uint rowFirstTexel = y * width;
+    first = 0;
+    last = width - 1;
+    while (first < last)
+    {
+        uint middle = (first + last) / 2;
+        if (EnvironmentTexels[rowFirstTexel + middle].radiance_conditionalCDF.w > rnd.x)
+            last = middle;
+        else
+            first = middle + 1;
+    }
+    uint x = first;
+    float texelStart = x > 0 ? EnvironmentTexels[rowFirstTexel + x - 1].radiance_conditionalCDF.w : 0.0f;
+    float texelProbability = EnvironmentTexels[rowFirstTexel + x].radiance_conditionalCDF.w - texelStart;
+
+    float u = (float(x) + min((rnd.x - texelStart) / texelProbability, c_oneMinusEpsilon)) / float(width);
+    float v = (float(y) + min((rnd.y - rowStart) / rowProbability, c_oneMinusEpsilon)) / float(height);
+
+    float3 dir = EnvironmentUVToDirection(u, v);
+
+    radiance = EnvironmentTexels[rowFirstTexel + x].radiance_conditionalCDF.xyz;
+    // sin(theta) from the direction like EnvironmentPdf() finds it, so the two agree near the poles
+    float sinTheta = sqrt(max(1.0f - dir.y * dir.y, 0.0f));
+    pdf = (sinTheta > 0.0f) ? rowProbability * float(height) * texelProbability * float(width) / (2.0f * c_pi * c_pi * sinTheta) : 0.0f;
+    return dir;
+}
+
+//----------------------------------------------------------------------------
+// Next event estimation for the environment, like SampleDirectLight(). It's seen from pos if nothing is in the way for
+// c_environmentDistance.
+float3 SampleDirectEnvironment (in float3 pos, in float3 normal, inout SRNG rng)
+{
+    float3 radiance;
+    float environmentPdf;
+    float3 dir = SampleEnvironment(RandomFloat2(rng), radiance, environmentPdf);
+    float cosSurface = dot(normal, dir);
+    if (environmentPdf <= 0.0f || cosSurface <= 0.0f || OccludedBetween(pos, pos + dir * c_environmentDistance))
+        return float3(0.0f, 0.0f, 0.0f);
+
+    float bouncePdf = cosSurface / c_pi;
+    return radiance * (bouncePdf * MISWeight(environmentPdf, bouncePdf) / environmentPdf);
+}
+
+//----------------------------------------------------------------------------
+float3 Light_Outgoing (in SRayHitInfo rayHitInfo, in float3 rayHitPos, inout SRNG rng, bool whiteAlbedo, bool lightSampling, bool lightTree)
+{
+    bool environmentSampling = lightSampling && environmentWidth_environmentHeight_zw.x > 0;
+
     float3 lightSum = float3(0.0f, 0.0f, 0.0f);
     float3 lightMultiplier = float3(1.0f, 1.0f, 1.0f);
+    float emissiveWeight = 1.0f;
     
-    for (int i = 0; i <= c_numBounces; ++i)
+    for (uint i = 0; i <= maxBounces_rouletteStartBounce_zw.x; ++i)
     {
+        rng.m_bounce = i;
+        rng.m_dimension = 0;
+
         // update our light sum and future light multiplier
-        lightSum += rayHitInfo.m_emissive * lightMultiplier;
+        lightSum += rayHitInfo.m_emissive * lightMultiplier * emissiveWeight;
         if (!whiteAlbedo)
             lightMultiplier *= rayHitInfo.m_albedo;
 
         // add a random recursive sample for global illumination
-        float3 newRayDir = CosineSampleHemisphere(rayHitInfo.m_surfaceNormal, rngSeed);
+        float3 newRayDir = CosineSampleHemisphere(rayHitInfo.m_surfaceNormal, rng);
+
+        // light sampling, for the lights the bounce could hit before the path ends, and the environment if there is one
+        if (lightSampling && i < maxBounces_rouletteStartBounce_zw.x)
+            lightSum += SampleDirectLight(rayHitPos, rayHitInfo.m_surfaceNormal, rng, lightTree) * lightMultiplier;
+        if (environmentSampling && i < maxBounces_rouletteStartBounce_zw.x)
+            lightSum += SampleDirectEnvironment(rayHitPos, rayHitInfo.m_surfaceNormal, rng) * lightMultiplier;
+
+        // Russian roulette. Paths whose light multiplier has gotten small stop with probability 1 - max channel, and
+        // the ones that go on are divided by the chance they had of going on, so the expected value stays the same.
+        // Starting at bounce rouletteStartBounce, so a value past maxBounces turns it off.
+        if (i >= maxBounces_rouletteStartBounce_zw.y)
+        {
+            float survival = min(max(max(lightMultiplier.x, lightMultiplier.y), lightMultiplier.z), 1.0f);
+            if (RandomFloat(rng) >= survival)
+                return lightSum;
+            lightMultiplier /= survival;
+        }
+
         SRayHitInfo newRayHitInfo = ClosestIntersection(rayHitPos, newRayDir);
 
-        // if we hit something new, we continue
+        // if we hit something new, we continue. Light sampling could have found it too if it's a light.
         if (newRayHitInfo.m_intersectTime >= 0.0f)
         {
+            emissiveWeight = 1.0f;
+            if (lightSampling && newRayHitInfo.m_lightIndex >= 0)
+                emissiveWeight = MISWeight(dot(rayHitInfo.m_surfaceNormal, newRayDir) / c_pi, LightPdf(rayHitPos, rayHitInfo.m_surfaceNormal, newRayHitInfo, newRayDir, lightTree));
+
             rayHitInfo = newRayHitInfo;
             rayHitPos += newRayDir * newRayHitInfo.m_intersectTime;
         }
-        // else we missed so light using the miss color (skybox lighting) and return the light we've summed up
+        // else we missed so light using the miss color (skybox lighting) and return the light we've summed up. Environment
+        // sampling could have found it too, except on the last bounce.
         else
         {
-            lightSum += nearPlaneDist_missColor.yzw * lightMultiplier;
+            float missWeight = 1.0f;
+            if (environmentSampling && i < maxBounces_rouletteStartBounce_zw.x)
+                missWeight = MISWeight(dot(rayHitInfo.m_surfaceNormal, newRayDir) / c_pi, EnvironmentPdf(newRayDir));
+            lightSum += MissColor(newRayDir) * lightMultiplier * missWeight;
             return lightSum;
         }
     }
@@ -574,21 +1514,21 @@ float3 Light_Outgoing (in SRayHitInfo rayHitInfo, in float3 rayHitPos, inout flo
 }
 
 //----------------------------------------------------------------------------
-float3 Light_Incoming (in float3 rayPos, in float3 rayDir, inout float rngSeed, bool whiteAlbedo)
+float3 Light_Incoming (in float3 rayPos, in float3 rayDir, inout SRNG rng, bool whiteAlbedo, bool lightSampling, bool lightTree)
 {
     // find out what our ray hit first
     SRayHitInfo rayHitInfo = ClosestIntersection(rayPos, rayDir);
 
     // if it missed, return the miss color
     if (rayHitInfo.m_intersectTime < 0.0f)
-        return nearPlaneDist_missColor.yzw;
+        return MissColor(rayDir);
 
     // else, return the amount of light coming towards us from that point on the object we hit
-    return Light_Outgoing(rayHitInfo, rayPos + rayDir * rayHitInfo.m_intersectTime, rngSeed, whiteAlbedo);
+    return Light_Outgoing(rayHitInfo, rayPos + rayDir * rayHitInfo.m_intersectTime, rng, whiteAlbedo, lightSampling, lightTree);
 }
 
 //----------------------------------------------------------------------------
-float3 Light_Incoming (in float3 rayPos, in float3 rayDir, inout float rngSeed, in FirstRayHit firstRayHit, bool whiteAlbedo)
+float3 Light_Incoming (in float3 rayPos, in float3 rayDir, inout SRNG rng, in FirstRayHit firstRayHit, bool whiteAlbedo, bool lightSampling, bool lightTree)
 {
     // get our first ray hit from the info provided
     SRayHitInfo rayHitInfo;
@@ -596,11 +1536,37 @@ float3 Light_Incoming (in float3 rayPos, in float3 rayDir, inout float rngSeed,
     rayHitInfo.m_intersectTime = firstRayHit.surfaceNormal_intersectTime.w;
     rayHitInfo.m_albedo = firstRayHit.albedo_w.xyz;
     rayHitInfo.m_emissive = firstRayHit.emissive_w.xyz;
+    rayHitInfo.m_lightIndex = -1;
 
     // if it missed, return the miss color
     if (rayHitInfo.m_intersectTime < 0.0f)
-        return nearPlaneDist_missColor.yzw;
+        return MissColor(rayDir);
 
     // else, return the amount of light coming towards us from that point on the object we hit
-    return Light_Outgoing(rayHitInfo, rayPos + rayDir * rayHitInfo.m_intersectTime, rngSeed, whiteAlbedo);
+    return Light_Outgoing(rayHitInfo, rayPos + rayDir * rayHitInfo.m_intersectTime, rng, whiteAlbedo, lightSampling, lightTree);
+}
+
+//----------------------------------------------------------------------------
+//                            Adaptive Sampling
+//----------------------------------------------------------------------------
+static const float c_adaptiveLuminanceFloor = 0.05f;
+static const float c_adaptiveMaxPixelError = 1.0f;
+
+//----------------------------------------------------------------------------
+float Luminance (in float3 color)
+{
+    return dot(color, float3(0.299f, 0.587f, 0.114f));
+}
+
+//----------------------------------------------------------------------------
+// The relative standard error of a pixel's mean luminance, estimated from the mean and second moment of sampleCount
+// samples. Error is relative to at least c_adaptiveLuminanceFloor, so noise in near black pixels doesn't look huge, and
+// is clamped to c_adaptiveMaxPixelError so a few fireflies can't dominate a tile.
+float PixelError (in float meanLuminance, in float secondMoment, in float sampleCount)
+{
+    if (sampleCount < 2.0f)
+        return c_adaptiveMaxPixelError;
+
+    float variance = max(secondMoment - meanLuminance * meanLuminance, 0.0f) * sampleCount / (sampleCount - 1.0f);
+    return min(sqrt(variance / sampleCount) / max(meanLuminance, c_adaptiveLuminanceFloor), c_adaptiveMaxPixelError);
 }
\ No newline at end of file
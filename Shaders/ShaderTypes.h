@@ -15,9 +15,110 @@ SamplerState SamplerAnisoWrap;
 Texture2D pathTraceOutput;
 RWTexture2D<float4> pathTraceOutput_rw;
 
+Texture2D pathTraceMoments;
+RWTexture2D<float4> pathTraceMoments_rw;
+
 Texture2D blueNoise256;
 RWTexture2D<float4> blueNoise256_rw;
 
+Texture2D blueNoiseSpatiotemporal0;
+RWTexture2D<float4> blueNoiseSpatiotemporal0_rw;
+
+Texture2D blueNoiseSpatiotemporal1;
+RWTexture2D<float4> blueNoiseSpatiotemporal1_rw;
+
+Texture2D blueNoiseSpatiotemporal2;
+RWTexture2D<float4> blueNoiseSpatiotemporal2_rw;
+
+Texture2D blueNoiseSpatiotemporal3;
+RWTexture2D<float4> blueNoiseSpatiotemporal3_rw;
+
+Texture2D blueNoiseSpatiotemporal4;
+RWTexture2D<float4> blueNoiseSpatiotemporal4_rw;
+
+Texture2D blueNoiseSpatiotemporal5;
+RWTexture2D<float4> blueNoiseSpatiotemporal5_rw;
+
+Texture2D blueNoiseSpatiotemporal6;
+RWTexture2D<float4> blueNoiseSpatiotemporal6_rw;
+
+Texture2D blueNoiseSpatiotemporal7;
+RWTexture2D<float4> blueNoiseSpatiotemporal7_rw;
+
+Texture2D blueNoiseSpatiotemporal8;
+RWTexture2D<float4> blueNoiseSpatiotemporal8_rw;
+
+Texture2D blueNoiseSpatiotemporal9;
+RWTexture2D<float4> blueNoiseSpatiotemporal9_rw;
+
+Texture2D blueNoiseSpatiotemporal10;
+RWTexture2D<float4> blueNoiseSpatiotemporal10_rw;
+
+Texture2D blueNoiseSpatiotemporal11;
+RWTexture2D<float4> blueNoiseSpatiotemporal11_rw;
+
+Texture2D blueNoiseSpatiotemporal12;
+RWTexture2D<float4> blueNoiseSpatiotemporal12_rw;
+
+Texture2D blueNoiseSpatiotemporal13;
+RWTexture2D<float4> blueNoiseSpatiotemporal13_rw;
+
+Texture2D blueNoiseSpatiotemporal14;
+RWTexture2D<float4> blueNoiseSpatiotemporal14_rw;
+
+Texture2D blueNoiseSpatiotemporal15;
+RWTexture2D<float4> blueNoiseSpatiotemporal15_rw;
+
+Texture2D blueNoiseSpatiotemporal16;
+RWTexture2D<float4> blueNoiseSpatiotemporal16_rw;
+
+Texture2D blueNoiseSpatiotemporal17;
+RWTexture2D<float4> blueNoiseSpatiotemporal17_rw;
+
+Texture2D blueNoiseSpatiotemporal18;
+RWTexture2D<float4> blueNoiseSpatiotemporal18_rw;
+
+Texture2D blueNoiseSpatiotemporal19;
+RWTexture2D<float4> blueNoiseSpatiotemporal19_rw;
+
+Texture2D blueNoiseSpatiotemporal20;
+RWTexture2D<float4> blueNoiseSpatiotemporal20_rw;
+
+Texture2D blueNoiseSpatiotemporal21;
+RWTexture2D<float4> blueNoiseSpatiotemporal21_rw;
+
+Texture2D blueNoiseSpatiotemporal22;
+RWTexture2D<float4> blueNoiseSpatiotemporal22_rw;
+
+Texture2D blueNoiseSpatiotemporal23;
+RWTexture2D<float4> blueNoiseSpatiotemporal23_rw;
+
+Texture2D blueNoiseSpatiotemporal24;
+RWTexture2D<float4> blueNoiseSpatiotemporal24_rw;
+
+Texture2D blueNoiseSpatiotemporal25;
+RWTexture2D<float4> blueNoiseSpatiotemporal25_rw;
+
+Texture2D blueNoiseSpatiotemporal26;
+RWTexture2D<float4> blueNoiseSpatiotemporal26_rw;
+
+Texture2D blueNoiseSpatiotemporal27;
+RWTexture2D<float4> blueNoiseSpatiotemporal27_rw;
+
+Texture2D blueNoiseSpatiotemporal28;
+RWTexture2D<float4> blueNoiseSpatiotemporal28_rw;
+
+Texture2D blueNoiseSpatiotemporal29;
+RWTexture2D<float4> blueNoiseSpatiotemporal29_rw;
+
+Texture2D blueNoiseSpatiotemporal30;
+RWTexture2D<float4> blueNoiseSpatiotemporal30_rw;
+
+Texture2D blueNoiseSpatiotemporal31;
+RWTexture2D<float4> blueNoiseSpatiotemporal31_rw;
+
+Texture2DArray blueNoiseSpatiotemporal;
+
 Texture2D circleneg4;
 RWTexture2D<float4> circleneg4_rw;
 
@@ -85,13 +186,17 @@ cbuffer ConstantsOnce
   float4 uvmultiplier_blackPoint_whitePoint_triplanarPow;
   float4 overlayOpacity_yzw;
   uint4 numSpheres_numTris_numOBBs_numQuads;
-  uint4 numModels_yzw;
+  uint4 numModels_sceneRootNode_numScenePrims_numLights;
+  uint4 environmentWidth_environmentHeight_zw;
 };
 
 cbuffer ConstantsPerFrame
 {
-  float4 frameRnd_w;
+  uint4 rngSeed_yzw;
+  float4 adaptiveError_adaptiveMinSamples_zw;
   uint4 sampleCount_samplesPerFrame_zw;
+  uint4 maxBounces_rouletteStartBounce_zw;
+  uint4 sampler_lightPicker_zw;
 };
 
 //----------------------------------------------------------------------------
@@ -115,7 +220,7 @@ struct SpherePrim
 {
   float4 position_Radius;
   float4 albedo_w;
-  float4 emissive_w;
+  float4 emissive_lightIndex;
 };
 
 struct TrianglePrim
@@ -125,7 +230,7 @@ struct TrianglePrim
   float4 positionC_w;
   float4 normal_w;
   float4 albedo_w;
-  float4 emissive_w;
+  float4 emissive_lightIndex;
 };
 
 struct QuadPrim
@@ -136,7 +241,7 @@ struct QuadPrim
   float4 positionD_w;
   float4 normal_w;
   float4 albedo_w;
-  float4 emissive_w;
+  float4 emissive_lightIndex;
 };
 
 struct OBBPrim
@@ -147,13 +252,18 @@ struct OBBPrim
   float4 YAxis_w;
   float4 ZAxis_w;
   float4 albedo_w;
-  float4 emissive_w;
+  float4 emissive_lightIndex;
 };
 
 struct ModelPrim
 {
-  float4 position_Radius;
-  uint4 firstTriangle_lastTriangle_zw;
+  float4 worldToObjectX;
+  float4 worldToObjectY;
+  float4 worldToObjectZ;
+  float4 objectToWorldX;
+  float4 objectToWorldY;
+  float4 objectToWorldZ;
+  uint4 firstTriangle_lastTriangle_rootNode_firstLight;
 };
 
 struct ModelTrianglePrim
@@ -163,7 +273,44 @@ struct ModelTrianglePrim
   float4 positionC_w;
   float4 normal_w;
   float4 albedo_w;
-  float4 emissive_w;
+  float4 emissive_lightIndex;
+};
+
+struct BVHNode
+{
+  float4 boundsMin_w;
+  float4 boundsMax_w;
+  uint4 rightChild_firstPrim_numPrims_splitAxis;
+};
+
+struct ScenePrimitive
+{
+  uint4 type_index_zw;
+};
+
+struct LightPrim
+{
+  uint4 type_index_model_w;
+  uint4 alias_treeLeaf_zw;
+  float4 selectionPDF_area_aliasThreshold_w;
+};
+
+struct LightTreeNode
+{
+  float4 boundsMin_power;
+  float4 boundsMax_cosTheta;
+  float4 axis_w;
+  uint4 rightChild_light_parent_w;
+};
+
+struct EnvironmentTexel
+{
+  float4 radiance_conditionalCDF;
+};
+
+struct EnvironmentRow
+{
+  float4 marginalCDF_yzw;
 };
 
 struct FirstRayHit
@@ -188,6 +335,18 @@ StructuredBuffer<ModelPrim> Models;
 
 StructuredBuffer<ModelTrianglePrim> ModelTriangles;
 
+StructuredBuffer<BVHNode> BVHNodes;
+
+StructuredBuffer<ScenePrimitive> ScenePrimitives;
+
+StructuredBuffer<LightPrim> Lights;
+
+StructuredBuffer<LightTreeNode> LightTreeNodes;
+
+StructuredBuffer<EnvironmentTexel> EnvironmentTexels;
+
+StructuredBuffer<EnvironmentRow> EnvironmentRows;
+
 StructuredBuffer<FirstRayHit> FirstRayHits;
 RWStructuredBuffer<FirstRayHit> FirstRayHits_rw;
 
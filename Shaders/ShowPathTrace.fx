@@ -107,11 +107,11 @@ float3 GetPixelColor (SPixelInput input, bool greyScale, bool crossHatch, bool s
         SpherePrim sphere;
         sphere.position_Radius = float4(rayPos, 10.0f);
         sphere.albedo_w = float4(0.0f, 0.0f, 0.0f, 0.0f);
-        sphere.emissive_w = float4(0.0f, 0.0f, 0.0f, 0.0f);
+        sphere.emissive_lightIndex = float4(0.0f, 0.0f, 0.0f, -1.0f);
 
         RayIntersectsSphere(rayPos, rayDir, sphere, rayHitInfo);
 
-        light = nearPlaneDist_missColor.yzw;
+        light = MissColor(rayDir);
     }
 
     // store off the color sample for use with overlay opacity blending
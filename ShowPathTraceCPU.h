@@ -0,0 +1,147 @@
+#pragma once
+
+// C++ version of GetPixelColor() in Shaders/ShowPathTrace.fx, which turns the path traced HDR image into what is shown
+// on screen. Needs CPU_ONLY for the textures, and ShaderTypesInitTexturesCPU() to have been called for cross hatching.
+// There is no anisotropic filtering on the CPU, so the aniso option of the shader isn't here.
+
+#include "PathTraceCPU.h"
+
+//----------------------------------------------------------------------------
+inline float SmoothStep (float edge0, float edge1, float x)
+{
+    float t = (std::min)((std::max)((x - edge0) / (edge1 - edge0), 0.0f), 1.0f);
+    return t * t * (3.0f - 2.0f * t);
+}
+
+//----------------------------------------------------------------------------
+// triplanar sample of one slice of the cross hatching texture array, with uvs swapped and doubled for the perpendicular sample
+inline float SampleHatchingSlice (const float2 uvs[3], const float3& absNormal, float absNormalWeight, float slice, bool perpendicular)
+{
+    const CTextureCPU& dotsarray = ShaderData::Textures::dotsarray;
+    size_t sliceIndex = size_t((std::max)(slice, 0.0f));
+
+    float texel = 0.0f;
+    for (size_t axis = 0; axis < 3; ++axis)
+    {
+        float2 uv = perpendicular ? float2{ uvs[axis][1] * 2.0f, uvs[axis][0] * 2.0f } : uvs[axis];
+        texel += dotsarray.SampleLinearWrap(uv[0], uv[1], sliceIndex)[0] * absNormal[axis];
+    }
+    return texel / absNormalWeight;
+}
+
+//----------------------------------------------------------------------------
+inline float SampleHatchingTexture (const float3& worldPos, const float3& normal, float brightness, bool explicitCrossHatch)
+{
+    const float4& uvmultiplier_blackPoint_whitePoint_triplanarPow = ShaderData::ConstantBuffers::ConstantsOnce.Read().uvmultiplier_blackPoint_whitePoint_triplanarPow;
+
+    // caclulate the array slice to read
+    float w = brightness * float(ShaderData::Textures::dotsarray.NumSlices());
+
+    // triplanar projection sample the crosshatching texture
+    // manually lerp to get trilinear interpolation between slice samples
+    float2 uvs[3] =
+    {
+        { worldPos[1] * uvmultiplier_blackPoint_whitePoint_triplanarPow[0], worldPos[2] * uvmultiplier_blackPoint_whitePoint_triplanarPow[0] },
+        { worldPos[0] * uvmultiplier_blackPoint_whitePoint_triplanarPow[0], worldPos[2] * uvmultiplier_blackPoint_whitePoint_triplanarPow[0] },
+        { worldPos[0] * uvmultiplier_blackPoint_whitePoint_triplanarPow[0], worldPos[1] * uvmultiplier_blackPoint_whitePoint_triplanarPow[0] },
+    };
+
+    float3 absNormal;
+    for (size_t axis = 0; axis < 3; ++axis)
+        absNormal[axis] = std::pow(std::abs(normal[axis]), uvmultiplier_blackPoint_whitePoint_triplanarPow[3]);
+    float absNormalWeight = absNormal[0] + absNormal[1] + absNormal[2];
+
+    float crossHatchTexelFloor = SampleHatchingSlice(uvs, absNormal, absNormalWeight, std::floor(w), false);
+    float crossHatchTexelCeil = SampleHatchingSlice(uvs, absNormal, absNormalWeight, std::ceil(w), false);
+    float crossHatchTexel = crossHatchTexelFloor + (crossHatchTexelCeil - crossHatchTexelFloor) * Frac(w);
+
+    // do explicit cross hatching if we should, by doing a perpendicular sample with uv's *2, averaged in to the other
+    if (explicitCrossHatch)
+    {
+        crossHatchTexelFloor = SampleHatchingSlice(uvs, absNormal, absNormalWeight, std::floor(w), true);
+        crossHatchTexelCeil = SampleHatchingSlice(uvs, absNormal, absNormalWeight, std::ceil(w), true);
+        float otherCrossHatchTexel = crossHatchTexelFloor + (crossHatchTexelCeil - crossHatchTexelFloor) * Frac(w);
+
+        crossHatchTexel = (crossHatchTexel + otherCrossHatchTexel) * 0.5f;
+    }
+
+    return crossHatchTexel;
+}
+
+//----------------------------------------------------------------------------
+// light is the path traced value for the pixel at uv, which is the pixel's center like the pixel shader gets.
+inline float3 GetPixelColor (const SCamera& camera, float u, float v, float3 light, const ShaderTypes::StructuredBuffers::FirstRayHit& firstRayHit, bool greyScale, bool crossHatch, bool smoothStep, bool explicitCrossHatch)
+{
+    const ShaderTypes::ConstantBuffers::ConstantsOnce& constants = ShaderData::ConstantBuffers::ConstantsOnce.Read();
+
+    // get our first ray hit info
+    SRayHitInfo rayHitInfo;
+    rayHitInfo.m_surfaceNormal = XYZ(firstRayHit.surfaceNormal_intersectTime);
+    rayHitInfo.m_intersectTime = firstRayHit.surfaceNormal_intersectTime[3];
+    rayHitInfo.m_albedo = XYZ(firstRayHit.albedo_w);
+    rayHitInfo.m_emissive = XYZ(firstRayHit.emissive_w);
+
+    // calculate the ray for this pixel and get the time of the first ray hit
+    float3 rayPos, rayDir;
+    CalculateRay(camera, u, v, rayPos, rayDir);
+
+    // if the ray didn't hit anything, fake a planar hit for shading purposes
+    if (rayHitInfo.m_intersectTime < 0.0f)
+    {
+        // alternately could position the sphere at rayPos, but that makes the triplanar projection change as the camera moves!
+        rayPos = { 0.0f, 0.0f, 0.0f };
+
+        ShaderTypes::StructuredBuffers::SpherePrim sphere;
+        sphere.position_Radius = { rayPos[0], rayPos[1], rayPos[2], 10.0f };
+        sphere.albedo_w = { 0.0f, 0.0f, 0.0f, 0.0f };
+        sphere.emissive_lightIndex = { 0.0f, 0.0f, 0.0f, -1.0f };
+
+        RayIntersectsSphere(rayPos, rayDir, sphere, rayHitInfo);
+
+        light = MissColor(rayDir);
+    }
+
+    // store off the color sample for use with overlay opacity blending
+    float3 colorSample = light;
+
+    // reinhard operator to convert from HDR to SDR
+    for (float& channel : light)
+        channel = channel / (channel + 1.0f);
+
+    // get the brightness of this SDR RGB value. aka get Y from YUV.
+    float brightness = Dot(light, { 0.299f, 0.587f, 0.114f });
+
+    // remap the brightness using the black point / white point
+    const float4& uvmultiplier_blackPoint_whitePoint_triplanarPow = constants.uvmultiplier_blackPoint_whitePoint_triplanarPow;
+    brightness = uvmultiplier_blackPoint_whitePoint_triplanarPow[1] + brightness * (uvmultiplier_blackPoint_whitePoint_triplanarPow[2] - uvmultiplier_blackPoint_whitePoint_triplanarPow[1]);
+
+    // smoothstep the result if we are supposed to
+    if (smoothStep)
+        brightness = SmoothStep(0.0f, 1.0f, brightness);
+
+    // apply cross hatching
+    if (crossHatch)
+    {
+        // get the color of the cross hatched texel at this location
+        float3 pixelPos = rayPos + rayDir * rayHitInfo.m_intersectTime;
+        float crossHatchTexel = SampleHatchingTexture(pixelPos, rayHitInfo.m_surfaceNormal, brightness, explicitCrossHatch);
+
+        // apply crosshatching texture
+        if (greyScale)
+            light = { crossHatchTexel, crossHatchTexel, crossHatchTexel };
+        else
+            light = light * crossHatchTexel;
+    }
+    else if (greyScale)
+    {
+        light = { brightness, brightness, brightness };
+    }
+
+    // do overlay opacity blending
+    light = colorSample + (light - colorSample) * constants.overlayOpacity_yzw[0];
+
+    // return sRGB corrected value
+    for (float& channel : light)
+        channel = std::pow(channel, 1.0f / 2.0f);
+    return light;
+}
\ No newline at end of file
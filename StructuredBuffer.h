@@ -1,12 +1,14 @@
 #pragma once
 
 #include <array>
+#include "Utils.h"
 
 template <typename T, size_t NUMELEMENTS>
 class CStructuredBuffer
 {
 public:
 
+#ifndef CPU_ONLY
     bool Create (ID3D11Device* device, bool CPUWrites, const char* debugName)
     {
         // CPU write, GPU read
@@ -72,9 +74,10 @@ public:
 
         return true;
     }
+#endif
 
     template <typename LAMBDA>
-    void WriteNoFlush (LAMBDA& lambda)
+    void WriteNoFlush (LAMBDA&& lambda)
     {
         // let the caller write to the storage. They can accept it as a reference
         lambda(m_storage);
@@ -82,6 +85,10 @@ public:
 
     bool FlushWrites (ID3D11DeviceContext* deviceContext)
     {
+#ifdef CPU_ONLY
+        // CPU only builds just use the storage
+        return true;
+#else
         // prepare to write to the structred buffer
         HRESULT result;
         D3D11_MAPPED_SUBRESOURCE mappedResource;
@@ -100,10 +107,11 @@ public:
         // We are done writing
         deviceContext->Unmap(m_structuredBuffer.m_ptr, 0);
         return true;
+#endif
     }
 
     template <typename LAMBDA>
-    bool Write (ID3D11DeviceContext* deviceContext, LAMBDA& lambda)
+    bool Write (ID3D11DeviceContext* deviceContext, LAMBDA&& lambda)
     {
         WriteNoFlush(lambda);
         return FlushWrites(deviceContext);
@@ -111,14 +119,21 @@ public:
 
     const std::array<T, NUMELEMENTS>& Read () const { return m_storage; }
 
+#ifndef CPU_ONLY
     ID3D11ShaderResourceView* GetSRV () { return m_structuredBufferSRV.m_ptr; }
     ID3D11UnorderedAccessView* GetUAV() { return m_structuredBufferUAV.m_ptr; }
+#else
+    // CPU kernels write to the storage directly, like a shader writes through the UAV
+    std::array<T, NUMELEMENTS>& GetUAV () { return m_storage; }
+#endif
 
 private:
 
     std::array<T, NUMELEMENTS> m_storage;
 
+#ifndef CPU_ONLY
     CAutoReleasePointer<ID3D11Buffer> m_structuredBuffer;
     CAutoReleasePointer<ID3D11ShaderResourceView> m_structuredBufferSRV;
     CAutoReleasePointer<ID3D11UnorderedAccessView> m_structuredBufferUAV;
+#endif
 };
\ No newline at end of file
@@ -8,6 +8,10 @@
 #include <random>
 #include <chrono>
 #include <complex>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
 
 typedef uint8_t uint8;
 
@@ -283,6 +287,37 @@ bool ImageSave (const SImageData &image, const char *fileName)
     return true;
 }
  
+//======================================================================================
+// Saves an uncompressed 24 bit targa, which is what the path tracer loads (see Targa.h). The rows go bottom up like
+// they do in a bitmap, so they are written out as is, just without the padding.
+bool ImageSaveTGA (const SImageData &image, const char *fileName)
+{
+    // open the file if we can
+    FILE *file;
+    file = fopen(fileName, "wb");
+    if (!file) {
+        printf("Could not save %s\n", fileName);
+        return false;
+    }
+
+    // make the header: uncompressed true color, with the origin at the bottom left
+    uint8 header[18] = { 0 };
+    header[2] = 2;
+    header[12] = uint8(image.m_width & 0xFF);
+    header[13] = uint8(image.m_width >> 8);
+    header[14] = uint8(image.m_height & 0xFF);
+    header[15] = uint8(image.m_height >> 8);
+    header[16] = 24;
+
+    // write the data and close the file
+    fwrite(header, sizeof(header), 1, file);
+    for (size_t rowIndex = 0; rowIndex < image.m_height; ++rowIndex)
+        fwrite(&image.m_pixels[rowIndex * image.m_pitch], image.m_width * 3, 1, file);
+    fclose(file);
+
+    return true;
+}
+
 //======================================================================================
 void ImageInit (SImageData& image, size_t width, size_t height)
 {
@@ -797,9 +832,439 @@ void GenerateTAM (const char* baseFileName, size_t dimensions, size_t numShades,
     }
 }
 
+//======================================================================================
+//                                     CThreadPool
+//======================================================================================
+// Splits a range into one chunk per hardware thread and runs a function on each chunk, with the calling thread doing
+// the first one. The threads wait around between calls, since void and cluster makes a call for every pixel.
+class CThreadPool
+{
+public:
+    CThreadPool ()
+    {
+        size_t numThreads = max(std::thread::hardware_concurrency(), 1u);
+        for (size_t i = 1; i < numThreads; ++i)
+            m_threads.emplace_back([this, i] () { WorkerThread(i); });
+    }
+
+    ~CThreadPool ()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_quit = true;
+        }
+        m_wake.notify_all();
+        for (std::thread& thread : m_threads)
+            thread.join();
+    }
+
+    size_t NumChunks () const { return m_threads.size() + 1; }
+
+    // calls chunkFunction(chunkIndex, begin, end) for each of the NumChunks() chunks of [0, count) and waits for them all
+    void ForEachChunk (size_t count, const std::function<void(size_t, size_t, size_t)>& chunkFunction)
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_count = count;
+            m_chunkFunction = &chunkFunction;
+            m_pending = m_threads.size();
+            ++m_generation;
+        }
+        m_wake.notify_all();
+
+        RunChunk(0);
+
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_done.wait(lock, [this] () { return m_pending == 0; });
+    }
+
+private:
+    void RunChunk (size_t chunkIndex)
+    {
+        size_t begin = m_count * chunkIndex / NumChunks();
+        size_t end = m_count * (chunkIndex + 1) / NumChunks();
+        (*m_chunkFunction)(chunkIndex, begin, end);
+    }
+
+    void WorkerThread (size_t chunkIndex)
+    {
+        uint64_t generation = 0;
+        while (true)
+        {
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_wake.wait(lock, [&] () { return m_quit || m_generation != generation; });
+                if (m_quit)
+                    return;
+                generation = m_generation;
+            }
+
+            RunChunk(chunkIndex);
+
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                --m_pending;
+            }
+            m_done.notify_one();
+        }
+    }
+
+    std::vector<std::thread> m_threads;
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+    std::condition_variable m_done;
+    uint64_t m_generation = 0;
+    size_t m_pending = 0;
+    bool m_quit = false;
+
+    size_t m_count = 0;
+    const std::function<void(size_t, size_t, size_t)>* m_chunkFunction = nullptr;
+};
+
+//======================================================================================
+// In place radix 2 fast fourier transform of count values that are stride apart. count needs to be a power of 2. The
+// inverse divides by count, so that a transform followed by an inverse transform gives back what went in.
+void FFT (std::complex<float>* data, size_t count, size_t stride, bool inverse)
+{
+    // put the values in bit reversed order
+    for (size_t i = 1, j = 0; i < count; ++i)
+    {
+        size_t bit = count >> 1;
+        for (; j & bit; bit >>= 1)
+            j ^= bit;
+        j ^= bit;
+        if (i < j)
+            std::swap(data[i * stride], data[j * stride]);
+    }
+
+    // combine pairs of transforms into transforms twice as long, until there's one of all of them
+    for (size_t length = 2; length <= count; length <<= 1)
+    {
+        float angle = (inverse ? 2.0f : -2.0f) * c_pi / float(length);
+        for (size_t start = 0; start < count; start += length)
+        {
+            for (size_t i = 0; i < length / 2; ++i)
+            {
+                std::complex<float>& a = data[(start + i) * stride];
+                std::complex<float>& b = data[(start + i + length / 2) * stride];
+                std::complex<float> t = b * std::polar(1.0f, angle * float(i));
+                b = a - t;
+                a += t;
+            }
+        }
+    }
+
+    if (inverse)
+    {
+        for (size_t i = 0; i < count; ++i)
+            data[i * stride] /= float(count);
+    }
+}
+
+//======================================================================================
+// 3d FFT of a width x height x depth volume stored a slice at a time, done as 1d FFTs along each axis in turn. The
+// lines along an axis don't depend on each other, so they are split between the threads.
+void FFTVolume (std::vector<std::complex<float>>& data, size_t width, size_t height, size_t depth, bool inverse, CThreadPool& threadPool)
+{
+    threadPool.ForEachChunk(height * depth, [&] (size_t chunkIndex, size_t begin, size_t end) {
+        for (size_t line = begin; line < end; ++line)
+            FFT(&data[line * width], width, 1, inverse);
+    });
+
+    threadPool.ForEachChunk(width * depth, [&] (size_t chunkIndex, size_t begin, size_t end) {
+        for (size_t line = begin; line < end; ++line)
+            FFT(&data[(line / width) * width * height + line % width], height, width, inverse);
+    });
+
+    threadPool.ForEachChunk(width * height, [&] (size_t chunkIndex, size_t begin, size_t end) {
+        for (size_t line = begin; line < end; ++line)
+            FFT(&data[line], depth, width * height, inverse);
+    });
+}
+
+//======================================================================================
+//                               CSpatiotemporalBlueNoise
+//======================================================================================
+// Makes a stack of depth slices, each dimensions x dimensions, where every slice is blue noise and every pixel's values
+// down the stack are blue noise too. The path tracer reads slice N mod depth on frame N, so each frame's noise is blue
+// over the screen, and each pixel's values over the frames are spread out instead of clumping up.
+//
+// This is void and cluster (Ulichney 1993) with the energy from "Scalar Spatiotemporal Blue Noise Masks" (Wolfe et al
+// 2022): a gaussian over the other pixels of the same slice, plus a gaussian over the same pixel in the other slices,
+// both wrapping around. Nothing else adds energy, so pixels in different slices at different places don't push each
+// other apart. The energy of the whole volume is the points convolved with that kernel, which is done with FFTs.
+// Adding or removing a point after that only changes the energy of its slice and of its pixel in the other slices,
+// which is cheap to update directly, but float error builds up over the thousands of updates, so the FFT redoes the
+// whole thing every slice's worth of points. Finding the tightest cluster or largest void looks at every pixel of the
+// volume, so that is split between threads.
+static const float c_stbnSigmaSpatial = 1.9f;
+static const float c_stbnSigmaTemporal = 1.9f;
+static const float c_stbnInitialDensity = 0.1f;     // the fraction of pixels that are points in the initial pattern
+
+class CSpatiotemporalBlueNoise
+{
+public:
+    CSpatiotemporalBlueNoise (size_t dimensions, size_t depth, CThreadPool& threadPool)
+        : m_dimensions(dimensions)
+        , m_depth(depth)
+        , m_sliceSize(dimensions * dimensions)
+        , m_threadPool(threadPool)
+    {
+        m_points.resize(m_sliceSize * m_depth, 0);
+        m_energy.resize(m_sliceSize * m_depth, 0.0f);
+        m_chunkBest.resize(m_threadPool.NumChunks());
+
+        // the kernel, without the point itself
+        m_spatialKernel.resize(m_sliceSize);
+        for (size_t y = 0; y < m_dimensions; ++y)
+        {
+            for (size_t x = 0; x < m_dimensions; ++x)
+            {
+                float dx = float(min(x, m_dimensions - x));
+                float dy = float(min(y, m_dimensions - y));
+                m_spatialKernel[y * m_dimensions + x] = std::exp(-(dx * dx + dy * dy) / (2.0f * c_stbnSigmaSpatial * c_stbnSigmaSpatial));
+            }
+        }
+        m_spatialKernel[0] = 0.0f;
+
+        m_temporalKernel.resize(m_depth);
+        for (size_t t = 0; t < m_depth; ++t)
+        {
+            float dt = float(min(t, m_depth - t));
+            m_temporalKernel[t] = std::exp(-(dt * dt) / (2.0f * c_stbnSigmaTemporal * c_stbnSigmaTemporal));
+        }
+        m_temporalKernel[0] = 0.0f;
+
+        // the frequency domain kernel, for CalculateEnergy()
+        m_kernelFFT.assign(m_sliceSize * m_depth, std::complex<float>(0.0f, 0.0f));
+        for (size_t i = 0; i < m_sliceSize; ++i)
+            m_kernelFFT[i] = m_spatialKernel[i];
+        for (size_t t = 0; t < m_depth; ++t)
+            m_kernelFFT[t * m_sliceSize] += m_temporalKernel[t];
+        FFTVolume(m_kernelFFT, m_dimensions, m_dimensions, m_depth, false, m_threadPool);
+    }
+
+    // Gives every pixel of the volume its rank, which is the order that void and cluster would turn them into points
+    void Generate (std::vector<size_t>& ranks)
+    {
+        size_t count = m_points.size();
+        ranks.resize(count);
+
+        // seed the random number generator
+        static std::random_device rd;
+        static std::mt19937 rng(rd());
+
+        // make the initial pattern out of white noise
+        size_t numInitialPoints = max(size_t(float(count) * c_stbnInitialDensity), size_t(1));
+        std::uniform_int_distribution<size_t> dist(0, count - 1);
+        for (size_t placed = 0; placed < numInitialPoints; )
+        {
+            size_t index = dist(rng);
+            if (!m_points[index])
+            {
+                m_points[index] = 1;
+                ++placed;
+            }
+        }
+        CalculateEnergy();
+
+        // move the point in the tightest cluster to the largest void until that doesn't move it anymore. The limit is
+        // just in case it gets stuck going back and forth between two patterns.
+        printf("Initial pattern\n");
+        for (size_t swap = 0; swap < count; ++swap)
+        {
+            size_t cluster = FindTightestCluster();
+            TogglePoint(cluster);
+            size_t largestVoid = FindLargestVoid();
+            TogglePoint(largestVoid);
+            if (largestVoid == cluster)
+                break;
+        }
+        CalculateEnergy();
+        std::vector<uint8> initialPoints = m_points;
+        std::vector<float> initialEnergy = m_energy;
+
+        // phase 1: rank the initial points by taking away the one in the tightest cluster, until there are none left
+        printf("Phase 1\n");
+        for (size_t rank = numInitialPoints; rank > 0; --rank)
+        {
+            size_t cluster = FindTightestCluster();
+            TogglePoint(cluster);
+            ranks[cluster] = rank - 1;
+            UpdateProgress(numInitialPoints - rank, numInitialPoints);
+        }
+        printf("\n");
+
+        // phase 2 and 3: go back to the initial pattern and fill the largest void until every pixel is a point. The
+        // original algorithm switches to finding the tightest cluster of the empty pixels half way through, but with
+        // a kernel that is the same everywhere, that's the same pixel as the largest void.
+        printf("Phase 2\n");
+        m_points = initialPoints;
+        m_energy = initialEnergy;
+        for (size_t rank = numInitialPoints; rank < count; ++rank)
+        {
+            size_t largestVoid = FindLargestVoid();
+            TogglePoint(largestVoid);
+            ranks[largestVoid] = rank;
+            UpdateProgress(rank - numInitialPoints, count - numInitialPoints);
+        }
+        printf("\n");
+    }
+
+private:
+    // every point's energy, from scratch
+    void CalculateEnergy ()
+    {
+        std::vector<std::complex<float>> volume(m_points.size());
+        for (size_t i = 0; i < m_points.size(); ++i)
+            volume[i] = m_points[i] ? 1.0f : 0.0f;
+
+        FFTVolume(volume, m_dimensions, m_dimensions, m_depth, false, m_threadPool);
+        for (size_t i = 0; i < volume.size(); ++i)
+            volume[i] *= m_kernelFFT[i];
+        FFTVolume(volume, m_dimensions, m_dimensions, m_depth, true, m_threadPool);
+
+        for (size_t i = 0; i < volume.size(); ++i)
+            m_energy[i] = volume[i].real();
+        m_togglesSinceCalculate = 0;
+    }
+
+    // adds a point if there isn't one, else removes it, and updates the energy to match
+    void TogglePoint (size_t index)
+    {
+        size_t slice = index / m_sliceSize;
+        size_t pixel = index % m_sliceSize;
+        size_t pixelX = pixel % m_dimensions;
+        size_t pixelY = pixel / m_dimensions;
+        float sign = m_points[index] ? -1.0f : 1.0f;
+        m_points[index] ^= 1;
+
+        if (++m_togglesSinceCalculate >= m_sliceSize)
+        {
+            CalculateEnergy();
+            return;
+        }
+
+        float* energy = &m_energy[slice * m_sliceSize];
+        for (size_t y = 0; y < m_dimensions; ++y)
+        {
+            const float* kernelRow = &m_spatialKernel[((y + m_dimensions - pixelY) % m_dimensions) * m_dimensions];
+            for (size_t x = 0; x < m_dimensions; ++x)
+                energy[y * m_dimensions + x] += sign * kernelRow[(x + m_dimensions - pixelX) % m_dimensions];
+        }
+
+        for (size_t t = 0; t < m_depth; ++t)
+            m_energy[t * m_sliceSize + pixel] += sign * m_temporalKernel[(t + m_depth - slice) % m_depth];
+    }
+
+    size_t FindTightestCluster ()
+    {
+        return FindMostEnergy(1, 1.0f);
+    }
+
+    size_t FindLargestVoid ()
+    {
+        return FindMostEnergy(0, -1.0f);
+    }
+
+    // Finds the pixel with the most energy times scale, out of the ones that are or aren't points. Ties go to the lowest
+    // index, so the answer doesn't depend on how many threads there are.
+    size_t FindMostEnergy (uint8 isPoint, float scale)
+    {
+        m_threadPool.ForEachChunk(m_points.size(), [&] (size_t chunkIndex, size_t begin, size_t end) {
+            size_t best = SIZE_MAX;
+            float bestEnergy = 0.0f;
+            for (size_t i = begin; i < end; ++i)
+            {
+                float energy = m_energy[i] * scale;
+                if (m_points[i] == isPoint && (best == SIZE_MAX || energy > bestEnergy))
+                {
+                    best = i;
+                    bestEnergy = energy;
+                }
+            }
+            m_chunkBest[chunkIndex] = best;
+        });
+
+        size_t best = SIZE_MAX;
+        for (size_t chunkBest : m_chunkBest)
+        {
+            if (chunkBest != SIZE_MAX && (best == SIZE_MAX || m_energy[chunkBest] * scale > m_energy[best] * scale))
+                best = chunkBest;
+        }
+        return best;
+    }
+
+    static void UpdateProgress (size_t done, size_t total)
+    {
+        size_t tick = total / 100;
+        if (tick == 0 || done % tick == 0)
+            printf("               \r%i%%  (%zu / %zu)\r", int(100.0f*float(done) / float(total)), done, total);
+    }
+
+    size_t m_dimensions;
+    size_t m_depth;
+    size_t m_sliceSize;
+    CThreadPool& m_threadPool;
+
+    std::vector<float> m_spatialKernel;
+    std::vector<float> m_temporalKernel;
+    std::vector<std::complex<float>> m_kernelFFT;
+
+    std::vector<uint8> m_points;
+    std::vector<float> m_energy;
+    size_t m_togglesSinceCalculate = 0;
+
+    std::vector<size_t> m_chunkBest;
+};
+
+//======================================================================================
+// dimensions and depth need to be powers of 2, for the FFT
+void GenerateSpatiotemporalBlueNoise (const char* baseFileName, size_t dimensions, size_t depth)
+{
+    CThreadPool threadPool;
+    printf("Spatiotemporal blue noise %zu x %zu x %zu, %zu threads\n", dimensions, dimensions, depth, threadPool.NumChunks());
+
+    std::vector<size_t> ranks;
+    {
+        SBlockTimer timer(baseFileName);
+        CSpatiotemporalBlueNoise generator(dimensions, depth, threadPool);
+        generator.Generate(ranks);
+    }
+
+    // the value of each pixel is its rank remapped to [0, 255]
+    char fileName[1024];
+    SImageData image;
+    for (size_t slice = 0; slice < depth; ++slice)
+    {
+        ImageInit(image, dimensions, dimensions);
+        for (size_t y = 0; y < dimensions; ++y)
+        {
+            SColor* pixels = (SColor*)&image.m_pixels[y * image.m_pitch];
+            for (size_t x = 0; x < dimensions; ++x)
+            {
+                uint8 value = uint8(ranks[(slice * dimensions + y) * dimensions + x] * 256 / ranks.size());
+                pixels[x].Set(value, value, value);
+            }
+        }
+
+        sprintf(fileName, baseFileName, slice);
+        printf("%s\n", fileName);
+        ImageSaveTGA(image, fileName);
+    }
+}
+
 //======================================================================================
 int main (int argc, char** argv)
 {
+    // "TAMGenerator stbn" makes the spatiotemporal blue noise textures that the path tracer uses, instead of a TAM
+    if (argc > 1 && !strcmp(argv[1], "stbn"))
+    {
+        GenerateSpatiotemporalBlueNoise("../Art/BlueNoiseSpatiotemporal_%zu.tga", 64, 32);
+        WaitForEnter();
+        return 0;
+    }
+
     // TODO: use a grid for dots to make finding closest neighbor easier
 
     // TODO: this blue noise kinda sucks for tiling (why?), and also sucks when it's denser.  Increasing candidate count didn't really help much.
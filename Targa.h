@@ -0,0 +1,129 @@
+#pragma once
+
+#include <stdio.h>
+#include <vector>
+
+// Loads 24 and 32 bit targa files as top down RGBA8 pixels. Doesn't use d3d, so CPU_ONLY projects can load textures too.
+
+struct TargaHeader
+{
+    unsigned char data1[12];
+    unsigned short width;
+    unsigned short height;
+    unsigned char bpp;
+    unsigned char data2;
+};
+
+inline bool LoadTarga(const char* filename, int& height, int& width, std::vector<unsigned char>& targaData)
+{
+    int error, bpp, imageSize, index, i, j, k;
+    FILE* filePtr;
+    unsigned int count;
+    TargaHeader targaFileHeader;
+    std::vector<unsigned char> targaImage;
+
+    // Open the targa file for reading in binary.
+#ifdef _MSC_VER
+    error = fopen_s(&filePtr, filename, "rb");
+#else
+    filePtr = fopen(filename, "rb");
+    error = filePtr ? 0 : 1;
+#endif
+    if (error != 0)
+    {
+        return false;
+    }
+
+    // Read in the file header.
+    count = (unsigned int)fread(&targaFileHeader, sizeof(TargaHeader), 1, filePtr);
+    if (count != 1)
+    {
+        return false;
+    }
+
+    // Get the important information from the header.
+    height = (int)targaFileHeader.height;
+    width = (int)targaFileHeader.width;
+    bpp = (int)targaFileHeader.bpp;
+
+    // Check that it is 32 bit and not 24 bit.
+    if (bpp != 24 && bpp != 32)
+    {
+        return false;
+    }
+
+    int bytesPerPixel = bpp / 8;
+
+    // Calculate the size of the 32 bit image data.
+    imageSize = width * height * bytesPerPixel;
+
+    // Allocate memory for the targa image data.
+    targaImage.resize(imageSize);
+
+    // Read in the targa image data.
+    count = (unsigned int)fread(&targaImage[0], 1, imageSize, filePtr);
+    if (count != (unsigned int)imageSize)
+    {
+        return false;
+    }
+
+    // Close the file.
+    error = fclose(filePtr);
+    if (error != 0)
+    {
+        return false;
+    }
+
+    // Allocate memory for the targa destination data.
+    targaData.resize(imageSize / bytesPerPixel * 4);
+
+    // Initialize the index into the targa destination data array.
+    index = 0;
+
+    // Initialize the index into the targa image data.
+    k = (width * height * bytesPerPixel) - (width * bytesPerPixel);
+
+    // Now copy the targa image data into the targa destination array in the correct order since the targa format is stored upside down.
+    if (bpp == 32)
+    {
+        for (j = 0; j < height; j++)
+        {
+            for (i = 0; i < width; i++)
+            {
+                targaData[index + 0] = targaImage[k + 2];  // Red.
+                targaData[index + 1] = targaImage[k + 1];  // Green.
+                targaData[index + 2] = targaImage[k + 0];  // Blue
+                targaData[index + 3] = targaImage[k + 3];  // Alpha
+
+                                                             // Increment the indexes into the targa data.
+                k += bytesPerPixel;
+                index += 4;
+            }
+
+            // Set the targa image data index back to the preceding row at the beginning of the column since its reading it in upside down.
+            k -= (width * 2 * bytesPerPixel);
+        }
+    }
+    else
+    {
+        for (j = 0; j < height; j++)
+        {
+            for (i = 0; i < width; i++)
+            {
+                targaData[index + 0] = targaImage[k + 2];  // Red.
+                targaData[index + 1] = targaImage[k + 1];  // Green.
+                targaData[index + 2] = targaImage[k + 0];  // Blue
+                targaData[index + 3] = 255;  // Alpha
+
+                                                           // Increment the indexes into the targa data.
+                k += bytesPerPixel;
+                index += 4;
+            }
+
+            // Set the targa image data index back to the preceding row at the beginning of the column since its reading it in upside down.
+            k -= (width * 2 * bytesPerPixel);
+        }
+    }
+
+    return true;
+}
\ No newline at end of file
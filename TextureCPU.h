@@ -0,0 +1,119 @@
+#pragma once
+
+#include <array>
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include "Targa.h"
+
+// CPU_ONLY stand in for CTexture. Texels are float4s, with 8 bit images converted to [0,1] like an UNORM texture.
+// Sampling uses wrap addressing, like SamplerNearestWrap and SamplerLinearWrap. Arrays and volumes are a stack of slices.
+class CTextureCPU
+{
+public:
+    typedef std::array<float, 4> TTexel;
+
+    bool LoadTGA (const char* fileName)
+    {
+        int height, width;
+        std::vector<unsigned char> targaData;
+        if (!LoadTarga(fileName, height, width, targaData))
+            return false;
+
+        Create(width, height, 1);
+        for (size_t i = 0; i < m_texels.size(); ++i)
+        {
+            for (size_t channel = 0; channel < 4; ++channel)
+                m_texels[i][channel] = float(targaData[i * 4 + channel]) / 255.0f;
+        }
+        return true;
+    }
+
+    void Create (size_t width, size_t height, size_t numSlices)
+    {
+        m_width = width;
+        m_height = height;
+        m_numSlices = numSlices;
+        m_texels.assign(width * height * numSlices, { 0.0f, 0.0f, 0.0f, 0.0f });
+    }
+
+    // the slices all need to be the same size
+    bool CreateArray (CTextureCPU** slices, size_t numSlices)
+    {
+        if (numSlices == 0)
+            return false;
+        for (size_t i = 1; i < numSlices; ++i)
+        {
+            if (slices[i]->m_width != slices[0]->m_width || slices[i]->m_height != slices[0]->m_height || slices[i]->m_numSlices != 1)
+                return false;
+        }
+
+        Create(slices[0]->m_width, slices[0]->m_height, numSlices);
+        for (size_t i = 0; i < numSlices; ++i)
+            std::copy(slices[i]->m_texels.begin(), slices[i]->m_texels.end(), m_texels.begin() + i * m_width * m_height);
+        return true;
+    }
+
+    size_t Width () const { return m_width; }
+    size_t Height () const { return m_height; }
+    size_t NumSlices () const { return m_numSlices; }
+
+    TTexel& Texel (size_t x, size_t y, size_t slice = 0) { return m_texels[(slice * m_height + y) * m_width + x]; }
+    const TTexel& Texel (size_t x, size_t y, size_t slice = 0) const { return m_texels[(slice * m_height + y) * m_width + x]; }
+
+    TTexel SampleNearestWrap (float u, float v, size_t slice = 0) const
+    {
+        return Texel(WrapCoordinate(std::floor(u * float(m_width)), m_width), WrapCoordinate(std::floor(v * float(m_height)), m_height), SliceIndex(slice));
+    }
+
+    // bilinear, with texel centers at half integer coordinates like d3d
+    TTexel SampleLinearWrap (float u, float v, size_t slice = 0) const
+    {
+        float x = u * float(m_width) - 0.5f;
+        float y = v * float(m_height) - 0.5f;
+        float x0 = std::floor(x);
+        float y0 = std::floor(y);
+        float fracX = x - x0;
+        float fracY = y - y0;
+
+        size_t ix0 = WrapCoordinate(x0, m_width);
+        size_t ix1 = WrapCoordinate(x0 + 1.0f, m_width);
+        size_t iy0 = WrapCoordinate(y0, m_height);
+        size_t iy1 = WrapCoordinate(y0 + 1.0f, m_height);
+        slice = SliceIndex(slice);
+
+        const TTexel& a = Texel(ix0, iy0, slice);
+        const TTexel& b = Texel(ix1, iy0, slice);
+        const TTexel& c = Texel(ix0, iy1, slice);
+        const TTexel& d = Texel(ix1, iy1, slice);
+
+        TTexel ret;
+        for (size_t channel = 0; channel < 4; ++channel)
+        {
+            float top = a[channel] + (b[channel] - a[channel]) * fracX;
+            float bottom = c[channel] + (d[channel] - c[channel]) * fracX;
+            ret[channel] = top + (bottom - top) * fracY;
+        }
+        return ret;
+    }
+
+private:
+    static size_t WrapCoordinate (float coordinate, size_t size)
+    {
+        float wrapped = std::fmod(coordinate, float(size));
+        if (wrapped < 0.0f)
+            wrapped += float(size);
+        return (std::min)(size_t(wrapped), size - 1);
+    }
+
+    // array slices outside of the array are clamped, like d3d does
+    size_t SliceIndex (size_t slice) const
+    {
+        return (std::min)(slice, m_numSlices - 1);
+    }
+
+    size_t m_width = 0;
+    size_t m_height = 0;
+    size_t m_numSlices = 0;
+    std::vector<TTexel> m_texels;
+};
\ No newline at end of file
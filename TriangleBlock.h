@@ -0,0 +1,232 @@
+#pragma once
+
+// Structure of arrays triangle blocks for the CPU ray tracer. A block holds the geometry of 8 triangles with each
+// triangle in its own lane, so one ray can be tested against all 8 at once with AVX2, or two halves with SSE4.
+// Only the geometry is in the block. The normal, albedo and emissive are read from the original triangle once
+// the nearest hit is known.
+
+#include <vector>
+#include <float.h>
+#include "ShaderTypes.h"
+#if defined(__AVX2__) || defined(__SSE4_1__)
+#include <immintrin.h>
+#endif
+
+static const size_t c_triangleBlockWidth = 8;
+
+struct alignas(32) STriangleBlock8
+{
+    float m_originX[c_triangleBlockWidth];  // positionA
+    float m_originY[c_triangleBlockWidth];
+    float m_originZ[c_triangleBlockWidth];
+    float m_edge1X[c_triangleBlockWidth];   // positionB - positionA
+    float m_edge1Y[c_triangleBlockWidth];
+    float m_edge1Z[c_triangleBlockWidth];
+    float m_edge2X[c_triangleBlockWidth];   // positionC - positionA
+    float m_edge2Y[c_triangleBlockWidth];
+    float m_edge2Z[c_triangleBlockWidth];
+};
+
+typedef std::vector<STriangleBlock8> TTriangleBlocks;
+
+// Makes blocks from triangles [firstTriangle, lastTriangle). Unused lanes of the last block are degenerate triangles,
+// which rays never hit.
+template <typename TRIANGLES>
+void MakeTriangleBlocks (const TRIANGLES& triangles, size_t firstTriangle, size_t lastTriangle, TTriangleBlocks& blocks)
+{
+    size_t count = lastTriangle - firstTriangle;
+    blocks.clear();
+    blocks.resize((count + c_triangleBlockWidth - 1) / c_triangleBlockWidth);
+    for (size_t i = 0; i < blocks.size() * c_triangleBlockWidth; ++i)
+    {
+        STriangleBlock8& block = blocks[i / c_triangleBlockWidth];
+        size_t lane = i % c_triangleBlockWidth;
+
+        float3 origin = { 0.0f, 0.0f, 0.0f };
+        float3 edge1 = { 0.0f, 0.0f, 0.0f };
+        float3 edge2 = { 0.0f, 0.0f, 0.0f };
+        if (i < count)
+        {
+            const auto& triangle = triangles[firstTriangle + i];
+            origin = XYZ(triangle.positionA_w);
+            edge1 = XYZ(triangle.positionB_w) - origin;
+            edge2 = XYZ(triangle.positionC_w) - origin;
+        }
+
+        block.m_originX[lane] = origin[0];
+        block.m_originY[lane] = origin[1];
+        block.m_originZ[lane] = origin[2];
+        block.m_edge1X[lane] = edge1[0];
+        block.m_edge1Y[lane] = edge1[1];
+        block.m_edge1Z[lane] = edge1[2];
+        block.m_edge2X[lane] = edge2[0];
+        block.m_edge2Y[lane] = edge2[1];
+        block.m_edge2Z[lane] = edge2[2];
+    }
+}
+
+#if defined(__AVX2__) || defined(__SSE4_1__)
+
+// The GraphicsCodex ray triangle test from Shaders/PathTrace.h, on the lanes of a block. VEC is __m256 or __m128 and the
+// OPS struct provides the instructions for it. Returns the hit time in each lane, or FLT_MAX for a miss.
+template <typename OPS, typename VEC>
+inline VEC RayIntersectsTriangleLanes (const float3& rayPos, const float3& rayDir, const float* originX, const float* originY, const float* originZ,
+    const float* edge1X, const float* edge1Y, const float* edge1Z, const float* edge2X, const float* edge2Y, const float* edge2Z, float maxIntersectTime)
+{
+    VEC dirX = OPS::Set1(rayDir[0]);
+    VEC dirY = OPS::Set1(rayDir[1]);
+    VEC dirZ = OPS::Set1(rayDir[2]);
+    VEC e1X = OPS::Load(edge1X);
+    VEC e1Y = OPS::Load(edge1Y);
+    VEC e1Z = OPS::Load(edge1Z);
+    VEC e2X = OPS::Load(edge2X);
+    VEC e2Y = OPS::Load(edge2Y);
+    VEC e2Z = OPS::Load(edge2Z);
+
+    // q = cross(rayDir, e_2), a = dot(e_1, q)
+    VEC qX = OPS::Sub(OPS::Mul(dirY, e2Z), OPS::Mul(dirZ, e2Y));
+    VEC qY = OPS::Sub(OPS::Mul(dirZ, e2X), OPS::Mul(dirX, e2Z));
+    VEC qZ = OPS::Sub(OPS::Mul(dirX, e2Y), OPS::Mul(dirY, e2X));
+    VEC a = OPS::Add(OPS::Add(OPS::Mul(e1X, qX), OPS::Mul(e1Y, qY)), OPS::Mul(e1Z, qZ));
+    VEC zero = OPS::Zero();
+    VEC valid = OPS::CmpNE(a, zero);
+
+    // s = (rayPos - positionA) / a, r = cross(s, e_1)
+    VEC invA = OPS::Div(OPS::Set1(1.0f), a);
+    VEC sX = OPS::Mul(OPS::Sub(OPS::Set1(rayPos[0]), OPS::Load(originX)), invA);
+    VEC sY = OPS::Mul(OPS::Sub(OPS::Set1(rayPos[1]), OPS::Load(originY)), invA);
+    VEC sZ = OPS::Mul(OPS::Sub(OPS::Set1(rayPos[2]), OPS::Load(originZ)), invA);
+    VEC rX = OPS::Sub(OPS::Mul(sY, e1Z), OPS::Mul(sZ, e1Y));
+    VEC rY = OPS::Sub(OPS::Mul(sZ, e1X), OPS::Mul(sX, e1Z));
+    VEC rZ = OPS::Sub(OPS::Mul(sX, e1Y), OPS::Mul(sY, e1X));
+
+    // barycentric coordinates and hit time
+    VEC b0 = OPS::Add(OPS::Add(OPS::Mul(sX, qX), OPS::Mul(sY, qY)), OPS::Mul(sZ, qZ));
+    VEC b1 = OPS::Add(OPS::Add(OPS::Mul(rX, dirX), OPS::Mul(rY, dirY)), OPS::Mul(rZ, dirZ));
+    VEC b2 = OPS::Sub(OPS::Sub(OPS::Set1(1.0f), b0), b1);
+    VEC t = OPS::Add(OPS::Add(OPS::Mul(e2X, rX), OPS::Mul(e2Y, rY)), OPS::Mul(e2Z, rZ));
+
+    valid = OPS::And(valid, OPS::CmpGE(b0, zero));
+    valid = OPS::And(valid, OPS::CmpGE(b1, zero));
+    valid = OPS::And(valid, OPS::CmpGE(b2, zero));
+    valid = OPS::And(valid, OPS::CmpGE(t, zero));
+    valid = OPS::And(valid, OPS::CmpLE(t, OPS::Set1(maxIntersectTime)));
+    return OPS::Blend(OPS::Set1(FLT_MAX), t, valid);
+}
+
+#endif
+
+#ifdef __AVX2__
+struct STriangleOpsAVX
+{
+    static __m256 Set1 (float f) { return _mm256_set1_ps(f); }
+    static __m256 Load (const float* f) { return _mm256_load_ps(f); }
+    static __m256 Zero () { return _mm256_setzero_ps(); }
+    static __m256 Add (__m256 a, __m256 b) { return _mm256_add_ps(a, b); }
+    static __m256 Sub (__m256 a, __m256 b) { return _mm256_sub_ps(a, b); }
+    static __m256 Mul (__m256 a, __m256 b) { return _mm256_mul_ps(a, b); }
+    static __m256 Div (__m256 a, __m256 b) { return _mm256_div_ps(a, b); }
+    static __m256 And (__m256 a, __m256 b) { return _mm256_and_ps(a, b); }
+    static __m256 CmpNE (__m256 a, __m256 b) { return _mm256_cmp_ps(a, b, _CMP_NEQ_OQ); }
+    static __m256 CmpGE (__m256 a, __m256 b) { return _mm256_cmp_ps(a, b, _CMP_GE_OQ); }
+    static __m256 CmpLE (__m256 a, __m256 b) { return _mm256_cmp_ps(a, b, _CMP_LE_OQ); }
+    static __m256 Blend (__m256 a, __m256 b, __m256 mask) { return _mm256_blendv_ps(a, b, mask); }
+};
+#elif defined(__SSE4_1__)
+struct STriangleOpsSSE
+{
+    static __m128 Set1 (float f) { return _mm_set1_ps(f); }
+    static __m128 Load (const float* f) { return _mm_load_ps(f); }
+    static __m128 Zero () { return _mm_setzero_ps(); }
+    static __m128 Add (__m128 a, __m128 b) { return _mm_add_ps(a, b); }
+    static __m128 Sub (__m128 a, __m128 b) { return _mm_sub_ps(a, b); }
+    static __m128 Mul (__m128 a, __m128 b) { return _mm_mul_ps(a, b); }
+    static __m128 Div (__m128 a, __m128 b) { return _mm_div_ps(a, b); }
+    static __m128 And (__m128 a, __m128 b) { return _mm_and_ps(a, b); }
+    static __m128 CmpNE (__m128 a, __m128 b) { return _mm_cmpneq_ps(a, b); }
+    static __m128 CmpGE (__m128 a, __m128 b) { return _mm_cmpge_ps(a, b); }
+    static __m128 CmpLE (__m128 a, __m128 b) { return _mm_cmple_ps(a, b); }
+    static __m128 Blend (__m128 a, __m128 b, __m128 mask) { return _mm_blendv_ps(a, b, mask); }
+};
+#endif
+
+// Tests the ray against the 8 triangles of the block. Returns the lane of the nearest hit that is no farther than
+// maxIntersectTime (if it's >= 0), and its time in intersectTime. Returns -1 if nothing was hit.
+inline int RayIntersectsTriangleBlock (const float3& rayPos, const float3& rayDir, const STriangleBlock8& block, float maxIntersectTime, float& intersectTime)
+{
+    if (maxIntersectTime < 0.0f)
+        maxIntersectTime = FLT_MAX;
+
+    alignas(32) float times[c_triangleBlockWidth];
+#ifdef __AVX2__
+    __m256 t = RayIntersectsTriangleLanes<STriangleOpsAVX, __m256>(rayPos, rayDir, block.m_originX, block.m_originY, block.m_originZ,
+        block.m_edge1X, block.m_edge1Y, block.m_edge1Z, block.m_edge2X, block.m_edge2Y, block.m_edge2Z, maxIntersectTime);
+
+    // reduce to the minimum time across the lanes, then find which lane has it
+    __m256 minT = _mm256_min_ps(t, _mm256_permute_ps(t, _MM_SHUFFLE(2, 3, 0, 1)));
+    minT = _mm256_min_ps(minT, _mm256_permute_ps(minT, _MM_SHUFFLE(1, 0, 3, 2)));
+    minT = _mm256_min_ps(minT, _mm256_permute2f128_ps(minT, minT, 1));
+    int hitMask = _mm256_movemask_ps(_mm256_cmp_ps(t, minT, _CMP_EQ_OQ)) & _mm256_movemask_ps(_mm256_cmp_ps(t, _mm256_set1_ps(FLT_MAX), _CMP_LT_OQ));
+    if (hitMask == 0)
+        return -1;
+    _mm256_store_ps(times, t);
+#elif defined(__SSE4_1__)
+    for (size_t half = 0; half < 2; ++half)
+    {
+        size_t offset = half * 4;
+        __m128 t = RayIntersectsTriangleLanes<STriangleOpsSSE, __m128>(rayPos, rayDir, block.m_originX + offset, block.m_originY + offset, block.m_originZ + offset,
+            block.m_edge1X + offset, block.m_edge1Y + offset, block.m_edge1Z + offset, block.m_edge2X + offset, block.m_edge2Y + offset, block.m_edge2Z + offset, maxIntersectTime);
+        _mm_store_ps(times + offset, t);
+    }
+    float minTime = FLT_MAX;
+    int hitMask = 0;
+    for (size_t i = 0; i < c_triangleBlockWidth; ++i)
+    {
+        if (times[i] < minTime)
+        {
+            minTime = times[i];
+            hitMask = 1 << i;
+        }
+    }
+    if (hitMask == 0)
+        return -1;
+#else
+    // scalar version of the same math
+    for (size_t i = 0; i < c_triangleBlockWidth; ++i)
+    {
+        times[i] = FLT_MAX;
+        float3 e_1 = { block.m_edge1X[i], block.m_edge1Y[i], block.m_edge1Z[i] };
+        float3 e_2 = { block.m_edge2X[i], block.m_edge2Y[i], block.m_edge2Z[i] };
+        float3 q = Cross(rayDir, e_2);
+        float a = Dot(e_1, q);
+        if (a == 0.0f)
+            continue;
+        float3 s = (rayPos - float3{ block.m_originX[i], block.m_originY[i], block.m_originZ[i] }) * (1.0f / a);
+        float3 r = Cross(s, e_1);
+        float b0 = Dot(s, q);
+        float b1 = Dot(r, rayDir);
+        float b2 = 1.0f - b0 - b1;
+        float t = Dot(e_2, r);
+        if (b0 >= 0.0f && b1 >= 0.0f && b2 >= 0.0f && t >= 0.0f && t <= maxIntersectTime)
+            times[i] = t;
+    }
+    float minTime = FLT_MAX;
+    int hitMask = 0;
+    for (size_t i = 0; i < c_triangleBlockWidth; ++i)
+    {
+        if (times[i] < minTime)
+        {
+            minTime = times[i];
+            hitMask = 1 << i;
+        }
+    }
+    if (hitMask == 0)
+        return -1;
+#endif
+
+    int lane = 0;
+    while (((hitMask >> lane) & 1) == 0)
+        ++lane;
+    intersectTime = times[lane];
+    return lane;
+}
\ No newline at end of file
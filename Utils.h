@@ -1,10 +1,18 @@
 #pragma once
 
 #include <stdio.h>
+#include <string.h>
+
+// CPU_ONLY is defined by the projects that don't use d3d (like Benchmark), so they only get the portable parts
+#ifndef CPU_ONLY
 #include <windows.h>
+#else
+struct ID3D11DeviceContext;
+#endif
 
 static const float c_pi = 3.14159265359f;
 
+#ifndef CPU_ONLY
 template <typename T>
 struct CAutoReleasePointer
 {
@@ -35,6 +43,7 @@ struct CAutoReleasePointer
 
     T* m_ptr;
 };
+#endif
 
 inline float DegreesToRadians (float degrees)
 {
@@ -43,6 +52,8 @@ inline float DegreesToRadians (float degrees)
 
 inline void ReportError(const char* message)
 {
+#ifndef CPU_ONLY
     OutputDebugStringA(message);
-    fprintf(stderr, message);
+#endif
+    fprintf(stderr, "%s", message);
 }
\ No newline at end of file
@@ -1,7 +1,6 @@
 #define _CRT_SECURE_NO_WARNINGS
 
 #include <chrono>
-#include <random>
 #include "d3d11.h"
 #include "Shader.h"
 #include "Model.h"
@@ -20,9 +19,21 @@ bool g_explicitCrossHatch = false;
 bool g_smoothStep = false;
 bool g_aniso = false;
 bool g_whiteAlbedo = false;
-bool g_blueNoise = true;
+int g_sampler = (int)ESampler::BlueNoise;
+bool g_adaptive = false;
+float g_adaptiveError = 0.1f;
+int g_adaptiveMinSamples = 32;
 int g_samplesPerFrame = 1;
+int g_maxBounces = c_maxBounces;
+bool g_russianRoulette = c_rouletteStartBounce <= c_maxBounces;
+int g_rouletteStartBounce = c_rouletteStartBounce;
+int g_lightPicker = (int)ELightPicker::AliasTable;
 int g_samplesTotal = 0;
+int g_scene = 0;
+bool g_animateModels = false;
+int g_bvhRefits = 0;
+int g_bvhRebuilds = 0;
+float g_bvhCostRatio = 1.0f;
 
 float g_triplanarPow = 4.0f;
 float g_uvScale = 0.25f;
@@ -36,14 +47,6 @@ CModel<ShaderTypes::VertexFormats::Pos2D> g_fullScreenMesh;
 static INT64                    g_Time = 0;
 static INT64                    g_TicksPerSecond = 0;
 
-float RandomFloat (float min, float max)
-{
-    static std::random_device rd;
-    static std::mt19937 mt(rd());
-    std::uniform_real_distribution<float> dist(min, max);
-    return dist(mt);
-}
-
 bool init ()
 {
     WindowInit(c_width, c_height, c_fullScreen);
@@ -88,7 +91,8 @@ bool init ()
             data.cameraAt_FOVY = { 0.0f, 0.0f, 0.0f, c_fovY };
             data.nearPlaneDist_missColor = { 0.0f, 0.0f, 0.0f, 0.0f };
             data.numSpheres_numTris_numOBBs_numQuads = { 0, 0, 0, 0 };
-            data.numModels_yzw = { 0, 0, 0, 0 };
+            data.numModels_sceneRootNode_numScenePrims_numLights = { 0, 0, 0, 0 };
+            data.environmentWidth_environmentHeight_zw = { 0, 0, 0, 0 };
 			data.uvmultiplier_blackPoint_whitePoint_triplanarPow = { g_uvScale, g_blackPoint, g_whitePoint, g_triplanarPow };
             data.overlayOpacity_yzw = { g_overlayOpacity, 0.0f, 0.0f, 0.0f };
         }
@@ -103,8 +107,11 @@ bool init ()
         g_d3d.Context(),
         [] (ShaderTypes::ConstantBuffers::ConstantsPerFrame& data)
         {
-            data.frameRnd_w = { 0.0f, 0.0f, 0.0f, 0.0f };
+            data.rngSeed_yzw = { 0, 0, 0, 0 };
             data.sampleCount_samplesPerFrame_zw = {0, (unsigned int)g_samplesPerFrame, 0, 0};
+            data.adaptiveError_adaptiveMinSamples_zw = { g_adaptiveError, float(g_adaptiveMinSamples), 0.0f, 0.0f };
+            data.maxBounces_rouletteStartBounce_zw = { c_maxBounces, c_rouletteStartBounce, 0, 0 };
+            data.sampler_lightPicker_zw = { (unsigned int)g_sampler, (unsigned int)g_lightPicker, 0, 0 };
         }
     );
     if (!writeOK)
@@ -166,13 +173,24 @@ void IMGUIWindow ()
         }
 
         // handle UI
-        static int scene = 0;
-
         bool updateConstants = false;
         bool updateScene = false;
 
         ImGui::Begin("", nullptr, ImGuiWindowFlags_AlwaysAutoResize | ImGuiWindowFlags_NoResize | ImGuiWindowFlags_NoTitleBar);
 
+        const char* samplers[] = {
+            "White Noise",
+            "Blue Noise & Golden Ratio",
+            "Spatiotemporal Blue Noise",
+            "Owen Scrambled Sobol"
+        };
+
+        const char* lightPickers[] = {
+            "No Light Sampling",
+            "Light Sampling",
+            "Light Sampling, Light Tree"
+        };
+
         const char* scenes[] = {
             "Sphere Plane Dark",
             "Sphere Plane Light",
@@ -181,15 +199,33 @@ void IMGUIWindow ()
             "Furnace Test",
             "Cornell Obj",
             "Obj Test",
-            "Spheres"
+            "Spheres",
+            "Glowing Jets",
+            "Sun Sky"
         };
 
         if (ImGui::CollapsingHeader("Scene", ImGuiTreeNodeFlags_DefaultOpen))
         {
-            updateScene |= ImGui::Combo("Scene", &scene, scenes, (int)EScene::COUNT);
+            updateScene |= ImGui::Combo("Scene", &g_scene, scenes, (int)EScene::COUNT);
+            if (SceneIsAnimated((EScene)g_scene))
+                ImGui::Checkbox("Animate Models", &g_animateModels);
             bool resetRender = ImGui::Checkbox("White Albedo", &g_whiteAlbedo);
-            resetRender |= ImGui::Checkbox("Use Blue Noise & Golden Ratio", &g_blueNoise);
+            bool updateSampling = ImGui::Combo("Random Numbers", &g_sampler, samplers, (int)ESampler::COUNT);
+            updateSampling |= ImGui::Combo("Lights", &g_lightPicker, lightPickers, (int)ELightPicker::COUNT);
+            resetRender |= updateSampling;
             bool updateSamplesPerFrame = ImGui::SliderInt("Samples Per Frame", &g_samplesPerFrame, 1, 50);
+            bool updateBounces = ImGui::SliderInt("Max Bounces", &g_maxBounces, 0, 16);
+            updateBounces |= ImGui::Checkbox("Russian Roulette", &g_russianRoulette);
+            if (g_russianRoulette)
+                updateBounces |= ImGui::SliderInt("Russian Roulette Start Bounce", &g_rouletteStartBounce, 0, 16);
+            resetRender |= updateBounces;
+            ImGui::Checkbox("Adaptive Sampling", &g_adaptive);
+            bool updateAdaptive = false;
+            if (g_adaptive)
+            {
+                updateAdaptive |= ImGui::SliderFloat("Adaptive Error", &g_adaptiveError, 0.001f, 0.5f, "%0.3f", 2.0f);
+                updateAdaptive |= ImGui::SliderInt("Adaptive Min Samples", &g_adaptiveMinSamples, 2, 256);
+            }
             resetRender |= ImGui::Button("Reset Render");
 
             if (resetRender)
@@ -204,6 +240,40 @@ void IMGUIWindow ()
                 );
             }
 
+            // russian roulette is turned off by starting it after the last bounce
+            if (updateBounces)
+            {
+                ShaderData::ConstantBuffers::ConstantsPerFrame.Write(
+                    g_d3d.Context(),
+                    [=](ShaderTypes::ConstantBuffers::ConstantsPerFrame& data)
+                    {
+                        data.maxBounces_rouletteStartBounce_zw = { (unsigned int)g_maxBounces, (unsigned int)(g_russianRoulette ? g_rouletteStartBounce : g_maxBounces + 1), 0, 0 };
+                    }
+                );
+            }
+
+            if (updateSampling)
+            {
+                ShaderData::ConstantBuffers::ConstantsPerFrame.Write(
+                    g_d3d.Context(),
+                    [=](ShaderTypes::ConstantBuffers::ConstantsPerFrame& data)
+                    {
+                        data.sampler_lightPicker_zw = { (unsigned int)g_sampler, (unsigned int)g_lightPicker, 0, 0 };
+                    }
+                );
+            }
+
+            if (updateAdaptive)
+            {
+                ShaderData::ConstantBuffers::ConstantsPerFrame.Write(
+                    g_d3d.Context(),
+                    [=](ShaderTypes::ConstantBuffers::ConstantsPerFrame& data)
+                    {
+                        data.adaptiveError_adaptiveMinSamples_zw = { g_adaptiveError, float(g_adaptiveMinSamples), 0.0f, 0.0f };
+                    }
+                );
+            }
+
             if (updateSamplesPerFrame)
             {
                 ShaderData::ConstantBuffers::ConstantsPerFrame.Write(
@@ -240,15 +310,18 @@ void IMGUIWindow ()
             float msPerFrame = FPSLast > 0 ? 1000.0f / FPSLast : 0.0f;
             float samplesPerSecond = FPSLast * float(ShaderData::ConstantBuffers::ConstantsPerFrame.Read().sampleCount_samplesPerFrame_zw[1]);
 
+            // models share mesh data, so the triangle count is the end of the last mesh
             unsigned int meshTriangleCount = 0;
-            unsigned int meshCount = ShaderData::ConstantBuffers::ConstantsOnce.Read().numModels_yzw[0];
+            unsigned int meshCount = ShaderData::ConstantBuffers::ConstantsOnce.Read().numModels_sceneRootNode_numScenePrims_numLights[0];
             for (size_t i = 0; i < meshCount; ++i)
-                meshTriangleCount += ShaderData::StructuredBuffers::Models.Read()[i].firstTriangle_lastTriangle_zw[1] - ShaderData::StructuredBuffers::Models.Read()[i].firstTriangle_lastTriangle_zw[0];
+                meshTriangleCount = (std::max)(meshTriangleCount, ShaderData::StructuredBuffers::Models.Read()[i].firstTriangle_lastTriangle_rootNode_firstLight[1]);
 
             uint4 counts = ShaderData::ConstantBuffers::ConstantsOnce.Read().numSpheres_numTris_numOBBs_numQuads;
-            ImGui::Text("Rendering at %u x %u\nSpheres: %u\nTriangles: %u\nOBBs: %u\nQuads: %u\nMeshes: %u triangles in %u meshes\n", c_width, c_height, counts[0], counts[1], counts[2], counts[3], meshTriangleCount, meshCount);
+            ImGui::Text("Rendering at %u x %u\nSpheres: %u\nTriangles: %u\nOBBs: %u\nQuads: %u\nMeshes: %u triangles shared by %u models\n", c_width, c_height, counts[0], counts[1], counts[2], counts[3], meshTriangleCount, meshCount);
             ImGui::Text("FPS: %0.2f (%0.2f ms)", framesPerSecond, msPerFrame);
             ImGui::Text("%u samples (%0.2f samples per second)\n", g_samplesTotal, samplesPerSecond);
+            if (g_animateModels && SceneIsAnimated((EScene)g_scene))
+                ImGui::Text("Scene BVH: %i refits, %i rebuilds, SAH cost %0.2fx of built\n", g_bvhRefits, g_bvhRebuilds, g_bvhCostRatio);
             ImGui::Separator();
         }
 
@@ -274,7 +347,10 @@ void IMGUIWindow ()
         if (updateScene)
         {
             g_samplesTotal = 0;
-            FillSceneData((EScene)scene, g_d3d.Context());
+            g_bvhRefits = 0;
+            g_bvhRebuilds = 0;
+            if (!FillSceneData((EScene)g_scene, g_d3d.Context()))
+                ReportError("Could not fill scene data\n");
         }
     }
 
@@ -377,7 +453,11 @@ int WINAPI WinMain (HINSTANCE hInstance, HINSTANCE hPrevInstance, PSTR pScmdline
     const size_t dispatchX = 1 + c_width / 32;
     const size_t dispatchY = 1 + c_height / 32;
 
-    FillSceneData(EScene::SphereOnPlane_LowLight, g_d3d.Context());
+    if (!FillSceneData(EScene::SphereOnPlane_LowLight, g_d3d.Context()))
+    {
+        ReportError("Could not fill scene data\n");
+        return 0;
+    }
 
     bool done = false;
     while (!done)
@@ -399,17 +479,33 @@ int WINAPI WinMain (HINSTANCE hInstance, HINSTANCE hPrevInstance, PSTR pScmdline
         {
             IMGUIWindow();
 
+            // move the models of animated scenes. The image changes every frame, so accumulation starts over.
+            std::chrono::duration<float> appTimeSeconds = std::chrono::high_resolution_clock::now() - appStart;
+            bool animated = false;
+            if (g_animateModels && SceneIsAnimated((EScene)g_scene))
+            {
+                bool rebuiltBVH = false;
+                animated = AnimateScene((EScene)g_scene, appTimeSeconds.count(), g_d3d.Context(), rebuiltBVH, g_bvhCostRatio);
+                if (!animated)
+                {
+                    ReportError("Could not animate scene, animation turned off\n");
+                    g_animateModels = false;
+                }
+                if (rebuiltBVH)
+                    ++g_bvhRebuilds;
+                else
+                    ++g_bvhRefits;
+                g_samplesTotal = 0;
+            }
+
             // update frame specific values
 			bool firstSample = false;
-            std::chrono::duration<float> appTimeSeconds = std::chrono::high_resolution_clock::now() - appStart;
             bool writeOK = ShaderData::ConstantBuffers::ConstantsPerFrame.Write(
                 g_d3d.Context(),
-                [&firstSample, &appTimeSeconds] (ShaderTypes::ConstantBuffers::ConstantsPerFrame& data)
+                [&firstSample, animated] (ShaderTypes::ConstantBuffers::ConstantsPerFrame& data)
                 {
-                    data.frameRnd_w[0] = RandomFloat(0.0f, 1.0f);
-                    data.frameRnd_w[1] = RandomFloat(0.0f, 1.0f);
-                    data.frameRnd_w[2] = RandomFloat(0.0f, 1.0f);
-
+                    if (animated)
+                        data.sampleCount_samplesPerFrame_zw[0] = 0;
                     data.sampleCount_samplesPerFrame_zw[0]++;
 
 					firstSample = (data.sampleCount_samplesPerFrame_zw[0] == 1);
@@ -429,7 +525,7 @@ int WINAPI WinMain (HINSTANCE hInstance, HINSTANCE hPrevInstance, PSTR pScmdline
 			}
 
             // path tracing compute shader
-            const CComputeShader& computeShader = ShaderData::GetShader_pathTrace({g_whiteAlbedo, g_blueNoise});
+            const CComputeShader& computeShader = ShaderData::GetShader_pathTrace({g_whiteAlbedo, g_adaptive});
             FillShaderParams<EShaderType::compute>(g_d3d.Context(), computeShader.GetReflector());
             computeShader.Dispatch(g_d3d.Context(), dispatchX, dispatchY, 1);
             UnbindShaderTextures<EShaderType::compute>(g_d3d.Context(), computeShader.GetReflector());